@@ -0,0 +1,159 @@
+# Analysis results by position, so that a position searched again after an undo, in a new game
+# or on another day is answered from the cache instead of searched from scratch.
+# An entry holds the deepest result seen for a position key (sf.key) and side to move: depth,
+# score, search time, best and ponder moves and the pv. The entries live in a fixed table, in
+# memory or mapped from a file that keeps them across runs.
+#
+#   cache = analysis_cache.AnalysisCache("/home/pi/analysis.bin")
+#   cache.update(key, "w", depth=12, score_type="c", score=35, time=850, pv=["e2e4", "e7e5"])
+#   cache.finish(key, "w", "e2e4", "e7e5", movetime)
+#   entry = cache.get(key, "w")
+#   if entry and entry.satisfies(movetime=1000): ...
+#
+# PYCOCHESS_ANALYSIS_CACHE=<file> makes pycochess keep its cache in that file.
+import atexit
+import mmap
+import os
+import struct
+import threading
+from collections import namedtuple
+
+# Entries of the table, a new position takes the slot of its key
+ENTRIES = 1 << 16
+# Moves of the pv kept in an entry
+PV_MOVES = 8
+MAGIC = "PYCOAC01"
+# Magic and number of entries
+_HEADER = struct.Struct("<8sI")
+# Key, side to move, depth, score type ("c" for cp, "m" for mate), score, search time in ms,
+# best and ponder moves, pv length and pv moves, the moves as pack_move() gives them
+_ENTRY = struct.Struct("<QcBchIHHB{0}H".format(PV_MOVES))
+_KEY_MASK = (1 << 64) - 1
+_FILES = "abcdefgh"
+_PROMOTIONS = " nbrq"
+
+
+def pack_move(move):
+    # A UCI move on 15 bits (from, to and promotion), 0 for none
+    if not move or move == "(none)":
+        return 0
+    origin = _FILES.index(move[0]) + 8 * (int(move[1]) - 1)
+    target = _FILES.index(move[2]) + 8 * (int(move[3]) - 1)
+    promotion = _PROMOTIONS.index(move[4]) if len(move) > 4 else 0
+    return origin | target << 6 | promotion << 12
+
+
+def unpack_move(packed):
+    if not packed:
+        return None
+    origin, target, promotion = packed & 63, packed >> 6 & 63, packed >> 12
+    move = _FILES[origin % 8] + str(origin // 8 + 1) + _FILES[target % 8] + str(target // 8 + 1)
+    return move + _PROMOTIONS[promotion].strip()
+
+
+class Entry(namedtuple("Entry", "depth score_type score time bestmove ponder pv")):
+    def satisfies(self, depth=None, movetime=None, **params):
+        # True when a search to depth or of movetime would not give more, the clock time
+        # controls always search
+        if not self.bestmove or not self.ponder:
+            return False
+        if depth is not None:
+            return self.depth >= depth
+        if movetime is not None and not params:
+            return self.time >= movetime
+        return False
+
+    def lines(self):
+        # The info and bestmove lines of the engine for this result
+        score = "mate" if self.score_type == "m" else "cp"
+        return ["info depth {0} score {1} {2} time {3} pv {4}".format(self.depth, score, self.score, self.time,
+                                                                       " ".join(self.pv)),
+                "bestmove {0} ponder {1}".format(self.bestmove, self.ponder)]
+
+
+class AnalysisCache(object):
+    def __init__(self, path=None, entries=ENTRIES):
+        self.path = path
+        self.lock = threading.Lock()
+        self.hits = 0
+        self.misses = 0
+        self.closed = False
+        size = _HEADER.size + entries * _ENTRY.size
+        if path:
+            fd = os.open(path, os.O_RDWR | os.O_CREAT, 0644)
+            try:
+                if os.fstat(fd).st_size != size:
+                    os.ftruncate(fd, 0)
+                    os.ftruncate(fd, size)
+                self.table = mmap.mmap(fd, size)
+            finally:
+                os.close(fd)
+            atexit.register(self.close)
+        else:
+            self.table = mmap.mmap(-1, size)
+        magic, count = _HEADER.unpack_from(self.table, 0)
+        if magic != MAGIC or count != entries:
+            # New file, or one of another layout
+            self.table[:] = "\0" * size
+            _HEADER.pack_into(self.table, 0, MAGIC, entries)
+        self.entries = entries
+
+    def _offset(self, key):
+        return _HEADER.size + (key % self.entries) * _ENTRY.size
+
+    def _read(self, key, side):
+        # The raw fields of the entry of the position, None when its slot holds another one
+        if self.closed:
+            return None
+        fields = _ENTRY.unpack_from(self.table, self._offset(key))
+        if fields[0] != key or fields[1] != side or not fields[2]:
+            return None
+        return fields
+
+    def get(self, key, side):
+        key &= _KEY_MASK
+        with self.lock:
+            fields = self._read(key, side)
+        if not fields:
+            self.misses += 1
+            return None
+        self.hits += 1
+        depth, score_type, score, time, bestmove, ponder, length = fields[2:9]
+        pv = [unpack_move(m) for m in fields[9:9 + length]]
+        return Entry(depth, score_type, score, time, unpack_move(bestmove), unpack_move(ponder), pv)
+
+    def update(self, key, side, depth, score_type, score, time, pv):
+        # Result of an info line, kept unless the entry of the position is deeper
+        key &= _KEY_MASK
+        if not pv or depth <= 0:
+            return
+        pv = [pack_move(m) for m in pv[:PV_MOVES]]
+        with self.lock:
+            fields = self._read(key, side)
+            if self.closed or fields and fields[2] > depth:
+                return
+            if fields and fields[2] == depth:
+                time = max(time, fields[5])
+            _ENTRY.pack_into(self.table, self._offset(key), key, side, min(depth, 255), score_type,
+                             max(-32768, min(32767, score)), time, pv[0], pv[1] if len(pv) > 1 else 0,
+                             len(pv), *(pv + [0] * (PV_MOVES - len(pv))))
+
+    def finish(self, key, side, bestmove, ponder, time=0):
+        # The bestmove of the search that gave the entry of the position, which took time ms
+        key &= _KEY_MASK
+        with self.lock:
+            fields = self._read(key, side)
+            if not fields or not bestmove or bestmove == "(none)":
+                return
+            fields = list(fields)
+            fields[5] = max(fields[5], time or 0)
+            fields[6] = pack_move(bestmove)
+            fields[7] = pack_move(ponder)
+            _ENTRY.pack_into(self.table, self._offset(key), *fields)
+
+    def close(self):
+        with self.lock:
+            if self.path and not self.closed:
+                self.closed = True
+                self.table.flush()
+                self.table.close()
@@ -0,0 +1,90 @@
+import os
+import shutil
+import tempfile
+import unittest
+
+import analysis_cache
+
+KEY = 0x123456789abcdef0
+
+
+class MoveTest(unittest.TestCase):
+
+    def test_round_trip(self):
+        for move in ["e2e4", "a1h8", "h7h8q", "b2a1n"]:
+            self.assertEqual(analysis_cache.unpack_move(analysis_cache.pack_move(move)), move)
+        self.assertEqual(analysis_cache.pack_move("(none)"), 0)
+        self.assertIsNone(analysis_cache.unpack_move(0))
+
+
+class AnalysisCacheTest(unittest.TestCase):
+
+    def setUp(self):
+        self.cache = analysis_cache.AnalysisCache(entries=64)
+
+    def test_update_and_finish(self):
+        self.assertIsNone(self.cache.get(KEY, "w"))
+        self.cache.update(KEY, "w", depth=12, score_type="c", score=35, time=850, pv=["e2e4", "e7e5"])
+        entry = self.cache.get(KEY, "w")
+        self.assertEqual((entry.depth, entry.score, entry.pv), (12, 35, ["e2e4", "e7e5"]))
+        # The pv gives the best and ponder moves until the bestmove comes
+        self.assertTrue(entry.satisfies(depth=10))
+        self.assertFalse(entry.satisfies(movetime=1000))
+        self.cache.finish(KEY, "w", "e2e4", "e7e5", 1000)
+        entry = self.cache.get(KEY, "w")
+        self.assertTrue(entry.satisfies(depth=12))
+        self.assertFalse(entry.satisfies(depth=13))
+        self.assertTrue(entry.satisfies(movetime=1000))
+        self.assertFalse(entry.satisfies(movetime=1000, wtime=60000))
+        self.assertEqual(entry.lines(), ["info depth 12 score cp 35 time 1000 pv e2e4 e7e5",
+                                         "bestmove e2e4 ponder e7e5"])
+        self.assertEqual((self.cache.hits, self.cache.misses), (2, 1))
+
+    def test_deepest_kept(self):
+        self.cache.update(KEY, "w", depth=12, score_type="c", score=35, time=850, pv=["e2e4"])
+        self.cache.update(KEY, "w", depth=8, score_type="c", score=10, time=100, pv=["d2d4"])
+        self.assertEqual(self.cache.get(KEY, "w").pv, ["e2e4"])
+        self.cache.update(KEY, "w", depth=14, score_type="m", score=-3, time=2000, pv=["g1f3"])
+        entry = self.cache.get(KEY, "w")
+        self.assertEqual((entry.depth, entry.score_type, entry.score), (14, "m", -3))
+
+    def test_side_and_slot(self):
+        self.cache.update(KEY, "w", depth=5, score_type="c", score=0, time=10, pv=["e2e4"])
+        self.assertIsNone(self.cache.get(KEY, "b"))
+        # Another key of the same slot replaces it
+        self.cache.update(KEY + 64, "w", depth=1, score_type="c", score=0, time=10, pv=["d2d4"])
+        self.assertIsNone(self.cache.get(KEY, "w"))
+        self.assertEqual(self.cache.get(KEY + 64, "w").pv, ["d2d4"])
+
+    def test_long_pv(self):
+        moves = ["g1f3", "g8f6", "f3g1", "f6g8"] * 3
+        self.cache.update(KEY, "w", depth=5, score_type="c", score=0, time=10, pv=moves)
+        self.assertEqual(self.cache.get(KEY, "w").pv, moves[:analysis_cache.PV_MOVES])
+
+
+class FileTest(unittest.TestCase):
+
+    def setUp(self):
+        self.directory = tempfile.mkdtemp()
+        self.path = os.path.join(self.directory, "analysis.bin")
+
+    def tearDown(self):
+        shutil.rmtree(self.directory)
+
+    def test_kept_across_runs(self):
+        cache = analysis_cache.AnalysisCache(self.path, entries=64)
+        cache.update(KEY, "b", depth=9, score_type="c", score=-20, time=500, pv=["e7e5", "g1f3"])
+        cache.finish(KEY, "b", "e7e5", "g1f3")
+        cache.close()
+        self.assertIsNone(cache.get(KEY, "b"))
+        cache = analysis_cache.AnalysisCache(self.path, entries=64)
+        self.assertEqual(cache.get(KEY, "b").bestmove, "e7e5")
+        cache.close()
+        # A file of another layout starts empty
+        cache = analysis_cache.AnalysisCache(self.path, entries=32)
+        self.assertIsNone(cache.get(KEY, "b"))
+        cache.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,109 @@
+# Times of the two players of a game. The remaining time of a side is computed from the time it had
+# when it started running and the timestamp of that start, never by subtracting ticks, so it stays
+# exact whatever the scheduling delays. While a side runs, tick(color) is called each time its
+# remaining time reaches a whole second (and once more at 0), from a ticker of the clock module.
+#
+#   times = chess_clock.ChessClock(display)
+#   times.reset({"w": 300000, "b": 300000})
+#   times.run("w")                  # white thinks
+#   times.run("b", at=timestamp)    # white moved at timestamp
+#   times.remaining("w")            # ms
+#
+# sync() takes the times of a physical clock as the authority: they replace the computed ones.
+# ticker=loop.ticker runs the ticks in an event loop (see event_loop.py) instead.
+import math
+import threading
+
+import clock
+
+
+class ChessClock(object):
+    def __init__(self, tick=None, ticker=None):
+        self.tick = tick
+        self.lock = threading.RLock()
+        self.ticker = (ticker or clock.ticker)(self._tick)
+        self.times = {}
+        # Side running, None when no time runs, and the timestamp of its start
+        self.running = None
+        self.since = None
+
+    def reset(self, times):
+        # times: ms of each color, every time stops
+        with self.lock:
+            self.times = dict(times)
+            self.running = None
+            self.since = None
+            self.ticker.cancel()
+
+    def _settle(self, at):
+        # Charges the running side with its time up to at
+        if self.running is not None:
+            self.times[self.running] -= (at - self.since) * 1000
+            self.since = at
+
+    def remaining(self, color, at=None):
+        # ms left to color at the timestamp at, now by default
+        with self.lock:
+            ms = self.times.get(color, 0)
+            if color == self.running:
+                ms -= ((clock.now() if at is None else at) - self.since) * 1000
+            return max(0, int(ms))
+
+    def displayed(self, color):
+        # remaining() to the nearest second, the second a tick reached
+        return int(round(self.remaining(color) / 1000.)) * 1000
+
+    def set(self, color, ms, at=None):
+        with self.lock:
+            at = clock.now() if at is None else at
+            self._settle(at)
+            self.times[color] = ms
+            self._schedule()
+
+    def add(self, color, ms):
+        # An increment
+        with self.lock:
+            self.times[color] = self.times.get(color, 0) + ms
+            self._schedule()
+
+    def run(self, color, at=None):
+        # Runs the time of color from the timestamp at, now by default, None stops every time
+        with self.lock:
+            if color == self.running:
+                return
+            at = clock.now() if at is None else at
+            self._settle(at)
+            self.running = color
+            self.since = at if color is not None else None
+            self._schedule()
+
+    def sync(self, times, at=None):
+        # Times of a physical clock, in ms, at the timestamp at
+        with self.lock:
+            self.times.update(times)
+            if self.running is not None:
+                self.since = clock.now() if at is None else at
+            self._schedule()
+
+    def _schedule(self):
+        # Next tick: when the running time reaches the second below the current remaining time
+        if self.running is None:
+            self.ticker.cancel()
+            return
+        left = self.times[self.running] - (clock.now() - self.since) * 1000
+        if left <= 0:
+            self.ticker.cancel()
+            return
+        # A tick a little early for the rounding of the deadline still moves on to the next second
+        target = max(0, (int(math.ceil((left - 1) / 1000.)) - 1) * 1000)
+        self.ticker.set(self.since + (self.times[self.running] - target) / 1000.)
+
+    def _tick(self):
+        with self.lock:
+            color = self.running
+            self._schedule()
+        if color is not None and self.tick:
+            self.tick(color)
+
+    def close(self):
+        self.ticker.close()
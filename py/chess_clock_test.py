@@ -0,0 +1,83 @@
+import unittest
+
+import chess_clock
+import clock
+
+
+class ChessClockTest(unittest.TestCase):
+
+    def setUp(self):
+        clock.set_clock(clock.SimulatedClock(speed=0))
+        self.ticks = []
+        self.times = chess_clock.ChessClock(lambda color: self.ticks.append((color, self.times.displayed(color))))
+        self.times.reset({"w": 300000, "b": 300000})
+
+    def tearDown(self):
+        self.times.close()
+        clock.set_clock(None)
+
+    def test_remaining(self):
+        start = clock.now()
+        self.times.run("w", start)
+        self.assertEqual(self.times.remaining("w", start + 10.5), 289500)
+        self.assertEqual(self.times.remaining("b", start + 10.5), 300000)
+        self.times.run("b", start + 10.5)
+        self.assertEqual(self.times.remaining("w", start + 20), 289500)
+        self.assertEqual(self.times.remaining("b", start + 20), 290500)
+        # Never below 0
+        self.assertEqual(self.times.remaining("b", start + 1000), 0)
+
+    def test_increment(self):
+        # Fischer: the increment is added to the side that moved
+        start = clock.now()
+        self.times.run("w", start)
+        self.times.run("b", start + 5)
+        self.times.add("w", 2000)
+        self.assertEqual(self.times.remaining("w", start + 6), 297000)
+        self.times.run("w", start + 8)
+        self.times.add("b", 2000)
+        self.assertEqual(self.times.remaining("b", start + 9), 299000)
+        self.assertEqual(self.times.remaining("w", start + 9), 296000)
+
+    def test_increment_while_running(self):
+        start = clock.now()
+        self.times.run("w", start)
+        self.times.add("w", 3000)
+        self.assertEqual(self.times.remaining("w", start + 1), 302000)
+
+    def test_ticks(self):
+        self.times.reset({"w": 3500, "b": 2000})
+        self.times.run("w")
+        clock.sleep(1.2)
+        self.times.run("b")
+        clock.sleep(3)
+        # A tick on each whole second of the running side, and at 0
+        self.assertEqual(self.ticks, [("w", 3000), ("b", 1000), ("b", 0)])
+
+    def test_stop(self):
+        self.times.run("w")
+        clock.sleep(2.2)
+        self.times.run(None)
+        clock.sleep(10)
+        # No tick once every time stopped
+        self.assertAlmostEqual(self.times.remaining("w"), 297800, delta=1)
+        self.assertEqual(self.ticks, [("w", 299000), ("w", 298000)])
+
+    def test_sync(self):
+        start = clock.now()
+        self.times.run("w", start)
+        # The physical clock is the authority
+        self.times.sync({"w": 100000, "b": 50000}, start + 1)
+        self.assertEqual(self.times.remaining("w", start + 3), 98000)
+        self.assertEqual(self.times.remaining("b", start + 3), 50000)
+
+    def test_set(self):
+        start = clock.now()
+        self.times.run("b", start)
+        self.times.set("w", 60000, start + 1)
+        self.assertEqual(self.times.remaining("w", start + 2), 60000)
+        self.assertEqual(self.times.remaining("b", start + 2), 298000)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,311 @@
+# Time source of pycochess, the board drivers and the emulator.
+# Every wait, timer and timestamp goes through the current clock of this module, the system
+# clock unless set_clock() replaced it. A SimulatedClock runs speed times faster than real time,
+# or with speed 0 only moves when waited on (sleep(), poll() timeouts and advance() jump to
+# the end of the wait at once), so that timed games and clock logic are tested in milliseconds.
+#
+#   clock.set_clock(clock.SimulatedClock(speed=0))
+#   clock.call_later(1.0, tick)
+#   clock.sleep(5)     # runs tick 5 times, returns after about a millisecond
+#
+# The system clock is CLOCK_MONOTONIC, as the one of the dgtnix driver: its times are only
+# compared with each other and do not jump when the wall clock is set. A ticker(function) calls
+# function at the deadlines set() on it, from a timerfd armed on the absolute deadline, so that a
+# periodic tick re-armed from its own deadlines does not drift with the scheduling delays.
+#
+#   ticker = clock.ticker(tick)
+#   ticker.set(clock.now() + 1)
+#
+# PYCOCHESS_CLOCK_SPEED=<speed> starts the programs with a SimulatedClock.
+import ctypes
+import ctypes.util
+import errno
+import heapq
+import itertools
+import math
+import os
+import struct
+import threading
+import time
+
+# Real seconds a wait of an instant clock still yields, so that other threads and processes progress
+QUANTUM = 0.001
+
+_CLOCK_MONOTONIC = 1
+_TFD_CLOEXEC = 0o2000000
+_TFD_TIMER_ABSTIME = 1
+
+
+class _Timespec(ctypes.Structure):
+    _fields_ = [("tv_sec", ctypes.c_long), ("tv_nsec", ctypes.c_long)]
+
+
+class _Itimerspec(ctypes.Structure):
+    _fields_ = [("it_interval", _Timespec), ("it_value", _Timespec)]
+
+try:
+    _libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+    _clock_gettime = _libc.clock_gettime
+    _clock_gettime.argtypes = [ctypes.c_int, ctypes.POINTER(_Timespec)]
+except (OSError, AttributeError):
+    _libc = _clock_gettime = None
+try:
+    _timerfd_create = _libc.timerfd_create
+    _timerfd_settime = _libc.timerfd_settime
+    _timerfd_settime.argtypes = [ctypes.c_int, ctypes.c_int, ctypes.POINTER(_Itimerspec), ctypes.c_void_p]
+except AttributeError:
+    _timerfd_create = _timerfd_settime = None
+
+
+def _milliseconds(timeout):
+    # Timeout of poll(), which truncates to the millisecond: rounded up, not to wake up early in a loop
+    return None if timeout is None else int(math.ceil(timeout * 1000))
+
+
+def monotonic():
+    # Seconds of CLOCK_MONOTONIC whatever the current clock, the time of the dgtnix event timestamps
+    if not _clock_gettime:
+        return time.time()
+    ts = _Timespec()
+    if _clock_gettime(_CLOCK_MONOTONIC, ctypes.byref(ts)):
+        raise OSError(ctypes.get_errno(), "clock_gettime")
+    return ts.tv_sec + ts.tv_nsec * 1e-9
+
+
+class _TimerTicker(object):
+    # Ticker of the clocks without timerfd, a timer of the clock per deadline
+    def __init__(self, owner, function):
+        self.owner = owner
+        self.function = function
+        self.timer = None
+        self.lock = threading.Lock()
+
+    def set(self, deadline):
+        with self.lock:
+            if self.timer:
+                self.timer.cancel()
+            self.timer = self.owner.call_later(max(0., deadline - self.owner.now()), self.function)
+
+    def cancel(self):
+        with self.lock:
+            if self.timer:
+                self.timer.cancel()
+            self.timer = None
+
+    def close(self):
+        self.cancel()
+
+
+class Timerfd(object):
+    # A timerfd on CLOCK_MONOTONIC armed on absolute deadlines, readable when one expired
+    def __init__(self):
+        self.fd = _timerfd_create(_CLOCK_MONOTONIC, _TFD_CLOEXEC)
+        if self.fd < 0:
+            raise OSError(ctypes.get_errno(), "timerfd_create")
+
+    def fileno(self):
+        return self.fd
+
+    def arm(self, deadline):
+        # Deadline 0 disarms, a deadline already past expires at once
+        spec = _Itimerspec()
+        if deadline:
+            spec.it_value.tv_sec = int(deadline)
+            spec.it_value.tv_nsec = max(1, int((deadline - int(deadline)) * 1e9))
+        if _timerfd_settime(self.fd, _TFD_TIMER_ABSTIME, ctypes.byref(spec), None):
+            raise OSError(ctypes.get_errno(), "timerfd_settime")
+
+    def read(self):
+        # Blocks until a deadline expired, the number of expirations
+        while True:
+            try:
+                return struct.unpack("Q", os.read(self.fd, 8))[0]
+            except OSError as e:
+                if e.errno != errno.EINTR:
+                    raise
+
+    def close(self):
+        os.close(self.fd)
+
+
+class _TimerfdTicker(object):
+    # A Timerfd and a thread blocked reading it
+    def __init__(self, function):
+        self.function = function
+        self.timerfd = Timerfd()
+        self.closed = False
+        self.thread = threading.Thread(target=self.run, name="ticker")
+        self.thread.daemon = True
+        self.thread.start()
+
+    def set(self, deadline):
+        self.timerfd.arm(deadline)
+
+    def cancel(self):
+        self.timerfd.arm(0)
+
+    def close(self):
+        self.closed = True
+        # Wakes the thread up
+        self.timerfd.arm(monotonic())
+
+    def run(self):
+        while True:
+            self.timerfd.read()
+            if self.closed:
+                self.timerfd.close()
+                return
+            self.function()
+
+
+class SystemClock(object):
+    def now(self):
+        return monotonic()
+
+    def ticker(self, function):
+        # Calls function at the deadlines set() on it, in a thread of its own
+        if _timerfd_create and _clock_gettime:
+            return _TimerfdTicker(function)
+        return _TimerTicker(self, function)
+
+    def timerfd(self):
+        # A Timerfd on this clock, None when the clock has none
+        if _timerfd_create and _clock_gettime:
+            return Timerfd()
+        return None
+
+    def sleep(self, seconds):
+        if seconds > 0:
+            time.sleep(seconds)
+
+    def call_later(self, delay, function, *args):
+        # Runs function(*args) in delay seconds, returns something with cancel()
+        timer = threading.Timer(delay, function, args)
+        timer.start()
+        return timer
+
+    def poll(self, poller, timeout=None):
+        # poller.poll() with a timeout in seconds of this clock, None waits forever
+        return poller.poll(_milliseconds(timeout))
+
+
+class _SimulatedTimer(object):
+    def __init__(self, function, args):
+        self.function = function
+        self.args = args
+        self.cancelled = False
+
+    def cancel(self):
+        self.cancelled = True
+
+
+class SimulatedClock(object):
+    def __init__(self, speed=0., start=None):
+        self.speed = speed
+        self.real_start = time.time()
+        self.start = self.real_start if start is None else start
+        self.advanced = 0.
+        self.timers = []
+        self.sequence = itertools.count()
+        self.lock = threading.RLock()
+
+    def now(self):
+        if self.speed > 0:
+            return self.start + (time.time() - self.real_start) * self.speed
+        return self.start + self.advanced
+
+    def advance(self, seconds):
+        # Moves an instant clock forward, running on the way the timers falling due, in order.
+        # Timers run in the calling thread.
+        with self.lock:
+            target = self.now() + seconds
+        while True:
+            with self.lock:
+                if not self.timers or self.timers[0][0] > target:
+                    self.advanced = max(self.advanced, target - self.start)
+                    return
+                due, _, timer = heapq.heappop(self.timers)
+                self.advanced = max(self.advanced, due - self.start)
+            if not timer.cancelled:
+                timer.function(*timer.args)
+
+    def sleep(self, seconds):
+        if seconds <= 0:
+            return
+        if self.speed > 0:
+            time.sleep(seconds / self.speed)
+            return
+        self.advance(seconds)
+        time.sleep(min(seconds, QUANTUM))
+
+    def call_later(self, delay, function, *args):
+        if self.speed > 0:
+            timer = threading.Timer(delay / self.speed, function, args)
+            timer.start()
+            return timer
+        timer = _SimulatedTimer(function, args)
+        with self.lock:
+            heapq.heappush(self.timers, (self.now() + delay, next(self.sequence), timer))
+        return timer
+
+    def ticker(self, function):
+        return _TimerTicker(self, function)
+
+    def timerfd(self):
+        # Its time is not the one of the kernel
+        return None
+
+    def poll(self, poller, timeout=None):
+        if self.speed > 0:
+            return poller.poll(_milliseconds(None if timeout is None else timeout / self.speed))
+        events = poller.poll(0)
+        if events:
+            return events
+        if timeout is None:
+            # Nothing would ever move the clock, wait for the next timer or for real input
+            with self.lock:
+                timeout = self.timers[0][0] - self.now() if self.timers else None
+            if timeout is None:
+                return poller.poll(QUANTUM * 1000)
+        self.sleep(timeout)
+        return poller.poll(0)
+
+
+_clock = SystemClock()
+
+
+def get_clock():
+    return _clock
+
+
+def set_clock(new_clock):
+    # Before the threads using the clock start, None for the system clock
+    global _clock
+    _clock = new_clock or SystemClock()
+
+
+def now():
+    return _clock.now()
+
+
+def sleep(seconds):
+    _clock.sleep(seconds)
+
+
+def call_later(delay, function, *args):
+    return _clock.call_later(delay, function, *args)
+
+
+def ticker(function):
+    return _clock.ticker(function)
+
+
+def timerfd():
+    return _clock.timerfd()
+
+
+def poll(poller, timeout=None):
+    return _clock.poll(poller, timeout)
+
+if os.environ.get("PYCOCHESS_CLOCK_SPEED"):
+    set_clock(SimulatedClock(float(os.environ["PYCOCHESS_CLOCK_SPEED"])))
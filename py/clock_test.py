@@ -0,0 +1,125 @@
+import os
+import select
+import threading
+import time
+import unittest
+
+import clock
+import tracing
+
+
+class SimulatedClockTest(unittest.TestCase):
+
+    def setUp(self):
+        self.clock = clock.SimulatedClock(speed=0, start=100.)
+        clock.set_clock(self.clock)
+        self.calls = []
+
+    def tearDown(self):
+        clock.set_clock(None)
+
+    def test_sleep_is_instant(self):
+        start = time.time()
+        clock.sleep(3600)
+        self.assertEqual(clock.now(), 3700.)
+        self.assertLess(time.time() - start, 1)
+
+    def test_timers_in_order(self):
+        clock.call_later(2, self.calls.append, "second")
+        clock.call_later(1, self.calls.append, "first")
+        clock.call_later(3, self.calls.append, "late")
+        clock.sleep(2.5)
+        self.assertEqual(self.calls, ["first", "second"])
+        self.assertEqual(clock.now(), 102.5)
+
+    def test_timer_sees_its_deadline(self):
+        clock.call_later(1, lambda: self.calls.append(clock.now()))
+        clock.sleep(5)
+        self.assertEqual(self.calls, [101.])
+
+    def test_cancel(self):
+        timer = clock.call_later(1, self.calls.append, "cancelled")
+        timer.cancel()
+        clock.sleep(2)
+        self.assertEqual(self.calls, [])
+
+    def test_ticker(self):
+        # A periodic tick re-armed from its own deadlines
+        deadlines = [101.]
+
+        def tick():
+            self.calls.append(clock.now())
+            deadlines[0] += 1
+            ticker.set(deadlines[0])
+        ticker = clock.ticker(tick)
+        ticker.set(deadlines[0])
+        clock.sleep(3.5)
+        ticker.close()
+        self.assertEqual(self.calls, [101., 102., 103.])
+        clock.sleep(2)
+        self.assertEqual(len(self.calls), 3)
+
+    def test_poll_waits_for_timers(self):
+        read, write = os.pipe()
+        poller = select.poll()
+        poller.register(read, select.POLLIN)
+        try:
+            clock.call_later(10, os.write, write, "x")
+            # No timeout: the clock jumps to the next timer instead of blocking forever
+            self.assertEqual(clock.poll(poller), [(read, select.POLLIN)])
+            self.assertEqual(clock.now(), 110.)
+            os.read(read, 1)
+            self.assertEqual(clock.poll(poller, 5), [])
+            self.assertEqual(clock.now(), 115.)
+        finally:
+            os.close(read)
+            os.close(write)
+
+    def test_no_timerfd(self):
+        self.assertIsNone(clock.timerfd())
+
+
+class SystemClockTest(unittest.TestCase):
+
+    def test_monotonic(self):
+        first = clock.now()
+        time.sleep(0.01)
+        self.assertGreaterEqual(clock.now() - first, 0.01)
+        # Tracing timestamps stay on the system clock when a simulated one is set
+        clock.set_clock(clock.SimulatedClock(speed=0, start=0.))
+        try:
+            self.assertAlmostEqual(tracing.now(), clock.monotonic(), delta=0.1)
+            self.assertEqual(clock.now(), 0.)
+        finally:
+            clock.set_clock(None)
+
+    def test_ticker(self):
+        ticked = threading.Event()
+        ticker = clock.ticker(ticked.set)
+        try:
+            start = clock.now()
+            ticker.set(start + 0.05)
+            self.assertTrue(ticked.wait(5))
+            self.assertGreaterEqual(clock.now() - start, 0.05)
+        finally:
+            ticker.close()
+            # Its thread closes the timerfd, not while the interpreter exits
+            if hasattr(ticker, "thread"):
+                ticker.thread.join(5)
+
+    def test_poll_timeout(self):
+        read, write = os.pipe()
+        poller = select.poll()
+        poller.register(read, select.POLLIN)
+        try:
+            start = clock.now()
+            self.assertEqual(clock.poll(poller, 0.02), [])
+            # Rounded up to the millisecond, never early
+            self.assertGreaterEqual(clock.now() - start, 0.02)
+        finally:
+            os.close(read)
+            os.close(write)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -19,7 +19,9 @@
 //#include <config.h>
 #define VERSION "1.9.2"
 /* POSIX compliance tag */
-#define _GNU_SOURCE 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 
 
 #include <stdio.h>
@@ -40,6 +42,13 @@
 #include <string.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /* Includes for the virtual board socket
  */
@@ -123,10 +132,71 @@ sem_t dgtnixEventSemaphore;
 
 #define _DGTNIX_VIRTUAL_BOARD 0x10
 #define _DGTNIX_REAL_BOARD 0x20
+#define _DGTNIX_REPLAY_BOARD 0x40
+
+/* A full board dump is requested at least this often (in seconds)
+   even when the board looks consistent */
+#define _DGTNIX_DUMP_INTERVAL 30.
+/* A requested dump that did not arrive within this many seconds is requested again */
+#define _DGTNIX_DUMP_TIMEOUT 2.
+/* Seconds dgtnixInit() waits for the answer to its board dump request */
+#define _DGTNIX_INIT_TIMEOUT 5.
+/* dgtnixInit() tries a device that does not answer this many times, 
+   _DGTNIX_INIT_RETRY_DELAY seconds apart, the board may still be waking up */
+#define _DGTNIX_INIT_ATTEMPTS 3
+#define _DGTNIX_INIT_RETRY_DELAY 1.
+/* A device that went away is reopened when its node comes back, or retried 
+   after this many seconds, doubling up to _DGTNIX_RECONNECT_DELAY_MAX */
+#define _DGTNIX_RECONNECT_DELAY 0.05
+#define _DGTNIX_RECONNECT_DELAY_MAX 2.
+/* The delay is reset once a connection stayed up this many seconds, a device 
+   that opens but drops before is reopened after the delay too */
+#define _DGTNIX_RECONNECT_STABLE 5.
+/* Size of the path of the port given to dgtnixInit() */
+#define _DGTNIX_SIZE_PORT 256
+/* Material limits used by the consistency check of _fieldUpdateReceived() */
+#define _DGTNIX_MAX_PIECES_PER_SIDE 16
+#define _DGTNIX_MAX_PAWNS_PER_SIDE 8
+
+/* Delay (in seconds) without field update after which the position is 
+   reported as stable with a DGTNIX_EVENT_STABLE event */
+#define _DGTNIX_STABLE_DELAY 0.25
+/* A clock button held this long (in seconds) generates a DGTNIX_BUTTON_LONG event */
+#define _DGTNIX_LONG_PRESS_DELAY 1.0
+/* A second button pressed within this delay (in seconds) of the first one, 
+   while the first is held, generates a DGTNIX_BUTTON_CHORD event */
+#define _DGTNIX_CHORD_DELAY 0.3
+/* Number of presses kept for getClockButtonState() */
+#define _DGTNIX_BUTTON_QUEUE_SIZE 32
+/* Number of events kept for dgtnixWaitEvents(), the oldest are dropped first */
+#define _DGTNIX_EVENT_QUEUE_SIZE 256
+/* First bytes of a capture file, then records of :
+   direction (1 byte), monotonic time in ns (8 bytes), length (2 bytes), data.
+   A record holds a whole message, read from or written to the board */
+#define _DGTNIX_CAPTURE_MAGIC "DGTNIXC1"
+#define _DGTNIX_CAPTURE_MAGIC_SIZE 8
+#define _DGTNIX_CAPTURE_READ 'R'
+#define _DGTNIX_CAPTURE_WRITE 'W'
+/* Seconds between two fflush() of a running capture */
+#define _DGTNIX_CAPTURE_FLUSH_INTERVAL 1.
 
 /* Size of the internal g_readBuffer array */
 #define READBUFFERSIZE 512
 
+/* Clocks of the driver, see dgtnixSetClock() */
+/* Longest wait of the driver loop between two looks at the board with a clock 
+   other than the system clock, in seconds of that clock */
+#define _DGTNIX_CLOCK_SLICE 0.01
+/* Real seconds a sleep of the instant simulated clock (speed 0) still gives to other threads */
+#define _DGTNIX_SIMULATED_QUANTUM 0.001
+
+/* Statistics of dgtnixGetStats() */
+/* Lock free update of a counter of g_stats */
+#define _DGTNIX_STAT_ADD(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+/* One message to the engine in this many (a power of two) checks the pipe 
+   for g_stats.pipeStalls, a poll() per message would cost more than the write */
+#define _DGTNIX_PIPE_STALL_SAMPLE 16
+
 /* Messages sent to the clock */
 #define _DGTNIX_CLOCK_MESSAGE   0x2b
 #define _DGTNIX_CMD_CLOCK_DISPLAY  0x01
@@ -134,34 +204,132 @@ sem_t dgtnixEventSemaphore;
 #define _DGTNIX_CMD_CLOCK_END      0x03
 
 /*********************************/
+/* Asynchronous log : a ring of records per thread, written by _debug() */
+#define _DGTNIX_LOG_RING_SIZE 256
+#define _DGTNIX_LOG_MAX_ARGS 8
+/* bytes of the %s arguments of a record */
+#define _DGTNIX_LOG_STRINGS 96
+/* longest formatted line */
+#define _DGTNIX_LOG_LINE 512
+/* seconds between two drains of the rings by the log thread */
+#define _DGTNIX_LOG_INTERVAL 0.05
+
+typedef union _dgtnixLogArgument
+{
+  long integer;
+  double real;
+  void *pointer;
+  /* of the string in _dgtnixLogRecord.strings */
+  size_t offset;
+} _dgtnixLogArgument;
+
+typedef struct _dgtnixLogRecord
+{
+  double time;
+  /* the format literal given to _debug() */
+  const char *format;
+  int error;
+  int count;
+  _dgtnixLogArgument arguments[_DGTNIX_LOG_MAX_ARGS];
+  char strings[_DGTNIX_LOG_STRINGS];
+} _dgtnixLogRecord;
+
+/* Single producer (its thread), single consumer (under g_logMutex) */
+typedef struct _dgtnixLogRing
+{
+  unsigned int head;
+  unsigned int tail;
+  /* 1 once its thread is finished, it may then be reused */
+  int unused;
+  struct _dgtnixLogRing *next;
+  _dgtnixLogRecord records[_DGTNIX_LOG_RING_SIZE];
+} _dgtnixLogRing;
+
 /* Intern functions declarations */
 /*********************************/
 static void* _threadManagedFunc(void *);
 static void _sendMessageToBoard(int);
 static int _readMessageFromBoard();
+static int _readMessage();
 static void _sendMessageToEngine(const char*, size_t);
 static int _debug(const char *, ...);
+static char _logConversion(const char **, int *);
+static _dgtnixLogRing *_logRing();
+static void _initLogKey();
+static void _releaseLogRing(void *);
+static void _startLogThread();
+static void *_logThread(void *);
+static int _formatLogRecord(const _dgtnixLogRecord *, char *, int);
+static void _flushLog();
+static int _copyLogLiteral(char *, int, const char *, const char *);
+static int _writeLog(const char *, int);
 static int _closeDescriptor(int *);
 static int _closeAllDescriptors();
+static void _wakeEventWaiters();
 static int _mySleep(double);
 static char _convertInternalPieceToExternal(char);
+static double _monotonicTime();
+static double _systemNow(void *);
+static void _systemSleep(double, void *);
+static double _simulatedNow(void *);
+static void _simulatedSleep(double, void *);
+static int _waitBoard(double);
+static uint64_t _diffBoards(const char *, const char *);
+static int _boardIsConsistent();
+static void _requestBoardDump();
+static void _sendFieldEventToEngine(int, char, int);
+static void _boardDumpReceived(const unsigned char *);
+static void _publishBoard();
+static unsigned long _readSnapshot(char *);
+static void _initEvents();
+static void _postEvent(dgtnixEvent *);
+static void _postStableEvent();
+static void _postButtonEvent(int, int, int, double);
+static void _clockButtonsReported(int);
+static void _longPressDue();
 static int _queryVendorStrings();
 static void _dumpBoard(const char *);
 static void _fieldUpdateReceived(int, char );
-static void _bwtimeReceived(unsigned char [6]);
+static void _bwtimeReceived(unsigned char [7]);
 static void _assertDriverInitialised(const char *);
-static int _setTTY(const char *);
-static int _setUnixSocket(const char *);
+static int _openTTY(const char *, int);
+static int _openPort(const char *, char *, int);
+static int _initPort(const char *);
+static int _initDriver(const char *);
+static void _boardAnswered();
+static int _waitBoardAnswer(double);
+static int _probeByte(int, unsigned char);
+static int _readError(ssize_t);
+static void _reconnect();
+static void _waitDeviceNode(double);
+static void _increaseReconnectDelay();
+static void _postConnectionEvent(int);
+static ssize_t _boardRead(void *, size_t);
+static ssize_t _boardWrite(const void *, size_t);
+static void _captureRecord(char, double, const void *, size_t);
+static void _captureEndMessage();
+static void *_replayFeeder(void *);
+static int _openUnixSocket(const char *);
 static void _setBoardOrientation(unsigned int orientation);
 static void _setDebugMode(unsigned int value);
+static void _recordLatency(unsigned long *, unsigned long *, double);
+static int _formatHistogram(char *, int, const char *, const unsigned long *, unsigned long);
 /****************************************/
 /* Intern global variables declarations */
 /****************************************/
 /* Internal representation of the board, synced with DGT */
 static char g_board[64];
-/* The board returned by dgtnixGetBoard(). It is a copy of g_board but 
-   converted with _convertInternalPieceToExternal(...) */
-static char g_transmitedBoard[64];
+/* The board returned by dgtnixGetBoard(). It is a copy of the last 
+   published snapshot, one per thread so that concurrent callers do 
+   not write the array another one is reading */
+static __thread char g_transmitedBoard[64];
+/* Snapshots of g_board, converted with _convertInternalPieceToExternal(...) 
+   and oriented, published by _publishBoard(). g_snapshotSequence is odd while
+   a snapshot is written, and the stable snapshot is g_snapshots[(g_snapshotSequence >> 1) & 1] */
+static char g_snapshots[2][64];
+static unsigned long g_snapshotSequence;
+/* Internal piece to external piece, indexed by _DGTNIX_EMPTY.._DGTNIX_BQUEEN */
+static const char g_externalPieces[] = " PRNBKQprnbkq";
 /* The string to print before the debug message */
 static const char *g_debugString="dgtnix-debug:";
 /* Descriptor for the running thread */
@@ -170,6 +338,18 @@ static pthread_t g_driverThread;
 static unsigned char g_readBuffer[READBUFFERSIZE];
 /* Descriptor of the  board-driver communication file */
 static int g_descriptorDriverBoard=-1;
+/* Port of dgtnixInit(), reopened by _reconnect() */
+static char g_port[_DGTNIX_SIZE_PORT];
+/* The port of the board found by dgtnixProbe(), kept open for dgtnixInit() */
+static int g_probedDescriptor = -1;
+static char g_probedMode;
+static char g_probedPort[_DGTNIX_SIZE_PORT];
+/* inotify descriptor watching the directory of g_port while it is away */
+static int g_inotifyDescriptor=-1;
+/* Seconds before the next reopening attempt, reset once the connection stayed up 
+   _DGTNIX_RECONNECT_STABLE seconds, and the monotonic time it was opened */
+static double g_reconnectDelay=_DGTNIX_RECONNECT_DELAY;
+static double g_connectedTime;
 /* Descriptor of the communication file as returned by dgtnixInit(...) */
 static int g_pipeEngineReadSide=-1;
 /* Descriptor of the communication file on the driver to the engine side */ 
@@ -190,6 +370,13 @@ static char g_serialFlag;
 static char g_trademarkFlag;
 /* Flag to test wether the busadress string was already queryed to the board */
 static char g_busadressFlag;
+/* Set once g_board holds a full dump, 
+   later dumps are diffed against g_board instead of replacing it */
+static char g_boardSynced;
+/* Set when a field update contradicts g_board, cleared by the next dump */
+static char g_boardDumpPending;
+/* Monotonic time of the last board dump request */
+static double g_lastDumpTime;
 /* Flag for the verbose debug mode */
 static char g_debugMode=DGTNIX_DEBUG_OFF;
 /* Flag set to the real board or the virtual board */
@@ -207,8 +394,83 @@ static  int g_wturn;
 static  char g_boardOrientation=DGTNIX_BOARD_ORIENTATION_CLOCKLEFT;
 /* simply ensure that the driver was initialised with dgtnixInit( ... ) */
 static char g_initialised=0;
+/* The driver thread was started and not joined yet, it may have given up on the board by itself */
+static char g_driverThreadStarted=0;
 /* This mutex is used by to ensure that during a dgtnixGetBoard(...) call, the board is'nt updated */
 static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Monotonic time at which a DGTNIX_EVENT_STABLE event is due, 0 if none */
+static double g_stableDeadline;
+/* Clock button currently held (0 if none), the time it was pressed and 
+   the monotonic time at which it becomes a long press (0 if none is due) */
+static int g_buttonHeld;
+static double g_buttonPressTime;
+static double g_longPressDeadline;
+/* Circular queue of the presses returned by getClockButtonState(), protected by g_eventMutex */
+static int g_buttonQueue[_DGTNIX_BUTTON_QUEUE_SIZE];
+static int g_buttonQueueHead;
+static int g_buttonQueueCount;
+/* Circular queue of the events returned by dgtnixWaitEvents(), protected by g_eventMutex */
+static dgtnixEvent g_events[_DGTNIX_EVENT_QUEUE_SIZE];
+static int g_eventHead;
+static int g_eventCount;
+/* Event classes that are queued, see dgtnixSubscribeEvents() */
+static unsigned int g_eventSubscription = DGTNIX_EVENT_ALL & ~DGTNIX_EVENT_TIME;
+/* Number of threads blocked in dgtnixWaitEvents() for each event class bit. 
+   The driver thread only wakes waiters up for the classes they wait for */
+static int g_eventWaiters[8];
+static pthread_mutex_t g_eventMutex = PTHREAD_MUTEX_INITIALIZER;
+/* Signaled on events, initialised with a monotonic clock by _initEvents() */
+static pthread_cond_t g_eventCond;
+static pthread_once_t g_eventOnce = PTHREAD_ONCE_INIT;
+/* eventfd signaled when an event of a class of g_eventFdMask is queued, see dgtnixEventFd(),
+   protected by g_eventMutex */
+static int g_eventFd = -1;
+static unsigned int g_eventFdMask;
+/* Capture of the board traffic, NULL if none, protected by g_captureMutex */
+static FILE *g_captureFile;
+static pthread_mutex_t g_captureMutex = PTHREAD_MUTEX_INITIALIZER;
+/* Monotonic time of the last fflush() of the capture */
+static double g_captureFlushed;
+/* Bytes of the message being read from the board, recorded together 
+   once the message is read. Only used by the thread reading the board */
+static unsigned char g_captureMessage[READBUFFERSIZE + 3];
+static size_t g_captureMessageSize;
+/* Replay : the capture being fed, the speed factor (0 as fast as possible), 
+   the feeding side of the socketpair and the feeder state */
+static FILE *g_replayFile;
+static double g_replaySpeed;
+static int g_replayFeedSide=-1;
+static pthread_t g_replayThread;
+static volatile int g_replayStop;
+static int g_replayDone;
+static unsigned long g_replayBytes;
+static pthread_mutex_t g_replayMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_replayCond = PTHREAD_COND_INITIALIZER;
+/* The log rings, the ring of this thread and the messages dropped on full rings */
+static _dgtnixLogRing *g_logRings;
+static __thread _dgtnixLogRing *g_threadLogRing;
+static unsigned long g_logDropped;
+static pthread_key_t g_logKey;
+static pthread_once_t g_logKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_once_t g_logOnce = PTHREAD_ONCE_INIT;
+/* Taken by the consumer of the rings */
+static pthread_mutex_t g_logMutex = PTHREAD_MUTEX_INITIALIZER;
+/* The clock of every wait and timestamp of the driver, see dgtnixSetClock() */
+static dgtnixClock g_clock = { _systemNow, _systemSleep, NULL };
+/* The simulated clock : its speed, the system time and its own time when it was set, 
+   and how far the sleeps moved it (speed 0), in ns */
+static double g_simulatedSpeed;
+static double g_simulatedStart;
+static double g_simulatedOrigin;
+static uint64_t g_simulatedAdvance;
+/* Counters of dgtnixGetStats(), only updated with _DGTNIX_STAT_ADD */
+static dgtnixStats g_stats;
+/* Monotonic time the first byte of the message being parsed was read, 0 if none */
+static double g_messageArrival;
+/* g_messageArrival of the last field update, the arrival of the next stable event */
+static double g_updateArrival;
+/* Monotonic time the pending clock message was first sent, 0 if none */
+static double g_clockSendTime;
 /* This mutex is used tu ensure we have recieved a clock ack message */
 static pthread_mutex_t clock_ack_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -219,11 +481,22 @@ static pthread_mutex_t clock_send_mutex = PTHREAD_MUTEX_INITIALIZER;
 /* Intern function begins with _...   */
 /**************************************/
 /* A redefinition of the function sleep, 
- * with double precision, sleep_time in seconds.  
+ * with double precision, sleep_time in seconds of the driver clock.  
  */
 static int _mySleep (double sleep_time)
+{
+  g_clock.sleep(sleep_time, g_clock.context);
+  return 0;
+}
+
+/* The sleep of the system clock */
+static void _systemSleep(double sleep_time, void *context)
 {
   struct timespec tv;
+  /* The system and simulated clocks have no context */
+  (void)context;
+  if(sleep_time <= 0)
+    return;
   /* Construct the timespec from the number of whole seconds... */
   tv.tv_sec = (time_t) sleep_time;
   /* ... and the remainder in nanoseconds. */
@@ -236,15 +509,228 @@ static int _mySleep (double sleep_time)
       int rval = nanosleep (&tv, &tv);
       if (rval == 0)
 	/* Completed the entire sleep time; all done. */
-	return 0;
+	return;
       else if (errno == EINTR)
 	/* Interrupted by a signal. Try again. */
 	continue;
       else 
 	/* Some other error; bail out. */
-	return rval;
+	return;
     }
-  return 0;
+}
+
+/*
+ * Monotonic time in seconds of the driver clock.
+ */
+static double _monotonicTime()
+{
+  return g_clock.now(g_clock.context);
+}
+
+/*
+ * The time of the system clock : monotonic, unaffected by changes of the wall clock.
+ */
+static double _systemNow(void *context)
+{
+  struct timespec ts;
+  (void)context;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * The simulated clock runs g_simulatedSpeed times faster than the system clock.
+ * With speed 0 it only moves when slept on : a sleep moves it at once to its 
+ * end (unless another sleeper already moved it further) and only yields 
+ * the processor for _DGTNIX_SIMULATED_QUANTUM, so that the other threads 
+ * and the board still progress.
+ */
+static double _simulatedNow(void *context)
+{
+  (void)context;
+  if(g_simulatedSpeed > 0)
+    return g_simulatedOrigin + (_systemNow(NULL) - g_simulatedStart) * g_simulatedSpeed;
+  return g_simulatedOrigin + __atomic_load_n(&g_simulatedAdvance, __ATOMIC_ACQUIRE) * 1e-9;
+}
+
+static void _simulatedSleep(double seconds, void *context)
+{
+  uint64_t target, current;
+  (void)context;
+  if(seconds <= 0)
+    return;
+  if(g_simulatedSpeed > 0)
+    {
+      _systemSleep(seconds / g_simulatedSpeed, NULL);
+      return;
+    }
+  current = __atomic_load_n(&g_simulatedAdvance, __ATOMIC_RELAXED);
+  /* Rounded up, a sleep always moves the clock */
+  target = current + (uint64_t)(seconds * 1e9) + 1;
+  while(current < target 
+	&& !__atomic_compare_exchange_n(&g_simulatedAdvance, &current, target, 0, 
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  _systemSleep(seconds < _DGTNIX_SIMULATED_QUANTUM ? seconds : _DGTNIX_SIMULATED_QUANTUM, NULL);
+}
+
+/*
+ * Wait until the board has something to read (return > 0) or until deadline 
+ * of the driver clock (return 0). Other clocks than the system one are looked 
+ * at between waits of at most _DGTNIX_CLOCK_SLICE.
+ */
+static int _waitBoard(double deadline)
+{
+  struct pollfd pfd;
+  pfd.fd = g_descriptorDriverBoard;
+  pfd.events = POLLIN;
+  if(g_clock.now == _systemNow)
+    {
+      int delay = (int)((deadline - _monotonicTime()) * 1000);
+      return poll(&pfd, 1, delay > 0 ? delay : 0);
+    }
+  while(1)
+    {
+      double remaining = deadline - _monotonicTime();
+      int ready = poll(&pfd, 1, 0);
+      if(ready != 0 || remaining <= 0)
+	return ready;
+      _mySleep(remaining < _DGTNIX_CLOCK_SLICE ? remaining : _DGTNIX_CLOCK_SLICE);
+    }
+}
+
+/*
+ * read() and write() on g_descriptorDriverBoard, 
+ * every byte is also recorded when a capture is running : 
+ * the bytes read are kept until _captureEndMessage().
+ */
+static ssize_t _boardRead(void *buffer, size_t count)
+{
+  ssize_t n = read(g_descriptorDriverBoard, buffer, count);
+  _DGTNIX_STAT_ADD(g_stats.readCalls, 1);
+  if(n > 0)
+    {
+      _DGTNIX_STAT_ADD(g_stats.readBytes, n);
+      if(g_captureMessageSize + n > sizeof(g_captureMessage))
+	_captureEndMessage();
+      if((size_t)n <= sizeof(g_captureMessage))
+	{
+	  memcpy(g_captureMessage + g_captureMessageSize, buffer, n);
+	  g_captureMessageSize += n;
+	}
+    }
+  return n;
+}
+
+static ssize_t _boardWrite(const void *buffer, size_t count)
+{
+  ssize_t n = write(g_descriptorDriverBoard, buffer, count);
+  _DGTNIX_STAT_ADD(g_stats.writeCalls, 1);
+  if(n > 0)
+    {
+      _DGTNIX_STAT_ADD(g_stats.writeBytes, n);
+      _captureRecord(_DGTNIX_CAPTURE_WRITE, _monotonicTime(), buffer, n);
+    }
+  return n;
+}
+
+/*
+ * Add a latency in seconds to a histogram of DGTNIX_STATS_BUCKETS buckets 
+ * (bucket i below 2^i microseconds) and to its total in microseconds.
+ */
+static void _recordLatency(unsigned long *histogram, unsigned long *total, double seconds)
+{
+  unsigned long us = seconds > 0 ? (unsigned long)(seconds * 1e6) : 0;
+  int bucket = us ? 8 * sizeof(us) - __builtin_clzl(us) : 0;
+  if(bucket >= DGTNIX_STATS_BUCKETS)
+    bucket = DGTNIX_STATS_BUCKETS - 1;
+  _DGTNIX_STAT_ADD(histogram[bucket], 1);
+  _DGTNIX_STAT_ADD(*total, us);
+}
+
+/* 
+ * Appends a record of the bytes moved at monotonic time to the capture, 
+ * if one is running. The capture is flushed every _DGTNIX_CAPTURE_FLUSH_INTERVAL
+ * seconds so that a crash loses little of it.
+ */
+static void _captureRecord(char direction, double time, const void *data, size_t count)
+{
+  uint64_t ns = (uint64_t)(time * 1e9);
+  uint16_t length = (uint16_t)count;
+  pthread_mutex_lock(&g_captureMutex);
+  if(g_captureFile)
+    {
+      fwrite(&direction, 1, 1, g_captureFile);
+      fwrite(&ns, sizeof(ns), 1, g_captureFile);
+      fwrite(&length, sizeof(length), 1, g_captureFile);
+      fwrite(data, 1, length, g_captureFile);
+      if(time - g_captureFlushed >= _DGTNIX_CAPTURE_FLUSH_INTERVAL)
+	{
+	  fflush(g_captureFile);
+	  g_captureFlushed = time;
+	}
+    }
+  pthread_mutex_unlock(&g_captureMutex);
+}
+
+/* Records the bytes of the message read from the board, at the time its first byte came */
+static void _captureEndMessage()
+{
+  if(!g_captureMessageSize)
+    return;
+  _captureRecord(_DGTNIX_CAPTURE_READ, g_messageArrival ? g_messageArrival : _monotonicTime(),
+		 g_captureMessage, g_captureMessageSize);
+  g_captureMessageSize = 0;
+}
+
+/*
+ * Thread feeding the board side of a replay with the bytes 
+ * read from the board in the capture, at the captured pace 
+ * multiplied by g_replaySpeed. What the driver writes is drained.
+ */
+static void *_replayFeeder(void *params)
+{
+  char direction;
+  uint64_t ns, firstNs = 0;
+  uint16_t length;
+  static unsigned char data[65536];
+  unsigned char drain[256];
+  double start = _monotonicTime();
+  int first = 1, unread;
+  while(!g_replayStop
+	&& fread(&direction, 1, 1, g_replayFile) == 1
+	&& fread(&ns, sizeof(ns), 1, g_replayFile) == 1
+	&& fread(&length, sizeof(length), 1, g_replayFile) == 1
+	&& fread(data, 1, length, g_replayFile) == length)
+    {
+      while(recv(g_replayFeedSide, drain, sizeof(drain), MSG_DONTWAIT) > 0)
+	;
+      if(direction != _DGTNIX_CAPTURE_READ)
+	continue;
+      if(first)
+	{
+	  firstNs = ns;
+	  first = 0;
+	}
+      if(g_replaySpeed > 0)
+	{
+	  double due = start + (ns - firstNs) * 1e-9 / g_replaySpeed, delay;
+	  /* By small steps, dgtnixClose() may stop the replay during long pauses */
+	  while(!g_replayStop && (delay = due - _monotonicTime()) > 0)
+	    _mySleep(delay < 0.1 ? delay : 0.1);
+	}
+      if(send(g_replayFeedSide, data, length, MSG_NOSIGNAL) != length)
+	break;
+      g_replayBytes += length;
+    }
+  /* Done once the driver read everything, the socket stays open so that the driver idles */
+  while(!g_replayStop && ioctl(g_descriptorDriverBoard, FIONREAD, &unread) == 0 && unread > 0)
+    _mySleep(0.001);
+  pthread_mutex_lock(&g_replayMutex);
+  g_replayDone = 1;
+  pthread_cond_broadcast(&g_replayCond);
+  pthread_mutex_unlock(&g_replayMutex);
+  return params;
 }
 
 /* 
@@ -252,27 +738,278 @@ static int _mySleep (double sleep_time)
  * but append g_debugString at the beginning of the line
  * does nothing if g_debugMode=0. 
  * See dgtnixSetDebugMode(...) 
+ *
+ * Nothing is written here : the format and its raw arguments are stored 
+ * in the log ring of the calling thread (strings are copied, truncated 
+ * to what remains of _DGTNIX_LOG_STRINGS), _logThread formats them later.
+ * Messages are dropped, and counted, when the ring is full.
  */
 static int _debug(const char *format, ...)
 {
   if( (g_debugMode == DGTNIX_DEBUG_ON) || (g_debugMode == DGTNIX_DEBUG_WITH_TIME))
     {
-      fprintf(stderr, "%s", g_debugString);
-      if(dgtnix_errno!=0)
+      _dgtnixLogRing *ring = _logRing();
+      unsigned int head = ring->head;
+      int isLong;
+      char conversion;
+      const char *spec = format;
+      if(head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == _DGTNIX_LOG_RING_SIZE)
 	{
-	  fprintf(stderr, "dgtnix_errno:");
-	  fprintf(stderr, "%s", strerror(dgtnix_errno));
-	  fprintf(stderr, ":");
+	  __atomic_fetch_add(&g_logDropped, 1, __ATOMIC_RELAXED);
+	  return 0;
 	}
+      _dgtnixLogRecord *record = &ring->records[head % _DGTNIX_LOG_RING_SIZE];
+      size_t used = 0;
+      record->time = _monotonicTime();
+      record->format = format;
+      record->error = dgtnix_errno;
+      record->count = 0;
       va_list ap;
       va_start(ap, format);
-      int res=vfprintf(stderr, format, ap);
+      while(record->count < _DGTNIX_LOG_MAX_ARGS && (conversion = _logConversion(&spec, &isLong)))
+	{
+	  _dgtnixLogArgument *argument = &record->arguments[record->count++];
+	  if(conversion == 's')
+	    {
+	      const char *string = va_arg(ap, const char *);
+	      size_t length = strlen(string);
+	      /* The strings before filled the record, this one is empty */
+	      if(used >= _DGTNIX_LOG_STRINGS - 1)
+		{
+		  length = 0;
+		  used = _DGTNIX_LOG_STRINGS - 1;
+		}
+	      if(used + length >= _DGTNIX_LOG_STRINGS)
+		length = _DGTNIX_LOG_STRINGS - used - 1;
+	      memcpy(record->strings + used, string, length);
+	      record->strings[used + length] = '\0';
+	      argument->offset = used;
+	      used += length + 1;
+	    }
+	  else if(strchr("eEfgG", conversion))
+	    argument->real = va_arg(ap, double);
+	  else if(conversion == 'p')
+	    argument->pointer = va_arg(ap, void *);
+	  else
+	    argument->integer = isLong ? va_arg(ap, long) : va_arg(ap, int);
+	}
       va_end(ap);
-      return res;
+      __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+      pthread_once(&g_logOnce, _startLogThread);
+      return 1;
     }
   return 0;
 }
 
+/*
+ * Skip *format to the next conversion of a printf format and return its 
+ * character, or 0 at the end. *isLong tells if it has a 'l' modifier.
+ * On return *format points just after the conversion.
+ */
+static char _logConversion(const char **format, int *isLong)
+{
+  const char *c = *format;
+  while(*c)
+    {
+      if(*c++ != '%')
+	continue;
+      if(*c == '%')
+	{
+	  c++;
+	  continue;
+	}
+      *isLong = 0;
+      while(*c && !strchr("diouxXcsfeEgGp", *c))
+	if(*c++ == 'l')
+	  *isLong = 1;
+      if(!*c)
+	break;
+      *format = c + 1;
+      return *c;
+    }
+  *format = c;
+  return 0;
+}
+
+/*
+ * The log ring of the calling thread. It is taken from the rings left by 
+ * finished threads, or allocated and pushed on g_logRings (they are never freed).
+ */
+static _dgtnixLogRing *_logRing()
+{
+  _dgtnixLogRing *ring = g_threadLogRing;
+  int one = 1;
+  if(ring)
+    return ring;
+  pthread_once(&g_logKeyOnce, _initLogKey);
+  for(ring = __atomic_load_n(&g_logRings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    if(__atomic_compare_exchange_n(&ring->unused, &one, 0, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      break;
+    else
+      one = 1;
+  if(!ring)
+    {
+      ring = (_dgtnixLogRing *)calloc(1, sizeof(_dgtnixLogRing));
+      if(!ring)
+	{
+	  perror("dgtnix critical:_logRing: calloc() error\n");
+	  exit(-1);
+	}
+      ring->next = __atomic_load_n(&g_logRings, __ATOMIC_RELAXED);
+      while(!__atomic_compare_exchange_n(&g_logRings, &ring->next, ring, 0, 
+					 __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	;
+    }
+  g_threadLogRing = ring;
+  pthread_setspecific(g_logKey, ring);
+  return ring;
+}
+
+/* pthread_once() routine of the key that gives back the ring of a finished thread */
+static void _initLogKey()
+{
+  pthread_key_create(&g_logKey, _releaseLogRing);
+}
+
+static void _releaseLogRing(void *ring)
+{
+  __atomic_store_n(&((_dgtnixLogRing *)ring)->unused, 1, __ATOMIC_RELEASE);
+}
+
+/* pthread_once() routine, started by the first message */
+static void _startLogThread()
+{
+  pthread_t thread;
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+  if(pthread_create(&thread, &attributes, _logThread, NULL) != 0)
+    perror("dgtnix critical:_startLogThread: pthread_create() error\n");
+  pthread_attr_destroy(&attributes);
+  /* What is still in the rings when the program exits */
+  atexit(_flushLog);
+}
+
+/* Formats the log rings on stderr every _DGTNIX_LOG_INTERVAL real seconds, whatever the driver clock */
+static void *_logThread(void *params)
+{
+  while(1)
+    {
+      _systemSleep(_DGTNIX_LOG_INTERVAL, NULL);
+      _flushLog();
+    }
+  return params;
+}
+
+/*
+ * Format one record as the former synchronous _debug() did, 
+ * truncated to size. Return the length written.
+ */
+static int _formatLogRecord(const _dgtnixLogRecord *record, char *buffer, int size)
+{
+  const char *format = record->format;
+  const char *spec = format;
+  char conversion, piece[32];
+  int isLong, i = 0, length;
+  length = snprintf(buffer, size, "%s", g_debugString);
+  if(record->error != 0 && length < size)
+    length += snprintf(buffer + length, size - length, "dgtnix_errno:%s:", strerror(record->error));
+  while(length < size && (conversion = _logConversion(&spec, &isLong)))
+    {
+      /* The literal text before the conversion, then the conversion alone */
+      const char *percent = spec - 1;
+      while(*percent != '%')
+	percent--;
+      length += _copyLogLiteral(buffer + length, size - length, format, percent);
+      if(length >= size || spec - percent >= (int)sizeof(piece))
+	break;
+      memcpy(piece, percent, spec - percent);
+      piece[spec - percent] = '\0';
+      format = spec;
+      const _dgtnixLogArgument *argument = &record->arguments[i];
+      if(i++ >= record->count)
+	break;
+      if(conversion == 's')
+	length += snprintf(buffer + length, size - length, piece, record->strings + argument->offset);
+      else if(strchr("eEfgG", conversion))
+	length += snprintf(buffer + length, size - length, piece, argument->real);
+      else if(conversion == 'p')
+	length += snprintf(buffer + length, size - length, piece, argument->pointer);
+      else if(isLong)
+	length += snprintf(buffer + length, size - length, piece, argument->integer);
+      else
+	length += snprintf(buffer + length, size - length, piece, (int)argument->integer);
+    }
+  if(length < size)
+    length += _copyLogLiteral(buffer + length, size - length, format, format + strlen(format));
+  return length < size ? length : size - 1;
+}
+
+/* Copy the text of a format from from to to, "%%" being '%', return the length copied */
+static int _copyLogLiteral(char *buffer, int size, const char *from, const char *to)
+{
+  int length = 0;
+  for(; from < to && length < size; from++)
+    {
+      if(from[0] == '%' && from[1] == '%')
+	from++;
+      buffer[length++] = *from;
+    }
+  return length;
+}
+
+/*
+ * Format every record of the rings on stderr, in time order, 
+ * with a single write() per full buffer.
+ */
+static void _flushLog()
+{
+  char buffer[4096];
+  int length = 0;
+  unsigned long dropped;
+  pthread_mutex_lock(&g_logMutex);
+  while(1)
+    {
+      /* The oldest record of all the rings */
+      _dgtnixLogRing *ring, *oldest = NULL;
+      for(ring = __atomic_load_n(&g_logRings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+	if(ring->tail != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)
+	   && (!oldest || ring->records[ring->tail % _DGTNIX_LOG_RING_SIZE].time 
+	       < oldest->records[oldest->tail % _DGTNIX_LOG_RING_SIZE].time))
+	  oldest = ring;
+      if(!oldest)
+	break;
+      if(length > (int)sizeof(buffer) - _DGTNIX_LOG_LINE)
+	length = _writeLog(buffer, length);
+      length += _formatLogRecord(&oldest->records[oldest->tail % _DGTNIX_LOG_RING_SIZE], 
+				 buffer + length, _DGTNIX_LOG_LINE);
+      __atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+    }
+  dropped = __atomic_exchange_n(&g_logDropped, 0, __ATOMIC_RELAXED);
+  if(dropped)
+    {
+      if(length > (int)sizeof(buffer) - _DGTNIX_LOG_LINE)
+	length = _writeLog(buffer, length);
+      length += snprintf(buffer + length, _DGTNIX_LOG_LINE, "%s%lu messages dropped\n", 
+			 g_debugString, dropped);
+    }
+  _writeLog(buffer, length);
+  pthread_mutex_unlock(&g_logMutex);
+}
+
+/* write() the whole buffer on stderr, return 0, the new length of the buffer */
+static int _writeLog(const char *buffer, int length)
+{
+  ssize_t n;
+  while(length > 0 && ((n = write(2, buffer, length)) > 0 || errno == EINTR))
+    if(n > 0)
+      {
+	buffer += n;
+	length -= n;
+      }
+  return 0;
+}
+
 /* 
  * Convert a piece from the internal representation to 
  * the representation defined in dgtnix.h (ex:  white pawn = 'P').
@@ -314,6 +1051,127 @@ static char _convertInternalPieceToExternal(char c)
     }
 }
 
+/*
+ * Publish a snapshot of g_board for dgtnixGetBoard(), dgtnixTestBoard() and 
+ * dgtnixCopyBoard(). Writers are serialised by g_mutex, which must be held.
+ * The snapshot is written into the buffer readers are not using, so readers 
+ * never wait on the driver thread : they retry only if a second publication 
+ * overwrote the buffer they were copying.
+ */
+static void _publishBoard()
+{
+  unsigned long sequence = __atomic_load_n(&g_snapshotSequence, __ATOMIC_RELAXED);
+  char *snapshot = g_snapshots[((sequence >> 1) + 1) & 1];
+  int i;
+  __atomic_store_n(&g_snapshotSequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  if(g_boardOrientation == DGTNIX_BOARD_ORIENTATION_CLOCKLEFT)
+    for(i = 0; i < 64; i++)
+      snapshot[i] = g_externalPieces[(unsigned char)g_board[i]];
+  else
+    for(i = 0; i < 64; i++)
+      snapshot[i] = g_externalPieces[(unsigned char)g_board[63-i]];
+  __atomic_store_n(&g_snapshotSequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copy the last published snapshot into board (a char[64]) without locking.
+ * Return the version of the copied snapshot.
+ */
+static unsigned long _readSnapshot(char *board)
+{
+  unsigned long before, after;
+  do
+    {
+      before = __atomic_load_n(&g_snapshotSequence, __ATOMIC_ACQUIRE);
+      memcpy(board, g_snapshots[(before >> 1) & 1], 64);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      after = __atomic_load_n(&g_snapshotSequence, __ATOMIC_RELAXED);
+    }
+  /* The copied buffer is only rewritten by the publication following 
+     the one in progress (or the next one if none is) */
+  while(after > (before | 1) + 1);
+  return before >> 1;
+}
+
+/*
+ * Compare two board representations (char[64]) and return a mask 
+ * with bit i set when square i differs.
+ * Uses SSE2 when available, otherwise compares a word (8 squares) at a time 
+ * and only looks at single squares inside the words that differ.
+ */
+static uint64_t _diffBoards(const char *a, const char *b)
+{
+  uint64_t mask = 0;
+  int i;
+#ifdef __SSE2__
+  for(i = 0; i < 64; i += 16)
+    {
+      __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+      __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+      unsigned int equal = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+      mask |= (uint64_t)(~equal & 0xffff) << i;
+    }
+#else
+  for(i = 0; i < 64; i += 8)
+    {
+      uint64_t wa, wb;
+      int j;
+      memcpy(&wa, a + i, 8);
+      memcpy(&wb, b + i, 8);
+      if(wa == wb)
+	continue;
+      for(j = 0; j < 8; j++)
+	if(a[i+j] != b[i+j])
+	  mask |= (uint64_t)1 << (i+j);
+    }
+#endif
+  return mask;
+}
+
+/*
+ * Inexpensive sanity check of g_board : a real position never has 
+ * more than one king, 8 pawns or 16 pieces per side, nor pawns on 
+ * the first or last rank. Lifted pieces only lower these numbers, 
+ * so a failure means that a field update was lost.
+ * Must be called with g_mutex held.
+ */
+static int _boardIsConsistent()
+{
+  int pieces[13] = {0};
+  int square;
+  for(square = 0; square < 64; square++)
+    {
+      unsigned char piece = g_board[square];
+      if(piece > _DGTNIX_BQUEEN)
+	return 0;
+      if((piece == _DGTNIX_WPAWN || piece == _DGTNIX_BPAWN) && (square < 8 || square >= 56))
+	return 0;
+      pieces[piece]++;
+    }
+  int white = pieces[_DGTNIX_WPAWN] + pieces[_DGTNIX_WROOK] + pieces[_DGTNIX_WKNIGHT]
+    + pieces[_DGTNIX_WBISHOP] + pieces[_DGTNIX_WKING] + pieces[_DGTNIX_WQUEEN];
+  int black = pieces[_DGTNIX_BPAWN] + pieces[_DGTNIX_BROOK] + pieces[_DGTNIX_BKNIGHT]
+    + pieces[_DGTNIX_BBISHOP] + pieces[_DGTNIX_BKING] + pieces[_DGTNIX_BQUEEN];
+  return pieces[_DGTNIX_WKING] <= 1 && pieces[_DGTNIX_BKING] <= 1
+    && pieces[_DGTNIX_WPAWN] <= _DGTNIX_MAX_PAWNS_PER_SIDE 
+    && pieces[_DGTNIX_BPAWN] <= _DGTNIX_MAX_PAWNS_PER_SIDE
+    && white <= _DGTNIX_MAX_PIECES_PER_SIDE && black <= _DGTNIX_MAX_PIECES_PER_SIDE;
+}
+
+/*
+ * Ask the board for a full dump, unless one is already on its way.
+ */
+static void _requestBoardDump()
+{
+  if(g_boardDumpPending && _monotonicTime() - g_lastDumpTime < _DGTNIX_DUMP_TIMEOUT)
+    return;
+  g_boardDumpPending = 1;
+  g_lastDumpTime = _monotonicTime();
+  _DGTNIX_STAT_ADD(g_stats.dumpRequests, 1);
+  _sendMessageToBoard(_DGTNIX_SEND_BRD);
+}
+
 /*
  * queryVendorStrings
  * update the internal representation of 
@@ -387,7 +1245,7 @@ static void _sendMessageToBoard(int command)
 	  exit(-1);
 	}
     }
-  if(write(g_descriptorDriverBoard,&command ,1)!=1)
+  if(_boardWrite(&command ,1)!=1)
     {
       perror("dgtnix critical:sendMessageToBoard: write() error\n");
       _closeDescriptor(&g_descriptorDriverBoard);
@@ -426,8 +1284,11 @@ static void _sendMessageToBoard(int command)
 /*
  * Wrapper of the unix write(...) that sends a 
  * message to the DGT board.
+ * The message is sent again every second until the clock acks it, 
+ * at most tries times (forever if tries <= 0).
+ * Return 1 once the clock acked it, 0 if it never did.
  */
-void _sendMessageToClock(unsigned char a, unsigned char b, unsigned char c, unsigned char d, unsigned char e, unsigned char f, unsigned char beep, unsigned char dots)
+int _sendMessageToClock(unsigned char a, unsigned char b, unsigned char c, unsigned char d, unsigned char e, unsigned char f, unsigned char beep, unsigned char dots, int tries)
 {
   pthread_mutex_lock (&clock_ack_mutex);
 
@@ -454,9 +1315,11 @@ void _sendMessageToClock(unsigned char a, unsigned char b, unsigned char c, unsi
   message[10]=dots;
   message[11]=beep?0x03:0x01;
   message[12]=0x00;
-  int numRetries = 0;
+  int numRetries = 0, sent = 0;
+  _DGTNIX_STAT_ADD(g_stats.clockMessages, 1);
+  g_clockSendTime = _monotonicTime();
   retry:
-  if(write(g_descriptorDriverBoard,&message ,13)!=13)
+  if(_boardWrite(&message ,13)!=13)
     {
       perror("dgtnix critical:sendMessageToClock: write() error. Retrying.. \n");
       ++ numRetries;
@@ -465,14 +1328,25 @@ void _sendMessageToClock(unsigned char a, unsigned char b, unsigned char c, unsi
         _closeDescriptor(&g_descriptorDriverBoard);
         exit(-1);
       }
-      sleep(numRetries*2);
+      _mySleep(numRetries*2);
+      _DGTNIX_STAT_ADD(g_stats.clockRetries, 1);
       goto retry;
     }
 
-    sleep(1); //wait for the ACK message
+    sent++;
+    _mySleep(1); //wait for the ACK message
     if(pthread_mutex_trylock(&clock_ack_mutex))
     {
         //printf("WE ARE STUCK! - NO ACK RECEIVED\n");
+        if(tries > 0 && sent >= tries)
+          {
+            /* No clock answers, give the ack mutex back */
+            _debug("no clock ACK after %d messages\n", sent);
+            g_clockSendTime = 0;
+            pthread_mutex_unlock(&clock_ack_mutex);
+            return 0;
+          }
+        _DGTNIX_STAT_ADD(g_stats.clockRetries, 1);
         goto retry;
     }
     else
@@ -480,6 +1354,7 @@ void _sendMessageToClock(unsigned char a, unsigned char b, unsigned char c, unsi
         //printf("YEPEEE  ACK RECEIVED\n");
         pthread_mutex_unlock(&clock_ack_mutex);
     }
+    return 1;
 }
 
 void dgtnixUpdate()
@@ -533,13 +1408,19 @@ unsigned char _characterToLcdCode(char c)
 
 /* Prints a 6 character string message on the DGT Clock */
 void dgtnixPrintMessageOnClock(const char * message, unsigned char beep, unsigned char dots)
+{
+    dgtnixSendMessageToClock(message, beep, dots, 0);
+}
+
+int dgtnixSendMessageToClock(const char * message, unsigned char beep, unsigned char dots, int tries)
 {
     unsigned char a,b,c,d,e,f; 
-    printf("Sending message:%s\n",message);
+    int acked;
+    _debug("Sending message %s to the clock\n", message);
     if(strlen(message)<6) 
     {
-        perror("dgtnix critical:dgtnixPrintMessageOnClock: invalid message length\n");
-        return;
+        perror("dgtnix critical:dgtnixSendMessageToClock: invalid message length\n");
+        return -1;
     }   
     a=_characterToLcdCode(message[0]);
     b=_characterToLcdCode(message[1]);
@@ -549,8 +1430,9 @@ void dgtnixPrintMessageOnClock(const char * message, unsigned char beep, unsigne
     f=_characterToLcdCode(message[5]); 
     
     pthread_mutex_lock (&clock_send_mutex);
-    _sendMessageToClock(a,b,c,d,e,f,beep,dots);
+    acked = _sendMessageToClock(a,b,c,d,e,f,beep,dots,tries);
     pthread_mutex_unlock (&clock_send_mutex);
+    return acked;
 }
 
 /*
@@ -564,13 +1446,238 @@ static void _sendMessageToEngine(const char*message, size_t length)
       perror("dgtnix critical:sendMessageToEngine: invalid descriptor\n");
       exit(-1);
     }
-  if(write(g_pipeDriverWriteSide,(void *) message, length) != length)
+  static unsigned int sent;
+  if((__atomic_fetch_add(&sent, 1, __ATOMIC_RELAXED) & (_DGTNIX_PIPE_STALL_SAMPLE - 1)) == 0)
+    {
+      struct pollfd writable = { g_pipeDriverWriteSide, POLLOUT, 0 };
+      if(poll(&writable, 1, 0) == 0)
+	/* The engine does not read fast enough, the write() below will block */
+	_DGTNIX_STAT_ADD(g_stats.pipeStalls, 1);
+    }
+  if(write(g_pipeDriverWriteSide,(void *) message, length) != (ssize_t)length)
     {
       perror("dgtnix critical:sendMessageToEngine: write error\n");
       exit(-1);
     }
 }
 
+/*
+ * pthread_once() routine, g_eventCond must wait on the monotonic clock 
+ * as the deadlines of dgtnixWaitEvents() are computed with _systemNow().
+ */
+static void _initEvents()
+{
+  pthread_condattr_t attributes;
+  pthread_condattr_init(&attributes);
+  pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+  pthread_cond_init(&g_eventCond, &attributes);
+  pthread_condattr_destroy(&attributes);
+}
+
+/*
+ * Queue an event for dgtnixWaitEvents() if its class is subscribed, waited
+ * for or signaled by the eventfd, and wake the waiters up only if one of 
+ * them waits for this class.
+ * The timestamp is filled here, and the arrival when it is not set.
+ */
+static void _postEvent(dgtnixEvent *event)
+{
+  int bit;
+  unsigned int waiting = 0;
+  event->timestamp = _monotonicTime();
+  if(!event->arrival)
+    event->arrival = g_messageArrival;
+  if(g_messageArrival > 0)
+    _recordLatency(g_stats.publishLatency, &g_stats.publishLatencyTotal, 
+		   event->timestamp - g_messageArrival);
+  pthread_once(&g_eventOnce, _initEvents);
+  pthread_mutex_lock(&g_eventMutex);
+  for(bit = 0; bit < 8; bit++)
+    if(g_eventWaiters[bit])
+      waiting |= 1 << bit;
+  if(!(event->type & (g_eventSubscription | g_eventFdMask | waiting)))
+    {
+      pthread_mutex_unlock(&g_eventMutex);
+      return;
+    }
+  if(g_eventCount == _DGTNIX_EVENT_QUEUE_SIZE)
+    {
+      /* Nobody reads, drop the oldest */
+      _DGTNIX_STAT_ADD(g_stats.eventsDropped, 1);
+      g_eventHead = (g_eventHead + 1) % _DGTNIX_EVENT_QUEUE_SIZE;
+      g_eventCount--;
+    }
+  g_events[(g_eventHead + g_eventCount) % _DGTNIX_EVENT_QUEUE_SIZE] = *event;
+  g_eventCount++;
+  if(event->type & waiting)
+    pthread_cond_broadcast(&g_eventCond);
+  if(g_eventFd >= 0 && (event->type & g_eventFdMask))
+    {
+      uint64_t one = 1;
+      /* Only fails when the counter is full, the reader is signaled anyway */
+      if(write(g_eventFd, &one, sizeof(one)) < 0)
+	_debug("dgtnix: eventfd write error\n");
+    }
+  pthread_mutex_unlock(&g_eventMutex);
+}
+
+int dgtnixEventFd(unsigned int mask)
+{
+  int fd;
+  pthread_mutex_lock(&g_eventMutex);
+  if(g_eventFd < 0)
+    g_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(g_eventFd >= 0)
+    {
+      g_eventFdMask = mask & DGTNIX_EVENT_ALL;
+      /* The events already queued are signaled too */
+      if(g_eventCount)
+	{
+	  uint64_t one = 1;
+	  if(write(g_eventFd, &one, sizeof(one)) < 0)
+	    _debug("dgtnix: eventfd write error\n");
+	}
+    }
+  fd = g_eventFd;
+  pthread_mutex_unlock(&g_eventMutex);
+  return fd;
+}
+
+/*
+ * The board answered the request of _initDriver(), wake _waitBoardAnswer() up.
+ * Called once per dgtnixInit(), outside of g_mutex.
+ */
+static void _boardAnswered()
+{
+  pthread_once(&g_eventOnce, _initEvents);
+  pthread_mutex_lock(&g_eventMutex);
+  pthread_cond_broadcast(&g_eventCond);
+  pthread_mutex_unlock(&g_eventMutex);
+}
+
+/*
+ * Wait until the board answered or for timeout real seconds, 
+ * returns 1 if it answered, 0 otherwise.
+ */
+static int _waitBoardAnswer(double timeout)
+{
+  double deadline = _systemNow(NULL) + timeout;
+  struct timespec ts;
+  ts.tv_sec = (time_t)deadline;
+  ts.tv_nsec = (long)((deadline - ts.tv_sec) * 1e9);
+
+  pthread_once(&g_eventOnce, _initEvents);
+  pthread_mutex_lock(&g_eventMutex);
+  while(g_boardUpdated != 1)
+    if(pthread_cond_timedwait(&g_eventCond, &g_eventMutex, &ts) == ETIMEDOUT)
+      break;
+  pthread_mutex_unlock(&g_eventMutex);
+  return g_boardUpdated == 1;
+}
+
+/*
+ * Report the current position as stable, called when no field update 
+ * was received during _DGTNIX_STABLE_DELAY seconds or after a board dump.
+ */
+static void _postStableEvent()
+{
+  dgtnixEvent event;
+  memset(&event, 0, sizeof(event));
+  event.type = DGTNIX_EVENT_STABLE;
+  event.version = dgtnixGetBoardVersion();
+  event.arrival = g_messageArrival ? g_messageArrival : g_updateArrival;
+  g_stableDeadline = 0;
+  _postEvent(&event);
+}
+
+/*
+ * Post a DGTNIX_EVENT_CONNECTION event, flags is DGTNIX_CONNECTION_LOST or 
+ * DGTNIX_CONNECTION_RESTORED.
+ */
+static void _postConnectionEvent(int flags)
+{
+  dgtnixEvent event;
+  memset(&event, 0, sizeof(event));
+  event.type = DGTNIX_EVENT_CONNECTION;
+  event.flags = flags;
+  event.version = dgtnixGetBoardVersion();
+  _postEvent(&event);
+}
+
+/*
+ * Post a DGTNIX_EVENT_BUTTON event. 
+ * flags is a combination of DGTNIX_BUTTON_..., buttons is the mask of the 
+ * buttons involved (1 << button) and pressTime the time the button was pressed.
+ */
+static void _postButtonEvent(int button, int flags, int buttons, double pressTime)
+{
+  dgtnixEvent event;
+  memset(&event, 0, sizeof(event));
+  event.type = DGTNIX_EVENT_BUTTON;
+  event.code = button;
+  event.flags = flags;
+  event.buttons = buttons;
+  event.pressTime = pressTime;
+  _postEvent(&event);
+}
+
+/*
+ * Called with the button (0 if none) reported by each clock ack message.
+ * The clock reports a button once per press, so every button reported is 
+ * a press edge, posted as soon as it is reported, and no button a release 
+ * edge (flagged long if it was held long enough). A press while a button 
+ * is held means the release of the held one was missed : it is released 
+ * first, unflagged as its release time is unknown, and a second button 
+ * following the first one quickly is a chord. Presses are also queued for 
+ * getClockButtonState().
+ */
+static void _clockButtonsReported(int button)
+{
+  double now = _monotonicTime();
+  int held = g_buttonHeld;
+  if(!button && !held)
+    return;
+  if(held)
+    {
+      int flags = DGTNIX_BUTTON_RELEASED;
+      if(!button && now - g_buttonPressTime >= _DGTNIX_LONG_PRESS_DELAY)
+	flags |= DGTNIX_BUTTON_LONG;
+      _debug("Clock button #%d released after %fs\n", held, now - g_buttonPressTime);
+      _postButtonEvent(held, flags, 1 << held, g_buttonPressTime);
+    }
+  g_buttonHeld = button;
+  g_longPressDeadline = 0;
+  if(!button)
+    return;
+  if(held && held != button && now - g_buttonPressTime < _DGTNIX_CHORD_DELAY)
+    _postButtonEvent(button, DGTNIX_BUTTON_CHORD, (1 << held) | (1 << button), g_buttonPressTime);
+  g_buttonPressTime = now;
+  g_longPressDeadline = now + _DGTNIX_LONG_PRESS_DELAY;
+  clockButtonState = button;
+  pthread_mutex_lock(&g_eventMutex);
+  if(g_buttonQueueCount == _DGTNIX_BUTTON_QUEUE_SIZE)
+    {
+      g_buttonQueueHead = (g_buttonQueueHead + 1) % _DGTNIX_BUTTON_QUEUE_SIZE;
+      g_buttonQueueCount--;
+    }
+  g_buttonQueue[(g_buttonQueueHead + g_buttonQueueCount) % _DGTNIX_BUTTON_QUEUE_SIZE] = button;
+  g_buttonQueueCount++;
+  pthread_mutex_unlock(&g_eventMutex);
+  _postButtonEvent(button, DGTNIX_BUTTON_PRESSED, 1 << button, now);
+}
+
+/*
+ * Report the held button as a long press while it is still held, 
+ * so that menus do not have to wait for the release. The deadline is 
+ * only set by a press edge and cleared by the next edge.
+ */
+static void _longPressDue()
+{
+  g_longPressDeadline = 0;
+  _debug("Clock button #%d long press\n", g_buttonHeld);
+  _postButtonEvent(g_buttonHeld, DGTNIX_BUTTON_LONG, 1 << g_buttonHeld, g_buttonPressTime);
+}
+
 /*
  * The main polling loop of the thread, 
  * waits for events on the ports. 
@@ -579,16 +1686,41 @@ static void _sendMessageToEngine(const char*message, size_t length)
 static void *_threadManagedFunc(void *params)
 { 
   g_initialised = 1;
+  g_connectedTime = _monotonicTime();
   _queryVendorStrings();
   sem_init(&dgtnixEventSemaphore,0,0);
   _sendMessageToBoard(_DGTNIX_SEND_UPDATE);
   int numRetries = 0;
   while( 1 ) 
     {  
-      if(_readMessageFromBoard()<0)
+      double deadline = g_stableDeadline;
+      if(g_longPressDeadline > 0 && (deadline == 0 || g_longPressDeadline < deadline))
+	deadline = g_longPressDeadline;
+      if(deadline > 0)
+	{
+	  /* Wait for the next message only until the position is stable 
+	     or the held button becomes a long press */
+	  if(_waitBoard(deadline) == 0)
+	    {
+	      if(deadline == g_stableDeadline)
+		_postStableEvent();
+	      else
+		_longPressDue();
+	      continue;
+	    }
+	}
+      int status = _readMessageFromBoard();
+      /* Events posted from now on are not caused by a board message */
+      g_messageArrival = 0;
+      if(status == -2 && g_virtualBoardMode != _DGTNIX_REPLAY_BOARD)
+	{
+	  _reconnect();
+	  continue;
+	}
+      if(status<0)
 	{
 	  ++numRetries;
-	  sleep(numRetries*2);
+	  _mySleep(numRetries*2);
 	  fprintf(stderr, "dgtnixManagerFunc:read error -- retrying\n");
 	  if (numRetries>5)
 	    {
@@ -600,38 +1732,120 @@ static void *_threadManagedFunc(void *params)
       else
         {
           numRetries = 0;
+	  if(g_reconnectDelay > _DGTNIX_RECONNECT_DELAY 
+	     && _monotonicTime() - g_connectedTime >= _DGTNIX_RECONNECT_STABLE)
+	    g_reconnectDelay = _DGTNIX_RECONNECT_DELAY;
         }
       /*_dumpBoard(g_board);*/
       sem_post(&dgtnixEventSemaphore); 
     }
   _closeAllDescriptors();
   g_initialised = 0;
+  _wakeEventWaiters();
   return params;
 }
 
+/*
+ * The device of g_port went away (unplugged cable, lost Bluetooth link) : 
+ * report it, then reopen it as soon as its node comes back in its directory 
+ * (inotify) or every g_reconnectDelay seconds, doubling up to _DGTNIX_RECONNECT_DELAY_MAX. 
+ * The board dump requested then is diffed against the last known board by 
+ * _boardDumpReceived(), which posts the moves made meanwhile after the 
+ * DGTNIX_CONNECTION_RESTORED event. Returns once the device is back, 
+ * dgtnixClose() cancels the wait.
+ */
+static void _reconnect()
+{
+  char directory[_DGTNIX_SIZE_PORT];
+  char *slash;
+  char mode;
+  int fd;
+
+  _DGTNIX_STAT_ADD(g_stats.disconnects, 1);
+  _closeDescriptor(&g_descriptorDriverBoard);
+  _debug("%s is gone, waiting for it to come back\n", g_port);
+  _postConnectionEvent(DGTNIX_CONNECTION_LOST);
+
+  snprintf(directory, sizeof(directory), "%s", g_port);
+  slash = strrchr(directory, '/');
+  if(!slash)
+    strcpy(directory, ".");
+  else
+    slash[slash == directory ? 1 : 0] = '\0';
+  g_inotifyDescriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if(g_inotifyDescriptor >= 0 
+     && inotify_add_watch(g_inotifyDescriptor, directory, IN_CREATE | IN_ATTRIB | IN_MOVED_TO) < 0)
+    {
+      _debug("cannot watch %s, polling for %s\n", directory, g_port);
+      _closeDescriptor(&g_inotifyDescriptor);
+    }
+  /* The last connection dropped soon after it was opened : not reopened at once */
+  if(_monotonicTime() - g_connectedTime < _DGTNIX_RECONNECT_STABLE)
+    {
+      _mySleep(g_reconnectDelay);
+      _increaseReconnectDelay();
+    }
+  while((fd = _openPort(g_port, &mode, 0)) < 0)
+    {
+      _waitDeviceNode(g_reconnectDelay);
+      _increaseReconnectDelay();
+    }
+  if(g_inotifyDescriptor >= 0)
+    _closeDescriptor(&g_inotifyDescriptor);
+  g_descriptorDriverBoard = fd;
+  g_connectedTime = _monotonicTime();
+  _DGTNIX_STAT_ADD(g_stats.reconnects, 1);
+  _debug("%s is back\n", g_port);
+  _postConnectionEvent(DGTNIX_CONNECTION_RESTORED);
+  _sendMessageToBoard(_DGTNIX_SEND_UPDATE);
+  /* Whatever was pending was lost with the device */
+  g_boardDumpPending = 0;
+  _requestBoardDump();
+}
+
+/*
+ * Wait for a change in the directory watched by g_inotifyDescriptor, 
+ * or for seconds.
+ */
+static void _waitDeviceNode(double seconds)
+{
+  struct pollfd pfd;
+  char events[4096];
+  if(g_inotifyDescriptor < 0)
+    {
+      _mySleep(seconds);
+      return;
+    }
+  pfd.fd = g_inotifyDescriptor;
+  pfd.events = POLLIN;
+  if(poll(&pfd, 1, (int)(seconds * 1000)) > 0)
+    /* Only the wake up matters */
+    while(read(g_inotifyDescriptor, events, sizeof(events)) > 0)
+      ;
+}
+
+/* Double g_reconnectDelay, up to _DGTNIX_RECONNECT_DELAY_MAX */
+static void _increaseReconnectDelay()
+{
+  g_reconnectDelay *= 2;
+  if(g_reconnectDelay > _DGTNIX_RECONNECT_DELAY_MAX)
+    g_reconnectDelay = _DGTNIX_RECONNECT_DELAY_MAX;
+}
+
 /*
  * Print the board in parameter (a char[64]) to stderr.
  */
 static void _dumpBoard(const char *board)
 {
-  int square;
-  for (square = 0; square < 64; square++)
+  int line;
+  char p[8];
+  for (line = 0; line < 8; line++)
     {
-      if(!(square%8))
-	{ 
-	  if(!(square==0))
-	    {
-	      fprintf(stderr,"|\n");
-	      fprintf(stderr, "%s", g_debugString);
-	    }
-	  else
-	    {
-	      fprintf(stderr, "%s", g_debugString);
-	    }
-	}
-      fprintf(stderr,"|%c", _convertInternalPieceToExternal(board[square]));
+      int column;
+      for (column = 0; column < 8; column++)
+	p[column] = _convertInternalPieceToExternal(board[line * 8 + column]);
+      _debug("|%c|%c|%c|%c|%c|%c|%c|%c|\n", p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]);
     }
-  fprintf(stderr,"|\n");
 }
 
 /*
@@ -655,8 +1869,14 @@ static int _closeDescriptor(int *descriptor)
 }
 
 int getClockButtonState() {
-  int button = clockButtonState;
-  clockButtonState = 0;
+  int button = 0;
+  pthread_mutex_lock(&g_eventMutex);
+  if (g_buttonQueueCount > 0) {
+    button = g_buttonQueue[g_buttonQueueHead];
+    g_buttonQueueHead = (g_buttonQueueHead + 1) % _DGTNIX_BUTTON_QUEUE_SIZE;
+    g_buttonQueueCount--;
+  }
+  pthread_mutex_unlock(&g_eventMutex);
   return button;
 }
 
@@ -664,42 +1884,28 @@ int extractBit (unsigned char data, int bitPosition) {
     return (data >> bitPosition) & 0x01;
 }
 
-// TODO: Detect bit order based on machine endianness. This code wont work on little endian machines.
-void processClockBits (unsigned char data) {
-
-    int first = extractBit(data, 0);
-    int second = extractBit(data, 1);
-    int third = extractBit(data, 2);
-    int fifth = extractBit(data, 4);
-    int sixth = extractBit(data, 5);
-
-    // Detect clock buttons from left most button
-    if (first == 1 && second == 0 && third == 0) {
-        _debug("Clock button #1 pressed\n");
-        clockButtonState = 1;
-    }
-    else if (first == 0 && second == 0 && third == 1) {
-        _debug("Clock button #2 pressed\n");
-        clockButtonState = 2;
-    }
-    else if (first == 1 && second == 1 && third == 0) {
-        _debug("Clock button #3 pressed\n");
-        clockButtonState = 3;
-    }
-    else if (first == 0 && second == 1 && third == 0 && fifth == 1 && sixth == 1) {
-        _debug("Clock button #4 pressed\n");
-        clockButtonState = 4;
-    }
-    else if (first == 1 && second == 0 && third == 1) {
-        _debug("Clock button #5 pressed\n");
-        clockButtonState = 5;
-    }
-/*
-    else {
-        _debug("No clock button pressed\n");
-    }
-*/
-
+/* 
+ * Clock buttons 1 to 5 as (mask, bits) of a clock ack byte, the leftmost 
+ * first. decode_clock_button() of pydgt.py decodes them with the same table.
+ */
+static const unsigned char g_clockButtonBits[5][2] =
+  {
+    { 0x07, 0x01 },
+    { 0x07, 0x04 },
+    { 0x07, 0x03 },
+    { 0x37, 0x32 },
+    { 0x07, 0x05 },
+  };
+
+/* Return the clock button (1 to 5) encoded in data, 0 if none */
+int processClockBits (unsigned char data) {
+    int button;
+    for (button = 1; button <= 5; button++)
+      if ((data & g_clockButtonBits[button - 1][0]) == g_clockButtonBits[button - 1][1]) {
+        _debug("Clock button #%d pressed\n", button);
+        return button;
+      }
+    return 0;
 }
 
 /* 
@@ -713,7 +1919,7 @@ void processClockBits (unsigned char data) {
  */
 static void _bwtimeReceived(unsigned char buffer[7])
 {
-  int j;
+  int j, lever;
   
    /* Check if we have a clock ack message */
   if( ((buffer[3]&0x0f) == 0x0a) || ((buffer[6]&0x0f) == 0x0a) )
@@ -722,13 +1928,28 @@ static void _bwtimeReceived(unsigned char buffer[7])
 //    printf("%d\n", extractBit(buffer[3],3));
 //    processClockBits(buffer[2]);
 
-    processClockBits(buffer[5]);
-    processClockBits(buffer[6]);
+    int button = processClockBits(buffer[5]);
+    if (!button)
+      button = processClockBits(buffer[6]);
+    _clockButtonsReported(button);
      //clock ack message
     _debug("clock ACK received\n");
+    _DGTNIX_STAT_ADD(g_stats.clockAcks, 1);
+    if(g_clockSendTime > 0)
+      {
+	_recordLatency(g_stats.ackLatency, &g_stats.ackLatencyTotal, 
+		       _monotonicTime() - g_clockSendTime);
+	g_clockSendTime = 0;
+      }
     pthread_mutex_unlock (&clock_ack_mutex);
+    dgtnixEvent event;
+    memset(&event, 0, sizeof(event));
+    event.type = DGTNIX_EVENT_ACK;
+    _postEvent(&event);
     return;
   }
+  /* No time, the lever was moved */
+  lever = !(buffer[0] | buffer[1] | buffer[2] | buffer[3] | buffer[4] | buffer[5]);
     
   for (j = 0; j < 6; j++)
     buffer[j] = (buffer[ j] >> 4) * 10 + (buffer[ j] & 15); 
@@ -765,35 +1986,39 @@ static void _bwtimeReceived(unsigned char buffer[7])
 	}
     }
   /* If it is pertinent, send a DGTNIX_MSG_TIME to the chess engine */
-  if( g_btime!=-1)
+  if( g_btime!=-1 || lever)
     {
       char code = DGTNIX_MSG_TIME;
-      _sendMessageToEngine(&code, 1);
+      if(g_btime != -1)
+	_sendMessageToEngine(&code, 1);
+      dgtnixEvent event;
+      memset(&event, 0, sizeof(event));
+      event.type = DGTNIX_EVENT_TIME;
+      event.wtime = g_wtime;
+      event.btime = g_btime;
+      event.wturn = g_wturn;
+      if(lever)
+	{
+	  event.flags = DGTNIX_TIME_LEVER;
+	  event.code = buffer[6];
+	}
+      _postEvent(&event);
       if(g_debugMode ==  DGTNIX_DEBUG_WITH_TIME) 
 	_debug("Sending char DGTNIX_MSG_TIME to the engine \n");
     }
 }
 
-/* 
- *  Manage the reception of the FIELD_UPDATE message 
- *  function called only by _readMessageFromBoard()
+/*
+ * Send a DGTNIX_MSG_MV_ADD or DGTNIX_MSG_MV_REMOVE message to the engine
+ * for the square mposition (internal numbering) and the internal piece mpiece 
+ * that was added on it or removed from it.
  */
-static void _fieldUpdateReceived(int mposition, char mpiece)
+static void _sendFieldEventToEngine(int mposition, char mpiece, int remove)
 {
-  /*_debug("_fieldUpdateReceived %d %c %d\n", mposition, mpiece, mpiece); */
-  /* Remove = 1 if the move is a piece removal 
-     else 0 (a piece was added )  */
-  int remove;
-  if(_convertInternalPieceToExternal(mpiece) == ' ')
-    remove = 1;
-  else
-    remove = 0;
   /* Explicit the piece, column and line that are 
-   * concerned by the _DGTNIX_FIELD_UPDATE */
+   * concerned by the event */
   char intern_column;
   char intern_line;
-  char board_column = 'A'+ (mposition % 8); 
-  char board_line = 8 - (mposition / 8);
   
   if (g_boardOrientation == DGTNIX_BOARD_ORIENTATION_CLOCKLEFT)
     {
@@ -810,62 +2035,189 @@ static void _fieldUpdateReceived(int mposition, char mpiece)
       fprintf(stderr, "dgtnix critical, unrecognized board orientation\n");
       exit(-1);
     }
-  char piece;
-  if(remove)
-    piece = _convertInternalPieceToExternal(g_board[mposition]);
-  else
-    piece =_convertInternalPieceToExternal(mpiece);
-  
-  /* A piece was removed from a square */
+  char piece = _convertInternalPieceToExternal(mpiece);
+  /* Send the message code followed by the intern_column,
+   * the intern_line and the piece to the chess engine */ 
+  char message[4];
+  message[0] = remove ? DGTNIX_MSG_MV_REMOVE : DGTNIX_MSG_MV_ADD;
+  message[1] = intern_column;
+  message[2] = intern_line;
+  message[3] = piece;
+  _sendMessageToEngine(message, 4);
+  dgtnixEvent event;
+  memset(&event, 0, sizeof(event));
+  event.type = DGTNIX_EVENT_MOVE;
+  event.code = message[0];
+  event.column = intern_column;
+  event.line = intern_line;
+  event.piece = piece;
+  event.version = dgtnixGetBoardVersion();
+  _postEvent(&event);
+  g_stableDeadline = _monotonicTime() + _DGTNIX_STABLE_DELAY;
   if(remove)
-    _debug("%c removed from %c%d on the board\n",piece, board_column, board_line);
-  /* A piece was added on a square */
+    _debug("Sending DGTNIX_MSG_MV_REMOVE (%c on %c%d) to the engine \n",piece, intern_column, intern_line);
   else
-    _debug("%c added on %c%d on the board\n", piece, board_column, board_line);
+    _debug("Sending DGTNIX_MSG_MV_ADD (%c on %c%d) to the engine \n",piece, intern_column, intern_line);
+}
+
+/* 
+ *  Manage the reception of the FIELD_UPDATE message 
+ *  function called only by _readMessageFromBoard()
+ *
+ *  The board representation is maintained from the field updates alone.
+ *  A full dump is only requested when the update contradicts g_board 
+ *  (a lost update), when g_board fails _boardIsConsistent() or 
+ *  every _DGTNIX_DUMP_INTERVAL seconds.
+ */
+static void _fieldUpdateReceived(int mposition, char mpiece)
+{
+  /*_debug("_fieldUpdateReceived %d %c %d\n", mposition, mpiece, mpiece); */
+  if(mposition < 0 || mposition >= 64 || (unsigned char)mpiece > _DGTNIX_BQUEEN)
+    {
+      _debug("invalid field update %d %d, requesting a board dump\n", mposition, mpiece);
+      _requestBoardDump();
+      return;
+    }
+  /* Remove = 1 if the move is a piece removal 
+     else 0 (a piece was added )  */
+  int remove = (mpiece == _DGTNIX_EMPTY);
+  g_updateArrival = g_messageArrival;
+  char board_column = 'A'+ (mposition % 8); 
+  char board_line = 8 - (mposition / 8);
   
   /* Update the internal representation of the board */
   /* this portion is mutexed to protect the board representation  */
   pthread_mutex_lock( &g_mutex );
+  char previous = g_board[mposition];
+  /* Removing from an empty square or adding onto an occupied one 
+     means that we missed an update */
+  int desync = remove ? (previous == _DGTNIX_EMPTY) : (previous != _DGTNIX_EMPTY);
+  int answered = g_boardUpdated;
   g_board[mposition] = mpiece;
   g_boardUpdated=1;
+  if(!desync && !_boardIsConsistent())
+    desync = 1;
+  _publishBoard();
   pthread_mutex_unlock( &g_mutex );
-  /* End debug details */
-  /* Send the message 'M' followed by the intern_column,
-   * the intern_line and the piece to the chess engine */ 
-  char code;
+  if(!answered)
+    _boardAnswered();
+
+  char piece = _convertInternalPieceToExternal(remove ? previous : mpiece);
+  /* A piece was removed from a square */
   if(remove)
-    code = DGTNIX_MSG_MV_REMOVE;
+    _debug("%c removed from %c%d on the board\n",piece, board_column, board_line);
+  /* A piece was added on a square */
   else
-    code = DGTNIX_MSG_MV_ADD;
-  char message[4];
-  message[0] = code;
-  message[1] = intern_column;
-  message[2] = intern_line;
-  message[3] = piece;
-  _sendMessageToEngine(message, 4);
-  if(remove)
+    _debug("%c added on %c%d on the board\n", piece, board_column, board_line);
+
+  if(desync)
     {
-      _debug("Sending DGTNIX_MSG_MV_REMOVE (%c on %c%d) to the engine \n",piece, intern_column, intern_line);
-      code = DGTNIX_MSG_MV_REMOVE;
+      _DGTNIX_STAT_ADD(g_stats.desyncs, 1);
+      _debug("board representation out of sync, requesting a board dump\n");
+      _requestBoardDump();
     }
-  else
+  else if(_monotonicTime() - g_lastDumpTime > _DGTNIX_DUMP_INTERVAL)
+    _requestBoardDump();
+
+  if(remove && previous == _DGTNIX_EMPTY)
+    /* Nothing to report, the dump will tell what happened */
+    return;
+  if(!remove && previous != _DGTNIX_EMPTY)
+    _sendFieldEventToEngine(mposition, previous, 1);
+  _sendFieldEventToEngine(mposition, remove ? previous : mpiece, remove);
+}
+
+/*
+ *  Manage the reception of the BOARD_DUMP message
+ *  function called only by _readMessageFromBoard()
+ *
+ *  The first dump after dgtnixInit() initialises g_board. 
+ *  Later dumps are diffed against g_board and only the squares 
+ *  that differ generate DGTNIX_MSG_MV_REMOVE / DGTNIX_MSG_MV_ADD messages, 
+ *  so that a dump requested after a lost update looks to the engine 
+ *  like the updates it missed.
+ */
+static void _boardDumpReceived(const unsigned char *dump)
+{
+  char previous[64];
+  int square;
+  pthread_mutex_lock( &g_mutex );
+  uint64_t diff = _diffBoards(g_board, (const char *)dump);
+  memcpy(previous, g_board, 64);
+  for(square = 0; square < 64; square++)
+    if(dump[square] > _DGTNIX_BQUEEN)
+      {
+	pthread_mutex_unlock( &g_mutex );
+	_debug("invalid piece %d in board dump, ignored\n", dump[square]);
+	return;
+      }
+  if(diff)
+    {
+      memcpy(g_board, dump, 64);
+      _publishBoard();
+    }
+  int answered = g_boardUpdated;
+  g_boardUpdated=1;
+  int synced = g_boardSynced;
+  g_boardSynced = 1;
+  pthread_mutex_unlock( &g_mutex );
+  if(!answered)
+    _boardAnswered();
+  g_boardDumpPending = 0;
+  g_lastDumpTime = _monotonicTime();
+
+  if(!synced)
     {
-      _debug("Sending DGTNIX_MSG_MV_ADD (%c on %c%d) to the engine \n",piece, intern_column, intern_line);
-      code = DGTNIX_MSG_MV_ADD;
+      /* The initial position */
+      _postStableEvent();
+      return;
     }
-   fprintf(stderr, "DGT_FEN: "); 
-   printf("DGT_FEN: "); 
-   //fprintf(stderr, getDgtFEN('w'));
-  //fprintf(stderr, "\n");
+  if(!diff)
+    return;
+  _DGTNIX_STAT_ADD(g_stats.resyncs, 1);
+  _debug("board dump differs on %d squares\n", __builtin_popcountll(diff));
+  /* Removals first, so that the engine never sees two pieces on a square */
+  for(square = 0; square < 64; square++)
+    if(((diff >> square) & 1) && previous[square] != _DGTNIX_EMPTY)
+      _sendFieldEventToEngine(square, previous[square], 1);
+  for(square = 0; square < 64; square++)
+    if(((diff >> square) & 1) && dump[square] != _DGTNIX_EMPTY)
+      _sendFieldEventToEngine(square, dump[square], 0);
+  _postStableEvent();
 }
 
 
+/*
+ * Return value of _readMessageFromBoard() after a _boardRead() of n <= 0 : 
+ * -2 when the device is gone (end of file, unplugged tty), -1 for other errors.
+ */
+static int _readError(ssize_t n)
+{
+  if(n == 0)
+    return -2;
+  if(dgtnix_errno == EIO || dgtnix_errno == ENXIO || dgtnix_errno == ENODEV)
+    return -2;
+  return -1;
+}
+
 /*
  * The main read function, called by the _threadManagerFunction when there are chars to be read
  * identify the message on the port, update the intern board representation and reemit a message 
  * to the engine.
+ * Returns -2 when the device is gone.
  */
 static int _readMessageFromBoard()
+{
+  int retval = _readMessage();
+  /* The bytes read, a whole message or those skipped as invalid */
+  _captureEndMessage();
+  return retval;
+}
+
+/* 
+ * Body of _readMessageFromBoard() 
+ */
+static int _readMessage()
 {
   if(g_descriptorDriverBoard<0)
     {
@@ -884,15 +2236,17 @@ static int _readMessageFromBoard()
     g_readBuffer[i] = -10;
   
   /* first character, MESSAGE ID one byte, MSB (MESSAGE BIT) always 1 */
-  if( (charRead = read(g_descriptorDriverBoard, header, 1) ) < 0)
+  if( (charRead = _boardRead(header, 1) ) <= 0)
     {
       dgtnix_errno = errno;
       _debug("read(g_descriptorDriverBoard, header, 1) -1- int readMessageFromBoard(int g_descriptorDriverBoard)\n");
-      return -1;
+      return _readError(charRead);
     }
+  g_messageArrival = _monotonicTime();
   if( !(header[0] & 128) )
     {
       /* Invalid character */
+      _DGTNIX_STAT_ADD(g_stats.invalidBytes, charRead);
       _debug("invalid message -2- int readMessageFromBoard(int g_descriptorDriverBoard) :%c %d\n", header[0], header[0]);
       return -1;
     }
@@ -901,14 +2255,15 @@ static int _readMessageFromBoard()
   /* Second character, MSB of MESSAGE SIZE one byte, 
      MSB always 0, carrying D13 to D7 of the  total message length, 
      including the 3 header byte */
-  if( (charRead = read(g_descriptorDriverBoard, &header[1], 1) ) < 0)
+  if( (charRead = _boardRead(&header[1], 1) ) <= 0)
     {
       dgtnix_errno = errno;
       _debug("read(g_descriptorDriverBoard, header, 1) -3- int readMessageFromBoard(int g_descriptorDriverBoard)\n");
-      return -1;
+      return _readError(charRead);
     }
   if( header[1] & 128 )
     {
+      _DGTNIX_STAT_ADD(g_stats.invalidBytes, 2);
       _debug("invalid message -4- int readMessageFromBoard(int g_descriptorDriverBoard) :%c\n", header[1]);
       return -1;
     }
@@ -916,14 +2271,15 @@ static int _readMessageFromBoard()
   /* Third character, LSB of MESSAGE SIZE one byte, 
      MSB always 0, carrying  D6 to D0 of the total message length, 
      including the 3 header charRead */
-  if( (charRead = read(g_descriptorDriverBoard, &header[2], 1) ) < 0)
+  if( (charRead = _boardRead(&header[2], 1) ) <= 0)
     {
       dgtnix_errno = errno;
       _debug("read(g_descriptorDriverBoard, header, 1) -5- int readMessageFromBoard(int g_descriptorDriverBoard)\n");
-      return -1;
+      return _readError(charRead);
     }
   if( header[2] & 128 )
     {
+      _DGTNIX_STAT_ADD(g_stats.invalidBytes, 3);
       _debug("invalid message -6- int readMessageFromBoard(int g_descriptorDriverBoard) :%c %d\n", header[2], header[2]);
       return -1;
     }
@@ -942,14 +2298,19 @@ static int _readMessageFromBoard()
   int tmp2;
   while(tmp1 < messageLength)
     {
-      if((tmp2 = read(g_descriptorDriverBoard, g_readBuffer + tmp1, messageLength-tmp1 ) )< 0 ) 
+      if((tmp2 = _boardRead(g_readBuffer + tmp1, messageLength-tmp1 ) )<= 0 ) 
 	{
 	  dgtnix_errno=errno;
 	  _debug("read(g_descriptorDriverBoard, buffer + tmp, messageLength ) -7- int readMessageFromBoard(int g_descriptorDriverBoard)\n");
-	  return -1;
+	  return _readError(tmp2);
 	}
       tmp1 += tmp2; 
     }
+  if(commandID < DGTNIX_STATS_COMMANDS)
+    {
+      _DGTNIX_STAT_ADD(g_stats.frames[commandID], 1);
+      _DGTNIX_STAT_ADD(g_stats.frameBytes[commandID], messageLength + 3);
+    }
   switch (commandID) 
     {
     case _DGTNIX_NONE:
@@ -957,16 +2318,9 @@ static int _readMessageFromBoard()
       break;
     case _DGTNIX_BOARD_DUMP:
       _debug("Received _DGTNIX_BOARD_DUMP from the board\n");
-      pthread_mutex_lock( &g_mutex );
-      for (j = 0; j < 64; j++)
-      {
-          g_board[j] = g_readBuffer[j];
-
-      }
-      pthread_mutex_unlock( &g_mutex );
+      _boardDumpReceived(g_readBuffer);
       if(! (g_debugMode  ==  DGTNIX_DEBUG_OFF) )
           _dumpBoard(g_board);
-      g_boardUpdated=1;
       break;
     case _DGTNIX_BWTIME:
       if(g_debugMode  ==  DGTNIX_DEBUG_WITH_TIME)
@@ -1043,29 +2397,30 @@ static void _assertDriverInitialised(const char *message)
  * Do all the low level
  * stuff to access the RS232 port
  * or the virtual COM port by ftdi
- * If executed with sucess, 
- * g_descriptorDriverBoard contain the descriptor of the port.
+ * flags are added to those of open(), O_NONBLOCK does not wait for
+ * the connection of a Bluetooth port.
+ * Returns the descriptor of the port, or -1.
  */
-static int _setTTY(const char *port)
+static int _openTTY(const char *port, int flags)
 {
   /* Open the tty for read/write */
   struct termios trm;
-  int set, retval;
-  g_descriptorDriverBoard = open(port, O_RDWR | O_NOCTTY );
-  if (g_descriptorDriverBoard < 0) 
+  int set, retval, fd;
+  fd = open(port, O_RDWR | O_NOCTTY | flags);
+  if (fd < 0) 
     {
       dgtnix_errno = errno;
       /* keep msg to client app */
-      _debug("unable to open tty (open(%s) returns %d) in function setTTY\n", port, g_descriptorDriverBoard);
+      _debug("unable to open tty (open(%s) returns %d) in function openTTY\n", port, fd);
       return -1;
     }
-  ioctl(g_descriptorDriverBoard, TIOCMGET, &set);
+  ioctl(fd, TIOCMGET, &set);
   /* DTR high */
   set |= TIOCM_DTR;    
-  ioctl(g_descriptorDriverBoard, TIOCMSET, &set);
+  ioctl(fd, TIOCMSET, &set);
   /* flush buffers */
-  tcflush(g_descriptorDriverBoard, TCIOFLUSH);    
-  retval = tcgetattr(g_descriptorDriverBoard, &trm);
+  tcflush(fd, TCIOFLUSH);    
+  retval = tcgetattr(fd, &trm);
   /* input speed 9600 bds */
   cfsetispeed(&trm, B9600);      
   /* output speed 9600 bds */
@@ -1078,27 +2433,28 @@ static int _setTTY(const char *port)
   trm.c_cflag &= ~(CSIZE|PARENB);
   trm.c_cflag |= CS8; 
   /* end cfmakeraw  */
-  if((retval=tcsetattr(g_descriptorDriverBoard, TCSANOW, &trm))<0)
+  if((retval=tcsetattr(fd, TCSANOW, &trm))<0)
     {
       dgtnix_errno = errno;
-      _debug("unable to set attributes for tty (tcsetattr(%s,...) return %d):setTTY\n", port, retval);
+      _debug("unable to set attributes for tty (tcsetattr(%s,...) return %d):openTTY\n", port, retval);
       /* keep msg to client app */
-      _closeDescriptor(&g_descriptorDriverBoard);
+      close(fd);
       return -1;
     }
-  tcflush(g_descriptorDriverBoard, TCIOFLUSH); 
-  return g_descriptorDriverBoard;
+  tcflush(fd, TCIOFLUSH); 
+  return fd;
 }
 
 /*S_ISCHR(m)*/
 
 
-/*set a AF_UNIX socket as the fake board
+/*open a AF_UNIX socket as the fake board
  */
-static int _setUnixSocket(const char *port)
+static int _openUnixSocket(const char *port)
 {
-  if ((g_descriptorDriverBoard = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
-    perror("dgtnix critical: _setFakeTTY:");
+  int fd;
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    perror("dgtnix critical: _openUnixSocket:");
     exit(-1);
   }
   
@@ -1106,14 +2462,37 @@ static int _setUnixSocket(const char *port)
   servaddr.sun_family = AF_UNIX;
   strcpy(servaddr.sun_path, port);
   
-  if (connect(g_descriptorDriverBoard, (struct sockaddr *) &servaddr, sizeof( struct  sockaddr_un)) < 0) {
+  if (connect(fd, (struct sockaddr *) &servaddr, sizeof( struct  sockaddr_un)) < 0) {
     dgtnix_errno = errno;
-    close(g_descriptorDriverBoard);
-    g_descriptorDriverBoard=-1;
+    close(fd);
     _debug("Unable to connect socket for virtual board\n");
     return -1;
   }  
-  return g_descriptorDriverBoard;
+  return fd;
+}
+
+/*
+ * Open port, a tty or the AF_UNIX socket of a virtual board.
+ * *mode is set to _DGTNIX_REAL_BOARD or _DGTNIX_VIRTUAL_BOARD,
+ * flags are passed to the open() of a tty.
+ * Returns the descriptor, or -1.
+ */
+static int _openPort(const char *port, char *mode, int flags)
+{
+  struct stat stats;
+  if(stat(port, &stats)<0)
+    {
+      dgtnix_errno = errno;
+      _debug("fstab < 0 for port %s\n", port);
+      return -1;
+    }
+  if( S_ISCHR(stats.st_mode) )
+    {
+      *mode = _DGTNIX_REAL_BOARD;
+      return _openTTY(port, flags);
+    }
+  *mode = _DGTNIX_VIRTUAL_BOARD;
+  return _openUnixSocket(port);
 }
 
 /* Close the three opened descriptors
@@ -1142,6 +2521,9 @@ static int _closeAllDescriptors()
       _debug("close g_descriptorDriverBoard - int dgtnixWriteCOMPort (int port)\n");
       retval = -1;
     }
+  /* the driver thread was cancelled while waiting for the device */
+  if(g_inotifyDescriptor >= 0)
+    _closeDescriptor(&g_inotifyDescriptor);
   return retval;
 }
 
@@ -1185,6 +2567,7 @@ static void _setBoardOrientation(unsigned int orientation)
       fprintf(stderr, "dgtnix critical, unrecognized board orientation\n");
       exit(-1);
     }
+  _publishBoard();
   pthread_mutex_unlock( &g_mutex );
 }
 
@@ -1237,9 +2620,23 @@ const char *dgtnixToPrintableBoard(const char *board)
   return dumped_board;
 }
 
+/*
+ * Release the threads blocked in dgtnixWaitEvents() once the driver 
+ * is closed or its thread gave up, they return -1.
+ */
+static void _wakeEventWaiters()
+{
+  pthread_once(&g_eventOnce, _initEvents);
+  pthread_mutex_lock(&g_eventMutex);
+  pthread_cond_broadcast(&g_eventCond);
+  pthread_mutex_unlock(&g_eventMutex);
+}
+
 int dgtnixClose()
 {
-  _assertDriverInitialised("dgtnixClose");
+  /* A driver thread that gave up on the board is joined all the same */
+  if(!g_driverThreadStarted)
+    _assertDriverInitialised("dgtnixClose");
   void *status;
   int rc;
   /* Kill Previous thread if exists */
@@ -1248,40 +2645,191 @@ int dgtnixClose()
   rc = pthread_join(g_driverThread, &status);
   if (rc) 
     _debug("dgtnixClose() return code from pthread_join() is %d\n", rc);
+  g_driverThreadStarted=0;
   
   _closeAllDescriptors();
   g_initialised=0;
+  if(g_virtualBoardMode == _DGTNIX_REPLAY_BOARD)
+    {
+      g_replayStop = 1;
+      pthread_join(g_replayThread, NULL);
+      _closeDescriptor(&g_replayFeedSide);
+      fclose(g_replayFile);
+      g_replayFile = NULL;
+      g_virtualBoardMode = _DGTNIX_REAL_BOARD;
+    }
+  _wakeEventWaiters();
   _debug("the driver is closed\n");
+  _flushLog();
   return 1;
 }
 
 int dgtnixInit(const char *port)
 {
+  int attempt, retval = -2;
   if(g_initialised != 0)
     _debug("Close driver first\n");
-  int i;
-  struct stat stats;
-  if(stat(port, &stats)<0)
+  for(attempt = 0; attempt < _DGTNIX_INIT_ATTEMPTS && retval == -2; attempt++)
     {
-      dgtnix_errno = errno;
-      _debug("fstab < 0 for port %s\n", port);
-      return -1;
+      if(attempt)
+	_mySleep(_DGTNIX_INIT_RETRY_DELAY);
+      retval = _initPort(port);
     }
-  if( S_ISCHR(stats.st_mode) )
+  return retval;
+}
+
+/*
+ * One attempt of dgtnixInit()
+ */
+static int _initPort(const char *port)
+{
+  char mode;
+  int fd = -1;
+  /* The port dgtnixProbe() found is already open and connected */
+  if(g_probedDescriptor >= 0 && strcmp(port, g_probedPort) == 0)
     {
-      _debug("opening driver in normal mode\n");
-      g_virtualBoardMode = _DGTNIX_REAL_BOARD;
-      if( _setTTY(port) < 0)
-	return -1;
+      fd = g_probedDescriptor;
+      mode = g_probedMode;
+      g_probedDescriptor = -1;
     }
   else
     {
-      _debug("opening driver in virtual mode\n");
-      g_virtualBoardMode = _DGTNIX_VIRTUAL_BOARD;
-      if( _setUnixSocket(port) < 0)
-	return -1;
+      if(g_probedDescriptor >= 0)
+	_closeDescriptor(&g_probedDescriptor);
+      fd = _openPort(port, &mode, 0);
     }
-  
+  if(fd < 0)
+    return -1;
+  _debug(mode == _DGTNIX_REAL_BOARD ? "opening driver in normal mode\n" : "opening driver in virtual mode\n");
+  g_virtualBoardMode = mode;
+  g_descriptorDriverBoard = fd;
+  snprintf(g_port, sizeof(g_port), "%s", port);
+  return _initDriver(port);
+}
+
+/*
+ * Frame state machine of dgtnixProbe(), received is the number of bytes
+ * of a board dump frame received so far, returns the new number.
+ * A frame is complete at _DGTNIX_SIZE_BOARD_DUMP.
+ */
+static int _probeByte(int received, unsigned char byte)
+{
+  switch(received)
+    {
+    case 0:
+      break;
+    case 1:
+      /* size msb */
+      if(byte == 0)
+	return 2;
+      break;
+    case 2:
+      /* size lsb */
+      if(byte == _DGTNIX_SIZE_BOARD_DUMP)
+	return 3;
+      break;
+    default:
+      if(byte <= _DGTNIX_BQUEEN)
+	return received + 1;
+      break;
+    }
+  /* Out of the frame, resync on the next header */
+  return byte == _DGTNIX_MSG_BOARD_DUMP ? 1 : 0;
+}
+
+int dgtnixProbe(const char *const *ports, int count, int timeout)
+{
+  struct pollfd pfds[DGTNIX_PROBE_MAX];
+  int received[DGTNIX_PROBE_MAX];
+  int index[DGTNIX_PROBE_MAX];
+  char modes[DGTNIX_PROBE_MAX];
+  unsigned char request[2] = { _DGTNIX_SEND_RESET, _DGTNIX_SEND_BRD };
+  unsigned char buffer[256];
+  int i, j, opened = 0, found = -1;
+  char mode;
+  double deadline = _systemNow(NULL) + timeout / 1000.;
+
+  if(count > DGTNIX_PROBE_MAX)
+    {
+      _debug("dgtnixProbe() probes the first %d ports only\n", DGTNIX_PROBE_MAX);
+      count = DGTNIX_PROBE_MAX;
+    }
+  /* The board of an earlier probe that was not opened */
+  if(g_probedDescriptor >= 0)
+    _closeDescriptor(&g_probedDescriptor);
+  /* Ask every port for a board dump at once, a Bluetooth port that is still
+     connecting does not hold the others back */
+  for(i = 0; i < count; i++)
+    {
+      int fd = _openPort(ports[i], &mode, O_NONBLOCK);
+      if(fd < 0)
+	continue;
+      if(write(fd, request, sizeof(request)) != sizeof(request))
+	{
+	  _debug("unable to send the probe request to %s\n", ports[i]);
+	  close(fd);
+	  continue;
+	}
+      pfds[opened].fd = fd;
+      pfds[opened].events = POLLIN;
+      received[opened] = 0;
+      index[opened] = i;
+      modes[opened] = mode;
+      opened++;
+    }
+  /* The first complete frame wins */
+  while(opened && found < 0)
+    {
+      double left = deadline - _systemNow(NULL);
+      if(left <= 0.)
+	break;
+      if(poll(pfds, opened, (int)(left * 1000.) + 1) < 0)
+	{
+	  if(errno == EINTR)
+	    continue;
+	  dgtnix_errno = errno;
+	  break;
+	}
+      for(i = 0; i < opened && found < 0; i++)
+	{
+	  if(!pfds[i].revents || pfds[i].fd < 0)
+	    continue;
+	  ssize_t size = read(pfds[i].fd, buffer, sizeof(buffer));
+	  if(size <= 0)
+	    {
+	      /* Gone, poll() ignores negative descriptors */
+	      close(pfds[i].fd);
+	      pfds[i].fd = -1;
+	      continue;
+	    }
+	  for(j = 0; j < size; j++)
+	    if((received[i] = _probeByte(received[i], buffer[j])) == _DGTNIX_SIZE_BOARD_DUMP)
+	      {
+		found = index[i];
+		_debug("board dump received from %s\n", ports[found]);
+		/* dgtnixInit() of this port goes on with the connection */
+		fcntl(pfds[i].fd, F_SETFL, fcntl(pfds[i].fd, F_GETFL) & ~O_NONBLOCK);
+		g_probedDescriptor = pfds[i].fd;
+		g_probedMode = modes[i];
+		snprintf(g_probedPort, sizeof(g_probedPort), "%s", ports[found]);
+		pfds[i].fd = -1;
+		break;
+	      }
+	}
+    }
+  for(i = 0; i < opened; i++)
+    if(pfds[i].fd >= 0)
+      close(pfds[i].fd);
+  return found;
+}
+
+/*
+ * End of dgtnixInit() and dgtnixInitReplay(), once g_descriptorDriverBoard is open :
+ * resets the driver state, starts the driver thread and waits for the first board dump.
+ */
+static int _initDriver(const char *port)
+{
+  int i;
   /* do some initialisation stuff 
    *
    * ...
@@ -1290,16 +2838,28 @@ int dgtnixInit(const char *port)
   g_versionBuffer[0]='\0';
   g_busadressBuffer[0]='\0';
   g_trademarkBuffer[0]='\0';
+  pthread_mutex_lock( &g_mutex );
   for(i=0;i<64;i++)
-    {
-      g_board[i] = _DGTNIX_EMPTY;
-      g_transmitedBoard[i]= ' ';
-    }
+    g_board[i] = _DGTNIX_EMPTY;
+  _publishBoard();
+  pthread_mutex_unlock( &g_mutex );
   g_versionFlag=0;
   g_serialFlag=0;
   g_trademarkFlag=0;
   g_busadressFlag=0;
   g_boardUpdated=0;
+  g_boardSynced=0;
+  g_stableDeadline=0;
+  g_buttonHeld=0;
+  g_longPressDeadline=0;
+  pthread_mutex_lock(&g_eventMutex);
+  g_eventHead=0;
+  g_eventCount=0;
+  g_buttonQueueHead=0;
+  g_buttonQueueCount=0;
+  pthread_mutex_unlock(&g_eventMutex);
+  g_boardDumpPending=1;
+  g_lastDumpTime=_monotonicTime();
   g_btime=-1;
   g_wtime=-1;
   g_wturn=-1;
@@ -1333,21 +2893,14 @@ int dgtnixInit(const char *port)
       _debug("pthread_create:void dgtnixInit(const char *port)\n");
       return -1;
     }
-  double timeout = 5;
- 
-  while(g_boardUpdated != 1 &&  timeout > 0.)
-    {
-      _mySleep(0.05);
-      timeout -= 0.05;
-    }
-  if(g_boardUpdated != 1)
+  g_driverThreadStarted=1;
+  /* Done as soon as the board dump or a field update comes in */
+  if(!_waitBoardAnswer(_DGTNIX_INIT_TIMEOUT))
     /* The answer of the device is incorrect, it's not a dgt board */
     {
       _debug("%s does not respond to the init query.\n" ,port);
       dgtnixClose();
-      sleep(3);
-      return dgtnixInit(port);
-      //return -2;
+      return -2;
     }
   _debug("Board initialised\n");
   return g_pipeEngineReadSide;
@@ -1408,7 +2961,7 @@ const char *
      FEN[pos++] = ' ';
      FEN[pos++] = '1';
 
-     FEN[pos] = '0';
+     FEN[pos] = '\0';
 
      return FEN; 
    }
@@ -1425,57 +2978,153 @@ const char *
         return getDgtFEN('b');
     }
 
-int dgtnixTestBoard(const char *board)
+int dgtnixInitReplay(const char *capture, double speed)
 {
-  _assertDriverInitialised("dgtnixTestBoard");
-  int i;
-  pthread_mutex_lock( &g_mutex );
-  for(i=0; i<64; i++)
-    { 
-      if(g_boardOrientation == DGTNIX_BOARD_ORIENTATION_CLOCKLEFT)
-	{
-	  if(board[i] != _convertInternalPieceToExternal(g_board[i]))
-	    {
-	      pthread_mutex_unlock( &g_mutex );
-	      return 0;
-	    }
-	}
-      else
+  char magic[_DGTNIX_CAPTURE_MAGIC_SIZE];
+  int sv[2];
+  if(g_initialised != 0)
+    _debug("Close driver first\n");
+  if((g_replayFile = fopen(capture, "rb")) == NULL)
+    {
+      dgtnix_errno = errno;
+      _debug("cannot open the capture %s\n", capture);
+      return -1;
+    }
+  if(fread(magic, 1, sizeof(magic), g_replayFile) != sizeof(magic)
+     || memcmp(magic, _DGTNIX_CAPTURE_MAGIC, sizeof(magic)))
+    {
+      _debug("%s is not a dgtnix capture\n", capture);
+      fclose(g_replayFile);
+      g_replayFile = NULL;
+      return -1;
+    }
+  /* The driver reads the capture on one side of the pair as if it was the board */
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+      dgtnix_errno = errno;
+      _debug("socketpair:int dgtnixInitReplay(const char *capture, double speed)\n");
+      fclose(g_replayFile);
+      g_replayFile = NULL;
+      return -1;
+    }
+  g_descriptorDriverBoard = sv[0];
+  g_replayFeedSide = sv[1];
+  g_replaySpeed = speed;
+  g_replayStop = 0;
+  g_replayDone = 0;
+  g_replayBytes = 0;
+  g_virtualBoardMode = _DGTNIX_REPLAY_BOARD;
+  _debug("replaying %s\n", capture);
+  if(pthread_create(&g_replayThread, NULL, _replayFeeder, NULL) != 0)
+    {
+      _debug("pthread_create:int dgtnixInitReplay(const char *capture, double speed)\n");
+      _closeDescriptor(&g_descriptorDriverBoard);
+      _closeDescriptor(&g_replayFeedSide);
+      fclose(g_replayFile);
+      g_replayFile = NULL;
+      g_virtualBoardMode = _DGTNIX_REAL_BOARD;
+      return -1;
+    }
+  return _initDriver(capture);
+}
+
+long dgtnixWaitReplay(int timeout)
+{
+  _assertDriverInitialised("dgtnixWaitReplay");
+  int done;
+  struct timeval now;
+  struct timespec ts;
+  if(g_virtualBoardMode != _DGTNIX_REPLAY_BOARD)
+    return -1;
+  gettimeofday(&now, NULL);
+  ts.tv_sec = now.tv_sec + timeout / 1000;
+  ts.tv_nsec = now.tv_usec * 1000 + (timeout % 1000) * 1000000L;
+  if(ts.tv_nsec >= 1000000000L)
+    {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
+    }
+  pthread_mutex_lock(&g_replayMutex);
+  while(!g_replayDone)
+    {
+      if(timeout < 0)
+	pthread_cond_wait(&g_replayCond, &g_replayMutex);
+      else if(pthread_cond_timedwait(&g_replayCond, &g_replayMutex, &ts) == ETIMEDOUT)
+	break;
+    }
+  done = g_replayDone;
+  pthread_mutex_unlock(&g_replayMutex);
+  return done ? (long)g_replayBytes : -1;
+}
+
+int dgtnixStartCapture(const char *path)
+{
+  FILE *file = fopen(path, "wb");
+  if(!file)
+    {
+      dgtnix_errno = errno;
+      _debug("cannot create the capture %s\n", path);
+      return -1;
+    }
+  fwrite(_DGTNIX_CAPTURE_MAGIC, 1, _DGTNIX_CAPTURE_MAGIC_SIZE, file);
+  dgtnixStopCapture();
+  pthread_mutex_lock(&g_captureMutex);
+  g_captureFile = file;
+  g_captureFlushed = _monotonicTime();
+  pthread_mutex_unlock(&g_captureMutex);
+  _debug("capturing the board traffic into %s\n", path);
+  return 0;
+}
+
+void dgtnixStopCapture()
+{
+  pthread_mutex_lock(&g_captureMutex);
+  if(g_captureFile)
+    {
+      if(fflush(g_captureFile) != 0)
 	{
-	  if(board[i] != _convertInternalPieceToExternal(g_board[63-i]))
-	    {
-	      pthread_mutex_unlock( &g_mutex );
-	      return 0;
-	    }
+	  dgtnix_errno = errno;
+	  _debug("cannot flush the capture\n");
 	}
+      fclose(g_captureFile);
+      g_captureFile = NULL;
     }
-  pthread_mutex_unlock( &g_mutex );
-  return 1;
+  pthread_mutex_unlock(&g_captureMutex);
+}
+
+int dgtnixTestBoard(const char *board)
+{
+  _assertDriverInitialised("dgtnixTestBoard");
+  char snapshot[64];
+  _readSnapshot(snapshot);
+  return memcmp(board, snapshot, 64) == 0;
 }
 
 const char *dgtnixGetBoard(bool update)
 {
-  int i;
   _assertDriverInitialised("dgtnixGetBoard");
-  pthread_mutex_lock( &g_mutex );
-  if (update) {
-      g_boardUpdated = 1;
-  }
-  if(g_boardUpdated)
-    {
-      for(i=0; i<64;i++)
-        {
-	  if(g_boardOrientation == DGTNIX_BOARD_ORIENTATION_CLOCKLEFT)
-	    g_transmitedBoard[i] = _convertInternalPieceToExternal(g_board[i]);
-	  else
-	    g_transmitedBoard[i] = _convertInternalPieceToExternal(g_board[63-i]);
-        }
-      g_boardUpdated=0; 
-    }
-  pthread_mutex_unlock( &g_mutex );
+  /* The snapshot is always up to date, update is kept for compatibility */
+  (void)update;
+  _readSnapshot(g_transmitedBoard);
   return g_transmitedBoard;
 }
 
+unsigned long dgtnixCopyBoard(char *board)
+{
+  _assertDriverInitialised("dgtnixCopyBoard");
+  return _readSnapshot(board);
+}
+
+unsigned long dgtnixGetBoardVersion()
+{
+  return __atomic_load_n(&g_snapshotSequence, __ATOMIC_ACQUIRE) >> 1;
+}
+
+int dgtnixBoardChangedSince(unsigned long version)
+{
+  return dgtnixGetBoardVersion() != version;
+}
+
 const char *dgtnixQueryString(unsigned int flag)
 {
   static const char *undefinedFlagString = "dgtnixQueryString error, wrong argument";
@@ -1519,3 +3168,163 @@ int dgtnixGetClockData(int *pwhite_time, int *pblack_time, int *pwhite_turn)
   return 1;
 }
 
+void dgtnixSubscribeEvents(unsigned int mask)
+{
+  pthread_mutex_lock(&g_eventMutex);
+  g_eventSubscription = mask & DGTNIX_EVENT_ALL;
+  pthread_mutex_unlock(&g_eventMutex);
+}
+
+int dgtnixWaitEvents(unsigned int mask, int timeout, dgtnixEvent *events, int max)
+{
+  /* Closed, or the driver thread gave up on the board */
+  if(!dgtnixIsInitialised())
+    return -1;
+  int i, bit, found = 0, kept = 0, count;
+  /* g_eventCond waits on the system clock */
+  double deadline = _systemNow(NULL) + timeout / 1000.;
+  struct timespec ts;
+  ts.tv_sec = (time_t)deadline;
+  ts.tv_nsec = (long)((deadline - ts.tv_sec) * 1e9);
+
+  pthread_once(&g_eventOnce, _initEvents);
+  pthread_mutex_lock(&g_eventMutex);
+  /* The classes that are not subscribed are only queued while they are waited for */
+  for(bit = 0; bit < 8; bit++)
+    if(mask & (1 << bit))
+      g_eventWaiters[bit]++;
+  while(g_initialised)
+    {
+      for(i = 0; i < g_eventCount; i++)
+	if(g_events[(g_eventHead + i) % _DGTNIX_EVENT_QUEUE_SIZE].type & mask)
+	  break;
+      if(i < g_eventCount || timeout == 0)
+	break;
+      if(timeout < 0)
+	pthread_cond_wait(&g_eventCond, &g_eventMutex);
+      else if(pthread_cond_timedwait(&g_eventCond, &g_eventMutex, &ts) == ETIMEDOUT)
+	break;
+    }
+  for(bit = 0; bit < 8; bit++)
+    if(mask & (1 << bit))
+      g_eventWaiters[bit]--;
+  /* Take the whole batch of matching events, keep the others in order */
+  count = g_eventCount;
+  for(i = 0; i < count; i++)
+    {
+      dgtnixEvent *event = &g_events[(g_eventHead + i) % _DGTNIX_EVENT_QUEUE_SIZE];
+      if((event->type & mask) && found < max)
+	events[found++] = *event;
+      else
+	g_events[(g_eventHead + kept++) % _DGTNIX_EVENT_QUEUE_SIZE] = *event;
+    }
+  g_eventCount = kept;
+  pthread_mutex_unlock(&g_eventMutex);
+  return found || dgtnixIsInitialised() ? found : -1;
+}
+
+int dgtnixIsInitialised()
+{
+  return __atomic_load_n(&g_initialised, __ATOMIC_ACQUIRE) == 1;
+}
+
+void dgtnixGetStats(dgtnixStats *stats, int reset)
+{
+  unsigned long *from = (unsigned long *)&g_stats;
+  unsigned long *to = (unsigned long *)stats;
+  size_t i;
+  for(i = 0; i < sizeof(dgtnixStats) / sizeof(unsigned long); i++)
+    to[i] = reset ? __atomic_exchange_n(&from[i], 0, __ATOMIC_RELAXED)
+      : __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+}
+
+/* Appends a histogram of DGTNIX_STATS_BUCKETS buckets to the text of dgtnixFormatStats() */
+static int _formatHistogram(char *buffer, int size, const char *name, 
+			    const unsigned long *histogram, unsigned long total)
+{
+  int i, length = 0;
+  unsigned long count = 0;
+  for(i = 0; i < DGTNIX_STATS_BUCKETS && length >= 0 && length < size; i++)
+    {
+      count += histogram[i];
+      if(i < DGTNIX_STATS_BUCKETS - 1)
+	length += snprintf(buffer + length, size - length, "%s_bucket{le=\"%g\"} %lu\n",
+			   name, (double)(1UL << i) * 1e-6, count);
+      else
+	length += snprintf(buffer + length, size - length, "%s_bucket{le=\"+Inf\"} %lu\n",
+			   name, count);
+    }
+  if(length >= 0 && length < size)
+    length += snprintf(buffer + length, size - length, "%s_sum %g\n%s_count %lu\n",
+		       name, total * 1e-6, name, count);
+  return length;
+}
+
+int dgtnixFormatStats(const dgtnixStats *stats, char *buffer, int size)
+{
+  int i, length;
+  length = snprintf(buffer, size,
+		    "dgtnix_read_calls_total %lu\n"
+		    "dgtnix_read_bytes_total %lu\n"
+		    "dgtnix_write_calls_total %lu\n"
+		    "dgtnix_write_bytes_total %lu\n"
+		    "dgtnix_invalid_bytes_total %lu\n"
+		    "dgtnix_desyncs_total %lu\n"
+		    "dgtnix_dump_requests_total %lu\n"
+		    "dgtnix_resyncs_total %lu\n"
+		    "dgtnix_clock_messages_total %lu\n"
+		    "dgtnix_clock_retries_total %lu\n"
+		    "dgtnix_clock_acks_total %lu\n"
+		    "dgtnix_pipe_stalls_total %lu\n"
+		    "dgtnix_events_dropped_total %lu\n"
+		    "dgtnix_disconnects_total %lu\n"
+		    "dgtnix_reconnects_total %lu\n",
+		    stats->readCalls, stats->readBytes, stats->writeCalls, stats->writeBytes,
+		    stats->invalidBytes, stats->desyncs, stats->dumpRequests, stats->resyncs,
+		    stats->clockMessages, stats->clockRetries, stats->clockAcks,
+		    stats->pipeStalls, stats->eventsDropped,
+		    stats->disconnects, stats->reconnects);
+  /* Only the commands the board sent */
+  for(i = 0; i < DGTNIX_STATS_COMMANDS && length >= 0 && length < size; i++)
+    if(stats->frames[i])
+      length += snprintf(buffer + length, size - length, 
+			 "dgtnix_frames_total{command=\"0x%02x\"} %lu\n"
+			 "dgtnix_frame_bytes_total{command=\"0x%02x\"} %lu\n",
+			 i, stats->frames[i], i, stats->frameBytes[i]);
+  if(length >= 0 && length < size)
+    length += _formatHistogram(buffer + length, size - length, "dgtnix_publish_latency_seconds",
+			       stats->publishLatency, stats->publishLatencyTotal);
+  if(length >= 0 && length < size)
+    length += _formatHistogram(buffer + length, size - length, "dgtnix_ack_latency_seconds",
+			       stats->ackLatency, stats->ackLatencyTotal);
+  if(length < 0 || length >= size)
+    return -1;
+  return length;
+}
+
+void dgtnixSetClock(const dgtnixClock *clock)
+{
+  if(clock)
+    g_clock = *clock;
+  else
+    {
+      g_clock.now = _systemNow;
+      g_clock.sleep = _systemSleep;
+      g_clock.context = NULL;
+    }
+}
+
+void dgtnixSetSimulatedClock(double speed)
+{
+  dgtnixClock clock = { _simulatedNow, _simulatedSleep, NULL };
+  g_simulatedSpeed = speed > 0 ? speed : 0;
+  g_simulatedStart = _systemNow(NULL);
+  g_simulatedOrigin = g_simulatedStart;
+  __atomic_store_n(&g_simulatedAdvance, 0, __ATOMIC_RELEASE);
+  dgtnixSetClock(&clock);
+}
+
+double dgtnixClockNow()
+{
+  return _monotonicTime();
+}
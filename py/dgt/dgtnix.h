@@ -83,11 +83,29 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
   int dgtnixInit(const char *);
   int dgtnixClose();
   const char *dgtnixGetBoard();
+  unsigned long dgtnixCopyBoard(char *);
+  unsigned long dgtnixGetBoardVersion();
+  int dgtnixBoardChangedSince(unsigned long);
   const char *dgtnixToPrintableBoard(const char *);
   int dgtnixTestBoard(const char *);
+  void dgtnixSubscribeEvents(unsigned int);
+  int dgtnixWaitEvents(unsigned int, int, dgtnixEvent *, int);
+  int dgtnixIsInitialised();
+  int dgtnixEventFd(unsigned int);
   const char *dgtnixQueryString(unsigned int);
   int dgtnixGetClockData(int *, int *, int *);
   void dgtnixSetOption(unsigned long, unsigned int);
+  int dgtnixStartCapture(const char *);
+  void dgtnixStopCapture();
+  int dgtnixInitReplay(const char *, double);
+  long dgtnixWaitReplay(int);
+  void dgtnixGetStats(dgtnixStats *, int);
+  int dgtnixFormatStats(const dgtnixStats *, char *, int);
+  void dgtnixSetClock(const dgtnixClock *);
+  void dgtnixSetSimulatedClock(double);
+  double dgtnixClockNow();
+  int dgtnixProbe(const char *const *, int, int);
+  int dgtnixSendMessageToClock(const char *, unsigned char, unsigned char, int);
 */
 
 #ifndef __DGTNIX_H
@@ -127,6 +145,41 @@ extern "C" {
 
 #define DGTNIX_DRIVER_VERSION 0x1F04
 
+  /* event classes for dgtnixWaitEvents and dgtnixSubscribeEvents */
+  /* a piece was added or removed (code is DGTNIX_MSG_MV_ADD or DGTNIX_MSG_MV_REMOVE) */
+#define DGTNIX_EVENT_MOVE 0x01
+  /* the board did not change for a short while after moves, or a board dump was received */
+#define DGTNIX_EVENT_STABLE 0x02
+  /* a clock button changed state (code is the button number, flags tells how) */
+#define DGTNIX_EVENT_BUTTON 0x04
+  /* the clock sent its times (wtime, btime, wturn), or its lever state (flags) */
+#define DGTNIX_EVENT_TIME 0x08
+  /* the clock acknowledged a message */
+#define DGTNIX_EVENT_ACK 0x10
+  /* the device went away or came back (flags tells which) */
+#define DGTNIX_EVENT_CONNECTION 0x20
+#define DGTNIX_EVENT_ALL 0x3F
+
+  /* flags of the DGTNIX_EVENT_BUTTON events */
+  /* the button was pressed */
+#define DGTNIX_BUTTON_PRESSED 0x01
+  /* the button was released, pressTime tells when it was pressed */
+#define DGTNIX_BUTTON_RELEASED 0x02
+  /* the button is (or was, with DGTNIX_BUTTON_RELEASED) held for more than a second */
+#define DGTNIX_BUTTON_LONG 0x04
+  /* a second button was pressed while the first was held, buttons holds both */
+#define DGTNIX_BUTTON_CHORD 0x08
+
+  /* flags of the DGTNIX_EVENT_TIME events */
+  /* the message holds no time but the lever state, code is its last byte */
+#define DGTNIX_TIME_LEVER 0x01
+
+  /* flags of the DGTNIX_EVENT_CONNECTION events */
+  /* the device is gone, the driver waits for it */
+#define DGTNIX_CONNECTION_LOST 0x01
+  /* the device was reopened, the moves made meanwhile follow */
+#define DGTNIX_CONNECTION_RESTORED 0x02
+
   
   /* options of dgtnixInit */
 #define DGTNIX_BOARD_ORIENTATION 0x01
@@ -147,6 +200,96 @@ extern "C" {
 #define DGTNIX_LEFT_SEMICOLON 0x10
 #define DGTNIX_LEFT_1 0x20
   
+  /* An event returned by dgtnixWaitEvents() */
+  typedef struct dgtnixEvent
+  {
+    /* one of the DGTNIX_EVENT_... classes */
+    int type;
+    /* DGTNIX_MSG_MV_ADD or DGTNIX_MSG_MV_REMOVE for moves, button number for buttons, 
+       lever state for DGTNIX_TIME_LEVER */
+    int code;
+    /* square and piece for moves, as in the DGTNIX_MSG_MV_ADD messages */
+    char column;
+    char line;
+    char piece;
+    /* clock data for DGTNIX_EVENT_TIME, as in dgtnixGetClockData() */
+    int wtime;
+    int btime;
+    int wturn;
+    /* board version after a move or of a stable position */
+    unsigned long version;
+    /* monotonic time of the event, in seconds */
+    double timestamp;
+    /* DGTNIX_BUTTON_... flags for buttons, DGTNIX_TIME_... for times, 
+       DGTNIX_CONNECTION_... for connections */
+    int flags;
+    /* mask of the buttons concerned (1 << button number) */
+    int buttons;
+    /* monotonic time the button was pressed, in seconds */
+    double pressTime;
+    /* monotonic time the first byte of the board message behind the event was read, 
+       for a stable position the last field update, 0 if unknown */
+    double arrival;
+  } dgtnixEvent;
+
+  /* most ports probed at once by dgtnixProbe() */
+#define DGTNIX_PROBE_MAX 16
+
+  /* number of command IDs counted by dgtnixStats.frames */
+#define DGTNIX_STATS_COMMANDS 32
+  /* number of buckets of the latency histograms of dgtnixStats, 
+     bucket i counts latencies below 2^i microseconds, the last one the rest */
+#define DGTNIX_STATS_BUCKETS 24
+
+  /* Cumulative counters of the driver, returned by dgtnixGetStats().
+   * Every field is an unsigned long. */
+  typedef struct dgtnixStats
+  {
+    /* read() and write() calls on the board, and the bytes they moved */
+    unsigned long readCalls;
+    unsigned long readBytes;
+    unsigned long writeCalls;
+    unsigned long writeBytes;
+    /* messages received from the board by command ID (header included in frameBytes) */
+    unsigned long frames[DGTNIX_STATS_COMMANDS];
+    unsigned long frameBytes[DGTNIX_STATS_COMMANDS];
+    /* bytes dropped because they did not start a valid message header */
+    unsigned long invalidBytes;
+    /* field updates contradicting the board representation */
+    unsigned long desyncs;
+    /* board dumps requested, and those that corrected the board representation */
+    unsigned long dumpRequests;
+    unsigned long resyncs;
+    /* messages sent to the clock, the times they were resent, the acks received */
+    unsigned long clockMessages;
+    unsigned long clockRetries;
+    unsigned long clockAcks;
+    /* writes to the engine descriptor that found the pipe full, 
+       sampled : one write in 16 is checked */
+    unsigned long pipeStalls;
+    /* events dropped because the dgtnixWaitEvents() queue was full */
+    unsigned long eventsDropped;
+    /* times the device went away, and was reopened */
+    unsigned long disconnects;
+    unsigned long reconnects;
+    /* from the first byte of a board message to the events it published */
+    unsigned long publishLatency[DGTNIX_STATS_BUCKETS];
+    unsigned long publishLatencyTotal;
+    /* from a message sent to the clock to its ack, retries included */
+    unsigned long ackLatency[DGTNIX_STATS_BUCKETS];
+    unsigned long ackLatencyTotal;
+  } dgtnixStats;
+
+  /* The time source of the driver, set by dgtnixSetClock().
+   * now returns seconds that never go back, sleep waits for seconds of that 
+   * clock. Both are called from several threads with context. */
+  typedef struct dgtnixClock
+  {
+    double (*now)(void *context);
+    void (*sleep)(double seconds, void *context);
+    void *context;
+  } dgtnixClock;
+
   /******************************/
   /* API Functions declarations */
   /******************************/
@@ -170,9 +313,28 @@ extern "C" {
    * Return :
    * + -1 if fails to open the port
    * + -2 if the port can be opened but the device does'nt seems to be a DGT chess board (does'nt respond to some basic messages)
+   *   within 5 seconds, after 3 attempts one second apart
    * + a positive number if success, this number is the descriptor of the read-only file on which the communications with the board will occur.
+   * dgtnixInit() returns as soon as the board answered.
+   * If the device goes away later (unplugged cable), the driver reports a DGTNIX_EVENT_CONNECTION 
+   * and reopens it when it comes back, then resyncs the board with a board dump.
    */
   int dgtnixInit(const char *);
+
+  /* int dgtnixProbe(const char *const *ports, int count, int timeout);
+   * Find which of the count ports has a DGT board : all of them are opened at once,
+   * sent a board dump request and read until one answers with a valid board dump,
+   * or for timeout milliseconds. Unix sockets are probed as virtual boards.
+   * The ports are opened without waiting for a Bluetooth connection.
+   * Every port but the board's is closed again, pass the result to dgtnixInit()
+   * which goes on with the open port.
+   * It can be called before dgtnixInit(), at most DGTNIX_PROBE_MAX ports are probed.
+   *
+   * Return :
+   * + the index in ports of the first board that answered
+   * + -1 if none did
+   */
+  int dgtnixProbe(const char *const *, int, int);
   
   /* int dgtnixClose();
    * Simpy kill running thread and opened descriptors if any.
@@ -187,8 +349,10 @@ extern "C" {
   int dgtnixClose();
   
   /* const char *dgtnixGetBoard(bool update);
-   * The update flag updates the board in case of a reverse orientation
-   * Return a copy of the representation of the board
+   * The update flag is kept for compatibility, the returned board is always
+   * the last published snapshot (see dgtnixCopyBoard()).
+   * Return a copy of the representation of the board, owned by the calling
+   * thread and valid until its next call.
    *
    * Return :
    * + a char[64], the representation of the board. 
@@ -221,6 +385,29 @@ extern "C" {
    */
   /*void dgtnixPrintBoard(const char *, char *);*/
   
+  /* unsigned long dgtnixCopyBoard(char *board);
+   * Copy the current board representation (oriented like dgtnixGetBoard()) 
+   * into board, a char[64]. Unlike dgtnixGetBoard(), the copy is private to 
+   * the caller so several threads can call it concurrently.
+   * Readers never take a lock : the driver thread publishes versioned 
+   * snapshots and never waits on a reader.
+   *
+   * Return : the version of the copied board
+   */
+  unsigned long dgtnixCopyBoard(char *);
+
+  /* unsigned long dgtnixGetBoardVersion();
+   * Return the version of the board, incremented each time the board 
+   * representation changes (field update, differing dump, orientation).
+   */
+  unsigned long dgtnixGetBoardVersion();
+
+  /* int dgtnixBoardChangedSince(unsigned long version);
+   * Return 1 if the board changed since version (as returned by dgtnixCopyBoard() 
+   * or dgtnixGetBoardVersion()), 0 otherwise. Pollers can skip all work on 0.
+   */
+  int dgtnixBoardChangedSince(unsigned long);
+
   /* int dgtnixTestBoard(const char *board);
    * Test if the represenation of the board in parameter is equal to the 
    * inner representation maintained by the driver.
@@ -234,6 +421,8 @@ extern "C" {
    */
   int dgtnixTestBoard(const char *);
  
+  /* FEN of the board with tomove ('w' or 'b') to move, every castling 
+     allowed, no en passant, halfmove clock 0 and fullmove number 1 */
   const char* getDgtFENWhite ();
   const char* getDgtFEN (char);
   const char* getDgtFENBlack ();
@@ -247,6 +436,10 @@ extern "C" {
    *   DGTNIX_DEBUG_OFF : no debug info 
    *   DGTNIX_DEBUG_ON : all debug info except time messages are printed on stderr
    *   DGTNIX_DEBUG_WITH_TIME : all debug info are printed on stderr
+   * The mode may be changed at any time. The messages are queued by the thread 
+   * that emits them and printed by a log thread every 50ms (and by dgtnixClose()),
+   * the driver thread never waits for stderr. Messages are dropped, and the 
+   * count printed, if 256 of them are queued by a thread.
    *
    * DGTNIX_BOARD_ORIENTATION with values :
    *   DGTNIX_BOARD_ORIENTATION_CLOCKLEFT 
@@ -295,15 +488,168 @@ extern "C" {
   
   const char *dgtnixToPrintableBoard(const char *);
   
-  /* Prints a 6 character string message on the DGT Clock */
+  /* Prints a 6 character string message on the DGT Clock, 
+     sending it again every second until the clock acks it */
   void dgtnixPrintMessageOnClock(const char *, unsigned char beep, unsigned char dots);
+  /* int dgtnixSendMessageToClock(const char *message, unsigned char beep, unsigned char dots, int tries);
+   * Same as dgtnixPrintMessageOnClock(), but sends the message at most tries 
+   * times (forever if tries <= 0), a second apart.
+   *
+   * Return : 1 if the clock acked the message, 0 if it did not, 
+   * -1 if message is shorter than 6 characters
+   */
+  int dgtnixSendMessageToClock(const char *, unsigned char beep, unsigned char dots, int tries);
   void dgtnixUpdate();
 
-  /* Manage clock buttons */
+  /* Manage clock buttons 
+   * getClockButtonState() returns the oldest clock button press not returned yet, 
+   * 0 if none. No press is lost between two calls (up to 32 are kept).
+   * clockButtonState is the last pressed button.
+   * DGTNIX_EVENT_BUTTON events of dgtnixWaitEvents() also report the releases, 
+   * long presses and chords with their timestamps.
+   */
   int getClockButtonState();
   extern int clockButtonState;
   
-  /* Event semaphore */
+  /* void dgtnixSubscribeEvents(unsigned int mask);
+   * Select the event classes (DGTNIX_EVENT_...) that are queued for 
+   * dgtnixWaitEvents(), the others are discarded by the driver.
+   * By default every class except DGTNIX_EVENT_TIME is queued.
+   * The other classes are only queued while dgtnixWaitEvents() waits for them,
+   * or while they are in the mask of dgtnixEventFd() : subscribe the classes
+   * of a thread that waits in a loop not to lose those between two waits.
+   */
+  void dgtnixSubscribeEvents(unsigned int);
+
+  /* int dgtnixWaitEvents(unsigned int mask, int timeout, dgtnixEvent *events, int max);
+   * Block until at least one event of a class in mask is queued, then 
+   * move up to max of them (the whole batch) into events. 
+   * The driver thread only wakes a waiter up for the classes it waits for, 
+   * so clock ticks do not cost anything to a thread waiting for moves.
+   *
+   * Parameters :
+   * + unsigned int mask : DGTNIX_EVENT_... classes to wait for
+   * + int timeout : in milliseconds, 0 to return immediately, negative to wait forever
+   * + dgtnixEvent *events : an array of max events
+   * + int max : size of events
+   *
+   * Return : the number of events copied, 0 on timeout, -1 once the driver 
+   * is closed or its thread gave up on the board (dgtnixClose() and the 
+   * driver thread wake the waiters up). Unlike the other functions it may 
+   * be called on a closed driver.
+   */
+  int dgtnixWaitEvents(unsigned int, int, dgtnixEvent *, int);
+
+  /* int dgtnixIsInitialised();
+   * Return : 1 between dgtnixInit() and dgtnixClose() while the driver thread 
+   * runs, 0 otherwise, when the other functions must not be called. 
+   * After five read errors in a row the driver thread gives up by itself, 
+   * dgtnixClose() must still be called then.
+   */
+  int dgtnixIsInitialised();
+
+  /* int dgtnixEventFd(unsigned int mask);
+   * Return an eventfd that becomes readable when an event of a class in mask is queued,
+   * for a program multiplexing the driver with its other descriptors in poll().
+   * Read its 8 bytes counter, then take the events with dgtnixWaitEvents(mask, 0, ...)
+   * until it returns 0. The classes of mask are queued, see dgtnixSubscribeEvents(),
+   * until a next call replaces mask, dgtnixEventFd(0) stops the signals.
+   * The descriptor is the same for every call and lives as long as the program.
+   *
+   * Return : the descriptor, -1 on error (see errno)
+   * Unlike the other functions it may be called when the driver is not initialised.
+   */
+  int dgtnixEventFd(unsigned int);
+
+  /* int dgtnixStartCapture(const char *path);
+   * Record every byte read from and written to the board into the file path 
+   * (replaced if it exists), with monotonic timestamps, until dgtnixStopCapture().
+   * A record holds a whole message, the file is flushed every second.
+   * The capture may be started before dgtnixInit() to record the initialisation.
+   * Return : 0 on success, -1 if the file can not be created (see dgtnix_errno)
+   */
+  int dgtnixStartCapture(const char *);
+
+  /* void dgtnixStopCapture();
+   * Stop and flush the running capture, if any.
+   */
+  void dgtnixStopCapture();
+
+  /* int dgtnixInitReplay(const char *capture, double speed);
+   * Initialise the driver as dgtnixInit() does, but the board is replaced by the bytes 
+   * read from the board in a capture of dgtnixStartCapture(). They go through the same 
+   * parsing path as a live board. What the driver writes is discarded.
+   *
+   * Parameters :
+   * + const char *capture : the capture file
+   * + double speed : 1 for the captured timing, N for N times faster, 0 for as fast as possible
+   *
+   * Return : as dgtnixInit(), -2 if the capture does not start with a board dump
+   */
+  int dgtnixInitReplay(const char *, double);
+
+  /* long dgtnixWaitReplay(int timeout);
+   * Wait until the driver has read the whole capture of dgtnixInitReplay().
+   * The driver stays initialised (and idle) until dgtnixClose().
+   *
+   * Parameters :
+   * + int timeout : in milliseconds, negative to wait forever
+   *
+   * Return : the number of bytes replayed, -1 on timeout or when not replaying
+   */
+  long dgtnixWaitReplay(int);
+
+  /* void dgtnixGetStats(dgtnixStats *stats, int reset);
+   * Copy the counters of the driver into stats. They are updated without locks 
+   * by the driver thread, each counter is read atomically but not the whole structure.
+   * The latency totals are in microseconds.
+   * It may be called when the driver is not initialised.
+   *
+   * Parameters :
+   * + dgtnixStats *stats : where to copy the counters
+   * + int reset : if not 0, every counter is set back to 0 as it is read
+   */
+  void dgtnixGetStats(dgtnixStats *, int);
+
+  /* int dgtnixFormatStats(const dgtnixStats *stats, char *buffer, int size);
+   * Write stats as text, one "name{labels} value" line per counter as the 
+   * Prometheus text format does, the histograms with cumulative buckets in seconds.
+   *
+   * Return : the length of the text, -1 if it does not fit in size bytes
+   */
+  int dgtnixFormatStats(const dgtnixStats *, char *, int);
+
+  /* void dgtnixSetClock(const dgtnixClock *clock);
+   * Make clock the time source of every wait and timestamp of the driver : 
+   * the stable position delay, the long press, the clock retries and acks, 
+   * the dumps, the replay pace, the event timestamps and the captures.
+   * It must be called before dgtnixInit() (or dgtnixInitReplay()) or after dgtnixClose().
+   * dgtnixWaitEvents() and dgtnixWaitReplay() timeouts stay in real time.
+   *
+   * Parameters :
+   * + const dgtnixClock *clock : copied, NULL for the system monotonic clock (the default)
+   */
+  void dgtnixSetClock(const dgtnixClock *);
+
+  /* void dgtnixSetSimulatedClock(double speed);
+   * Make a simulated clock the time source of the driver, as dgtnixSetClock() does.
+   * It starts at the current time of the system clock.
+   *
+   * Parameters :
+   * + double speed : the simulated clock runs speed times faster than the system clock.
+   *   With 0 it only moves when the driver waits : every wait ends at once 
+   *   (after yielding the processor for a millisecond), so timed behaviours 
+   *   can be tested without waiting for them.
+   */
+  void dgtnixSetSimulatedClock(double);
+
+  /* double dgtnixClockNow();
+   * Return : the time of the driver clock in seconds, the clock of dgtnixEvent.timestamp
+   */
+  double dgtnixClockNow();
+
+  /* Event semaphore, posted for every message received from the board.
+   * dgtnixWaitEvents() should be preferred. */
   extern sem_t dgtnixEventSemaphore;
   
 #ifdef __cplusplus
@@ -28,12 +28,28 @@ from ctypes import *
 # int dgtnixInit(const char *);
 # int dgtnixClose();
 # const char *dgtnixGetBoard();
+# unsigned long dgtnixCopyBoard(char *);
+# unsigned long dgtnixGetBoardVersion();
+# int dgtnixBoardChangedSince(unsigned long);
 # void dgtnixPrintBoard(const char *, char *);
 # int dgtnixTestBoard(const char *);
 # void dgtnixSetOption(unsigned long,unsigned int);
 # float dgtnixQueryDriverVersion();
 # const char *dgtnixQueryString(unsigned int);
 # int dgtnixGetClockData(int *, int *, int *);
+# void dgtnixSubscribeEvents(unsigned int);
+# int dgtnixWaitEvents(unsigned int, int, dgtnixEvent *, int);
+# int dgtnixEventFd(unsigned int);
+# int dgtnixStartCapture(const char *);
+# void dgtnixStopCapture();
+# int dgtnixInitReplay(const char *, double);
+# long dgtnixWaitReplay(int);
+# void dgtnixGetStats(dgtnixStats *, int);
+# int dgtnixFormatStats(const dgtnixStats *, char *, int);
+# void dgtnixSetClock(const dgtnixClock *);
+# void dgtnixSetSimulatedClock(double);
+# double dgtnixClockNow();
+# int dgtnixProbe(const char *const *, int, int);
 
 class DgtnixError(Exception):
     def __init__(self, value):
@@ -41,6 +57,57 @@ class DgtnixError(Exception):
     def __str__(self):
         return repr(self.value)
 
+# Mirror of the dgtnixEvent struct of dgtnix.h
+class DgtnixEvent(Structure):
+    _fields_ = [("type", c_int),
+                ("code", c_int),
+                ("column", c_char),
+                ("line", c_char),
+                ("piece", c_char),
+                ("wtime", c_int),
+                ("btime", c_int),
+                ("wturn", c_int),
+                ("version", c_ulong),
+                ("timestamp", c_double),
+                ("flags", c_int),
+                ("buttons", c_int),
+                ("pressTime", c_double),
+                ("arrival", c_double)]
+
+# Mirror of the dgtnixStats struct of dgtnix.h
+DGTNIX_STATS_COMMANDS=32
+DGTNIX_STATS_BUCKETS=24
+class DgtnixStats(Structure):
+    _fields_ = [("readCalls", c_ulong),
+                ("readBytes", c_ulong),
+                ("writeCalls", c_ulong),
+                ("writeBytes", c_ulong),
+                ("frames", c_ulong * DGTNIX_STATS_COMMANDS),
+                ("frameBytes", c_ulong * DGTNIX_STATS_COMMANDS),
+                ("invalidBytes", c_ulong),
+                ("desyncs", c_ulong),
+                ("dumpRequests", c_ulong),
+                ("resyncs", c_ulong),
+                ("clockMessages", c_ulong),
+                ("clockRetries", c_ulong),
+                ("clockAcks", c_ulong),
+                ("pipeStalls", c_ulong),
+                ("eventsDropped", c_ulong),
+                ("disconnects", c_ulong),
+                ("reconnects", c_ulong),
+                ("publishLatency", c_ulong * DGTNIX_STATS_BUCKETS),
+                ("publishLatencyTotal", c_ulong),
+                ("ackLatency", c_ulong * DGTNIX_STATS_BUCKETS),
+                ("ackLatencyTotal", c_ulong)]
+
+# Mirror of the dgtnixClock struct of dgtnix.h
+DGTNIX_CLOCK_NOW = CFUNCTYPE(c_double, c_void_p)
+DGTNIX_CLOCK_SLEEP = CFUNCTYPE(None, c_double, c_void_p)
+class DgtnixClock(Structure):
+    _fields_ = [("now", DGTNIX_CLOCK_NOW),
+                ("sleep", DGTNIX_CLOCK_SLEEP),
+                ("context", c_void_p)]
+
 #libname is dgtnix.so on unix
 class dgtnix:
 ##
@@ -71,6 +138,26 @@ class dgtnix:
     DGTNIX_DEBUG_ON=0x01
     DGTNIX_DEBUG_OFF=0x04
     DGTNIX_DEBUG_WITH_TIME=0x08
+    # event classes of WaitEvents
+    DGTNIX_EVENT_MOVE=0x01
+    DGTNIX_EVENT_STABLE=0x02
+    DGTNIX_EVENT_BUTTON=0x04
+    DGTNIX_EVENT_TIME=0x08
+    DGTNIX_EVENT_ACK=0x10
+    DGTNIX_EVENT_CONNECTION=0x20
+    DGTNIX_EVENT_ALL=0x3F
+    # flags of the button events
+    DGTNIX_BUTTON_PRESSED=0x01
+    DGTNIX_BUTTON_RELEASED=0x02
+    DGTNIX_BUTTON_LONG=0x04
+    DGTNIX_BUTTON_CHORD=0x08
+    # flags of the time events
+    DGTNIX_TIME_LEVER=0x01
+    # flags of the connection events
+    DGTNIX_CONNECTION_LOST=0x01
+    DGTNIX_CONNECTION_RESTORED=0x02
+    # maximum number of events returned by one waitEvents call
+    EVENT_BATCH_SIZE=64
 
 
     def __init__(self,libName):
@@ -82,6 +169,9 @@ class dgtnix:
         self.Init=self.lib.dgtnixInit
         self.Close=self.lib.dgtnixClose
         self.GetBoard=self.lib.dgtnixGetBoard
+        self.CopyBoard=self.lib.dgtnixCopyBoard
+        self.GetBoardVersion=self.lib.dgtnixGetBoardVersion
+        self.BoardChangedSince=self.lib.dgtnixBoardChangedSince
         self.GetFenWhite = self.lib.getDgtFENWhite
         self.GetFenBlack = self.lib.getDgtFENBlack
         self.ToPrintableBoard=self.lib.dgtnixToPrintableBoard
@@ -91,21 +181,53 @@ class dgtnix:
         self.GetClockData=self.lib.dgtnixGetClockData
         self.SetOption=self.lib.dgtnixSetOption
         self.update = self.lib.dgtnixUpdate
+        self.SubscribeEvents=self.lib.dgtnixSubscribeEvents
+        self.WaitEvents=self.lib.dgtnixWaitEvents
+        self.EventFd=self.lib.dgtnixEventFd
+        self.StartCapture=self.lib.dgtnixStartCapture
+        self.StopCapture=self.lib.dgtnixStopCapture
+        self.InitReplay=self.lib.dgtnixInitReplay
+        self.WaitReplay=self.lib.dgtnixWaitReplay
+        self.GetStats=self.lib.dgtnixGetStats
+        self.FormatStats=self.lib.dgtnixFormatStats
+        self.SetClock=self.lib.dgtnixSetClock
+        self.SetSimulatedClock=self.lib.dgtnixSetSimulatedClock
+        self.ClockNow=self.lib.dgtnixClockNow
+        self.Probe=self.lib.dgtnixProbe
 
         #parameters
         self.Init.argtypes = [c_char_p]
         self.Close.argtypes = None
         self.GetBoard.argtypes = None
+        self.CopyBoard.argtypes = [c_char_p]
+        self.GetBoardVersion.argtypes = None
+        self.BoardChangedSince.argtypes = [c_ulong]
         self.ToPrintableBoard.argtypes = [c_char_p]
         self.TestBoard.argtypes= [c_char_p]
         self.QueryString.argtypes = [c_uint]
         self.GetClockData.argtypes = [POINTER(c_int),POINTER(c_int),POINTER(c_int)]
         self.SetOption.argtypes = [c_ulong, c_uint]
+        self.SubscribeEvents.argtypes = [c_uint]
+        self.WaitEvents.argtypes = [c_uint, c_int, POINTER(DgtnixEvent), c_int]
+        self.EventFd.argtypes = [c_uint]
+        self.StartCapture.argtypes = [c_char_p]
+        self.StopCapture.argtypes = None
+        self.InitReplay.argtypes = [c_char_p, c_double]
+        self.WaitReplay.argtypes = [c_int]
+        self.GetStats.argtypes = [POINTER(DgtnixStats), c_int]
+        self.FormatStats.argtypes = [POINTER(DgtnixStats), c_char_p, c_int]
+        self.SetClock.argtypes = [POINTER(DgtnixClock)]
+        self.SetSimulatedClock.argtypes = [c_double]
+        self.ClockNow.argtypes = None
+        self.Probe.argtypes = [POINTER(c_char_p), c_int, c_int]
 
         #return types
         self.Init.restype = c_int
         self.Close.restype = None
         self.GetBoard.restype = c_char_p
+        self.CopyBoard.restype = c_ulong
+        self.GetBoardVersion.restype = c_ulong
+        self.BoardChangedSince.restype = c_int
         self.GetFenWhite.restype = c_char_p
         self.GetFenBlack.restype = c_char_p
 
@@ -114,6 +236,70 @@ class dgtnix:
         self.QueryString.restype = c_char_p
         self.GetClockData.restype = c_int
         self.SetOption.restype = None
+        self.SubscribeEvents.restype = None
+        self.WaitEvents.restype = c_int
+        self.EventFd.restype = c_int
+        self.StartCapture.restype = c_int
+        self.StopCapture.restype = None
+        self.InitReplay.restype = c_int
+        self.WaitReplay.restype = c_long
+        self.GetStats.restype = None
+        self.FormatStats.restype = c_int
+        self.SetClock.restype = None
+        self.SetSimulatedClock.restype = None
+        self.ClockNow.restype = c_double
+        self.Probe.restype = c_int
+        self.clock = None
+        self.events = (DgtnixEvent * self.EVENT_BATCH_SIZE)()
+
+    def getBoardIfChanged(self, version):
+        # Returns (board, version), board is None if nothing moved since version
+        if not self.BoardChangedSince(version):
+            return None, version
+        board = create_string_buffer(64)
+        version = self.CopyBoard(board)
+        return board.raw, version
+
+    def waitEvents(self, mask, timeout=-1):
+        # Blocks until events of the classes in mask arrive (timeout in ms, -1 forever)
+        # and returns the whole batch as a list of DgtnixEvent
+        n = self.WaitEvents(mask, timeout, self.events, self.EVENT_BATCH_SIZE)
+        return [DgtnixEvent.from_buffer_copy(self.events[i]) for i in range(n)]
+
+    def getStats(self, reset=False):
+        # Returns a DgtnixStats copy of the driver counters, reset them if asked
+        stats = DgtnixStats()
+        self.GetStats(byref(stats), 1 if reset else 0)
+        return stats
+
+    def formatStats(self, stats=None):
+        # Text dump of the counters (of the driver if stats is None) for a metrics scrape
+        if stats is None:
+            stats = self.getStats()
+        size = 8192
+        while True:
+            text = create_string_buffer(size)
+            if self.FormatStats(byref(stats), text, size) >= 0:
+                return text.value
+            size *= 2
+
+    def probe(self, ports, timeout=2000):
+        # The first of ports with a board answering within timeout ms, or None
+        ports = list(ports)
+        index = self.Probe((c_char_p * len(ports))(*ports), len(ports), timeout)
+        return ports[index] if index >= 0 else None
+
+    def setClock(self, clock=None):
+        # Drive the timing of the driver with a python clock (an object with now() 
+        # and sleep(seconds)), None for the system clock. Before Init or after Close.
+        if clock is None:
+            self.clock = None
+            self.SetClock(None)
+            return
+        self.clock = DgtnixClock(DGTNIX_CLOCK_NOW(lambda context: clock.now()),
+                                 DGTNIX_CLOCK_SLEEP(lambda seconds, context: clock.sleep(seconds)),
+                                 None)
+        self.SetClock(byref(self.clock))
 
     def getFen(self, color='w'):
         if color == 'w':
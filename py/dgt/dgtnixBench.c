@@ -0,0 +1,543 @@
+/* dgtnixBench, microbenchmarks of the dgtnix hot paths
+Copyright (C) 2006 Pierre Boulenguez
+              2012 Jean-Francois Romang
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+/*
+ * The driver is compiled in this program so that its intern functions
+ * can be measured alone :
+ *   gcc -O2 -std=gnu99 dgtnixBench.c -o dgtnixBench -lpthread -lutil
+ *
+ * Usage : dgtnixBench [-n iterations] [-c capture] [-r readers] [-o file.json]
+ *
+ * parse         : frames read by _readMessageFromBoard() from a pty, a writer thread
+ *                 feeds the master side with a synthetic game or with the board bytes
+ *                 of a capture of dgtnixStartCapture() (-c)
+ * fieldUpdate   : _fieldUpdateReceived(), events and engine messages included
+ * getDgtFEN     : FEN of the current board
+ * getBoard      : dgtnixCopyBoard() by -r concurrent readers while the board is published
+ * lcdEncode     : _characterToLcdCode() of 6 characters clock messages
+ * bwtimeDecode  : _bwtimeReceived() of clock times
+ *
+ * Every benchmark reports its throughput and the latency percentiles of an operation
+ * (operations are timed by batches when they are too short for the clock).
+ * The JSON report goes to stdout (or -o file), a summary to stderr.
+ */
+#include "dgtnix.c"
+
+#include <pty.h>
+#include <sys/utsname.h>
+#include <getopt.h>
+
+/* operations timed together when a single one is shorter than the clock resolution */
+#define _BENCH_BATCH 64
+#define _BENCH_MAX_READERS 16
+
+typedef struct _benchResult
+{
+  const char *name;
+  unsigned long operations;
+  double seconds;
+  /* one duration per operation (or per operation of a batch), in ns */
+  double *samples;
+  unsigned long sampleCount;
+} _benchResult;
+
+static unsigned long g_benchIterations = 200000;
+static const char *g_benchCapture;
+static int g_benchReaders = 4;
+static volatile int g_benchStop;
+static volatile unsigned long g_benchSink;
+
+static uint64_t _benchNow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int _compareDoubles(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double _percentile(const _benchResult *result, double p)
+{
+  unsigned long i;
+  if(!result->sampleCount)
+    return 0;
+  i = (unsigned long)(p * (result->sampleCount - 1) + 0.5);
+  return result->samples[i];
+}
+
+static void _benchInit(_benchResult *result, const char *name, unsigned long samples)
+{
+  memset(result, 0, sizeof(*result));
+  result->name = name;
+  result->samples = (double *)malloc(samples * sizeof(double));
+  if(!result->samples)
+    {
+      perror("dgtnixBench: malloc");
+      exit(-1);
+    }
+}
+
+/* Reads and discards what the driver writes, to the board or to the engine */
+static void *_benchDrain(void *params)
+{
+  int fd = *(int *)params;
+  char buffer[4096];
+  while(read(fd, buffer, sizeof(buffer)) > 0)
+    ;
+  return NULL;
+}
+
+/* Internal codes of the initial position, A8 first */
+static void _benchInitialBoard(unsigned char board[64])
+{
+  static const unsigned char back[8] =
+    { _DGTNIX_WROOK, _DGTNIX_WKNIGHT, _DGTNIX_WBISHOP, _DGTNIX_WQUEEN,
+      _DGTNIX_WKING, _DGTNIX_WBISHOP, _DGTNIX_WKNIGHT, _DGTNIX_WROOK };
+  int i;
+  memset(board, _DGTNIX_EMPTY, 64);
+  for(i = 0; i < 8; i++)
+    {
+      board[i] = back[i] + (_DGTNIX_BPAWN - _DGTNIX_WPAWN);
+      board[8 + i] = _DGTNIX_BPAWN;
+      board[48 + i] = _DGTNIX_WPAWN;
+      board[56 + i] = back[i];
+    }
+}
+
+/* Driver state of a running board without a driver thread */
+static void _benchSetupDriver()
+{
+  static int engine[2] = { -1, -1 };
+  static int drain;
+  unsigned char board[64];
+  pthread_t thread;
+  if(engine[0] < 0)
+    {
+      if(pipe(engine) < 0)
+	{
+	  perror("dgtnixBench: pipe");
+	  exit(-1);
+	}
+      drain = engine[0];
+      pthread_create(&thread, NULL, _benchDrain, &drain);
+      g_pipeDriverWriteSide = engine[1];
+      g_pipeEngineReadSide = engine[0];
+    }
+  g_initialised = 1;
+  g_boardSynced = 0;
+  _benchInitialBoard(board);
+  _boardDumpReceived(board);
+  /* No dump requests during the measures */
+  g_lastDumpTime = 1e18;
+}
+
+/*
+ * A synthetic game : the initial dump, then pieces lifted and placed
+ * back (e2-e4, e4-e2...) with clock times every 8 frames.
+ */
+static unsigned char *_benchSyntheticStream(size_t *size, unsigned long frames)
+{
+  unsigned char *stream = (unsigned char *)malloc(_DGTNIX_SIZE_BOARD_DUMP + frames * _DGTNIX_SIZE_BWTIME);
+  static const unsigned char updates[4][2] =
+    { { 52, _DGTNIX_EMPTY }, { 36, _DGTNIX_WPAWN }, { 36, _DGTNIX_EMPTY }, { 52, _DGTNIX_WPAWN } };
+  size_t n = 0;
+  unsigned long i;
+  if(!stream)
+    {
+      perror("dgtnixBench: malloc");
+      exit(-1);
+    }
+  stream[n++] = _DGTNIX_MSG_BOARD_DUMP;
+  stream[n++] = 0;
+  stream[n++] = _DGTNIX_SIZE_BOARD_DUMP;
+  _benchInitialBoard(stream + n);
+  n += 64;
+  for(i = 1; i < frames; i++)
+    if(i % 8 == 0)
+      {
+	static const unsigned char times[7] = { 0x01, 0x23, 0x45, 0x01, 0x23, 0x45, 0x01 };
+	stream[n++] = _DGTNIX_MSG_BWTIME;
+	stream[n++] = 0;
+	stream[n++] = _DGTNIX_SIZE_BWTIME;
+	memcpy(stream + n, times, sizeof(times));
+	n += sizeof(times);
+      }
+    else
+      {
+	stream[n++] = _DGTNIX_MESSAGE_BIT | _DGTNIX_FIELD_UPDATE;
+	stream[n++] = 0;
+	stream[n++] = 5;
+	stream[n++] = updates[i % 4][0];
+	stream[n++] = updates[i % 4][1];
+      }
+  *size = n;
+  return stream;
+}
+
+/* The bytes read from the board in a capture, NULL if it can not be read */
+static unsigned char *_benchCaptureStream(const char *path, size_t *size)
+{
+  FILE *file = fopen(path, "rb");
+  char magic[_DGTNIX_CAPTURE_MAGIC_SIZE];
+  unsigned char *stream = NULL;
+  size_t n = 0, allocated = 0;
+  char direction;
+  uint64_t ns;
+  uint16_t length;
+  if(!file)
+    return NULL;
+  if(fread(magic, 1, sizeof(magic), file) != sizeof(magic)
+     || memcmp(magic, _DGTNIX_CAPTURE_MAGIC, sizeof(magic)))
+    {
+      fclose(file);
+      return NULL;
+    }
+  while(fread(&direction, 1, 1, file) == 1 && fread(&ns, sizeof(ns), 1, file) == 1
+	&& fread(&length, sizeof(length), 1, file) == 1)
+    {
+      if(n + length > allocated)
+	{
+	  allocated = 2 * (n + length);
+	  stream = (unsigned char *)realloc(stream, allocated);
+	}
+      if(fread(stream + n, 1, length, file) != length)
+	break;
+      if(direction == _DGTNIX_CAPTURE_READ)
+	n += length;
+    }
+  fclose(file);
+  *size = n;
+  return stream;
+}
+
+typedef struct _benchFeed
+{
+  int master;
+  const unsigned char *stream;
+  size_t size;
+} _benchFeed;
+
+/* Writes the stream on the master side of the pty until g_benchStop, and drains it */
+static void *_benchFeeder(void *params)
+{
+  _benchFeed *feed = (_benchFeed *)params;
+  size_t offset = 0;
+  char discard[256];
+  while(!g_benchStop)
+    {
+      struct pollfd pfd;
+      pfd.fd = feed->master;
+      pfd.events = POLLIN | POLLOUT;
+      if(poll(&pfd, 1, 100) <= 0)
+	continue;
+      if((pfd.revents & POLLIN) && read(feed->master, discard, sizeof(discard)) < 0)
+	break;
+      if(pfd.revents & POLLOUT)
+	{
+	  ssize_t n = write(feed->master, feed->stream + offset, feed->size - offset);
+	  if(n < 0 && errno != EAGAIN)
+	    break;
+	  if(n > 0)
+	    offset = (offset + n) % feed->size;
+	}
+    }
+  return NULL;
+}
+
+static void _benchParse(_benchResult *result)
+{
+  int master, slave;
+  struct termios tio;
+  pthread_t feeder;
+  _benchFeed feed;
+  unsigned long i;
+  unsigned char *stream;
+  uint64_t start, t;
+  if(g_benchCapture)
+    {
+      stream = _benchCaptureStream(g_benchCapture, &feed.size);
+      if(!stream || !feed.size)
+	{
+	  fprintf(stderr, "dgtnixBench: %s is not a dgtnix capture\n", g_benchCapture);
+	  exit(-1);
+	}
+    }
+  else
+    stream = _benchSyntheticStream(&feed.size, 4096);
+  if(openpty(&master, &slave, NULL, NULL, NULL) < 0)
+    {
+      perror("dgtnixBench: openpty");
+      exit(-1);
+    }
+  tcgetattr(slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+  fcntl(master, F_SETFL, O_NONBLOCK);
+  _benchSetupDriver();
+  g_descriptorDriverBoard = slave;
+  feed.master = master;
+  feed.stream = stream;
+  g_benchStop = 0;
+  pthread_create(&feeder, NULL, _benchFeeder, &feed);
+  _benchInit(result, "parse", g_benchIterations);
+  start = _benchNow();
+  for(i = 0; i < g_benchIterations; i++)
+    {
+      t = _benchNow();
+      if(_readMessageFromBoard() < 0)
+	break;
+      result->samples[result->sampleCount++] = _benchNow() - t;
+      /* The capture may contain a dump, keep the periodic ones away */
+      g_lastDumpTime = 1e18;
+    }
+  result->seconds = (_benchNow() - start) * 1e-9;
+  result->operations = i;
+  g_benchStop = 1;
+  pthread_join(feeder, NULL);
+  g_descriptorDriverBoard = -1;
+  close(master);
+  close(slave);
+  free(stream);
+}
+
+static void _benchFieldUpdate(_benchResult *result)
+{
+  static const unsigned char updates[4][2] =
+    { { 52, _DGTNIX_EMPTY }, { 36, _DGTNIX_WPAWN }, { 36, _DGTNIX_EMPTY }, { 52, _DGTNIX_WPAWN } };
+  unsigned long i;
+  uint64_t start, t;
+  _benchSetupDriver();
+  _benchInit(result, "fieldUpdate", g_benchIterations);
+  start = _benchNow();
+  for(i = 0; i < g_benchIterations; i++)
+    {
+      t = _benchNow();
+      _fieldUpdateReceived(updates[i % 4][0], updates[i % 4][1]);
+      result->samples[result->sampleCount++] = _benchNow() - t;
+    }
+  result->seconds = (_benchNow() - start) * 1e-9;
+  result->operations = i;
+}
+
+static void _benchGetDgtFEN(_benchResult *result)
+{
+  unsigned long i, j;
+  uint64_t start, t;
+  _benchSetupDriver();
+  _benchInit(result, "getDgtFEN", g_benchIterations / _BENCH_BATCH + 1);
+  start = _benchNow();
+  for(i = 0; i < g_benchIterations; i += _BENCH_BATCH)
+    {
+      t = _benchNow();
+      for(j = 0; j < _BENCH_BATCH; j++)
+	g_benchSink += getDgtFEN(j & 1 ? 'w' : 'b')[0];
+      result->samples[result->sampleCount++] = (double)(_benchNow() - t) / _BENCH_BATCH;
+    }
+  result->seconds = (_benchNow() - start) * 1e-9;
+  result->operations = i;
+}
+
+typedef struct _benchReader
+{
+  pthread_t thread;
+  unsigned long operations;
+  double *samples;
+  unsigned long sampleCount;
+} _benchReader;
+
+static void *_benchRead(void *params)
+{
+  _benchReader *reader = (_benchReader *)params;
+  char board[64];
+  unsigned long j;
+  uint64_t t;
+  while(!g_benchStop && reader->sampleCount < g_benchIterations / _BENCH_BATCH + 1)
+    {
+      t = _benchNow();
+      for(j = 0; j < _BENCH_BATCH; j++)
+	g_benchSink += dgtnixCopyBoard(board);
+      reader->samples[reader->sampleCount++] = (double)(_benchNow() - t) / _BENCH_BATCH;
+      reader->operations += _BENCH_BATCH;
+    }
+  return NULL;
+}
+
+/* dgtnixCopyBoard() by g_benchReaders threads while this one publishes boards */
+static void _benchGetBoard(_benchResult *result)
+{
+  _benchReader readers[_BENCH_MAX_READERS];
+  unsigned long perReader = g_benchIterations / _BENCH_BATCH + 1;
+  unsigned long publications = 0;
+  uint64_t start;
+  int r;
+  _benchSetupDriver();
+  _benchInit(result, "getBoard", perReader * g_benchReaders);
+  g_benchStop = 0;
+  start = _benchNow();
+  for(r = 0; r < g_benchReaders; r++)
+    {
+      memset(&readers[r], 0, sizeof(readers[r]));
+      readers[r].samples = result->samples + r * perReader;
+      pthread_create(&readers[r].thread, NULL, _benchRead, &readers[r]);
+    }
+  for(r = 0; r < g_benchReaders; r++)
+    {
+      /* Publish while the readers run, as the driver thread does on moves */
+      while(__atomic_load_n(&readers[r].sampleCount, __ATOMIC_RELAXED) < perReader)
+	{
+	  g_board[36] = publications & 1 ? _DGTNIX_WPAWN : _DGTNIX_EMPTY;
+	  _publishBoard();
+	  publications++;
+	  _mySleep(0.0001);
+	}
+      pthread_join(readers[r].thread, NULL);
+    }
+  result->seconds = (_benchNow() - start) * 1e-9;
+  /* Compact the samples of the readers */
+  for(r = 0; r < g_benchReaders; r++)
+    {
+      memmove(result->samples + result->sampleCount, readers[r].samples,
+	      readers[r].sampleCount * sizeof(double));
+      result->sampleCount += readers[r].sampleCount;
+      result->operations += readers[r].operations;
+    }
+}
+
+static void _benchLcdEncode(_benchResult *result)
+{
+  static const char messages[] = "e2e4  book  pic023 12345 done wrong a7a8q undo";
+  unsigned long i, j;
+  int k;
+  uint64_t start, t;
+  size_t length = strlen(messages) - 6;
+  _benchInit(result, "lcdEncode", g_benchIterations / _BENCH_BATCH + 1);
+  start = _benchNow();
+  for(i = 0; i < g_benchIterations; i += _BENCH_BATCH)
+    {
+      t = _benchNow();
+      for(j = 0; j < _BENCH_BATCH; j++)
+	for(k = 0; k < 6; k++)
+	  g_benchSink += _characterToLcdCode(messages[(i + j) % length + k]);
+      result->samples[result->sampleCount++] = (double)(_benchNow() - t) / _BENCH_BATCH;
+    }
+  result->seconds = (_benchNow() - start) * 1e-9;
+  result->operations = i;
+}
+
+static void _benchBwtimeDecode(_benchResult *result)
+{
+  static const unsigned char times[7] = { 0x01, 0x23, 0x45, 0x01, 0x23, 0x45, 0x01 };
+  unsigned char buffer[7];
+  unsigned long i;
+  uint64_t start, t;
+  _benchSetupDriver();
+  _benchInit(result, "bwtimeDecode", g_benchIterations);
+  start = _benchNow();
+  for(i = 0; i < g_benchIterations; i++)
+    {
+      /* Decoded in place */
+      memcpy(buffer, times, sizeof(buffer));
+      buffer[5] = (unsigned char)(i % 60 / 10 << 4 | i % 10);
+      t = _benchNow();
+      _bwtimeReceived(buffer);
+      result->samples[result->sampleCount++] = _benchNow() - t;
+    }
+  result->seconds = (_benchNow() - start) * 1e-9;
+  result->operations = i;
+}
+
+static void _benchReport(FILE *out, _benchResult *results, int count)
+{
+  struct utsname machine;
+  int i;
+  uname(&machine);
+  fprintf(out, "{\n  \"driver\": \"%s\",\n  \"machine\": \"%s\",\n  \"system\": \"%s %s\",\n"
+	  "  \"compiler\": \"%s\",\n  \"iterations\": %lu,\n  \"readers\": %d,\n"
+	  "  \"stream\": \"%s\",\n  \"benchmarks\": [\n",
+	  VERSION, machine.machine, machine.sysname, machine.release, __VERSION__,
+	  g_benchIterations, g_benchReaders, g_benchCapture ? g_benchCapture : "synthetic");
+  for(i = 0; i < count; i++)
+    {
+      _benchResult *r = &results[i];
+      qsort(r->samples, r->sampleCount, sizeof(double), _compareDoubles);
+      fprintf(out, "    {\"name\": \"%s\", \"operations\": %lu, \"seconds\": %.6f, "
+	      "\"ops_per_sec\": %.1f, \"p50_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f, "
+	      "\"p999_ns\": %.1f, \"max_ns\": %.1f}%s\n",
+	      r->name, r->operations, r->seconds, r->seconds > 0 ? r->operations / r->seconds : 0,
+	      _percentile(r, 0.5), _percentile(r, 0.9), _percentile(r, 0.99), _percentile(r, 0.999),
+	      _percentile(r, 1), i < count - 1 ? "," : "");
+      fprintf(stderr, "%-14s %12.0f ops/s   p50 %9.1f ns   p99 %9.1f ns   p99.9 %9.1f ns\n",
+	      r->name, r->seconds > 0 ? r->operations / r->seconds : 0,
+	      _percentile(r, 0.5), _percentile(r, 0.99), _percentile(r, 0.999));
+    }
+  fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+  _benchResult results[6];
+  const char *output = NULL;
+  FILE *out = stdout;
+  int option, i;
+  while((option = getopt(argc, argv, "n:c:r:o:")) != -1)
+    switch(option)
+      {
+      case 'n':
+	g_benchIterations = strtoul(optarg, NULL, 10);
+	break;
+      case 'c':
+	g_benchCapture = optarg;
+	break;
+      case 'r':
+	g_benchReaders = atoi(optarg);
+	if(g_benchReaders < 1 || g_benchReaders > _BENCH_MAX_READERS)
+	  g_benchReaders = 4;
+	break;
+      case 'o':
+	output = optarg;
+	break;
+      default:
+	fprintf(stderr, "usage: %s [-n iterations] [-c capture] [-r readers] [-o file.json]\n", argv[0]);
+	return 1;
+      }
+  if(!g_benchIterations)
+    g_benchIterations = 1;
+  /* The engine pipe writes must not kill us */
+  signal(SIGPIPE, SIG_IGN);
+  _benchParse(&results[0]);
+  _benchFieldUpdate(&results[1]);
+  _benchGetDgtFEN(&results[2]);
+  _benchGetBoard(&results[3]);
+  _benchLcdEncode(&results[4]);
+  _benchBwtimeDecode(&results[5]);
+  if(output && !(out = fopen(output, "w")))
+    {
+      perror(output);
+      return 1;
+    }
+  _benchReport(out, results, 6);
+  if(out != stdout)
+    fclose(out);
+  for(i = 0; i < 6; i++)
+    free(results[i].samples);
+  return 0;
+}
@@ -58,10 +58,21 @@ print "The board was found"
 dgtnix.update()
 #board_out = ""
 #dgtnix.SendToClock("tall  ", True, False)
+print dgtnix.getFen('w')
 while True:
    # bd = ""
-    print dgtnix.getFen('w')
-    time.sleep(1)
+    for event in dgtnix.waitEvents(dgtnix.DGTNIX_EVENT_STABLE | dgtnix.DGTNIX_EVENT_BUTTON):
+        if event.type == dgtnix.DGTNIX_EVENT_STABLE:
+            print dgtnix.getFen('w')
+        elif event.type == dgtnix.DGTNIX_EVENT_BUTTON:
+            if event.flags & dgtnix.DGTNIX_BUTTON_CHORD:
+                print "Clock buttons chord %#x" % event.buttons
+            elif event.flags & dgtnix.DGTNIX_BUTTON_RELEASED:
+                print "Clock button %d released after %.2fs" % (event.code, event.timestamp - event.pressTime)
+            elif event.flags & dgtnix.DGTNIX_BUTTON_LONG:
+                print "Clock button %d long press" % event.code
+            else:
+                print "Clock button %d pressed" % event.code
    # print dgtnix.GetBoard(True)
     #print bd
     #time.sleep(1)
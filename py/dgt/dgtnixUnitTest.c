@@ -0,0 +1,652 @@
+/* dgtnixUnitTest, tests of the dgtnix intern functions
+Copyright (C) 2006 Pierre Boulenguez
+              2012 Jean-Francois Romang
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+/*
+ * The driver is compiled in this program, as in dgtnixBench, so that its
+ * intern functions are tested without a board :
+ *   gcc -O2 -std=gnu99 dgtnixUnitTest.c -o dgtnixUnitTest -lpthread -lutil
+ *   ./dgtnixUnitTest
+ *
+ * Every test prints ok or FAIL with the failed checks, the exit status is
+ * the number of failed tests.
+ */
+#include "dgtnix.c"
+
+#include <pty.h>
+
+static int g_testFailures;
+
+#define _TEST_CHECK(condition) \
+  do { if(!(condition)) { fprintf(stderr, "  %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+      g_testFailures++; } } while(0)
+
+/* In place of _startLogThread(), the records stay in the rings */
+static void _noLogThread()
+{
+}
+
+/* _debug() copies the %s arguments truncated to the strings of the record */
+static void _testDebugLongStrings()
+{
+  char first[2 * _DGTNIX_LOG_STRINGS], second[2 * _DGTNIX_LOG_STRINGS], line[_DGTNIX_LOG_LINE];
+  _dgtnixLogRing *ring;
+  _dgtnixLogRecord *record;
+  memset(first, 'd', sizeof(first) - 1);
+  first[sizeof(first) - 1] = '\0';
+  memset(second, 'p', sizeof(second) - 1);
+  second[sizeof(second) - 1] = '\0';
+  g_debugMode = DGTNIX_DEBUG_ON;
+  ring = _logRing();
+  /* The log thread must not drain the record before it is checked */
+  pthread_once(&g_logOnce, _noLogThread);
+  _TEST_CHECK(_debug("cannot watch %s, polling for %s\n", first, second) == 1);
+  record = &ring->records[(ring->head - 1) % _DGTNIX_LOG_RING_SIZE];
+  _TEST_CHECK(record->count == 2);
+  _TEST_CHECK(record->arguments[0].offset == 0);
+  _TEST_CHECK(strlen(record->strings) == _DGTNIX_LOG_STRINGS - 1);
+  _TEST_CHECK(record->arguments[1].offset < _DGTNIX_LOG_STRINGS);
+  _TEST_CHECK(record->strings[record->arguments[1].offset] == '\0');
+  _TEST_CHECK(_formatLogRecord(record, line, sizeof(line)) > _DGTNIX_LOG_STRINGS);
+  _TEST_CHECK(_debug("%s %s %s\n", "watch", second, "short") == 1);
+  record = &ring->records[(ring->head - 1) % _DGTNIX_LOG_RING_SIZE];
+  _TEST_CHECK(!strcmp(record->strings, "watch"));
+  _TEST_CHECK(record->strings[record->arguments[2].offset] == '\0');
+  ring->tail = ring->head;
+  g_debugMode = DGTNIX_DEBUG_OFF;
+}
+
+/* Time of the test clock, moved by the tests */
+static double g_testNow = 100;
+
+static double _testClockNow(void *context)
+{
+  (void)context;
+  return g_testNow;
+}
+
+static void _testClockSleep(double seconds, void *context)
+{
+  (void)context;
+  g_testNow += seconds;
+}
+
+static void _testSetClock()
+{
+  dgtnixClock clock = { _testClockNow, _testClockSleep, NULL };
+  dgtnixSetClock(&clock);
+}
+
+/* Moves the events queued to events, return their number */
+static int _testTakeEvents(dgtnixEvent *events, int size)
+{
+  int count = 0;
+  pthread_once(&g_eventOnce, _initEvents);
+  pthread_mutex_lock(&g_eventMutex);
+  while(g_eventCount > 0 && count < size)
+    {
+      events[count++] = g_events[g_eventHead];
+      g_eventHead = (g_eventHead + 1) % _DGTNIX_EVENT_QUEUE_SIZE;
+      g_eventCount--;
+    }
+  g_eventCount = 0;
+  pthread_mutex_unlock(&g_eventMutex);
+  return count;
+}
+
+static int _testButtonEvent(const dgtnixEvent *event, int button, int flags)
+{
+  return event->type == DGTNIX_EVENT_BUTTON && event->code == button && event->flags == flags;
+}
+
+/* Every button reported is a press edge, a missed release is not a long press */
+static void _testButtonEdges()
+{
+  dgtnixEvent events[8];
+  _testSetClock();
+  _testTakeEvents(events, 8);
+  /* A short press */
+  _clockButtonsReported(1);
+  g_testNow += 0.2;
+  _clockButtonsReported(0);
+  _TEST_CHECK(_testTakeEvents(events, 8) == 2);
+  _TEST_CHECK(_testButtonEvent(&events[0], 1, DGTNIX_BUTTON_PRESSED));
+  _TEST_CHECK(_testButtonEvent(&events[1], 1, DGTNIX_BUTTON_RELEASED));
+  /* The release of the first press was missed, the second press is not lost */
+  _clockButtonsReported(2);
+  g_testNow += 0.5;
+  _clockButtonsReported(2);
+  _TEST_CHECK(_testTakeEvents(events, 8) == 3);
+  _TEST_CHECK(_testButtonEvent(&events[0], 2, DGTNIX_BUTTON_PRESSED));
+  _TEST_CHECK(_testButtonEvent(&events[1], 2, DGTNIX_BUTTON_RELEASED));
+  _TEST_CHECK(_testButtonEvent(&events[2], 2, DGTNIX_BUTTON_PRESSED));
+  _TEST_CHECK(events[2].pressTime == g_testNow);
+  /* The long press is timed from the last press edge */
+  _TEST_CHECK(g_longPressDeadline == g_testNow + _DGTNIX_LONG_PRESS_DELAY);
+  /* A missed release followed by another button long after : released, not long */
+  g_testNow += 5;
+  _clockButtonsReported(3);
+  _TEST_CHECK(_testTakeEvents(events, 8) == 2);
+  _TEST_CHECK(_testButtonEvent(&events[0], 2, DGTNIX_BUTTON_RELEASED));
+  _TEST_CHECK(_testButtonEvent(&events[1], 3, DGTNIX_BUTTON_PRESSED));
+  /* A release seen after the delay is long, a second button soon after the first a chord */
+  g_testNow += _DGTNIX_LONG_PRESS_DELAY;
+  _clockButtonsReported(0);
+  _clockButtonsReported(4);
+  g_testNow += _DGTNIX_CHORD_DELAY / 2;
+  _clockButtonsReported(5);
+  _clockButtonsReported(0);
+  _TEST_CHECK(_testTakeEvents(events, 8) == 6);
+  _TEST_CHECK(_testButtonEvent(&events[0], 3, DGTNIX_BUTTON_RELEASED | DGTNIX_BUTTON_LONG));
+  _TEST_CHECK(_testButtonEvent(&events[1], 4, DGTNIX_BUTTON_PRESSED));
+  _TEST_CHECK(_testButtonEvent(&events[2], 4, DGTNIX_BUTTON_RELEASED));
+  _TEST_CHECK(_testButtonEvent(&events[3], 5, DGTNIX_BUTTON_CHORD));
+  _TEST_CHECK(events[3].buttons == ((1 << 4) | (1 << 5)));
+  _TEST_CHECK(_testButtonEvent(&events[4], 5, DGTNIX_BUTTON_PRESSED));
+  _TEST_CHECK(_testButtonEvent(&events[5], 5, DGTNIX_BUTTON_RELEASED));
+  _TEST_CHECK(g_longPressDeadline == 0);
+  dgtnixSetClock(NULL);
+}
+
+/* The buttons as the clock reports them in byte 5 of its acks, the leftmost first */
+static void _testClockButtonBits()
+{
+  static const unsigned char reported[] = { 49, 52, 51, 50, 53 };
+  int i;
+  for(i = 0; i < 5; i++)
+    _TEST_CHECK(processClockBits(reported[i]) == i + 1);
+  _TEST_CHECK(processClockBits(0) == 0);
+  /* Button 4 also needs bits 4 and 5 */
+  _TEST_CHECK(processClockBits(0x02) == 0);
+}
+
+/* A device that opens but drops at once is reopened after a growing delay */
+static void _testReconnectBackoff()
+{
+  struct sockaddr_un address;
+  dgtnixEvent events[8];
+  double start;
+  int i, listening = socket(AF_UNIX, SOCK_STREAM, 0);
+  _testSetClock();
+  /* The connections are queued, never accepted */
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  snprintf(address.sun_path, sizeof(address.sun_path), "/tmp/dgtnixUnitTest-%d.sock", (int)getpid());
+  unlink(address.sun_path);
+  _TEST_CHECK(bind(listening, (struct sockaddr *)&address, sizeof(address)) == 0);
+  _TEST_CHECK(listen(listening, 16) == 0);
+  snprintf(g_port, sizeof(g_port), "%s", address.sun_path);
+  g_reconnectDelay = _DGTNIX_RECONNECT_DELAY;
+  g_connectedTime = g_testNow;
+  start = g_testNow;
+  for(i = 0; i < 4; i++)
+    _reconnect();
+  _TEST_CHECK(g_descriptorDriverBoard >= 0);
+  _TEST_CHECK(g_testNow - start > 15 * _DGTNIX_RECONNECT_DELAY - 1e-9);
+  _TEST_CHECK(g_testNow - start < 15 * _DGTNIX_RECONNECT_DELAY + 1e-9);
+  _TEST_CHECK(g_reconnectDelay == 16 * _DGTNIX_RECONNECT_DELAY);
+  /* A connection that stayed up is reopened at once */
+  g_testNow += _DGTNIX_RECONNECT_STABLE;
+  start = g_testNow;
+  _reconnect();
+  _TEST_CHECK(g_testNow == start);
+  _TEST_CHECK(_testTakeEvents(events, 8) == 8);
+  _TEST_CHECK(events[0].type == DGTNIX_EVENT_CONNECTION && events[0].flags == DGTNIX_CONNECTION_LOST);
+  _TEST_CHECK(events[7].type == DGTNIX_EVENT_CONNECTION && events[7].flags == DGTNIX_CONNECTION_RESTORED);
+  _closeDescriptor(&g_descriptorDriverBoard);
+  close(listening);
+  unlink(address.sun_path);
+  g_reconnectDelay = _DGTNIX_RECONNECT_DELAY;
+  dgtnixSetClock(NULL);
+}
+
+/* An all-zero BWTIME is the lever, the others the clock times */
+static void _testBwtimeLever()
+{
+  dgtnixEvent events[4];
+  unsigned char lever[7] = { 0, 0, 0, 0, 0, 0, 0x10 };
+  /* 1:02:03 on the right, 0:04:05 on the left, white to move */
+  unsigned char times[7] = { 0x01, 0x02, 0x03, 0x00, 0x04, 0x05, 0x01 };
+  int engine[2];
+  char code;
+  /* The engine pipe of dgtnixInit() */
+  _TEST_CHECK(pipe(engine) == 0);
+  g_pipeEngineReadSide = engine[0];
+  g_pipeDriverWriteSide = engine[1];
+  dgtnixSubscribeEvents(DGTNIX_EVENT_ALL);
+  _testTakeEvents(events, 4);
+  _bwtimeReceived(lever);
+  _bwtimeReceived(times);
+  _TEST_CHECK(_testTakeEvents(events, 4) == 2);
+  _TEST_CHECK(events[0].type == DGTNIX_EVENT_TIME && events[0].flags == DGTNIX_TIME_LEVER);
+  _TEST_CHECK(events[0].code == 0x10);
+  _TEST_CHECK(events[1].type == DGTNIX_EVENT_TIME && events[1].flags == 0);
+  _TEST_CHECK(events[1].btime == 3723 && events[1].wtime == 245 && events[1].wturn == 1);
+  /* The engine only hears of the times */
+  _TEST_CHECK(read(g_pipeEngineReadSide, &code, 1) == 1 && code == DGTNIX_MSG_TIME);
+  fcntl(g_pipeEngineReadSide, F_SETFL, O_NONBLOCK);
+  _TEST_CHECK(read(g_pipeEngineReadSide, &code, 1) < 0);
+  _closeDescriptor(&g_pipeEngineReadSide);
+  _closeDescriptor(&g_pipeDriverWriteSide);
+  dgtnixSubscribeEvents(DGTNIX_EVENT_ALL & ~DGTNIX_EVENT_TIME);
+}
+
+/* The board side of _testProbeKeepsBoard() : answers the probe request
+   with a board dump */
+static void *_testProbeBoard(void *context)
+{
+  int master = *(int *)context;
+  unsigned char request[2];
+  unsigned char dump[_DGTNIX_SIZE_BOARD_DUMP] = { _DGTNIX_MSG_BOARD_DUMP, 0, _DGTNIX_SIZE_BOARD_DUMP };
+  if(read(master, request, sizeof(request)) == sizeof(request))
+    _TEST_CHECK(write(master, dump, sizeof(dump)) == sizeof(dump));
+  return NULL;
+}
+
+/* dgtnixProbe() leaves the port of the board open for dgtnixInit() */
+static void _testProbeKeepsBoard()
+{
+  int master, slave;
+  pthread_t board;
+  const char *ports[2] = { "/nonexistent/dgt", NULL };
+  _TEST_CHECK(openpty(&master, &slave, NULL, NULL, NULL) == 0);
+  ports[1] = ttyname(slave);
+  pthread_create(&board, NULL, _testProbeBoard, &master);
+  _TEST_CHECK(dgtnixProbe(ports, 2, 2000) == 1);
+  pthread_join(board, NULL);
+  _TEST_CHECK(g_probedDescriptor >= 0 && strcmp(g_probedPort, ports[1]) == 0);
+  _TEST_CHECK(g_probedMode == _DGTNIX_REAL_BOARD);
+  _TEST_CHECK(!(fcntl(g_probedDescriptor, F_GETFL) & O_NONBLOCK));
+  /* The next probe closes it */
+  _TEST_CHECK(dgtnixProbe(ports, 1, 10) == -1);
+  _TEST_CHECK(g_probedDescriptor == -1);
+  close(master);
+  close(slave);
+}
+
+/* A capture records a message read byte by byte as one record */
+static void _testCaptureMessages()
+{
+  unsigned char version[5] = { _DGTNIX_MSG_VERSION, 0, 5, 3, 1 };
+  unsigned char request = _DGTNIX_SEND_VERSION;
+  unsigned char magic[_DGTNIX_CAPTURE_MAGIC_SIZE], data[8];
+  char path[] = "/tmp/dgtnixUnitTestXXXXXX", direction;
+  uint64_t ns;
+  uint16_t length;
+  int board[2];
+  size_t i;
+  FILE *file;
+  close(mkstemp(path));
+  _TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, board) == 0);
+  g_descriptorDriverBoard = board[0];
+  _TEST_CHECK(dgtnixStartCapture(path) == 0);
+  _TEST_CHECK(_boardWrite(&request, 1) == 1);
+  for(i = 0; i < sizeof(version); i++)
+    _TEST_CHECK(write(board[1], &version[i], 1) == 1);
+  _TEST_CHECK(_readMessageFromBoard() == 1);
+  dgtnixStopCapture();
+  g_descriptorDriverBoard = -1;
+  close(board[0]);
+  close(board[1]);
+  _TEST_CHECK((file = fopen(path, "rb")) != NULL);
+  if(!file)
+    return;
+  _TEST_CHECK(fread(magic, 1, sizeof(magic), file) == sizeof(magic));
+  _TEST_CHECK(memcmp(magic, _DGTNIX_CAPTURE_MAGIC, sizeof(magic)) == 0);
+  _TEST_CHECK(fread(&direction, 1, 1, file) == 1 && direction == _DGTNIX_CAPTURE_WRITE);
+  _TEST_CHECK(fread(&ns, sizeof(ns), 1, file) == 1);
+  _TEST_CHECK(fread(&length, sizeof(length), 1, file) == 1 && length == 1);
+  _TEST_CHECK(fread(data, 1, 1, file) == 1 && data[0] == request);
+  _TEST_CHECK(fread(&direction, 1, 1, file) == 1 && direction == _DGTNIX_CAPTURE_READ);
+  _TEST_CHECK(fread(&ns, sizeof(ns), 1, file) == 1);
+  _TEST_CHECK(fread(&length, sizeof(length), 1, file) == 1 && length == sizeof(version));
+  _TEST_CHECK(fread(data, 1, sizeof(version), file) == sizeof(version));
+  _TEST_CHECK(memcmp(data, version, sizeof(version)) == 0);
+  _TEST_CHECK(fread(&direction, 1, 1, file) == 0);
+  fclose(file);
+  unlink(path);
+}
+
+static void *_testGetBoardThread(void *params)
+{
+  (void)params;
+  return (void *)dgtnixGetBoard(true);
+}
+
+/* Every thread gets its own copy of the board from dgtnixGetBoard() */
+static void _testGetBoardPerThread()
+{
+  pthread_t thread;
+  void *other;
+  const char *board;
+  g_initialised = 1;
+  pthread_mutex_lock(&g_mutex);
+  memset(g_board, _DGTNIX_EMPTY, sizeof(g_board));
+  g_board[0] = _DGTNIX_WKING;
+  _publishBoard();
+  pthread_mutex_unlock(&g_mutex);
+  board = dgtnixGetBoard(true);
+  pthread_create(&thread, NULL, _testGetBoardThread, NULL);
+  pthread_join(thread, &other);
+  _TEST_CHECK(other != (void *)board);
+  _TEST_CHECK(memchr(board, 'K', 64) != NULL && memchr(board, 'k', 64) == NULL);
+  g_initialised = 0;
+}
+
+static void *_testWaitTimeThread(void *params)
+{
+  dgtnixEvent events[4];
+  *(int *)params = dgtnixWaitEvents(DGTNIX_EVENT_TIME, 2000, events, 4);
+  return NULL;
+}
+
+static int _testTimeWaiters()
+{
+  int waiters;
+  pthread_mutex_lock(&g_eventMutex);
+  waiters = g_eventWaiters[__builtin_ctz(DGTNIX_EVENT_TIME)];
+  pthread_mutex_unlock(&g_eventMutex);
+  return waiters;
+}
+
+/* A class that is not subscribed is only queued while it is waited for
+   or in the mask of the eventfd */
+static void _testWaitMaskTemporary()
+{
+  dgtnixEvent events[4], time;
+  pthread_t thread;
+  int found = -1, i;
+  memset(&time, 0, sizeof(time));
+  time.type = DGTNIX_EVENT_TIME;
+  g_initialised = 1;
+  dgtnixSubscribeEvents(DGTNIX_EVENT_ALL & ~DGTNIX_EVENT_TIME);
+  _testTakeEvents(events, 4);
+  _postEvent(&time);
+  _TEST_CHECK(_testTakeEvents(events, 4) == 0);
+  pthread_create(&thread, NULL, _testWaitTimeThread, &found);
+  for(i = 0; i < 2000 && !_testTimeWaiters(); i++)
+    usleep(1000);
+  _postEvent(&time);
+  pthread_join(thread, NULL);
+  _TEST_CHECK(found == 1);
+  /* Not after the wait */
+  _postEvent(&time);
+  _TEST_CHECK(_testTakeEvents(events, 4) == 0);
+  _TEST_CHECK(dgtnixEventFd(DGTNIX_EVENT_TIME) >= 0);
+  _postEvent(&time);
+  _TEST_CHECK(_testTakeEvents(events, 4) == 1);
+  dgtnixEventFd(0);
+  _postEvent(&time);
+  _TEST_CHECK(_testTakeEvents(events, 4) == 0);
+  _TEST_CHECK((g_eventSubscription & DGTNIX_EVENT_TIME) == 0);
+  g_initialised = 0;
+}
+
+static void *_testWaitForeverThread(void *params)
+{
+  dgtnixEvent events[4];
+  *(int *)params = dgtnixWaitEvents(DGTNIX_EVENT_TIME, -1, events, 4);
+  return NULL;
+}
+
+/* dgtnixWaitEvents() returns -1 on a closed driver, and wakes up with -1 
+   when the driver thread gives up, instead of exiting the process */
+static void _testWaitEventsClosed()
+{
+  dgtnixEvent events[4];
+  pthread_t thread;
+  int found = 0, i;
+  _TEST_CHECK(dgtnixWaitEvents(DGTNIX_EVENT_ALL, 0, events, 4) == -1);
+  _TEST_CHECK(!dgtnixIsInitialised());
+  g_initialised = 1;
+  _TEST_CHECK(dgtnixIsInitialised());
+  pthread_create(&thread, NULL, _testWaitForeverThread, &found);
+  for(i = 0; i < 2000 && !_testTimeWaiters(); i++)
+    usleep(1000);
+  /* As _threadManagedFunc() after five read errors */
+  g_initialised = 0;
+  _wakeEventWaiters();
+  pthread_join(thread, NULL);
+  _TEST_CHECK(found == -1);
+}
+
+/* Publications of _testSeqlock() */
+#define _TEST_PUBLICATIONS 20000
+
+/* Publishes boards of a single piece, alternately kings and pawns */
+static void *_testPublishThread(void *params)
+{
+  int i;
+  (void)params;
+  for(i = 0; i < _TEST_PUBLICATIONS; i++)
+    {
+      pthread_mutex_lock(&g_mutex);
+      memset(g_board, i & 1 ? _DGTNIX_WPAWN : _DGTNIX_WKING, sizeof(g_board));
+      _publishBoard();
+      pthread_mutex_unlock(&g_mutex);
+    }
+  return NULL;
+}
+
+/* dgtnixCopyBoard() never returns a board torn by a concurrent publication
+   (only likely to race on several cores) */
+static void _testSeqlock()
+{
+  pthread_t writer;
+  char board[64];
+  unsigned long start, version, last, sequence;
+  int torn = 0, older = 0, copies = 0, i;
+  g_initialised = 1;
+  pthread_mutex_lock(&g_mutex);
+  memset(g_board, _DGTNIX_WPAWN, sizeof(g_board));
+  _publishBoard();
+  pthread_mutex_unlock(&g_mutex);
+  start = last = dgtnixGetBoardVersion();
+  _TEST_CHECK(!dgtnixBoardChangedSince(start));
+  pthread_create(&writer, NULL, _testPublishThread, NULL);
+  while(last < start + _TEST_PUBLICATIONS)
+    {
+      version = dgtnixCopyBoard(board);
+      for(i = 1; i < 64; i++)
+	if(board[i] != board[0])
+	  break;
+      torn += i < 64 || (board[0] != 'K' && board[0] != 'P');
+      older += version < last;
+      last = version;
+      copies++;
+    }
+  pthread_join(writer, NULL);
+  _TEST_CHECK(torn == 0);
+  _TEST_CHECK(older == 0);
+  _TEST_CHECK(copies > 0);
+  _TEST_CHECK(dgtnixGetBoardVersion() == start + _TEST_PUBLICATIONS);
+  _TEST_CHECK(dgtnixBoardChangedSince(start));
+  /* The last board published was of pawns */
+  _TEST_CHECK(dgtnixCopyBoard(board) == start + _TEST_PUBLICATIONS && board[63] == 'P');
+  /* Midway through a publication the readers copy the previous board */
+  sequence = g_snapshotSequence;
+  g_snapshotSequence = sequence + 1;
+  memset(g_snapshots[((sequence >> 1) + 1) & 1], '?', 64);
+  _TEST_CHECK(dgtnixCopyBoard(board) == sequence >> 1 && board[0] == 'P' && board[63] == 'P');
+  g_snapshotSequence = sequence;
+  g_initialised = 0;
+}
+
+static void _testPostButton(int code)
+{
+  dgtnixEvent event;
+  memset(&event, 0, sizeof(event));
+  event.type = DGTNIX_EVENT_BUTTON;
+  event.code = code;
+  _postEvent(&event);
+}
+
+/* A full queue drops its oldest events, and counts them */
+static void _testEventQueueFull()
+{
+  static dgtnixEvent events[_DGTNIX_EVENT_QUEUE_SIZE + 4];
+  dgtnixStats stats;
+  int i, count;
+  dgtnixSubscribeEvents(DGTNIX_EVENT_ALL);
+  _testTakeEvents(events, _DGTNIX_EVENT_QUEUE_SIZE);
+  dgtnixGetStats(&stats, 1);
+  for(i = 0; i < _DGTNIX_EVENT_QUEUE_SIZE + 3; i++)
+    _testPostButton(i);
+  dgtnixGetStats(&stats, 1);
+  _TEST_CHECK(stats.eventsDropped == 3);
+  count = _testTakeEvents(events, _DGTNIX_EVENT_QUEUE_SIZE + 4);
+  _TEST_CHECK(count == _DGTNIX_EVENT_QUEUE_SIZE);
+  _TEST_CHECK(events[0].code == 3);
+  _TEST_CHECK(events[count - 1].code == _DGTNIX_EVENT_QUEUE_SIZE + 2);
+  dgtnixSubscribeEvents(DGTNIX_EVENT_ALL & ~DGTNIX_EVENT_TIME);
+}
+
+/* dgtnixWaitEvents() takes the matching events in order, at most max of
+   them, and leaves the others queued in order */
+static void _testEventBatch()
+{
+  dgtnixEvent events[8], ack;
+  memset(&ack, 0, sizeof(ack));
+  ack.type = DGTNIX_EVENT_ACK;
+  g_initialised = 1;
+  _testTakeEvents(events, 8);
+  _testPostButton(1);
+  ack.code = 1;
+  _postEvent(&ack);
+  _testPostButton(2);
+  _testPostButton(3);
+  ack.code = 2;
+  _postEvent(&ack);
+  _TEST_CHECK(dgtnixWaitEvents(DGTNIX_EVENT_BUTTON, 0, events, 2) == 2);
+  _TEST_CHECK(events[0].code == 1 && events[1].code == 2);
+  _TEST_CHECK(_testTakeEvents(events, 8) == 3);
+  _TEST_CHECK(events[0].type == DGTNIX_EVENT_ACK && events[0].code == 1);
+  _TEST_CHECK(events[1].type == DGTNIX_EVENT_BUTTON && events[1].code == 3);
+  _TEST_CHECK(events[2].type == DGTNIX_EVENT_ACK && events[2].code == 2);
+  /* Nothing matching, no wait */
+  _TEST_CHECK(dgtnixWaitEvents(DGTNIX_EVENT_BUTTON, 0, events, 8) == 0);
+  g_initialised = 0;
+}
+
+static void _testCaptureRecord(FILE *file, char direction, uint64_t ns,
+			       const unsigned char *data, uint16_t length)
+{
+  _TEST_CHECK(fwrite(&direction, 1, 1, file) == 1);
+  _TEST_CHECK(fwrite(&ns, sizeof(ns), 1, file) == 1);
+  _TEST_CHECK(fwrite(&length, sizeof(length), 1, file) == 1);
+  _TEST_CHECK(fwrite(data, 1, length, file) == length);
+}
+
+/* dgtnixInitReplay() feeds the board messages of a capture to the driver,
+   and skips what the driver wrote */
+static void _testReplay()
+{
+  unsigned char request = _DGTNIX_SEND_BRD;
+  unsigned char dump[_DGTNIX_SIZE_BOARD_DUMP] = { _DGTNIX_MSG_BOARD_DUMP, 0, _DGTNIX_SIZE_BOARD_DUMP };
+  char path[] = "/tmp/dgtnixUnitTestXXXXXX", board[64];
+  FILE *file;
+  int i;
+  dump[3] = _DGTNIX_WKING;
+  dump[3 + 63] = _DGTNIX_BQUEEN;
+  close(mkstemp(path));
+  _TEST_CHECK((file = fopen(path, "wb")) != NULL);
+  if(!file)
+    return;
+  _TEST_CHECK(fwrite(_DGTNIX_CAPTURE_MAGIC, 1, _DGTNIX_CAPTURE_MAGIC_SIZE, file) == _DGTNIX_CAPTURE_MAGIC_SIZE);
+  _testCaptureRecord(file, _DGTNIX_CAPTURE_WRITE, 1000, &request, 1);
+  _testCaptureRecord(file, _DGTNIX_CAPTURE_READ, 2000, dump, sizeof(dump));
+  fclose(file);
+  /* The driver thread waits on the system clock */
+  dgtnixSetClock(NULL);
+  _TEST_CHECK(dgtnixInitReplay(path, 0) >= 0);
+  if(g_initialised)
+    {
+      _TEST_CHECK(dgtnixWaitReplay(2000) == sizeof(dump));
+      dgtnixCopyBoard(board);
+      _TEST_CHECK(memchr(board, 'K', 64) != NULL && memchr(board, 'q', 64) != NULL);
+      for(i = 0; i < 64 && board[i] != 'K' && board[i] != 'q'; i++)
+	_TEST_CHECK(board[i] == ' ');
+      dgtnixClose();
+    }
+  _TEST_CHECK(g_virtualBoardMode == _DGTNIX_REAL_BOARD && g_replayFile == NULL);
+  unlink(path);
+}
+
+/* Without clock, dgtnixSendMessageToClock() gives up after tries messages */
+static void _testClockAckTries()
+{
+  unsigned char sent[4 * 13];
+  dgtnixStats stats;
+  int board[2];
+  _testSetClock();
+  _TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, board) == 0);
+  g_descriptorDriverBoard = board[0];
+  dgtnixGetStats(&stats, 1);
+  _TEST_CHECK(dgtnixSendMessageToClock("pic023", 1, 0, 3) == 0);
+  _TEST_CHECK(recv(board[1], sent, sizeof(sent), MSG_DONTWAIT) == 3 * 13);
+  _TEST_CHECK(sent[0] == _DGTNIX_CLOCK_MESSAGE && sent[13] == _DGTNIX_CLOCK_MESSAGE);
+  dgtnixGetStats(&stats, 1);
+  _TEST_CHECK(stats.clockMessages == 1 && stats.clockRetries == 2);
+  /* The ack mutex is free for the next message */
+  _TEST_CHECK(pthread_mutex_trylock(&clock_ack_mutex) == 0);
+  pthread_mutex_unlock(&clock_ack_mutex);
+  _TEST_CHECK(g_clockSendTime == 0);
+  g_descriptorDriverBoard = -1;
+  close(board[0]);
+  close(board[1]);
+}
+
+typedef struct _unitTest
+{
+  const char *name;
+  void (*function)();
+} _unitTest;
+
+static const _unitTest g_unitTests[] =
+  {
+    { "debugLongStrings", _testDebugLongStrings },
+    { "buttonEdges", _testButtonEdges },
+    { "clockButtonBits", _testClockButtonBits },
+    { "reconnectBackoff", _testReconnectBackoff },
+    { "bwtimeLever", _testBwtimeLever },
+    { "probeKeepsBoard", _testProbeKeepsBoard },
+    { "captureMessages", _testCaptureMessages },
+    { "getBoardPerThread", _testGetBoardPerThread },
+    { "waitMaskTemporary", _testWaitMaskTemporary },
+    { "waitEventsClosed", _testWaitEventsClosed },
+    { "seqlock", _testSeqlock },
+    { "eventQueueFull", _testEventQueueFull },
+    { "eventBatch", _testEventBatch },
+    { "replay", _testReplay },
+    { "clockAckTries", _testClockAckTries },
+  };
+
+int main()
+{
+  int failed = 0;
+  size_t i;
+  /* The engine pipe writes must not kill us */
+  signal(SIGPIPE, SIG_IGN);
+  for(i = 0; i < sizeof(g_unitTests) / sizeof(g_unitTests[0]); i++)
+    {
+      int failures = g_testFailures;
+      g_unitTests[i].function();
+      fprintf(stderr, "%-24s %s\n", g_unitTests[i].name, g_testFailures == failures ? "ok" : "FAIL");
+      failed += g_testFailures != failures;
+    }
+  return failed;
+}
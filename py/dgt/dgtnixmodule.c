@@ -0,0 +1,875 @@
+/* _dgtnix, CPython extension module wrapping the dgtnix driver
+   Copyright (C) 2006 Pierre Boulenguez
+                 2012 Jean-Francois Romang
+                 2012-2013 Shivkumar Shivaji
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License
+   as published by the Free Software Foundation; either version 2
+   of the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+/*
+ * Unlike dgtnix.py (ctypes), this module calls the driver directly :
+ * + Board objects hold a 64 bytes board representation that is refreshed
+ *   in place from the driver snapshot and exported through the buffer
+ *   protocol, memoryview(board) does not copy anything.
+ * + Events are returned as native structures, by wait_events(), by the
+ *   events() iterator or pushed to a callback by watch(). The GIL is
+ *   released while waiting.
+ * Build it with "python setup.py build_ext --inplace" in this directory.
+ */
+#include <Python.h>
+#include <structseq.h>
+#include <pthread.h>
+#include "dgtnix.h"
+
+/* events copied out of the driver by one wait */
+#define _DGTNIX_EVENT_BATCH_SIZE 64
+/* maximum number of watch() threads */
+#define _DGTNIX_MAX_WATCHERS 8
+
+/* a thread pushing events to a Python callback */
+typedef struct
+{
+  pthread_t thread;
+  unsigned int mask;
+  PyObject *callback;
+} _watcher;
+
+static PyObject *g_dgtnixError;
+/* Set from init() to close(). dgtnix exits the process if called while not 
+   initialised, which its thread may also end by itself : see _checkInitialised() */
+static int g_driverInitialised = 0;
+static _watcher g_watchers[_DGTNIX_MAX_WATCHERS];
+static int g_watcherCount = 0;
+
+static int _checkInitialised()
+{
+  if(!g_driverInitialised || !dgtnixIsInitialised())
+    {
+      PyErr_SetString(g_dgtnixError, "the driver is not initialised");
+      return 0;
+    }
+  return 1;
+}
+
+/****************/
+/* Event type   */
+/****************/
+
+static PyTypeObject EventType;
+
+static PyStructSequence_Field _eventFields[] = {
+  {"type", "DGTNIX_EVENT_... class"},
+  {"code", "MSG_MV_ADD or MSG_MV_REMOVE for moves, button number for buttons"},
+  {"column", "column of the square of a move"},
+  {"line", "line of the square of a move"},
+  {"piece", "piece of a move"},
+  {"wtime", "white clock time"},
+  {"btime", "black clock time"},
+  {"wturn", "1 if white is to move on the clock"},
+  {"version", "board version after a move or of a stable position"},
+  {"timestamp", "monotonic time of the event, in seconds"},
+  {"flags", "BUTTON_... flags of a button event"},
+  {"buttons", "mask of the buttons concerned (1 << button number)"},
+  {"press_time", "monotonic time the button was pressed, in seconds"},
+  {"arrival", "monotonic time the board message behind the event was read, 0 if unknown"},
+  {NULL}
+};
+
+static PyStructSequence_Desc _eventDesc = {
+  "_dgtnix.Event",
+  "An event of the dgtnix driver, see dgtnixEvent in dgtnix.h",
+  _eventFields,
+  14
+};
+
+/* Square and piece characters are None when the event has none */
+static PyObject *_charOrNone(char c)
+{
+  if(!c)
+    Py_RETURN_NONE;
+  return PyString_FromStringAndSize(&c, 1);
+}
+
+static PyObject *_newEvent(const dgtnixEvent *event)
+{
+  PyObject *e = PyStructSequence_New(&EventType);
+  if(!e)
+    return NULL;
+  PyStructSequence_SET_ITEM(e, 0, PyInt_FromLong(event->type));
+  PyStructSequence_SET_ITEM(e, 1, PyInt_FromLong(event->code));
+  PyStructSequence_SET_ITEM(e, 2, _charOrNone(event->column));
+  PyStructSequence_SET_ITEM(e, 3, _charOrNone(event->line));
+  PyStructSequence_SET_ITEM(e, 4, _charOrNone(event->piece));
+  PyStructSequence_SET_ITEM(e, 5, PyInt_FromLong(event->wtime));
+  PyStructSequence_SET_ITEM(e, 6, PyInt_FromLong(event->btime));
+  PyStructSequence_SET_ITEM(e, 7, PyInt_FromLong(event->wturn));
+  PyStructSequence_SET_ITEM(e, 8, PyLong_FromUnsignedLong(event->version));
+  PyStructSequence_SET_ITEM(e, 9, PyFloat_FromDouble(event->timestamp));
+  PyStructSequence_SET_ITEM(e, 10, PyInt_FromLong(event->flags));
+  PyStructSequence_SET_ITEM(e, 11, PyInt_FromLong(event->buttons));
+  PyStructSequence_SET_ITEM(e, 12, PyFloat_FromDouble(event->pressTime));
+  PyStructSequence_SET_ITEM(e, 13, PyFloat_FromDouble(event->arrival));
+  if(PyErr_Occurred())
+    {
+      Py_DECREF(e);
+      return NULL;
+    }
+  return e;
+}
+
+/* Waits with the GIL released, returns the number of events or -1 */
+static int _waitEvents(unsigned int mask, int timeout, dgtnixEvent *events)
+{
+  int n;
+  if(!_checkInitialised())
+    return -1;
+  Py_BEGIN_ALLOW_THREADS
+  n = dgtnixWaitEvents(mask, timeout, events, _DGTNIX_EVENT_BATCH_SIZE);
+  Py_END_ALLOW_THREADS
+  if(n < 0)
+    PyErr_SetString(g_dgtnixError, "the driver was closed");
+  return n;
+}
+
+/****************/
+/* Board type   */
+/****************/
+
+typedef struct
+{
+  PyObject_HEAD
+  char board[64];
+  unsigned long version;
+} BoardObject;
+
+static int Board_init(BoardObject *self, PyObject *args, PyObject *kwds)
+{
+  memset(self->board, ' ', 64);
+  self->version = 0;
+  return 0;
+}
+
+static PyObject *Board_refresh(BoardObject *self)
+{
+  if(!_checkInitialised())
+    return NULL;
+  /* Nothing is copied when the board did not change */
+  if(self->version && !dgtnixBoardChangedSince(self->version))
+    Py_RETURN_FALSE;
+  self->version = dgtnixCopyBoard(self->board);
+  Py_RETURN_TRUE;
+}
+
+static PyObject *Board_fen(BoardObject *self, PyObject *args)
+{
+  char tomove = 'w';
+  char fen[90];
+  int sq, pos = 0, empty = 0;
+  if(!PyArg_ParseTuple(args, "|c:fen", &tomove))
+    return NULL;
+  for(sq = 0; sq < 64; sq++)
+    {
+      if(self->board[sq] != ' ')
+	{
+	  if(empty)
+	    fen[pos++] = '0' + empty;
+	  empty = 0;
+	  fen[pos++] = self->board[sq];
+	}
+      else
+	empty++;
+      if(sq % 8 == 7)
+	{
+	  if(empty)
+	    fen[pos++] = '0' + empty;
+	  empty = 0;
+	  if(sq < 63)
+	    fen[pos++] = '/';
+	}
+    }
+  /* Same data fields as getDgtFEN() */
+  pos += sprintf(fen + pos, " %c KQkq - 0 1", tomove);
+  return PyString_FromStringAndSize(fen, pos);
+}
+
+static Py_ssize_t Board_length(BoardObject *self)
+{
+  return 64;
+}
+
+static PyObject *Board_item(BoardObject *self, Py_ssize_t i)
+{
+  if(i < 0 || i >= 64)
+    {
+      PyErr_SetString(PyExc_IndexError, "square out of range");
+      return NULL;
+    }
+  return PyString_FromStringAndSize(&self->board[i], 1);
+}
+
+static int Board_getbuffer(BoardObject *self, Py_buffer *view, int flags)
+{
+  return PyBuffer_FillInfo(view, (PyObject *)self, self->board, 64, 1, flags);
+}
+
+static Py_ssize_t Board_getreadbuffer(BoardObject *self, Py_ssize_t segment, void **ptr)
+{
+  if(segment != 0)
+    {
+      PyErr_SetString(PyExc_SystemError, "accessing non-existent board segment");
+      return -1;
+    }
+  *ptr = self->board;
+  return 64;
+}
+
+static Py_ssize_t Board_getsegcount(BoardObject *self, Py_ssize_t *lenp)
+{
+  if(lenp)
+    *lenp = 64;
+  return 1;
+}
+
+static PyObject *Board_getversion(BoardObject *self, void *closure)
+{
+  return PyLong_FromUnsignedLong(self->version);
+}
+
+static PyMethodDef Board_methods[] = {
+  {"refresh", (PyCFunction)Board_refresh, METH_NOARGS,
+   "refresh() -> True if the board changed since the last refresh"},
+  {"fen", (PyCFunction)Board_fen, METH_VARARGS,
+   "fen(tomove='w') -> FEN string of the board"},
+  {NULL}
+};
+
+static PyGetSetDef Board_getset[] = {
+  {"version", (getter)Board_getversion, NULL, "driver board version of the last refresh", NULL},
+  {NULL}
+};
+
+static PySequenceMethods Board_as_sequence = {
+  (lenfunc)Board_length,
+  0, 0,
+  (ssizeargfunc)Board_item,
+};
+
+static PyBufferProcs Board_as_buffer = {
+  (readbufferproc)Board_getreadbuffer,
+  0,
+  (segcountproc)Board_getsegcount,
+  (charbufferproc)Board_getreadbuffer,
+  (getbufferproc)Board_getbuffer,
+  0,
+};
+
+static PyTypeObject BoardType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "_dgtnix.Board",
+  sizeof(BoardObject),
+};
+
+/**********************/
+/* Events iterator    */
+/**********************/
+
+typedef struct
+{
+  PyObject_HEAD
+  unsigned int mask;
+  int timeout;
+  int count;
+  int next;
+  dgtnixEvent events[_DGTNIX_EVENT_BATCH_SIZE];
+} EventIteratorObject;
+
+static PyObject *EventIterator_next(EventIteratorObject *self)
+{
+  if(self->next == self->count)
+    {
+      self->next = self->count = 0;
+      self->count = _waitEvents(self->mask, self->timeout, self->events);
+      /* A timeout or a closed driver ends the iteration */
+      if(self->count <= 0)
+	{
+	  self->count = 0;
+	  PyErr_Clear();
+	  return NULL;
+	}
+    }
+  return _newEvent(&self->events[self->next++]);
+}
+
+static PyTypeObject EventIteratorType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "_dgtnix.EventIterator",
+  sizeof(EventIteratorObject),
+};
+
+/**********************/
+/* Watcher threads    */
+/**********************/
+
+/* Runs without the GIL and only takes it to call back. Ends once the driver is 
+   closed, or gave up, and releases its callback then. */
+static void *_watchEvents(void *arg)
+{
+  _watcher *w = (_watcher *)arg;
+  /* close() may reuse the slot of w while a callback of this thread runs */
+  unsigned int mask = w->mask;
+  PyObject *callback = w->callback;
+  dgtnixEvent events[_DGTNIX_EVENT_BATCH_SIZE];
+  PyGILState_STATE state;
+  int i, n;
+  while((n = dgtnixWaitEvents(mask, -1, events, _DGTNIX_EVENT_BATCH_SIZE)) > 0)
+    {
+      state = PyGILState_Ensure();
+      for(i = 0; i < n; i++)
+	{
+	  PyObject *e = _newEvent(&events[i]);
+	  PyObject *result = e ? PyObject_CallFunctionObjArgs(callback, e, NULL) : NULL;
+	  Py_XDECREF(e);
+	  if(result)
+	    Py_DECREF(result);
+	  else
+	    PyErr_Print();
+	}
+      PyGILState_Release(state);
+    }
+  state = PyGILState_Ensure();
+  Py_DECREF(callback);
+  PyGILState_Release(state);
+  return NULL;
+}
+
+/* Joins the watchers after dgtnixClose() woke them up, called without the GIL. 
+   A watcher calling close() from its callback is not waited for, it ends 
+   once the callback returns. */
+static void _joinWatchers()
+{
+  int i;
+  for(i = 0; i < g_watcherCount; i++)
+    if(pthread_equal(g_watchers[i].thread, pthread_self()))
+      pthread_detach(g_watchers[i].thread);
+    else
+      pthread_join(g_watchers[i].thread, NULL);
+}
+
+/**********************/
+/* Module functions   */
+/**********************/
+
+static PyObject *dgtnix_init(PyObject *self, PyObject *args)
+{
+  const char *port;
+  int fd;
+  if(!PyArg_ParseTuple(args, "s:init", &port))
+    return NULL;
+  if(g_driverInitialised)
+    {
+      PyErr_SetString(g_dgtnixError, "close the driver first");
+      return NULL;
+    }
+  /* dgtnixInit waits for the first board dump */
+  Py_BEGIN_ALLOW_THREADS
+  fd = dgtnixInit(port);
+  Py_END_ALLOW_THREADS
+  if(fd < 0)
+    {
+      PyErr_Format(g_dgtnixError, "cannot initialise the driver on %s (%d)", port, fd);
+      return NULL;
+    }
+  g_driverInitialised = 1;
+  return PyInt_FromLong(fd);
+}
+
+static PyObject *dgtnix_probe(PyObject *self, PyObject *args)
+{
+  PyObject *sequence, *list;
+  const char *ports[DGTNIX_PROBE_MAX];
+  int timeout = 2000, count, i, index;
+  if(!PyArg_ParseTuple(args, "O|i:probe", &sequence, &timeout))
+    return NULL;
+  if(!(list = PySequence_Fast(sequence, "probe() expects a sequence of ports")))
+    return NULL;
+  count = PySequence_Fast_GET_SIZE(list);
+  if(count > DGTNIX_PROBE_MAX)
+    count = DGTNIX_PROBE_MAX;
+  for(i = 0; i < count; i++)
+    if(!(ports[i] = PyString_AsString(PySequence_Fast_GET_ITEM(list, i))))
+      {
+	Py_DECREF(list);
+	return NULL;
+      }
+  /* The strings stay alive with list */
+  Py_BEGIN_ALLOW_THREADS
+  index = dgtnixProbe(ports, count, timeout);
+  Py_END_ALLOW_THREADS
+  PyObject *found = index >= 0 ? PySequence_Fast_GET_ITEM(list, index) : Py_None;
+  Py_INCREF(found);
+  Py_DECREF(list);
+  return found;
+}
+
+static PyObject *dgtnix_init_replay(PyObject *self, PyObject *args)
+{
+  const char *capture;
+  double speed = 1.;
+  int fd;
+  if(!PyArg_ParseTuple(args, "s|d:init_replay", &capture, &speed))
+    return NULL;
+  if(g_driverInitialised)
+    {
+      PyErr_SetString(g_dgtnixError, "close the driver first");
+      return NULL;
+    }
+  Py_BEGIN_ALLOW_THREADS
+  fd = dgtnixInitReplay(capture, speed);
+  Py_END_ALLOW_THREADS
+  if(fd < 0)
+    {
+      PyErr_Format(g_dgtnixError, "cannot replay %s (%d)", capture, fd);
+      return NULL;
+    }
+  g_driverInitialised = 1;
+  return PyInt_FromLong(fd);
+}
+
+static PyObject *dgtnix_wait_replay(PyObject *self, PyObject *args)
+{
+  int timeout = -1;
+  long bytes;
+  if(!PyArg_ParseTuple(args, "|i:wait_replay", &timeout))
+    return NULL;
+  if(!_checkInitialised())
+    return NULL;
+  Py_BEGIN_ALLOW_THREADS
+  bytes = dgtnixWaitReplay(timeout);
+  Py_END_ALLOW_THREADS
+  if(bytes < 0)
+    Py_RETURN_NONE;
+  return PyInt_FromLong(bytes);
+}
+
+static PyObject *dgtnix_start_capture(PyObject *self, PyObject *args)
+{
+  const char *path;
+  if(!PyArg_ParseTuple(args, "s:start_capture", &path))
+    return NULL;
+  if(dgtnixStartCapture(path) < 0)
+    {
+      errno = dgtnix_errno;
+      return PyErr_SetFromErrnoWithFilename(g_dgtnixError, (char *)path);
+    }
+  Py_RETURN_NONE;
+}
+
+static PyObject *dgtnix_stop_capture(PyObject *self)
+{
+  dgtnixStopCapture();
+  Py_RETURN_NONE;
+}
+
+static PyObject *dgtnix_close(PyObject *self)
+{
+  /* Also once the driver thread gave up on the board, to join it */
+  if(!g_driverInitialised)
+    {
+      PyErr_SetString(g_dgtnixError, "the driver is not initialised");
+      return NULL;
+    }
+  g_driverInitialised = 0;
+  Py_BEGIN_ALLOW_THREADS
+  dgtnixClose();
+  _joinWatchers();
+  Py_END_ALLOW_THREADS
+  /* The watchers released their callbacks */
+  g_watcherCount = 0;
+  Py_RETURN_NONE;
+}
+
+static PyObject *dgtnix_wait_events(PyObject *self, PyObject *args)
+{
+  unsigned int mask = DGTNIX_EVENT_ALL;
+  int timeout = -1, i, n;
+  dgtnixEvent events[_DGTNIX_EVENT_BATCH_SIZE];
+  PyObject *list;
+  if(!PyArg_ParseTuple(args, "|Ii:wait_events", &mask, &timeout))
+    return NULL;
+  n = _waitEvents(mask, timeout, events);
+  if(n < 0)
+    return NULL;
+  list = PyList_New(n);
+  if(!list)
+    return NULL;
+  for(i = 0; i < n; i++)
+    {
+      PyObject *e = _newEvent(&events[i]);
+      if(!e)
+	{
+	  Py_DECREF(list);
+	  return NULL;
+	}
+      PyList_SET_ITEM(list, i, e);
+    }
+  return list;
+}
+
+static PyObject *dgtnix_event_fd(PyObject *self, PyObject *args)
+{
+  unsigned int mask = DGTNIX_EVENT_ALL;
+  int fd;
+  if(!PyArg_ParseTuple(args, "|I:event_fd", &mask))
+    return NULL;
+  fd = dgtnixEventFd(mask);
+  if(fd < 0)
+    return PyErr_SetFromErrno(PyExc_OSError);
+  return PyInt_FromLong(fd);
+}
+
+static PyObject *dgtnix_events(PyObject *self, PyObject *args)
+{
+  EventIteratorObject *it;
+  unsigned int mask = DGTNIX_EVENT_ALL;
+  int timeout = -1;
+  if(!PyArg_ParseTuple(args, "|Ii:events", &mask, &timeout))
+    return NULL;
+  it = PyObject_New(EventIteratorObject, &EventIteratorType);
+  if(!it)
+    return NULL;
+  it->mask = mask;
+  it->timeout = timeout;
+  it->count = it->next = 0;
+  return (PyObject *)it;
+}
+
+static PyObject *dgtnix_watch(PyObject *self, PyObject *args)
+{
+  unsigned int mask;
+  PyObject *callback;
+  _watcher *w;
+  if(!PyArg_ParseTuple(args, "IO:watch", &mask, &callback))
+    return NULL;
+  if(!_checkInitialised())
+    return NULL;
+  if(!PyCallable_Check(callback))
+    {
+      PyErr_SetString(PyExc_TypeError, "callback must be callable");
+      return NULL;
+    }
+  if(g_watcherCount == _DGTNIX_MAX_WATCHERS)
+    {
+      PyErr_SetString(g_dgtnixError, "too many watchers");
+      return NULL;
+    }
+  w = &g_watchers[g_watcherCount];
+  w->mask = mask;
+  w->callback = callback;
+  Py_INCREF(callback);
+  if(pthread_create(&w->thread, NULL, _watchEvents, w))
+    {
+      Py_DECREF(callback);
+      return PyErr_SetFromErrno(g_dgtnixError);
+    }
+  g_watcherCount++;
+  Py_RETURN_NONE;
+}
+
+static PyObject *dgtnix_subscribe_events(PyObject *self, PyObject *args)
+{
+  unsigned int mask;
+  if(!PyArg_ParseTuple(args, "I:subscribe_events", &mask))
+    return NULL;
+  dgtnixSubscribeEvents(mask);
+  Py_RETURN_NONE;
+}
+
+static PyObject *dgtnix_board_version(PyObject *self)
+{
+  if(!_checkInitialised())
+    return NULL;
+  return PyLong_FromUnsignedLong(dgtnixGetBoardVersion());
+}
+
+static PyObject *dgtnix_test_board(PyObject *self, PyObject *args)
+{
+  Py_buffer board;
+  int equal;
+  if(!PyArg_ParseTuple(args, "s*:test_board", &board))
+    return NULL;
+  if(board.len != 64)
+    {
+      PyBuffer_Release(&board);
+      PyErr_SetString(PyExc_ValueError, "a board is 64 characters long");
+      return NULL;
+    }
+  equal = _checkInitialised() ? dgtnixTestBoard((const char *)board.buf) : -1;
+  PyBuffer_Release(&board);
+  if(equal < 0)
+    return NULL;
+  return PyBool_FromLong(equal);
+}
+
+static PyObject *dgtnix_set_option(PyObject *self, PyObject *args)
+{
+  unsigned long option;
+  unsigned int value;
+  if(!PyArg_ParseTuple(args, "kI:set_option", &option, &value))
+    return NULL;
+  dgtnixSetOption(option, value);
+  Py_RETURN_NONE;
+}
+
+static PyObject *dgtnix_query_string(PyObject *self, PyObject *args)
+{
+  unsigned int flag;
+  const char *s;
+  if(!PyArg_ParseTuple(args, "I:query_string", &flag))
+    return NULL;
+  if(!_checkInitialised())
+    return NULL;
+  s = dgtnixQueryString(flag);
+  if(!s)
+    Py_RETURN_NONE;
+  return PyString_FromString(s);
+}
+
+static PyObject *dgtnix_get_clock_data(PyObject *self)
+{
+  int wtime, btime, wturn;
+  if(!_checkInitialised())
+    return NULL;
+  if(!dgtnixGetClockData(&wtime, &btime, &wturn))
+    Py_RETURN_NONE;
+  return Py_BuildValue("(iii)", wtime, btime, wturn);
+}
+
+static PyObject *dgtnix_print_message_on_clock(PyObject *self, PyObject *args)
+{
+  const char *message;
+  int beep = 0, dots = 0, tries = 0, acked;
+  if(!PyArg_ParseTuple(args, "s|iii:print_message_on_clock", &message, &beep, &dots, &tries))
+    return NULL;
+  if(!_checkInitialised())
+    return NULL;
+  if(strlen(message) < 6)
+    {
+      PyErr_SetString(PyExc_ValueError, "clock messages are 6 characters long");
+      return NULL;
+    }
+  /* Blocks until the clock acknowledges the message, or tries seconds without clock */
+  Py_BEGIN_ALLOW_THREADS
+  acked = dgtnixSendMessageToClock(message, beep, dots, tries);
+  Py_END_ALLOW_THREADS
+  return PyBool_FromLong(acked == 1);
+}
+
+static PyObject *_ulongList(const unsigned long *values, int count)
+{
+  int i;
+  PyObject *list = PyList_New(count);
+  if(!list)
+    return NULL;
+  for(i = 0; i < count; i++)
+    PyList_SET_ITEM(list, i, PyLong_FromUnsignedLong(values[i]));
+  return list;
+}
+
+static PyObject *dgtnix_get_stats(PyObject *self, PyObject *args)
+{
+  int reset = 0;
+  dgtnixStats stats;
+  if(!PyArg_ParseTuple(args, "|i:get_stats", &reset))
+    return NULL;
+  dgtnixGetStats(&stats, reset);
+  return Py_BuildValue("{s:k,s:k,s:k,s:k,s:N,s:N,s:k,s:k,s:k,s:k,s:k,s:k,s:k,s:k,s:k,s:k,s:k,s:N,s:k,s:N,s:k}",
+		       "read_calls", stats.readCalls,
+		       "read_bytes", stats.readBytes,
+		       "write_calls", stats.writeCalls,
+		       "write_bytes", stats.writeBytes,
+		       "frames", _ulongList(stats.frames, DGTNIX_STATS_COMMANDS),
+		       "frame_bytes", _ulongList(stats.frameBytes, DGTNIX_STATS_COMMANDS),
+		       "invalid_bytes", stats.invalidBytes,
+		       "desyncs", stats.desyncs,
+		       "dump_requests", stats.dumpRequests,
+		       "resyncs", stats.resyncs,
+		       "clock_messages", stats.clockMessages,
+		       "clock_retries", stats.clockRetries,
+		       "clock_acks", stats.clockAcks,
+		       "pipe_stalls", stats.pipeStalls,
+		       "events_dropped", stats.eventsDropped,
+		       "disconnects", stats.disconnects,
+		       "reconnects", stats.reconnects,
+		       "publish_latency", _ulongList(stats.publishLatency, DGTNIX_STATS_BUCKETS),
+		       "publish_latency_total", stats.publishLatencyTotal,
+		       "ack_latency", _ulongList(stats.ackLatency, DGTNIX_STATS_BUCKETS),
+		       "ack_latency_total", stats.ackLatencyTotal);
+}
+
+static PyObject *dgtnix_format_stats(PyObject *self, PyObject *args)
+{
+  int reset = 0;
+  char text[16384];
+  dgtnixStats stats;
+  if(!PyArg_ParseTuple(args, "|i:format_stats", &reset))
+    return NULL;
+  dgtnixGetStats(&stats, reset);
+  /* 16k holds every command and both histograms */
+  if(dgtnixFormatStats(&stats, text, sizeof(text)) < 0)
+    {
+      PyErr_SetString(g_dgtnixError, "statistics do not fit in the buffer");
+      return NULL;
+    }
+  return PyString_FromString(text);
+}
+
+static PyObject *dgtnix_set_simulated_clock(PyObject *self, PyObject *args)
+{
+  double speed = 0;
+  if(!PyArg_ParseTuple(args, "|d:set_simulated_clock", &speed))
+    return NULL;
+  dgtnixSetSimulatedClock(speed);
+  Py_RETURN_NONE;
+}
+
+static PyObject *dgtnix_set_system_clock(PyObject *self)
+{
+  dgtnixSetClock(NULL);
+  Py_RETURN_NONE;
+}
+
+static PyObject *dgtnix_clock_now(PyObject *self)
+{
+  return PyFloat_FromDouble(dgtnixClockNow());
+}
+
+static PyMethodDef dgtnix_methods[] = {
+  {"init", dgtnix_init, METH_VARARGS,
+   "init(port) -> descriptor of the engine pipe, see dgtnixInit"},
+  {"probe", dgtnix_probe, METH_VARARGS,
+   "probe(ports, timeout=2000) -> the first of ports with a board answering within timeout ms, or None, see dgtnixProbe"},
+  {"init_replay", dgtnix_init_replay, METH_VARARGS,
+   "init_replay(capture, speed=1.) -> as init(), the board is replaced by a capture, speed 0 is as fast as possible"},
+  {"wait_replay", dgtnix_wait_replay, METH_VARARGS,
+   "wait_replay(timeout=-1) -> number of bytes replayed, None on timeout"},
+  {"start_capture", dgtnix_start_capture, METH_VARARGS,
+   "start_capture(path) records the board traffic into path"},
+  {"stop_capture", (PyCFunction)dgtnix_stop_capture, METH_NOARGS,
+   "stop_capture() stops and flushes the capture"},
+  {"close", (PyCFunction)dgtnix_close, METH_NOARGS,
+   "close() closes the driver and stops the watchers"},
+  {"wait_events", dgtnix_wait_events, METH_VARARGS,
+   "wait_events(mask=EVENT_ALL, timeout=-1) -> list of Event, timeout in ms"},
+  {"event_fd", dgtnix_event_fd, METH_VARARGS,
+   "event_fd(mask=EVENT_ALL) -> eventfd readable when events of mask are queued, then take them with wait_events(mask, 0)"},
+  {"events", dgtnix_events, METH_VARARGS,
+   "events(mask=EVENT_ALL, timeout=-1) -> iterator over Event, stops on timeout or close"},
+  {"watch", dgtnix_watch, METH_VARARGS,
+   "watch(mask, callback) calls callback(event) from a driver thread for each event, "
+   "subscribe the classes of mask not to lose those between two waits"},
+  {"subscribe_events", dgtnix_subscribe_events, METH_VARARGS,
+   "subscribe_events(mask), see dgtnixSubscribeEvents"},
+  {"board_version", (PyCFunction)dgtnix_board_version, METH_NOARGS,
+   "board_version() -> version of the current board snapshot"},
+  {"test_board", dgtnix_test_board, METH_VARARGS,
+   "test_board(board) -> True if the board is on the DGT board"},
+  {"set_option", dgtnix_set_option, METH_VARARGS,
+   "set_option(option, value), see dgtnixSetOption"},
+  {"query_string", dgtnix_query_string, METH_VARARGS,
+   "query_string(flag) -> string, see dgtnixQueryString"},
+  {"get_clock_data", (PyCFunction)dgtnix_get_clock_data, METH_NOARGS,
+   "get_clock_data() -> (wtime, btime, wturn) or None without clock"},
+  {"print_message_on_clock", dgtnix_print_message_on_clock, METH_VARARGS,
+   "print_message_on_clock(message, beep=0, dots=0, tries=0) waits for the clock ack, "
+   "sending the message again every second, at most tries times if tries > 0; "
+   "True once acked"},
+  {"get_stats", dgtnix_get_stats, METH_VARARGS,
+   "get_stats(reset=False) -> dict of the driver counters, latency totals in microseconds"},
+  {"format_stats", dgtnix_format_stats, METH_VARARGS,
+   "format_stats(reset=False) -> the counters as text for a metrics scrape"},
+  {"set_simulated_clock", dgtnix_set_simulated_clock, METH_VARARGS,
+   "set_simulated_clock(speed=0.) times the driver with a clock speed times faster than real time, 0 skips every wait, see dgtnixSetSimulatedClock"},
+  {"set_system_clock", (PyCFunction)dgtnix_set_system_clock, METH_NOARGS,
+   "set_system_clock() times the driver with the system monotonic clock again"},
+  {"clock_now", (PyCFunction)dgtnix_clock_now, METH_NOARGS,
+   "clock_now() -> time of the driver clock, the clock of the event timestamps"},
+  {NULL}
+};
+
+PyMODINIT_FUNC init_dgtnix(void)
+{
+  PyObject *m;
+
+  BoardType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER;
+  BoardType.tp_doc = "Board() -> 64 squares board representation, refresh() it from the driver";
+  BoardType.tp_init = (initproc)Board_init;
+  BoardType.tp_new = PyType_GenericNew;
+  BoardType.tp_methods = Board_methods;
+  BoardType.tp_getset = Board_getset;
+  BoardType.tp_as_sequence = &Board_as_sequence;
+  BoardType.tp_as_buffer = &Board_as_buffer;
+  if(PyType_Ready(&BoardType) < 0)
+    return;
+
+  EventIteratorType.tp_flags = Py_TPFLAGS_DEFAULT;
+  EventIteratorType.tp_iter = PyObject_SelfIter;
+  EventIteratorType.tp_iternext = (iternextfunc)EventIterator_next;
+  if(PyType_Ready(&EventIteratorType) < 0)
+    return;
+
+  PyStructSequence_InitType(&EventType, &_eventDesc);
+
+  /* watch() threads call back into Python */
+  PyEval_InitThreads();
+
+  m = Py_InitModule3("_dgtnix", dgtnix_methods, "Native binding of the dgtnix driver");
+  if(!m)
+    return;
+  g_dgtnixError = PyErr_NewException("_dgtnix.DgtnixError", NULL, NULL);
+  Py_INCREF(g_dgtnixError);
+  PyModule_AddObject(m, "DgtnixError", g_dgtnixError);
+  Py_INCREF(&BoardType);
+  PyModule_AddObject(m, "Board", (PyObject *)&BoardType);
+  Py_INCREF(&EventType);
+  PyModule_AddObject(m, "Event", (PyObject *)&EventType);
+
+  PyModule_AddIntConstant(m, "MSG_MV_ADD", DGTNIX_MSG_MV_ADD);
+  PyModule_AddIntConstant(m, "MSG_MV_REMOVE", DGTNIX_MSG_MV_REMOVE);
+  PyModule_AddIntConstant(m, "SERIAL_STRING", DGTNIX_SERIAL_STRING);
+  PyModule_AddIntConstant(m, "BUSADDRESS_STRING", DGTNIX_BUSADDRESS_STRING);
+  PyModule_AddIntConstant(m, "VERSION_STRING", DGTNIX_VERSION_STRING);
+  PyModule_AddIntConstant(m, "TRADEMARK_STRING", DGTNIX_TRADEMARK_STRING);
+  PyModule_AddIntConstant(m, "DRIVER_VERSION", DGTNIX_DRIVER_VERSION);
+  PyModule_AddIntConstant(m, "EVENT_MOVE", DGTNIX_EVENT_MOVE);
+  PyModule_AddIntConstant(m, "EVENT_STABLE", DGTNIX_EVENT_STABLE);
+  PyModule_AddIntConstant(m, "EVENT_BUTTON", DGTNIX_EVENT_BUTTON);
+  PyModule_AddIntConstant(m, "EVENT_TIME", DGTNIX_EVENT_TIME);
+  PyModule_AddIntConstant(m, "EVENT_ACK", DGTNIX_EVENT_ACK);
+  PyModule_AddIntConstant(m, "EVENT_CONNECTION", DGTNIX_EVENT_CONNECTION);
+  PyModule_AddIntConstant(m, "EVENT_ALL", DGTNIX_EVENT_ALL);
+  PyModule_AddIntConstant(m, "BUTTON_PRESSED", DGTNIX_BUTTON_PRESSED);
+  PyModule_AddIntConstant(m, "BUTTON_RELEASED", DGTNIX_BUTTON_RELEASED);
+  PyModule_AddIntConstant(m, "BUTTON_LONG", DGTNIX_BUTTON_LONG);
+  PyModule_AddIntConstant(m, "BUTTON_CHORD", DGTNIX_BUTTON_CHORD);
+  PyModule_AddIntConstant(m, "TIME_LEVER", DGTNIX_TIME_LEVER);
+  PyModule_AddIntConstant(m, "CONNECTION_LOST", DGTNIX_CONNECTION_LOST);
+  PyModule_AddIntConstant(m, "CONNECTION_RESTORED", DGTNIX_CONNECTION_RESTORED);
+  PyModule_AddIntConstant(m, "BOARD_ORIENTATION", DGTNIX_BOARD_ORIENTATION);
+  PyModule_AddIntConstant(m, "BOARD_ORIENTATION_CLOCKLEFT", DGTNIX_BOARD_ORIENTATION_CLOCKLEFT);
+  PyModule_AddIntConstant(m, "BOARD_ORIENTATION_CLOCKRIGHT", DGTNIX_BOARD_ORIENTATION_CLOCKRIGHT);
+  PyModule_AddIntConstant(m, "DEBUG", DGTNIX_DEBUG);
+  PyModule_AddIntConstant(m, "DEBUG_ON", DGTNIX_DEBUG_ON);
+  PyModule_AddIntConstant(m, "DEBUG_OFF", DGTNIX_DEBUG_OFF);
+  PyModule_AddIntConstant(m, "DEBUG_WITH_TIME", DGTNIX_DEBUG_WITH_TIME);
+}
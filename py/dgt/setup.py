@@ -0,0 +1,22 @@
+## Builds the _dgtnix extension module (native binding of the dgtnix driver)
+## and _ucinfo (native parser of the UCI engine info lines, see ucinfo.h)
+##     python setup.py build_ext --inplace
+
+from distutils.core import setup, Extension
+
+# The driver builds clean with -Wall -Wextra, the modules use the CPython 2 idioms (PyCFunction
+# casts, unused self arguments, partly initialised type objects). Python adds -Wstrict-prototypes,
+# the driver declares its functions without arguments as f().
+WARNINGS = ["-Wall", "-Wextra", "-Wno-unused-parameter", "-Wno-missing-field-initializers",
+            "-Wno-cast-function-type", "-Wno-strict-prototypes"]
+
+setup(name="dgtnix",
+      version="1.9.2",
+      description="POSIX driver for the Digital Game Timer chess board and clock",
+      ext_modules=[Extension("_dgtnix",
+                             sources=["dgtnixmodule.c", "dgtnix.c"],
+                             libraries=["pthread"],
+                             extra_compile_args=WARNINGS),
+                   Extension("_ucinfo",
+                             sources=["ucinfomodule.c", "ucinfo.c"],
+                             extra_compile_args=WARNINGS)])
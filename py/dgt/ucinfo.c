@@ -0,0 +1,241 @@
+/* ucinfo, a parser of the info lines of UCI chess engines
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ucinfo.h"
+
+/*************************************/
+/* Intern functions declarations     */
+/*************************************/
+static int _isSpace(char);
+static int _isEnd(char);
+static const char *_nextToken(const char *, int *);
+static int _tokenIs(const char *, int, const char *);
+static int _isMove(const char *, int);
+static const char *_readLong(const char *, long long *);
+
+/*
+ * Token separators, and the end of a line
+ */
+static int _isSpace(char c)
+{
+  return c == ' ' || c == '\t';
+}
+
+static int _isEnd(char c)
+{
+  return c == '\0' || c == '\n' || c == '\r';
+}
+
+/*
+ * Returns the start of the token at or after p, its length in *length,
+ * NULL at the end of the line
+ */
+static const char *_nextToken(const char *p, int *length)
+{
+  const char *end;
+  while(_isSpace(*p))
+    p++;
+  if(_isEnd(*p))
+    return NULL;
+  end = p;
+  while(!_isSpace(*end) && !_isEnd(*end))
+    end++;
+  *length = end - p;
+  return p;
+}
+
+static int _tokenIs(const char *token, int length, const char *word)
+{
+  return (int)strlen(word) == length && !memcmp(token, word, length);
+}
+
+/*
+ * A move in UCI notation : e2e4, e7e8q, or 0000 for a null move
+ */
+static int _isMove(const char *token, int length)
+{
+  if(length == 4 && !memcmp(token, "0000", 4))
+    return 1;
+  if(length != 4 && length != 5)
+    return 0;
+  if(token[0] < 'a' || token[0] > 'h' || token[1] < '1' || token[1] > '8'
+     || token[2] < 'a' || token[2] > 'h' || token[3] < '1' || token[3] > '8')
+    return 0;
+  return length == 4 || strchr("qrbn", token[4]) != NULL;
+}
+
+/*
+ * Reads the number token after p into *value,
+ * returns where the parsing goes on, NULL when there is no number
+ */
+static const char *_readLong(const char *p, long long *value)
+{
+  char *end;
+  int length;
+  const char *token = _nextToken(p, &length);
+  if(!token)
+    return NULL;
+  *value = strtoll(token, &end, 10);
+  if(end == token)
+    return NULL;
+  return end;
+}
+
+int ucinfoCommonPrefix(const ucinfo *a, const ucinfo *b)
+{
+  int i, n = a->pvLength < b->pvLength ? a->pvLength : b->pvLength;
+  if(n > UCINFO_MAX_PV)
+    n = UCINFO_MAX_PV;
+  for(i = 0; i < n; i++)
+    if(strcmp(a->pv[i], b->pv[i]))
+      break;
+  return i;
+}
+
+int ucinfoParse(const char *line, ucinfo *info)
+{
+  const char *p, *token;
+  int length;
+  long long value;
+
+  token = _nextToken(line, &length);
+  if(!token || !_tokenIs(token, length, "info"))
+    return 0;
+  /* The moves are only overwritten up to the new pvLength */
+  memset(info, 0, offsetof(ucinfo, pv));
+  info->pv[0][0] = '\0';
+  p = token + length;
+  while((token = _nextToken(p, &length)) != NULL)
+    {
+      p = token + length;
+      if(_tokenIs(token, length, "string"))
+	break;
+      if(_tokenIs(token, length, "pv"))
+	{
+	  info->fields |= UCINFO_PV;
+	  /* The moves up to the next field */
+	  while((token = _nextToken(p, &length)) != NULL && _isMove(token, length))
+	    {
+	      if(info->pvLength < UCINFO_MAX_PV)
+		{
+		  memcpy(info->pv[info->pvLength], token, length);
+		  info->pv[info->pvLength][length] = '\0';
+		}
+	      info->pvLength++;
+	      p = token + length;
+	    }
+	  continue;
+	}
+      if(_tokenIs(token, length, "refutation") || _tokenIs(token, length, "currline"))
+	{
+	  /* Moves, after the cpu number for currline */
+	  while((token = _nextToken(p, &length)) != NULL
+		&& (_isMove(token, length) || (*token >= '0' && *token <= '9')))
+	    p = token + length;
+	  continue;
+	}
+      if(_tokenIs(token, length, "lowerbound"))
+	{
+	  info->bound = UCINFO_BOUND_LOWER;
+	  continue;
+	}
+      if(_tokenIs(token, length, "upperbound"))
+	{
+	  info->bound = UCINFO_BOUND_UPPER;
+	  continue;
+	}
+      if(_tokenIs(token, length, "score"))
+	{
+	  token = _nextToken(p, &length);
+	  if(!token)
+	    break;
+	  p = token + length;
+	  if(_tokenIs(token, length, "cp"))
+	    info->scoreType = UCINFO_SCORE_CP;
+	  else if(_tokenIs(token, length, "mate"))
+	    info->scoreType = UCINFO_SCORE_MATE;
+	  else
+	    continue;
+	  if(!(p = _readLong(p, &value)))
+	    {
+	      info->scoreType = UCINFO_SCORE_NONE;
+	      break;
+	    }
+	  info->score = (int)value;
+	  info->fields |= UCINFO_SCORE;
+	  continue;
+	}
+      if(_tokenIs(token, length, "currmove"))
+	{
+	  if((token = _nextToken(p, &length)) != NULL)
+	    p = token + length;
+	  continue;
+	}
+      /* The number fields */
+      {
+	const char *next = _readLong(p, &value);
+	unsigned int field = 0;
+	if(!next)
+	  continue;
+	if(_tokenIs(token, length, "depth"))
+	  {
+	    field = UCINFO_DEPTH;
+	    info->depth = (int)value;
+	  }
+	else if(_tokenIs(token, length, "seldepth"))
+	  {
+	    field = UCINFO_SELDEPTH;
+	    info->seldepth = (int)value;
+	  }
+	else if(_tokenIs(token, length, "multipv"))
+	  {
+	    field = UCINFO_MULTIPV;
+	    info->multipv = (int)value;
+	  }
+	else if(_tokenIs(token, length, "nodes"))
+	  {
+	    field = UCINFO_NODES;
+	    info->nodes = (unsigned long long)value;
+	  }
+	else if(_tokenIs(token, length, "nps"))
+	  {
+	    field = UCINFO_NPS;
+	    info->nps = (unsigned long long)value;
+	  }
+	else if(_tokenIs(token, length, "time"))
+	  {
+	    field = UCINFO_TIME;
+	    info->time = (long)value;
+	  }
+	else if(_tokenIs(token, length, "hashfull"))
+	  {
+	    field = UCINFO_HASHFULL;
+	    info->hashfull = (int)value;
+	  }
+	else if(_tokenIs(token, length, "tbhits"))
+	  {
+	    field = UCINFO_TBHITS;
+	    info->tbhits = (unsigned long long)value;
+	  }
+	/* currmovenumber, cpuload, ... : the number is skipped too */
+	info->fields |= field;
+	p = next;
+      }
+    }
+  return 1;
+}
@@ -0,0 +1,114 @@
+/* ucinfo, a parser of the info lines of UCI chess engines
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+/*
+ * An engine prints hundreds of info lines per second at high depth, such as
+ *   info depth 21 seldepth 30 multipv 1 score cp 35 lowerbound nodes 123456 nps 987654 time 125 pv e2e4 e7e5
+ * ucinfoParse() reads one in place into a ucinfo structure, without allocating
+ * anything, so that a reader can parse every line and only keep the last one.
+ */
+
+/******************************/
+/* API Functions list         */
+/******************************/
+/*
+  int ucinfoParse(const char *, ucinfo *);
+  int ucinfoCommonPrefix(const ucinfo *, const ucinfo *);
+*/
+
+#ifndef __UCINFO_H
+#define __UCINFO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /************************/
+  /* Constant definitions */
+  /************************/
+  /* moves of the pv kept, the others are counted in pvLength only */
+#define UCINFO_MAX_PV 64
+  /* a move in UCI notation with its terminating zero, "e7e8q" */
+#define UCINFO_SIZE_MOVE 6
+
+  /* score types */
+#define UCINFO_SCORE_NONE 0
+#define UCINFO_SCORE_CP 1
+#define UCINFO_SCORE_MATE 2
+
+  /* score bounds */
+#define UCINFO_BOUND_EXACT 0
+#define UCINFO_BOUND_LOWER 1
+#define UCINFO_BOUND_UPPER 2
+
+  /* fields present in a line, flags of ucinfo.fields */
+#define UCINFO_DEPTH 0x001
+#define UCINFO_SELDEPTH 0x002
+#define UCINFO_MULTIPV 0x004
+#define UCINFO_SCORE 0x008
+#define UCINFO_NODES 0x010
+#define UCINFO_NPS 0x020
+#define UCINFO_TIME 0x040
+#define UCINFO_HASHFULL 0x080
+#define UCINFO_TBHITS 0x100
+#define UCINFO_PV 0x200
+
+  /*******************/
+  /* Data structures */
+  /*******************/
+  typedef struct ucinfo
+  {
+    /* UCINFO_... flags of the fields found in the line, the others are 0 */
+    unsigned int fields;
+    int depth;
+    int seldepth;
+    int multipv;
+    /* UCINFO_SCORE_... type, centipawns or moves to mate, UCINFO_BOUND_... */
+    int scoreType;
+    int score;
+    int bound;
+    unsigned long long nodes;
+    unsigned long long nps;
+    unsigned long long tbhits;
+    /* milliseconds */
+    long time;
+    /* per mille */
+    int hashfull;
+    /* moves of the pv, the first UCINFO_MAX_PV are in pv */
+    int pvLength;
+    char pv[UCINFO_MAX_PV][UCINFO_SIZE_MOVE];
+  } ucinfo;
+
+  /******************************/
+  /* API Functions declarations */
+  /******************************/
+  /* int ucinfoParse(const char *line, ucinfo *info);
+   * Parses an engine output line, up to its end or its newline, into info.
+   * Returns 1 for an info line, 0 for another line (info is then untouched).
+   * Unknown fields are skipped, "string" ends the line.
+   */
+  int ucinfoParse(const char *, ucinfo *);
+
+  /* int ucinfoCommonPrefix(const ucinfo *a, const ucinfo *b);
+   * Returns the number of leading pv moves a and b have in common, among the kept ones.
+   */
+  int ucinfoCommonPrefix(const ucinfo *, const ucinfo *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UCINFO_H */
@@ -0,0 +1,159 @@
+/* _ucinfo, CPython extension module wrapping the ucinfo parser
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+*/
+
+/*
+ * An Info object holds a ucinfo structure that parse(line) fills in place :
+ * parsing a line creates no Python object, only reading the pv does.
+ * engine_info.py falls back on a Python parser with the same interface
+ * when the module is not built ("python setup.py build_ext --inplace").
+ */
+#include <Python.h>
+#include <structmember.h>
+#include <stddef.h>
+#include "ucinfo.h"
+
+typedef struct
+{
+  PyObject_HEAD
+  ucinfo info;
+} InfoObject;
+
+static PyTypeObject InfoType;
+
+static PyObject *Info_parse(InfoObject *self, PyObject *args)
+{
+  const char *line;
+  int length;
+  if(!PyArg_ParseTuple(args, "s#:parse", &line, &length))
+    return NULL;
+  if(ucinfoParse(line, &self->info))
+    Py_RETURN_TRUE;
+  Py_RETURN_FALSE;
+}
+
+static PyObject *Info_copy(InfoObject *self)
+{
+  InfoObject *copy = PyObject_New(InfoObject, &InfoType);
+  if(!copy)
+    return NULL;
+  copy->info = self->info;
+  return (PyObject *)copy;
+}
+
+static PyObject *Info_common_prefix(InfoObject *self, PyObject *args)
+{
+  InfoObject *other;
+  if(!PyArg_ParseTuple(args, "O!:common_prefix", &InfoType, &other))
+    return NULL;
+  return PyInt_FromLong(ucinfoCommonPrefix(&self->info, &other->info));
+}
+
+static PyObject *Info_getpv(InfoObject *self, void *closure)
+{
+  int i, n = self->info.pvLength < UCINFO_MAX_PV ? self->info.pvLength : UCINFO_MAX_PV;
+  PyObject *pv = PyList_New(n);
+  if(!pv)
+    return NULL;
+  for(i = 0; i < n; i++)
+    {
+      PyObject *move = PyString_FromString(self->info.pv[i]);
+      if(!move)
+	{
+	  Py_DECREF(pv);
+	  return NULL;
+	}
+      PyList_SET_ITEM(pv, i, move);
+    }
+  return pv;
+}
+
+static PyMethodDef Info_methods[] = {
+  {"parse", (PyCFunction)Info_parse, METH_VARARGS,
+   "parse(line) -> True and the fields of the info line in place, False for another line"},
+  {"copy", (PyCFunction)Info_copy, METH_NOARGS,
+   "copy() -> Info with the same fields"},
+  {"common_prefix", (PyCFunction)Info_common_prefix, METH_VARARGS,
+   "common_prefix(other) -> number of leading pv moves in common with other"},
+  {NULL}
+};
+
+#define _INFO_MEMBER(name, type, field, doc) \
+  {name, type, offsetof(InfoObject, info) + offsetof(ucinfo, field), READONLY, doc}
+
+static PyMemberDef Info_members[] = {
+  _INFO_MEMBER("fields", T_UINT, fields, "FIELD_... flags of the fields of the line"),
+  _INFO_MEMBER("depth", T_INT, depth, "depth"),
+  _INFO_MEMBER("seldepth", T_INT, seldepth, "selective depth"),
+  _INFO_MEMBER("multipv", T_INT, multipv, "multipv number, 0 if none"),
+  _INFO_MEMBER("score_type", T_INT, scoreType, "SCORE_NONE, SCORE_CP or SCORE_MATE"),
+  _INFO_MEMBER("score", T_INT, score, "centipawns or moves to mate"),
+  _INFO_MEMBER("bound", T_INT, bound, "BOUND_EXACT, BOUND_LOWER or BOUND_UPPER"),
+  _INFO_MEMBER("nodes", T_ULONGLONG, nodes, "nodes searched"),
+  _INFO_MEMBER("nps", T_ULONGLONG, nps, "nodes per second"),
+  _INFO_MEMBER("tbhits", T_ULONGLONG, tbhits, "tablebase hits"),
+  _INFO_MEMBER("time", T_LONG, time, "search time in ms"),
+  _INFO_MEMBER("hashfull", T_INT, hashfull, "hash table use, per mille"),
+  _INFO_MEMBER("pv_length", T_INT, pvLength, "moves of the pv"),
+  {NULL}
+};
+
+static PyGetSetDef Info_getset[] = {
+  {"pv", (getter)Info_getpv, NULL, "list of the pv moves, the first MAX_PV ones", NULL},
+  {NULL}
+};
+
+static PyTypeObject InfoType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "_ucinfo.Info",
+  sizeof(InfoObject),
+};
+
+PyMODINIT_FUNC init_ucinfo(void)
+{
+  PyObject *m;
+
+  InfoType.tp_flags = Py_TPFLAGS_DEFAULT;
+  InfoType.tp_doc = "Info() -> fields of an engine info line, parse(line) them in place";
+  InfoType.tp_new = PyType_GenericNew;
+  InfoType.tp_methods = Info_methods;
+  InfoType.tp_members = Info_members;
+  InfoType.tp_getset = Info_getset;
+  if(PyType_Ready(&InfoType) < 0)
+    return;
+
+  m = Py_InitModule3("_ucinfo", NULL, "Native parser of the info lines of UCI engines");
+  if(!m)
+    return;
+  Py_INCREF(&InfoType);
+  PyModule_AddObject(m, "Info", (PyObject *)&InfoType);
+  PyModule_AddIntConstant(m, "MAX_PV", UCINFO_MAX_PV);
+  PyModule_AddIntConstant(m, "SCORE_NONE", UCINFO_SCORE_NONE);
+  PyModule_AddIntConstant(m, "SCORE_CP", UCINFO_SCORE_CP);
+  PyModule_AddIntConstant(m, "SCORE_MATE", UCINFO_SCORE_MATE);
+  PyModule_AddIntConstant(m, "BOUND_EXACT", UCINFO_BOUND_EXACT);
+  PyModule_AddIntConstant(m, "BOUND_LOWER", UCINFO_BOUND_LOWER);
+  PyModule_AddIntConstant(m, "BOUND_UPPER", UCINFO_BOUND_UPPER);
+  PyModule_AddIntConstant(m, "FIELD_DEPTH", UCINFO_DEPTH);
+  PyModule_AddIntConstant(m, "FIELD_SELDEPTH", UCINFO_SELDEPTH);
+  PyModule_AddIntConstant(m, "FIELD_MULTIPV", UCINFO_MULTIPV);
+  PyModule_AddIntConstant(m, "FIELD_SCORE", UCINFO_SCORE);
+  PyModule_AddIntConstant(m, "FIELD_NODES", UCINFO_NODES);
+  PyModule_AddIntConstant(m, "FIELD_NPS", UCINFO_NPS);
+  PyModule_AddIntConstant(m, "FIELD_TIME", UCINFO_TIME);
+  PyModule_AddIntConstant(m, "FIELD_HASHFULL", UCINFO_HASHFULL);
+  PyModule_AddIntConstant(m, "FIELD_TBHITS", UCINFO_TBHITS);
+  PyModule_AddIntConstant(m, "FIELD_PV", UCINFO_PV);
+}
@@ -0,0 +1,452 @@
+## Emulator of DGT boards and clocks speaking the serial protocol,
+## over pseudo terminals (as a real board on a serial port) or over a
+## unix socket (the virtual board mode of dgtnixInit).
+## A single poll loop serves all the boards, so hundreds can run at once.
+##
+##   python dgt_emulator.py --pty 2 --pgn game.pgn
+##   python dgt_emulator.py --unix /tmp/dgt.sock --latency 20 --jitter 5 --noise 0.001
+##   python dgt_emulator.py --pty 1 --pgn game.pgn --speed 10
+
+import argparse
+import errno
+import fcntl
+import os
+import pty
+import random
+import re
+import select
+import socket
+import sys
+import tty
+from ChessBoard import ChessBoard
+import clock
+
+# Messages sent by the board, as in dgtnix.c
+_DGTNIX_MESSAGE_BIT = 0x80
+_DGTNIX_BOARD_DUMP = 0x06
+_DGTNIX_BWTIME = 0x0d
+_DGTNIX_FIELD_UPDATE = 0x0e
+_DGTNIX_EE_MOVES = 0x0f
+_DGTNIX_BUSADDRESS = 0x10
+_DGTNIX_SERIALNR = 0x11
+_DGTNIX_TRADEMARK = 0x12
+_DGTNIX_VERSION = 0x13
+
+# Commands received by the board
+_DGTNIX_CLOCK_MESSAGE = 0x2b
+_DGTNIX_SEND_RESET = 0x40
+_DGTNIX_SEND_CLK = 0x41
+_DGTNIX_SEND_BRD = 0x42
+_DGTNIX_SEND_UPDATE = 0x43
+_DGTNIX_SEND_UPDATE_BRD = 0x44
+_DGTNIX_SEND_SERIALNR = 0x45
+_DGTNIX_SEND_BUSADDRESS = 0x46
+_DGTNIX_SEND_TRADEMARK = 0x47
+_DGTNIX_SEND_EE_MOVES = 0x49
+_DGTNIX_SEND_UPDATE_NICE = 0x4b
+_DGTNIX_SEND_VERSION = 0x4d
+# A clock message is the command and 12 more bytes
+_DGTNIX_CLOCK_MESSAGE_SIZE = 13
+
+# Board pieces as sent by the board, indexed by the ChessBoard letters
+piece_codes = {
+    '.': 0x00,
+    'P': 0x01, 'R': 0x02, 'N': 0x03, 'B': 0x04, 'K': 0x05, 'Q': 0x06,
+    'p': 0x07, 'r': 0x08, 'n': 0x09, 'b': 0x0a, 'k': 0x0b, 'q': 0x0c
+}
+
+# Clock acks, and clock buttons (0 is the leftmost) as (byte 4, byte 5) of the ack
+CLOCK_ACK = [0x0a, 0x10, 0x01, 0x0a, 0x00, 0x00, 0x00]
+clock_button_codes = {
+    0: (5, 49),
+    1: (33, 52),
+    2: (17, 51),
+    3: (9, 50),
+    4: (65, 53)
+}
+
+# Seconds between the field updates of one move (lift, then place)
+FIELD_UPDATE_DELAY = 0.05
+# Seconds between two BWTIME messages of a running clock
+CLOCK_TICK = 1.0
+
+
+def message(command_id, data):
+    length = len(data) + 3
+    return bytearray([_DGTNIX_MESSAGE_BIT | command_id, (length >> 7) & 0x7f, length & 0x7f]) + bytearray(data)
+
+
+def bcd(n):
+    return ((n / 10) << 4) | (n % 10)
+
+
+def pgn_moves(text):
+    # SAN moves of the first game of a PGN text
+    text = re.sub(r'\[[^\]]*\]', ' ', text)
+    text = re.sub(r'\{[^}]*\}|;[^\n]*', ' ', text)
+    while re.search(r'\([^()]*\)', text):
+        text = re.sub(r'\([^()]*\)', ' ', text)
+    moves = []
+    for token in text.split():
+        token = re.sub(r'^\d+\.+', '', token)
+        if not token or token.startswith('$'):
+            continue
+        if token in ('1-0', '0-1', '1/2-1/2', '*'):
+            break
+        moves.append(token)
+    return moves
+
+
+def board_squares(chessboard):
+    # The 64 piece codes in the board dump order, a8 first
+    return [piece_codes[piece] for row in chessboard.getBoard() for piece in row]
+
+
+class EmulatedBoard(object):
+    def __init__(self, fd, name, emulator, clock=True, latency=0., jitter=0., noise=0.,
+                 serial="00001", trademark="Digital Game Technology emulator", version=(1, 7)):
+        self.fd = fd
+        self.name = name
+        self.emulator = emulator
+        self.clock = clock
+        self.latency = latency
+        self.jitter = jitter
+        self.noise = noise
+        self.serial = serial
+        self.trademark = trademark
+        self.version = version
+        self.random = random.Random(fd)
+        self.squares = board_squares(ChessBoard())
+        self.updates = False
+        self.clock_updates = False
+        self.input = bytearray()
+        # Messages to send as (due time, bytes), in order
+        self.output = []
+        self.last_due = 0.
+        # Bytes due but not written yet, and whether they wait for the fd to be writable
+        self.pending = bytearray()
+        self.writing = False
+        # Board changes to come as (time, square, piece), and the board once they are done
+        self.script = []
+        self.plan = list(self.squares)
+        self.white_time = 300
+        self.black_time = 300
+        self.white_turn = True
+        self.clock_running = False
+        self.next_tick = 0.
+        self.game = None
+        self.move_delay = 2.
+        self.loop = False
+        self.stats = {'received': 0, 'sent': 0, 'moves': 0}
+
+    # Sending side
+
+    def send(self, data):
+        now = clock.now()
+        due = now + self.latency
+        if self.jitter:
+            due += self.random.uniform(-self.jitter, self.jitter)
+        # The line keeps the order of the messages
+        due = max(due, self.last_due, now)
+        self.last_due = due
+        data = bytearray(data)
+        if self.noise:
+            for i in xrange(len(data)):
+                if self.random.random() < self.noise:
+                    data[i] ^= 1 << self.random.randint(0, 7)
+        self.output.append((due, data))
+
+    def flush(self, now, writable=False):
+        # Writes the messages due, once the fd is writable again when a write was short
+        while self.output and self.output[0][0] <= now:
+            self.pending += self.output.pop(0)[1]
+        if not self.pending or (self.writing and not writable):
+            return
+        try:
+            n = os.write(self.fd, self.pending)
+        except OSError as e:
+            if e.errno not in (errno.EAGAIN, errno.EINTR):
+                raise
+            n = 0
+        self.stats['sent'] += n
+        del self.pending[:n]
+        self.emulator.watch_writes(self, bool(self.pending))
+
+    def send_dump(self):
+        self.send(message(_DGTNIX_BOARD_DUMP, self.squares))
+
+    def send_clock(self):
+        flags = 0x01 if self.clock else 0x00
+        if not self.white_turn:
+            flags |= 0x08
+        data = []
+        for t in (self.black_time, self.white_time):
+            t = max(t, 0)
+            data += [t / 3600, bcd(t / 60 % 60), bcd(t % 60)]
+        self.send(message(_DGTNIX_BWTIME, data + [flags]))
+
+    def send_ack(self, button=None):
+        data = list(CLOCK_ACK)
+        if button is not None:
+            data[4], data[5] = clock_button_codes[button]
+        self.send(message(_DGTNIX_BWTIME, data))
+
+    # Receiving side
+
+    def receive(self, data):
+        self.stats['received'] += len(data)
+        self.input += data
+        while self.input:
+            command = self.input[0]
+            if command == _DGTNIX_CLOCK_MESSAGE:
+                if len(self.input) < _DGTNIX_CLOCK_MESSAGE_SIZE:
+                    return
+                del self.input[:_DGTNIX_CLOCK_MESSAGE_SIZE]
+                if self.clock:
+                    self.send_ack()
+                continue
+            del self.input[0]
+            self.command(command)
+
+    def command(self, command):
+        if command == _DGTNIX_SEND_RESET:
+            self.updates = self.clock_updates = False
+        elif command == _DGTNIX_SEND_BRD:
+            self.send_dump()
+        elif command == _DGTNIX_SEND_CLK:
+            self.send_clock()
+        elif command in (_DGTNIX_SEND_UPDATE, _DGTNIX_SEND_UPDATE_NICE, _DGTNIX_SEND_UPDATE_BRD):
+            if self.game and not self.updates and not self.script:
+                self.updates = True
+                self.start_game()
+            self.updates = True
+            self.clock_updates = command != _DGTNIX_SEND_UPDATE_BRD
+        elif command == _DGTNIX_SEND_SERIALNR:
+            self.send(message(_DGTNIX_SERIALNR, bytearray(self.serial)))
+        elif command == _DGTNIX_SEND_BUSADDRESS:
+            self.send(message(_DGTNIX_BUSADDRESS, [self.fd >> 7 & 0x7f, self.fd & 0x7f]))
+        elif command == _DGTNIX_SEND_TRADEMARK:
+            self.send(message(_DGTNIX_TRADEMARK, bytearray(self.trademark)))
+        elif command == _DGTNIX_SEND_VERSION:
+            self.send(message(_DGTNIX_VERSION, self.version))
+        elif command == _DGTNIX_SEND_EE_MOVES:
+            self.send(message(_DGTNIX_EE_MOVES, []))
+
+    # Changes of the board and the clock
+
+    def set_square(self, square, piece):
+        self.squares[square] = piece
+        if self.updates:
+            self.send(message(_DGTNIX_FIELD_UPDATE, [square, piece]))
+
+    def arrange(self, squares, start):
+        # Schedules the field updates turning the board into squares, a hand lifts pieces first
+        at = start
+        changes = [(sq, squares[sq]) for sq in xrange(64) if squares[sq] != self.plan[sq]]
+        for square, piece in sorted(changes, key=lambda change: change[1] != 0):
+            if piece and self.plan[square]:
+                self.script.append((at, square, 0))
+                at += FIELD_UPDATE_DELAY
+            self.script.append((at, square, piece))
+            self.plan[square] = piece
+            at += FIELD_UPDATE_DELAY
+        return at
+
+    def play(self, moves, move_delay=2., loop=False):
+        # Plays the SAN moves on the board, move_delay seconds apart,
+        # from the time the driver asks for updates
+        self.game = moves
+        self.move_delay = move_delay
+        self.loop = loop
+        if self.updates:
+            self.start_game()
+
+    def start_game(self):
+        chessboard = ChessBoard()
+        at = self.arrange(board_squares(chessboard), clock.now())
+        for san in self.game:
+            if not chessboard.addTextMove(san):
+                print >> sys.stderr, "{0}: illegal move {1}".format(self.name, san)
+                break
+            at = self.arrange(board_squares(chessboard), at + self.move_delay)
+            self.script.append((at, -1, None))
+        self.clock_running = self.clock
+        self.next_tick = clock.now() + CLOCK_TICK
+
+    def press_button(self, button, hold=0.2):
+        self.send_ack(button)
+        self.script.append((clock.now() + hold, -2, button))
+
+    def step(self, now):
+        while self.script and self.script[0][0] <= now:
+            at, square, piece = self.script.pop(0)
+            if square >= 0:
+                self.set_square(square, piece)
+            elif square == -1:
+                # A move was completed, the player hits the clock
+                self.stats['moves'] += 1
+                self.white_turn = not self.white_turn
+                if self.clock_updates:
+                    self.send_clock()
+            elif square == -2:
+                # Button released
+                self.send_ack()
+        if not self.script and self.loop and self.game and self.updates:
+            self.start_game()
+        if self.clock_running and now >= self.next_tick:
+            self.next_tick += CLOCK_TICK
+            if self.white_turn:
+                self.white_time -= 1
+            else:
+                self.black_time -= 1
+            if self.clock_updates:
+                self.send_clock()
+
+    def next_deadline(self):
+        deadlines = [self.output[0][0]] if self.output else []
+        if self.script:
+            deadlines.append(self.script[0][0])
+        if self.clock_running:
+            deadlines.append(self.next_tick)
+        if self.loop and self.game and self.updates and not self.script:
+            deadlines.append(clock.now())
+        return min(deadlines) if deadlines else None
+
+
+class Emulator(object):
+    def __init__(self, **board_options):
+        self.board_options = board_options
+        self.boards = {}
+        self.listeners = {}
+        self.connections = {}
+        self.slaves = []
+        self.poller = select.poll()
+        self.on_new_board = None
+
+    def add_board(self, fd, name):
+        # A driver that stops reading must not block the other boards, its bytes stay pending
+        fcntl.fcntl(fd, fcntl.F_SETFL, fcntl.fcntl(fd, fcntl.F_GETFL) | os.O_NONBLOCK)
+        board = EmulatedBoard(fd, name, self, **self.board_options)
+        self.boards[fd] = board
+        self.poller.register(fd, select.POLLIN)
+        if self.on_new_board:
+            self.on_new_board(board)
+        return board
+
+    def add_pty(self):
+        # Returns the board and the device name to give to the driver
+        master, slave = pty.openpty()
+        tty.setraw(master)
+        tty.setraw(slave)
+        # The slave side stays open, a driver closing it would else hang up the board
+        self.slaves.append(slave)
+        name = os.ttyname(slave)
+        return self.add_board(master, name), name
+
+    def add_unix(self, path):
+        # Each connection on path gets its own board
+        if os.path.exists(path):
+            os.unlink(path)
+        listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        listener.bind(path)
+        listener.listen(128)
+        self.listeners[listener.fileno()] = listener
+        self.poller.register(listener.fileno(), select.POLLIN)
+        return listener
+
+    def watch_writes(self, board, writing):
+        # POLLOUT only while bytes wait for the board fd
+        if writing != board.writing:
+            board.writing = writing
+            self.poller.modify(board.fd, select.POLLIN | select.POLLOUT if writing else select.POLLIN)
+
+    def remove_board(self, board):
+        self.poller.unregister(board.fd)
+        del self.boards[board.fd]
+        if board.fd in self.connections:
+            self.connections[board.fd].close()
+        else:
+            os.close(board.fd)
+
+    def step(self, timeout=None):
+        now = clock.now()
+        deadlines = [d for d in (b.next_deadline() for b in self.boards.itervalues()) if d is not None]
+        if deadlines:
+            wait = max(0., min(deadlines) - now)
+            timeout = wait if timeout is None else min(timeout, wait)
+        for fd, event in clock.poll(self.poller, timeout):
+            if fd in self.listeners:
+                connection, address = self.listeners[fd].accept()
+                self.connections[connection.fileno()] = connection
+                self.add_board(connection.fileno(), "{0}#{1}".format(self.listeners[fd].getsockname(), connection.fileno()))
+                continue
+            board = self.boards.get(fd)
+            if not board:
+                continue
+            if event & select.POLLOUT:
+                board.flush(clock.now(), writable=True)
+            if not event & (select.POLLIN | select.POLLHUP | select.POLLERR):
+                continue
+            try:
+                data = os.read(fd, 4096)
+            except OSError as e:
+                if e.errno in (errno.EAGAIN, errno.EINTR):
+                    continue
+                # EIO on a pty while no driver has its slave side open
+                data = ''
+            if not data:
+                if fd in self.connections:
+                    self.remove_board(board)
+                    del self.connections[fd]
+                continue
+            board.receive(data)
+        now = clock.now()
+        for board in self.boards.values():
+            board.step(now)
+            board.flush(now)
+
+    def run(self, duration=None):
+        end = duration and clock.now() + duration
+        while not end or clock.now() < end:
+            self.step(end and max(0., end - clock.now()))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="DGT board and clock emulator")
+    parser.add_argument("--pty", type=int, default=0, help="number of boards on pseudo terminals")
+    parser.add_argument("--unix", help="unix socket path, each connection is a board")
+    parser.add_argument("--pgn", help="PGN game played on every board")
+    parser.add_argument("--move-delay", type=float, default=2., help="seconds between two moves")
+    parser.add_argument("--loop", action="store_true", help="replay the game forever")
+    parser.add_argument("--latency", type=float, default=0., help="line latency in ms")
+    parser.add_argument("--jitter", type=float, default=0., help="latency jitter in ms")
+    parser.add_argument("--noise", type=float, default=0., help="probability of a corrupted byte")
+    parser.add_argument("--no-clock", action="store_true", help="boards without clock")
+    parser.add_argument("--duration", type=float, help="seconds to run, forever by default")
+    parser.add_argument("--speed", type=float, help="run on a clock speed times faster than real time, "
+                        "0 skips the waits (give the driver the same clock)")
+    args = parser.parse_args()
+    if args.speed is not None:
+        clock.set_clock(clock.SimulatedClock(args.speed))
+
+    moves = pgn_moves(open(args.pgn).read()) if args.pgn else None
+    emulator = Emulator(clock=not args.no_clock, latency=args.latency / 1000., jitter=args.jitter / 1000.,
+                        noise=args.noise)
+
+    def start_game(board):
+        print "board {0}".format(board.name)
+        sys.stdout.flush()
+        if moves:
+            board.play(moves, args.move_delay, args.loop)
+
+    emulator.on_new_board = start_game
+    for i in xrange(args.pty):
+        emulator.add_pty()
+    if args.unix:
+        emulator.add_unix(args.unix)
+    try:
+        emulator.run(args.duration)
+    except KeyboardInterrupt:
+        pass
+    for board in emulator.boards.itervalues():
+        print "{0}: {1}".format(board.name, board.stats)
@@ -0,0 +1,117 @@
+import os
+import shutil
+import socket
+import tempfile
+import tty
+import unittest
+
+import dgt_emulator
+
+BOARD_DUMP_SIZE = 67
+
+
+class ProtocolTest(unittest.TestCase):
+
+    def test_message(self):
+        dump = dgt_emulator.message(dgt_emulator._DGTNIX_BOARD_DUMP, [0] * 64)
+        self.assertEqual(list(dump[:3]), [0x86, 0, BOARD_DUMP_SIZE])
+        self.assertEqual(len(dump), BOARD_DUMP_SIZE)
+        # The length is sent 7 bits at a time
+        self.assertEqual(list(dgt_emulator.message(0x0f, [0] * 200)[:3]), [0x8f, 1, 75])
+
+    def test_pgn_moves(self):
+        pgn = '[Event "test"]\n1. e4 {best by test} e5 (1... c5 2. Nf3) 2. Nf3 $1 Nc6 1-0 3. Bb5'
+        self.assertEqual(dgt_emulator.pgn_moves(pgn), ["e4", "e5", "Nf3", "Nc6"])
+
+
+class EmulatorTest(unittest.TestCase):
+
+    def setUp(self):
+        self.directory = tempfile.mkdtemp()
+        self.path = os.path.join(self.directory, "dgt.sock")
+        self.emulator = dgt_emulator.Emulator()
+        self.clients = []
+
+    def tearDown(self):
+        for client in self.clients:
+            client.close()
+        for board in self.emulator.boards.values():
+            self.emulator.remove_board(board)
+        for slave in self.emulator.slaves:
+            os.close(slave)
+        shutil.rmtree(self.directory)
+
+    def connect(self):
+        if not self.emulator.listeners:
+            self.emulator.add_unix(self.path)
+        client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        client.connect(self.path)
+        client.settimeout(0)
+        self.clients.append(client)
+        count = len(self.emulator.boards)
+        while len(self.emulator.boards) == count:
+            self.emulator.step(1.)
+        return client
+
+    def answer(self, client, size, steps=100):
+        # Runs the emulator until size bytes came back to client
+        data = bytearray()
+        for i in xrange(steps):
+            self.emulator.step(0.01)
+            try:
+                data += client.recv(size - len(data))
+            except socket.error:
+                pass
+            if len(data) == size:
+                break
+        return data
+
+    def test_pty(self):
+        board, name = self.emulator.add_pty()
+        driver = os.open(name, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(driver)
+        os.write(driver, chr(dgt_emulator._DGTNIX_SEND_BRD))
+        for i in xrange(10):
+            self.emulator.step(0.01)
+        dump = bytearray(os.read(driver, 4096))
+        os.close(driver)
+        self.assertEqual(len(dump), BOARD_DUMP_SIZE)
+        # a8 first: a black rook, then a white rook on a1
+        self.assertEqual(dump[3], 0x08)
+        self.assertEqual(dump[3 + 56], 0x02)
+
+    def test_version(self):
+        client = self.connect()
+        client.send(chr(dgt_emulator._DGTNIX_SEND_VERSION))
+        self.assertEqual(list(self.answer(client, 5)), [0x93, 0, 5, 1, 7])
+
+    def test_clock_ack(self):
+        client = self.connect()
+        client.send(bytearray([dgt_emulator._DGTNIX_CLOCK_MESSAGE] + [0] * 12))
+        ack = self.answer(client, 10)
+        self.assertEqual(list(ack[:3]), [0x8d, 0, 10])
+        self.assertEqual(list(ack[3:]), dgt_emulator.CLOCK_ACK)
+
+    def test_stalled_driver(self):
+        # A driver that stops reading does not block the others, its bytes wait
+        stalled = self.connect()
+        other = self.connect()
+        requests = 20000
+        stalled.settimeout(None)
+        stalled.sendall(chr(dgt_emulator._DGTNIX_SEND_BRD) * requests)
+        stalled.settimeout(0)
+        for i in xrange(50):
+            self.emulator.step(0.01)
+        board = [b for b in self.emulator.boards.values() if b.stats['received'] == requests][0]
+        self.assertTrue(board.writing)
+        self.assertTrue(board.pending)
+        other.send(chr(dgt_emulator._DGTNIX_SEND_VERSION))
+        self.assertEqual(len(self.answer(other, 5)), 5)
+        # Everything comes once it reads again
+        self.assertEqual(len(self.answer(stalled, requests * BOARD_DUMP_SIZE, steps=10000)),
+                         requests * BOARD_DUMP_SIZE)
+        self.assertFalse(board.writing)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,132 @@
+# Latest-wins compositor of a display (the DGT clock, the LCD): a frame submitted replaces the one
+# of its kind still waiting, so a slow display shows the newest content instead of working through
+# every frame written since. A thread shows the frames, the most important kind first, as fast as
+# show() returns: for the DGT clock that is the ack of the previous message.
+#
+#   clock_display = display.Compositor(send_and_wait_ack, name="clock_msg")
+#   clock_display.submit(display.TIME, frame)
+#   clock_display.submit(display.MOVE, frame)   # shown first, held HOLD[MOVE] seconds against TIME
+#
+# A frame of a kind stays on the display at least HOLD[kind] seconds against less important kinds,
+# so that a move is read before the next time tick covers it.
+import threading
+
+import clock
+import tracing
+
+# Kinds of frames, the most important first
+MOVE = 0
+TEXT = 1
+TIME = 2
+KINDS = (MOVE, TEXT, TIME)
+NAMES = {MOVE: "move", TEXT: "text", TIME: "time"}
+# Seconds a frame of a kind is shown before a less important one
+HOLD = {MOVE: 1.0, TEXT: 1.0, TIME: 0.}
+# A frame shown this many seconds after its submission counts as delayed
+DELAY = 0.5
+
+
+class Frame(object):
+    def __init__(self, kind, content, trace_id=None):
+        self.kind = kind
+        self.content = content
+        self.trace_id = trace_id
+        self.submitted = clock.now()
+        self.queued = tracing.now() if trace_id else None
+
+
+class Compositor(object):
+    def __init__(self, show, name="display", hold=None):
+        # show(content) shows a frame and returns once the display took it, in the thread of the
+        # compositor. The frames are traced as <name>_queue, from their submission to their show.
+        self.show = show
+        self.name = name
+        self.hold = dict(HOLD if hold is None else hold)
+        self.condition = threading.Condition()
+        self.pending = {}
+        # Kind and time of the frame shown last
+        self.shown_kind = None
+        self.shown_at = 0.
+        self.closed = False
+        # Timer waking the thread up at the end of a hold
+        self.timer = None
+        # Frames submitted, shown, replaced before being shown, and shown later than DELAY
+        self.submitted = 0
+        self.shown = 0
+        self.dropped = 0
+        self.delayed = 0
+        self.max_delay = 0.
+        self.thread = threading.Thread(target=self.run, name=name)
+        self.thread.daemon = True
+        self.thread.start()
+
+    def submit(self, kind, content, trace_id=None, append=None):
+        # Replaces the frame of kind waiting, or with append(waiting content, content) adds to it
+        with self.condition:
+            self.submitted += 1
+            waiting = self.pending.get(kind)
+            if waiting and append:
+                waiting.content = append(waiting.content, content)
+            else:
+                if waiting:
+                    self.dropped += 1
+                self.pending[kind] = Frame(kind, content, trace_id)
+            self.condition.notify()
+
+    def clear(self, kinds=KINDS):
+        # Drops the frames of kinds still waiting
+        with self.condition:
+            for kind in kinds:
+                if self.pending.pop(kind, None):
+                    self.dropped += 1
+
+    def _next(self):
+        # The frame to show now and None, or None and the seconds to wait for one
+        for kind in KINDS:
+            if kind not in self.pending:
+                continue
+            if self.shown_kind is not None and kind > self.shown_kind:
+                wait = self.shown_at + self.hold[self.shown_kind] - clock.now()
+                if wait > 0:
+                    return None, wait
+            return self.pending.pop(kind), None
+        return None, None
+
+    def run(self):
+        while True:
+            with self.condition:
+                while True:
+                    if self.closed:
+                        return
+                    frame, wait = self._next()
+                    if frame:
+                        break
+                    if wait and not self.timer:
+                        # The waits go through the clock, which may be simulated
+                        self.timer = clock.call_later(wait, self._wake)
+                    self.condition.wait()
+            tracing.complete(self.name + '_queue', frame.trace_id, frame.queued)
+            self.show(frame.content)
+            delay = clock.now() - frame.submitted
+            with self.condition:
+                self.shown += 1
+                self.shown_kind = frame.kind
+                self.shown_at = clock.now()
+                self.max_delay = max(self.max_delay, delay)
+                if delay > DELAY:
+                    self.delayed += 1
+
+    def _wake(self):
+        with self.condition:
+            self.timer = None
+            self.condition.notify()
+
+    def stats(self):
+        with self.condition:
+            return {"submitted": self.submitted, "shown": self.shown, "dropped": self.dropped,
+                    "delayed": self.delayed, "max_delay": self.max_delay}
+
+    def close(self):
+        with self.condition:
+            self.closed = True
+            self.condition.notify()
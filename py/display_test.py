@@ -0,0 +1,82 @@
+import threading
+import time
+import unittest
+
+import clock
+import display
+
+HOLD = {display.MOVE: 0.2, display.TEXT: 0.1, display.TIME: 0.}
+
+
+class CompositorTest(unittest.TestCase):
+
+    def setUp(self):
+        self.frames = []
+        # The first frame is held in show() until released, the others pile up behind it
+        self.released = threading.Event()
+        self.compositor = display.Compositor(self.show, "display_test", HOLD)
+
+    def tearDown(self):
+        self.released.set()
+        self.compositor.close()
+
+    def show(self, content):
+        self.frames.append((content, clock.now()))
+        self.released.wait(5)
+
+    def first_shown(self):
+        while not self.frames:
+            time.sleep(0.005)
+
+    def shown(self, count):
+        deadline = time.time() + 5
+        while self.compositor.stats()["shown"] < count and time.time() < deadline:
+            time.sleep(0.005)
+        return [content for content, shown_at in self.frames]
+
+    def test_latest_wins(self):
+        self.compositor.submit(display.TEXT, "first")
+        self.first_shown()
+        self.compositor.submit(display.TEXT, "second")
+        self.compositor.submit(display.TEXT, "third")
+        self.released.set()
+        self.assertEqual(self.shown(2), ["first", "third"])
+        stats = self.compositor.stats()
+        self.assertEqual((stats["submitted"], stats["shown"], stats["dropped"]), (3, 2, 1))
+
+    def test_append(self):
+        self.compositor.submit(display.TIME, "0:05")
+        self.first_shown()
+        self.compositor.submit(display.TEXT, "e4")
+        self.compositor.submit(display.TEXT, "e5", append=lambda waiting, content: waiting + " " + content)
+        self.released.set()
+        self.assertEqual(self.shown(2), ["0:05", "e4 e5"])
+        self.assertEqual(self.compositor.stats()["dropped"], 0)
+
+    def test_priority_and_hold(self):
+        self.compositor.submit(display.TIME, "0:05")
+        self.first_shown()
+        self.compositor.submit(display.TIME, "0:04")
+        self.compositor.submit(display.TEXT, "Check")
+        self.compositor.submit(display.MOVE, "e2e4")
+        self.released.set()
+        # A move first, then the others once it was held for its time
+        self.assertEqual(self.shown(4), ["0:05", "e2e4", "Check", "0:04"])
+        times = dict(self.frames)
+        self.assertGreaterEqual(times["Check"] - times["e2e4"], HOLD[display.MOVE] - 0.01)
+        self.assertGreaterEqual(times["0:04"] - times["Check"], HOLD[display.TEXT] - 0.01)
+
+    def test_clear(self):
+        self.compositor.submit(display.TIME, "0:05")
+        self.first_shown()
+        self.compositor.submit(display.TEXT, "Check")
+        self.compositor.submit(display.MOVE, "e2e4")
+        self.compositor.clear([display.TEXT])
+        self.released.set()
+        self.assertEqual(self.shown(2), ["0:05", "e2e4"])
+        time.sleep(HOLD[display.MOVE] + 0.1)
+        self.assertEqual(self.compositor.stats()["shown"], 2)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,171 @@
+# Info lines of the engine: parsed in place by the native parser of dgt/_ucinfo (see dgt/ucinfo.h),
+# or by the Python one below when it is not built, and coalesced by an Aggregator that publishes
+# the last one at most rate times per second, with the pv in SAN converted only from the first
+# move that changed since the last publication.
+#
+#   info = engine_info.Info()
+#   aggregator = engine_info.Aggregator(show, rate=4)     # show(info, san)
+#   aggregator.reset(fen)
+#   for line in lines:
+#       if info.parse(line) and info.pv_length:
+#           aggregator.update(info)
+import threading
+
+import clock
+import stockfish as sf
+
+# Publications per second of an Aggregator
+RATE = 4
+
+try:
+    from dgt._ucinfo import Info, SCORE_NONE, SCORE_CP, SCORE_MATE, BOUND_EXACT, BOUND_LOWER, BOUND_UPPER, MAX_PV
+except ImportError:
+    SCORE_NONE, SCORE_CP, SCORE_MATE = 0, 1, 2
+    BOUND_EXACT, BOUND_LOWER, BOUND_UPPER = 0, 1, 2
+    MAX_PV = 64
+    _NUMBERS = ("depth", "seldepth", "multipv", "nodes", "nps", "tbhits", "time", "hashfull")
+
+    class Info(object):
+        # Same fields as the native Info, the pv is a list of moves
+        def __init__(self):
+            self.clear()
+
+        def clear(self):
+            self.depth = self.seldepth = self.multipv = self.score = self.hashfull = self.time = 0
+            self.nodes = self.nps = self.tbhits = 0
+            self.score_type = SCORE_NONE
+            self.bound = BOUND_EXACT
+            self.pv = []
+            self.pv_length = 0
+
+        def parse(self, line):
+            tokens = line.split()
+            if not tokens or tokens[0] != "info":
+                return False
+            self.clear()
+            i = 1
+            while i < len(tokens):
+                token = tokens[i]
+                i += 1
+                if token == "string":
+                    break
+                if token == "pv":
+                    while i < len(tokens) and _is_move(tokens[i]):
+                        self.pv.append(tokens[i])
+                        i += 1
+                    self.pv_length = len(self.pv)
+                    self.pv = self.pv[:MAX_PV]
+                elif token == "lowerbound":
+                    self.bound = BOUND_LOWER
+                elif token == "upperbound":
+                    self.bound = BOUND_UPPER
+                elif token == "score" and i + 1 < len(tokens) and tokens[i] in ("cp", "mate"):
+                    try:
+                        self.score = int(tokens[i + 1])
+                        self.score_type = SCORE_CP if tokens[i] == "cp" else SCORE_MATE
+                    except ValueError:
+                        pass
+                    i += 2
+                elif token in _NUMBERS and i < len(tokens):
+                    try:
+                        setattr(self, token, int(tokens[i]))
+                        i += 1
+                    except ValueError:
+                        pass
+            return True
+
+        def copy(self):
+            other = Info()
+            other.__dict__.update(self.__dict__)
+            other.pv = list(self.pv)
+            return other
+
+        def common_prefix(self, other):
+            n = 0
+            for a, b in zip(self.pv, other.pv):
+                if a != b:
+                    break
+                n += 1
+            return n
+
+    def _is_move(token):
+        return token == "0000" or (len(token) in (4, 5) and "a" <= token[0] <= "h" and "1" <= token[1] <= "8"
+                                   and "a" <= token[2] <= "h" and "1" <= token[3] <= "8"
+                                   and (len(token) == 4 or token[4] in "qrbn"))
+
+
+class Aggregator(object):
+    def __init__(self, publish, rate=RATE, call_later=None):
+        # publish(info, san) is called with the last info and its pv in SAN, in the thread of
+        # update() or of the timers of call_later, clock.call_later by default
+        self.publish = publish
+        self.call_later = call_later or clock.call_later
+        self.interval = 1. / rate
+        self.lock = threading.Lock()
+        self.fen = None
+        self.pending = None
+        self.timer = None
+        self.last = 0.
+        # Last published info and SAN pv, and the positions along its pv as far as they were needed
+        self.published = None
+        self.san = []
+        self.fens = []
+        # Lines coalesced, and moves converted to SAN
+        self.updates = 0
+        self.dropped = 0
+        self.converted = 0
+
+    def reset(self, fen):
+        # A search of fen starts, the lines of the previous one are dropped
+        with self.lock:
+            if self.timer:
+                self.timer.cancel()
+            self.fen = fen
+            self.pending = None
+            self.timer = None
+            self.published = None
+            self.san = []
+            self.fens = [fen]
+
+    def update(self, info):
+        with self.lock:
+            if not self.fen:
+                return
+            self.updates += 1
+            if self.pending:
+                self.dropped += 1
+            self.pending = info.copy()
+            if self.timer:
+                return
+            delay = self.last + self.interval - clock.now()
+            if delay > 0:
+                self.timer = self.call_later(delay, self.flush)
+                return
+        self.flush()
+
+    def flush(self):
+        with self.lock:
+            info, self.pending, self.timer = self.pending, None, None
+            if not info:
+                return
+            self.last = clock.now()
+            try:
+                san = self._san(info)
+            except ValueError:
+                # A line of another position
+                return
+        self.publish(info, san)
+
+    def _san(self, info):
+        # SAN of the pv of info, converting only the moves after those in common with the last one
+        pv = info.pv
+        common = info.common_prefix(self.published) if self.published else 0
+        del self.fens[common + 1:]
+        while len(self.fens) <= common:
+            i = len(self.fens) - 1
+            self.fens.append(sf.get_fen(self.fens[i], [pv[i]]))
+        suffix = sf.to_san(self.fens[common], pv[common:]) if common < len(pv) else []
+        self.converted += len(suffix)
+        self.san = self.san[:common] + suffix
+        self.published = info
+        return list(self.san)
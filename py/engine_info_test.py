@@ -0,0 +1,175 @@
+import imp
+import os
+import sys
+import unittest
+
+import clock
+import engine_info
+import pycochess
+
+START = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+LINE = "info depth 21 seldepth 30 multipv 1 score cp -35 upperbound nodes 123456 nps 987654 time 125 pv e2e4 e7e5 g1f3"
+
+
+def python_info():
+    # engine_info with its Python parser, as when dgt/_ucinfo is not built
+    native = sys.modules.get("dgt._ucinfo")
+    sys.modules["dgt._ucinfo"] = None
+    try:
+        module = imp.load_source("engine_info_python", os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                                                    "engine_info.py"))
+    finally:
+        if native:
+            sys.modules["dgt._ucinfo"] = native
+        else:
+            del sys.modules["dgt._ucinfo"]
+    return module
+
+
+class ParserTest(object):
+    # The same behaviour for both parsers, self.module is their engine_info
+
+    def test_line(self):
+        info = self.module.Info()
+        self.assertTrue(info.parse(LINE))
+        self.assertEqual((info.depth, info.seldepth, info.multipv), (21, 30, 1))
+        self.assertEqual((info.nodes, info.nps, info.time), (123456, 987654, 125))
+        self.assertEqual(info.score_type, self.module.SCORE_CP)
+        self.assertEqual(info.score, -35)
+        self.assertEqual(info.bound, self.module.BOUND_UPPER)
+        self.assertEqual(list(info.pv), ["e2e4", "e7e5", "g1f3"])
+        self.assertEqual(info.pv_length, 3)
+
+    def test_mate(self):
+        info = self.module.Info()
+        self.assertTrue(info.parse("info depth 12 score mate -3 lowerbound pv h7h8q"))
+        self.assertEqual(info.score_type, self.module.SCORE_MATE)
+        self.assertEqual(info.score, -3)
+        self.assertEqual(info.bound, self.module.BOUND_LOWER)
+        self.assertEqual(list(info.pv), ["h7h8q"])
+
+    def test_fields_cleared(self):
+        info = self.module.Info()
+        info.parse(LINE)
+        self.assertTrue(info.parse("info depth 22 currmove e2e4 currmovenumber 1"))
+        self.assertEqual(info.depth, 22)
+        self.assertEqual(info.score_type, self.module.SCORE_NONE)
+        self.assertEqual(info.bound, self.module.BOUND_EXACT)
+        self.assertEqual(info.pv_length, 0)
+
+    def test_not_info(self):
+        info = self.module.Info()
+        self.assertFalse(info.parse("bestmove e2e4 ponder e7e5"))
+        self.assertFalse(info.parse(""))
+        self.assertTrue(info.parse("info string NNUE evaluation using nn.nnue enabled"))
+        self.assertEqual(info.pv_length, 0)
+
+    def test_long_pv(self):
+        info = self.module.Info()
+        moves = ["g1f3", "g8f6", "f3g1", "f6g8"] * 20
+        info.parse("info depth 40 score cp 0 pv " + " ".join(moves))
+        self.assertEqual(info.pv_length, 80)
+        self.assertEqual(list(info.pv), moves[:self.module.MAX_PV])
+
+    def test_copy_and_common_prefix(self):
+        info = self.module.Info()
+        info.parse("info depth 10 score cp 20 pv e2e4 e7e5 g1f3")
+        other = info.copy()
+        info.parse("info depth 11 score cp 25 pv e2e4 e7e5 b1c3")
+        self.assertEqual(other.depth, 10)
+        self.assertEqual(info.common_prefix(other), 2)
+        self.assertEqual(info.common_prefix(info), 3)
+
+
+class NativeParserTest(ParserTest, unittest.TestCase):
+
+    def setUp(self):
+        if hasattr(engine_info, "_is_move"):
+            self.skipTest("dgt/_ucinfo is not built")
+        self.module = engine_info
+
+
+class PythonParserTest(ParserTest, unittest.TestCase):
+
+    def setUp(self):
+        self.module = python_info()
+
+
+class Turn(object):
+    def __init__(self, turn):
+        self.turn = turn
+
+
+class ScoreTest(unittest.TestCase):
+
+    def score(self, turn, line):
+        info = engine_info.Info()
+        info.parse(line)
+        return pycochess.Pycochess.info_score.im_func(Turn(turn), info)
+
+    def test_white(self):
+        self.assertEqual(self.score(pycochess.WHITE, "info depth 5 score cp 35 pv e2e4"), 0.35)
+        self.assertEqual(self.score(pycochess.WHITE, "info depth 5 score mate 2 pv e2e4"), "mate 2")
+
+    def test_black(self):
+        # The engine scores for the side to move, the user sees them for white
+        self.assertEqual(self.score(pycochess.BLACK, "info depth 5 score cp 35 pv e7e5"), -0.35)
+        self.assertEqual(self.score(pycochess.BLACK, "info depth 5 score cp -120 pv e7e5"), 1.2)
+        self.assertEqual(self.score(pycochess.BLACK, "info depth 5 score mate -2 pv e7e5"), "mate 2")
+
+
+class AggregatorTest(unittest.TestCase):
+
+    def setUp(self):
+        clock.set_clock(clock.SimulatedClock(speed=0))
+        self.published = []
+        self.timers = []
+        self.aggregator = engine_info.Aggregator(lambda info, san: self.published.append((info.depth, san)),
+                                                 rate=4, call_later=self.call_later)
+        self.aggregator.reset(START)
+
+    def tearDown(self):
+        clock.set_clock(None)
+
+    def call_later(self, delay, callback):
+        self.timers.append((delay, callback))
+        return self
+
+    def cancel(self):
+        self.timers = []
+
+    def update(self, line):
+        info = engine_info.Info()
+        info.parse(line)
+        self.aggregator.update(info)
+
+    def test_rate(self):
+        self.update("info depth 1 score cp 10 pv e2e4")
+        self.update("info depth 2 score cp 20 pv e2e4 e7e5")
+        self.update("info depth 3 score cp 30 pv d2d4")
+        # The first one at once, the last one of the others after a quarter of a second
+        self.assertEqual(self.published, [(1, ["e4"])])
+        self.assertEqual(len(self.timers), 1)
+        self.assertAlmostEqual(self.timers[0][0], 0.25)
+        clock.sleep(self.timers[0][0])
+        self.timers.pop()[1]()
+        self.assertEqual(self.published, [(1, ["e4"]), (3, ["d4"])])
+        self.assertEqual((self.aggregator.updates, self.aggregator.dropped), (3, 1))
+
+    def test_common_prefix_converted_once(self):
+        self.update("info depth 1 score cp 10 pv e2e4 e7e5")
+        clock.sleep(1)
+        self.update("info depth 2 score cp 20 pv e2e4 e7e5 g1f3")
+        self.assertEqual(self.published[-1], (2, ["e4", "e5", "Nf3"]))
+        self.assertEqual(self.aggregator.converted, 3)
+
+    def test_reset_drops_pending(self):
+        self.update("info depth 1 score cp 10 pv e2e4")
+        self.update("info depth 2 score cp 20 pv d2d4")
+        self.aggregator.reset(START)
+        self.assertEqual(self.timers, [])
+        self.assertEqual(self.published, [(1, ["e4"])])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,217 @@
+# Event loop of pycochess: one thread polls the board, the engines, the timers and the input
+# devices, and runs their handlers one after the other, so that the handlers share the game state
+# without locks and a move goes from the board to the engine in one call chain.
+#
+#   loop = event_loop.EventLoop()
+#   loop.add_reader(board_fd, on_board)     # on_board() when board_fd is readable
+#   loop.call_later(1.0, tick)
+#   loop.call_soon(on_line, line)           # from any thread, runs in the loop
+#   loop.run()
+#
+# The timers are on the clock module: a timerfd armed on the earliest deadline with the system clock,
+# the poll() timeouts of a simulated one. Only call_soon(), call_later(), call_at() and stop() may
+# be called from other threads, the threads of blocking work (a display waiting on its hardware, a
+# library calling back) hand their results over with call_soon().
+import collections
+import errno
+import fcntl
+import heapq
+import itertools
+import os
+import select
+import threading
+import traceback
+
+import clock
+
+
+class Handle(object):
+    def __init__(self, deadline, function, args):
+        self.deadline = deadline
+        self.function = function
+        self.args = args
+        self.cancelled = False
+
+    def cancel(self):
+        self.cancelled = True
+
+
+class _LoopTicker(object):
+    # Same interface as the tickers of the clock module, calling function in the loop
+    def __init__(self, loop, function):
+        self.loop = loop
+        self.function = function
+        self.handle = None
+
+    def set(self, deadline):
+        self.cancel()
+        self.handle = self.loop.call_at(deadline, self.function)
+
+    def cancel(self):
+        if self.handle:
+            self.handle.cancel()
+        self.handle = None
+
+    def close(self):
+        self.cancel()
+
+
+class EventLoop(object):
+    def __init__(self):
+        self.poller = select.poll()
+        # fd -> (function, args)
+        self.readers = {}
+        self.ready = collections.deque()
+        # (deadline, sequence, Handle)
+        self.timers = []
+        self.sequence = itertools.count()
+        self.thread = None
+        self.stopped = False
+        # Wakes the poll up when another thread adds work
+        self.wakeup_read, self.wakeup_write = os.pipe()
+        for fd in (self.wakeup_read, self.wakeup_write):
+            fcntl.fcntl(fd, fcntl.F_SETFL, fcntl.fcntl(fd, fcntl.F_GETFL) | os.O_NONBLOCK)
+        self.poller.register(self.wakeup_read, select.POLLIN)
+        # Timerfd of the clock, made by run() as the clock may be set after the loop
+        self.timerfd = None
+        self.armed = None
+        # Handlers run, and polls that returned, since the loop started
+        self.handled = 0
+        self.wakeups = 0
+
+    def in_loop(self):
+        # True in the thread of the loop, and before the loop runs
+        return self.thread is None or self.thread is threading.current_thread()
+
+    def _wake(self):
+        if self.in_loop():
+            return
+        try:
+            os.write(self.wakeup_write, "x")
+        except OSError as e:
+            # A full pipe wakes the loop up anyway
+            if e.errno != errno.EAGAIN:
+                raise
+
+    def add_reader(self, fd, function, *args):
+        # function(*args) each time fd is readable, in the loop
+        if not self.in_loop():
+            self.call_soon(self.add_reader, fd, function, *args)
+            return
+        fd = fd if isinstance(fd, int) else fd.fileno()
+        self.readers[fd] = (function, args)
+        self.poller.register(fd, select.POLLIN)
+
+    def remove_reader(self, fd):
+        if not self.in_loop():
+            self.call_soon(self.remove_reader, fd)
+            return
+        fd = fd if isinstance(fd, int) else fd.fileno()
+        if self.readers.pop(fd, None):
+            self.poller.unregister(fd)
+
+    def call_soon(self, function, *args):
+        # From any thread, the deque appends are atomic
+        self.ready.append((function, args))
+        self._wake()
+
+    def call_at(self, deadline, function, *args):
+        # function(*args) at deadline, a time of the clock module, returns a Handle with cancel()
+        handle = Handle(deadline, function, args)
+        if self.in_loop():
+            self._push(handle)
+        else:
+            self.call_soon(self._push, handle)
+        return handle
+
+    def call_later(self, delay, function, *args):
+        return self.call_at(clock.now() + delay, function, *args)
+
+    def ticker(self, function):
+        # A ticker (see clock.ticker) whose ticks run in the loop
+        return _LoopTicker(self, function)
+
+    def _push(self, handle):
+        heapq.heappush(self.timers, (handle.deadline, next(self.sequence), handle))
+
+    def _next_deadline(self):
+        while self.timers and self.timers[0][2].cancelled:
+            heapq.heappop(self.timers)
+        return self.timers[0][0] if self.timers else None
+
+    def _run(self, function, args):
+        self.handled += 1
+        try:
+            function(*args)
+        except Exception:
+            # A failing handler must not stop the board, the engines and the clock with it
+            traceback.print_exc()
+
+    def _poll(self):
+        deadline = self._next_deadline()
+        if self.ready:
+            timeout = 0
+        elif self.timerfd:
+            if deadline != self.armed:
+                self.timerfd.arm(deadline or 0)
+                self.armed = deadline
+            timeout = None
+        else:
+            timeout = None if deadline is None else max(0., deadline - clock.now())
+        if timeout == 0:
+            return self.poller.poll(0)
+        return clock.poll(self.poller, timeout)
+
+    def run_once(self):
+        # The work handed over before the poll runs first, in order, what the handlers add waits
+        # for the next round
+        count = len(self.ready)
+        events = self._poll()
+        self.wakeups += 1
+        for _ in xrange(count):
+            function, args = self.ready.popleft()
+            self._run(function, args)
+        for fd, event in events:
+            if fd == self.wakeup_read:
+                try:
+                    os.read(fd, 4096)
+                except OSError:
+                    pass
+            elif self.timerfd and fd == self.timerfd.fileno():
+                try:
+                    os.read(fd, 8)
+                except OSError:
+                    pass
+                self.armed = None
+            elif fd in self.readers:
+                function, args = self.readers[fd]
+                self._run(function, args)
+        now = clock.now()
+        while self.timers and self.timers[0][0] <= now:
+            handle = heapq.heappop(self.timers)[2]
+            if not handle.cancelled:
+                self._run(handle.function, handle.args)
+
+    def run(self):
+        # Runs the handlers in the calling thread until stop()
+        self.thread = threading.current_thread()
+        self.stopped = False
+        if not self.timerfd:
+            self.timerfd = clock.timerfd()
+            if self.timerfd:
+                self.poller.register(self.timerfd.fileno(), select.POLLIN)
+        while not self.stopped:
+            self.run_once()
+
+    def run_in_thread(self, name="event_loop"):
+        # run() in a daemon thread of its own, for the programs whose main thread does other work
+        thread = threading.Thread(target=self.run, name=name)
+        thread.daemon = True
+        self.thread = thread
+        thread.start()
+        return thread
+
+    def stop(self):
+        def stop():
+            self.stopped = True
+        self.call_soon(stop)
@@ -0,0 +1,130 @@
+import os
+import threading
+import unittest
+
+import clock
+import event_loop
+
+
+class EventLoopTest(unittest.TestCase):
+
+    def setUp(self):
+        # An instant clock, run_once() jumps to the next timer
+        clock.set_clock(clock.SimulatedClock(speed=0))
+        self.loop = event_loop.EventLoop()
+        self.calls = []
+
+    def tearDown(self):
+        clock.set_clock(None)
+
+    def test_timers_in_order(self):
+        start = clock.now()
+        self.loop.call_later(2., self.calls.append, "two")
+        self.loop.call_later(1., self.calls.append, "one")
+        self.loop.call_at(start + 1., self.calls.append, "one again")
+        self.loop.run_once()
+        # Same deadline: in the order they were added
+        self.assertEqual(self.calls, ["one", "one again"])
+        self.assertAlmostEqual(clock.now() - start, 1., places=6)
+        self.loop.run_once()
+        self.assertEqual(self.calls, ["one", "one again", "two"])
+        self.assertAlmostEqual(clock.now() - start, 2., places=6)
+
+    def test_cancel(self):
+        handle = self.loop.call_later(1., self.calls.append, "cancelled")
+        self.loop.call_later(2., self.calls.append, "kept")
+        handle.cancel()
+        self.loop.run_once()
+        self.assertEqual(self.calls, ["kept"])
+
+    def test_call_soon_before_timers(self):
+        self.loop.call_later(0., self.calls.append, "timer")
+        self.loop.call_soon(self.calls.append, "soon")
+        self.loop.run_once()
+        self.assertEqual(self.calls, ["soon", "timer"])
+
+    def test_call_soon_from_handler_waits(self):
+        # What a handler adds runs in the next round
+        self.loop.call_soon(lambda: self.loop.call_soon(self.calls.append, "second"))
+        self.loop.run_once()
+        self.assertEqual(self.calls, [])
+        self.loop.run_once()
+        self.assertEqual(self.calls, ["second"])
+
+    def test_failing_handler(self):
+        def fail():
+            raise ValueError("handler")
+        self.loop.call_soon(fail)
+        self.loop.call_soon(self.calls.append, "after")
+        with open(os.devnull, "w") as devnull:
+            stderr = os.dup(2)
+            os.dup2(devnull.fileno(), 2)
+            try:
+                self.loop.run_once()
+            finally:
+                os.dup2(stderr, 2)
+                os.close(stderr)
+        self.assertEqual(self.calls, ["after"])
+
+    def test_reader(self):
+        read, write = os.pipe()
+        self.loop.add_reader(read, lambda: self.calls.append(os.read(read, 16)))
+        os.write(write, "board")
+        self.loop.run_once()
+        self.loop.remove_reader(read)
+        os.write(write, "again")
+        self.loop.call_soon(self.calls.append, "no reader")
+        self.loop.run_once()
+        self.assertEqual(self.calls, ["board", "no reader"])
+        os.close(read)
+        os.close(write)
+
+    def test_ticker(self):
+        ticker = self.loop.ticker(lambda: self.calls.append(clock.now()))
+        start = clock.now()
+        ticker.set(start + 1.)
+        ticker.set(start + 3.)
+        self.loop.run_once()
+        self.assertEqual(self.calls, [start + 3.])
+
+
+class EventLoopThreadTest(unittest.TestCase):
+
+    def test_call_soon_from_threads(self):
+        loop = event_loop.EventLoop()
+        calls = []
+        done = threading.Event()
+        thread = loop.run_in_thread()
+
+        def work(name):
+            for i in range(100):
+                loop.call_soon(calls.append, (name, i))
+
+        threads = [threading.Thread(target=work, args=(name,)) for name in "ab"]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        loop.call_soon(done.set)
+        self.assertTrue(done.wait(5))
+        # Each thread's calls in order, and all of them in the loop thread
+        self.assertEqual([i for name, i in calls if name == "a"], range(100))
+        self.assertEqual([i for name, i in calls if name == "b"], range(100))
+        self.assertFalse(loop.in_loop())
+        loop.stop()
+        thread.join(5)
+
+    def test_call_later_wakes_the_loop(self):
+        loop = event_loop.EventLoop()
+        fired = threading.Event()
+        thread = loop.run_in_thread()
+        start = clock.now()
+        loop.call_later(0.05, fired.set)
+        self.assertTrue(fired.wait(5))
+        self.assertGreaterEqual(clock.now() - start, 0.05)
+        loop.stop()
+        thread.join(5)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,260 @@
+# Journal of the games played: an append-only binary file of game events (game start, moves,
+# undos, clock stamps, results), one write() per event and an fdatasync() at most every
+# SYNC_INTERVAL seconds from a thread of its own, so that a crash loses at most that much play and
+# a restart never truncates the games before. The PGN of the games is exported from the journal,
+# an undo taking the move back instead of writing the game again.
+#
+#   journal = game_journal.Journal(PROG_PATH + "/py/games.journal")
+#   journal.start_game({"White": "User", "Black": "Stockfish"})
+#   journal.move("e2e4", "e4")
+#   journal.clock(299000, 300000)
+#   journal.undo()
+#   journal.result("1-0")
+#
+#   python game_journal.py games.journal -o games.pgn
+#
+# A record is its kind, wall time and payload length, the payload, and the CRC-32 of them: a record
+# torn by a crash fails its CRC and is cut off when the journal is opened again.
+import argparse
+import atexit
+import os
+import struct
+import sys
+import threading
+import time
+import zlib
+
+from analysis_cache import pack_move, unpack_move
+
+MAGIC = "PYCOGJ01"
+# Seconds between the end of a write and the fdatasync() that makes it durable
+SYNC_INTERVAL = 1.0
+
+# Kinds of records
+GAME = 1
+MOVE = 2
+UNDO = 3
+CLOCK = 4
+RESULT = 5
+
+# Kind, wall time (time.time()) and payload length
+_RECORD = struct.Struct("<BdH")
+_CRC = struct.Struct("<I")
+# The move as pack_move() gives it, followed by its SAN
+_MOVE = struct.Struct("<H")
+# White and black times in ms
+_CLOCK = struct.Struct("<ii")
+
+
+def _records(data):
+    # (end offset, kind, wall time, payload) of the records of data, up to the first torn one
+    offset = len(MAGIC)
+    while offset + _RECORD.size <= len(data):
+        kind, wall, length = _RECORD.unpack_from(data, offset)
+        end = offset + _RECORD.size + length + _CRC.size
+        if end > len(data):
+            return
+        crc, = _CRC.unpack_from(data, end - _CRC.size)
+        if zlib.crc32(buffer(data, offset, end - offset - _CRC.size)) & 0xffffffff != crc:
+            return
+        yield end, kind, wall, data[offset + _RECORD.size:end - _CRC.size]
+        offset = end
+
+
+def _torn_magic(data):
+    # A crash while the journal was created leaves a part of MAGIC, the journal is empty
+    return len(data) < len(MAGIC) and MAGIC.startswith(data)
+
+
+def read(path):
+    # The records of the journal at path, as (kind, wall time, payload)
+    with open(path, "rb") as f:
+        data = f.read()
+    if _torn_magic(data):
+        return []
+    if not data.startswith(MAGIC):
+        raise ValueError("{0} is not a game journal".format(path))
+    return [record[1:] for record in _records(data)]
+
+
+class Journal(object):
+    def __init__(self, path, sync_interval=SYNC_INTERVAL):
+        self.path = path
+        self.sync_interval = sync_interval
+        self.fd = os.open(path, os.O_RDWR | os.O_CREAT | os.O_APPEND, 0644)
+        data = os.read(self.fd, os.fstat(self.fd).st_size) if os.fstat(self.fd).st_size else ""
+        if _torn_magic(data):
+            os.ftruncate(self.fd, 0)
+            os.write(self.fd, MAGIC)
+        elif not data.startswith(MAGIC):
+            os.close(self.fd)
+            raise ValueError("{0} is not a game journal".format(path))
+        else:
+            end = len(MAGIC)
+            for end, _, _, _ in _records(data):
+                pass
+            if end < len(data):
+                # The torn record of a crash, the next ones are appended after the valid ones
+                os.ftruncate(self.fd, end)
+        self.condition = threading.Condition()
+        self.dirty = False
+        self.closed = False
+        # Records appended and fdatasync() calls, the batching of one over the other
+        self.appended = 0
+        self.syncs = 0
+        self.thread = threading.Thread(target=self.run, name="journal")
+        self.thread.daemon = True
+        self.thread.start()
+        atexit.register(self.close)
+
+    def append(self, kind, payload=""):
+        # One write(), with O_APPEND at the end of the file whatever was written before
+        header = _RECORD.pack(kind, time.time(), len(payload))
+        os.write(self.fd, header + payload + _CRC.pack(zlib.crc32(header + payload) & 0xffffffff))
+        with self.condition:
+            self.appended += 1
+            if not self.dirty:
+                self.dirty = True
+                self.condition.notify()
+
+    def start_game(self, tags):
+        # tags: PGN tags of the new game, the FEN one when it does not start from the initial position
+        self.append(GAME, "".join("{0}\t{1}\n".format(name, value) for name, value in sorted(tags.iteritems())))
+
+    def move(self, move, san):
+        self.append(MOVE, _MOVE.pack(pack_move(move)) + san)
+
+    def undo(self):
+        self.append(UNDO)
+
+    def clock(self, wtime, btime):
+        # Times in ms after the last move
+        self.append(CLOCK, _CLOCK.pack(int(wtime), int(btime)))
+
+    def result(self, result):
+        # "1-0", "0-1", "1/2-1/2", the result is durable at once
+        self.append(RESULT, result)
+        self.sync()
+
+    def sync(self):
+        with self.condition:
+            self.dirty = False
+            self.syncs += 1
+        os.fdatasync(self.fd)
+
+    def run(self):
+        # The writes of SYNC_INTERVAL seconds go to the disk together
+        while True:
+            with self.condition:
+                while not self.dirty and not self.closed:
+                    self.condition.wait()
+                if self.closed:
+                    return
+            time.sleep(self.sync_interval)
+            with self.condition:
+                if self.closed or not self.dirty:
+                    continue
+            self.sync()
+
+    def close(self):
+        with self.condition:
+            if self.closed:
+                return
+            self.closed = True
+            self.condition.notify()
+        # Not while the thread syncs
+        self.thread.join()
+        os.fdatasync(self.fd)
+        os.close(self.fd)
+
+
+class Game(object):
+    def __init__(self, tags, wall):
+        self.tags = tags
+        self.wall = wall
+        # (SAN, clock in ms of the side that moved or None) of each ply
+        self.plies = []
+        self.result = "*"
+
+
+def games(path):
+    # The games of the journal at path, the moves taken back removed
+    found = []
+    game = None
+    for kind, wall, payload in read(path):
+        if kind == GAME:
+            tags = dict(line.split("\t", 1) for line in payload.splitlines() if "\t" in line)
+            game = Game(tags, wall)
+            found.append(game)
+        elif not game:
+            continue
+        elif kind == MOVE:
+            game.plies.append([payload[_MOVE.size:] or unpack_move(_MOVE.unpack_from(payload)[0]), None])
+        elif kind == UNDO and game.plies:
+            game.plies.pop()
+            game.result = "*"
+        elif kind == CLOCK and game.plies:
+            # The side that made the last move, from the side to move of the start position
+            wtime, btime = _CLOCK.unpack(payload)
+            fen = game.tags.get("FEN")
+            black_first = fen is not None and fen.split()[1] == "b"
+            white_moved = (len(game.plies) % 2 == 1) != black_first
+            game.plies[-1][1] = wtime if white_moved else btime
+        elif kind == RESULT:
+            game.result = payload
+    return found
+
+
+def _clk(ms):
+    seconds = ms // 1000
+    return "{0}:{1:02d}:{2:02d}".format(seconds // 3600, seconds // 60 % 60, seconds % 60)
+
+
+def pgn(game):
+    tags = [("Event", "?"), ("Site", "?"), ("Date", time.strftime("%Y.%m.%d", time.localtime(game.wall))),
+            ("Round", "-"), ("White", "?"), ("Black", "?")]
+    tags = [(name, game.tags.get(name, value)) for name, value in tags] + [("Result", game.result)]
+    if "FEN" in game.tags:
+        tags += [("SetUp", "1"), ("FEN", game.tags["FEN"])]
+    tags += sorted((name, value) for name, value in game.tags.iteritems() if name not in dict(tags))
+    lines = ['[{0} "{1}"]'.format(name, value.replace("\\", "\\\\").replace('"', '\\"')) for name, value in tags]
+    fen = game.tags.get("FEN")
+    number = int(fen.split()[5]) if fen and len(fen.split()) == 6 else 1
+    black_first = fen is not None and fen.split()[1] == "b"
+    tokens = []
+    for i, (san, clk) in enumerate(game.plies):
+        white = (i % 2 == 0) != black_first
+        if white:
+            tokens.append("{0}.".format(number))
+        elif i == 0:
+            tokens.append("{0}...".format(number))
+        tokens.append(san)
+        if clk is not None:
+            tokens.append("{{[%clk {0}]}}".format(_clk(clk)))
+        if not white:
+            number += 1
+    tokens.append(game.result)
+    # Movetext lines of at most 79 characters
+    text = [""]
+    for token in tokens:
+        if text[-1] and len(text[-1]) + 1 + len(token) > 79:
+            text.append("")
+        text[-1] = (text[-1] + " " + token).lstrip()
+    return "\n".join(lines) + "\n\n" + "\n".join(text) + "\n"
+
+
+def export_pgn(path, out):
+    for game in games(path):
+        out.write(pgn(game) + "\n")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="PGN of the games of a pycochess game journal")
+    parser.add_argument("journal", nargs="?", default="games.journal", help="journal of pycochess")
+    parser.add_argument("-o", "--output", help="PGN file, standard output by default")
+    args = parser.parse_args()
+    if args.output:
+        with open(args.output, "w") as f:
+            export_pgn(args.journal, f)
+    else:
+        export_pgn(args.journal, sys.stdout)
@@ -0,0 +1,115 @@
+import os
+import shutil
+import StringIO
+import tempfile
+import unittest
+
+import game_journal
+
+
+class GameJournalTest(unittest.TestCase):
+
+    def setUp(self):
+        self.directory = tempfile.mkdtemp()
+        self.path = os.path.join(self.directory, "games.journal")
+
+    def tearDown(self):
+        shutil.rmtree(self.directory)
+
+    def write_game(self):
+        journal = game_journal.Journal(self.path, sync_interval=0.01)
+        journal.start_game({"White": "User", "Black": "Stockfish"})
+        for move, san in [("e2e4", "e4"), ("e7e5", "e5"), ("g1f3", "Nf3")]:
+            journal.move(move, san)
+            journal.clock(299000, 298000)
+        journal.undo()
+        journal.move("f1c4", "Bc4")
+        journal.clock(297000, 298000)
+        journal.result("1-0")
+        journal.close()
+
+    def test_round_trip(self):
+        self.write_game()
+        kinds = [kind for kind, wall, payload in game_journal.read(self.path)]
+        self.assertEqual(kinds, [game_journal.GAME] + [game_journal.MOVE, game_journal.CLOCK] * 3 +
+                         [game_journal.UNDO, game_journal.MOVE, game_journal.CLOCK, game_journal.RESULT])
+        games = game_journal.games(self.path)
+        self.assertEqual(len(games), 1)
+        game = games[0]
+        self.assertEqual(game.tags, {"White": "User", "Black": "Stockfish"})
+        # The undo took Nf3 back
+        self.assertEqual(game.plies, [["e4", 299000], ["e5", 298000], ["Bc4", 297000]])
+        self.assertEqual(game.result, "1-0")
+
+    def test_pgn(self):
+        self.write_game()
+        out = StringIO.StringIO()
+        game_journal.export_pgn(self.path, out)
+        pgn = out.getvalue()
+        self.assertIn('[White "User"]', pgn)
+        self.assertIn('[Result "1-0"]', pgn)
+        self.assertIn("1. e4 {[%clk 0:04:59]} e5 {[%clk 0:04:58]} 2. Bc4 {[%clk 0:04:57]} 1-0", pgn)
+
+    def test_black_to_move_start(self):
+        journal = game_journal.Journal(self.path)
+        journal.start_game({"FEN": "8/8/8/8/8/8/k7/K6R b - - 0 40"})
+        journal.move("a2a3", "Ka3")
+        journal.clock(60000, 55000)
+        journal.move("h1h3", "Rh3#")
+        journal.close()
+        game = game_journal.games(self.path)[0]
+        self.assertEqual(game.plies, [["Ka3", 55000], ["Rh3#", None]])
+        self.assertIn("40... Ka3 {[%clk 0:00:55]} 41. Rh3# *", game_journal.pgn(game))
+
+    def test_torn_tail(self):
+        self.write_game()
+        size = os.path.getsize(self.path)
+        # A record cut by a crash after two bytes of its payload
+        with open(self.path, "ab") as f:
+            f.write(game_journal._RECORD.pack(game_journal.MOVE, 0., 20) + "e2")
+        self.assertEqual(len(game_journal.read(self.path)), 11)
+        journal = game_journal.Journal(self.path)
+        self.assertEqual(os.path.getsize(self.path), size)
+        journal.start_game({"White": "User"})
+        journal.move("d2d4", "d4")
+        journal.close()
+        games = game_journal.games(self.path)
+        self.assertEqual([game.plies for game in games][-1], [["d4", None]])
+        self.assertEqual(len(games), 2)
+
+    def test_crc(self):
+        self.write_game()
+        with open(self.path, "r+b") as f:
+            f.seek(-3, os.SEEK_END)
+            f.write("X")
+        # The result record fails its CRC and is cut off
+        self.assertEqual(game_journal.games(self.path)[0].result, "*")
+
+    def test_torn_magic(self):
+        with open(self.path, "wb") as f:
+            f.write(game_journal.MAGIC[:4])
+        self.assertEqual(game_journal.read(self.path), [])
+        journal = game_journal.Journal(self.path)
+        journal.start_game({"White": "User"})
+        journal.move("e2e4", "e4")
+        journal.close()
+        self.assertEqual([game.plies for game in game_journal.games(self.path)], [[["e4", None]]])
+
+    def test_not_a_journal(self):
+        with open(self.path, "wb") as f:
+            f.write("NOT A JOURNAL")
+        self.assertRaises(ValueError, game_journal.read, self.path)
+        self.assertRaises(ValueError, game_journal.Journal, self.path)
+
+    def test_batched_syncs(self):
+        journal = game_journal.Journal(self.path, sync_interval=0.5)
+        journal.start_game({"White": "User"})
+        for i in range(10):
+            journal.clock(1000 * i, 1000 * i)
+        self.assertEqual(journal.appended, 11)
+        self.assertEqual(journal.syncs, 0)
+        journal.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,84 @@
+# Position of the game after each of its moves, so that the current FEN, key, SAN history and legal
+# moves no longer replay the whole game through sf.get_fen(start, moves) each time they are needed.
+# make() computes the new position from the previous one, unmake() pops it, and what is derived
+# from a position (key, legal moves, the moves leading to each next board) is computed once per ply.
+#
+#   game = game_state.GameState()
+#   game.make("e2e4")           # -> "e4"
+#   game.fen, game.key(), game.legal_moves()
+#   fen, moves = game.engine_position()
+#   sf.go(fen, moves=moves, movetime=1000)
+#
+# engine_position() gives the engines the position of the last capture or pawn move and the moves
+# since, which keeps what the engines replay bounded by the fifty moves rule in long games while
+# keeping the repetitions they need to see.
+import stockfish as sf
+
+
+class GameState(object):
+    def __init__(self, fen="startpos"):
+        self.reset(fen)
+
+    def reset(self, fen="startpos"):
+        self.start_fen = fen
+        self.moves = []
+        self.san = []
+        # One entry per ply, the start position first
+        self.fens = [sf.get_fen(fen, [])]
+        # Ply of the last capture or pawn move at each ply
+        self.roots = [0]
+        self.derived = [{}]
+
+    @property
+    def fen(self):
+        return self.fens[-1]
+
+    def fen_before(self, plies=1):
+        # FEN of the position plies moves ago, the start position before that
+        return self.fens[max(0, len(self.fens) - 1 - plies)]
+
+    def make(self, move):
+        # Plays move, returns its SAN
+        fen = self.fens[-1]
+        san = sf.to_san(fen, [move])[0]
+        new_fen = sf.get_fen(fen, [move])
+        self.moves.append(move)
+        self.san.append(san)
+        self.fens.append(new_fen)
+        # The halfmove clock is reset by captures and pawn moves
+        self.roots.append(len(self.moves) if new_fen.split()[4] == "0" else self.roots[-1])
+        self.derived.append({})
+        return san
+
+    def unmake(self):
+        # Takes the last move back, returns it
+        self.san.pop()
+        self.fens.pop()
+        self.roots.pop()
+        self.derived.pop()
+        return self.moves.pop()
+
+    def _derived(self, name, compute):
+        values = self.derived[-1]
+        if name not in values:
+            values[name] = compute()
+        return values[name]
+
+    def key(self):
+        return self._derived("key", lambda: sf.key(self.fens[-1], []))
+
+    def legal_moves(self):
+        return self._derived("legal_moves", lambda: sf.legal_moves(self.fens[-1]))
+
+    def move_to(self, placement):
+        # The legal move giving the piece placement (first FEN field), None if there is none
+        def successors():
+            fen = self.fens[-1]
+            return dict((sf.get_fen(fen, [m]).split()[0], m) for m in self.legal_moves())
+        return self._derived("successors", successors).get(placement)
+
+    def engine_position(self, extra=()):
+        # FEN and moves to send to an engine for the current position followed by the extra moves
+        root = self.roots[-1]
+        fen = self.start_fen if root == 0 else self.fens[root]
+        return fen, self.moves[root:] + list(extra)
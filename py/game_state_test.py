@@ -0,0 +1,70 @@
+import unittest
+
+import game_state
+import stockfish as sf
+
+START = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
+
+
+def position(fen):
+    # FEN without the move counters
+    return fen.split()[:4]
+
+
+class GameStateTest(unittest.TestCase):
+
+    def test_make_unmake(self):
+        game = game_state.GameState()
+        self.assertEqual(position(game.fen), position(START))
+        self.assertEqual(game.make("e2e4"), "e4")
+        self.assertEqual(game.make("g8f6"), "Nf6")
+        self.assertEqual(game.moves, ["e2e4", "g8f6"])
+        self.assertEqual(game.san, ["e4", "Nf6"])
+        self.assertEqual(position(game.fen), position(sf.get_fen("startpos", ["e2e4", "g8f6"])))
+        self.assertEqual(position(game.fen_before()), position(sf.get_fen("startpos", ["e2e4"])))
+        self.assertEqual(position(game.fen_before(5)), position(START))
+        self.assertEqual(game.unmake(), "g8f6")
+        self.assertEqual(game.moves, ["e2e4"])
+        self.assertEqual(position(game.fen), position(sf.get_fen("startpos", ["e2e4"])))
+
+    def test_derived(self):
+        game = game_state.GameState()
+        self.assertEqual(sorted(game.legal_moves()), sorted(sf.legal_moves(game.fen)))
+        self.assertEqual(game.key(), sf.key(game.fen, []))
+        game.make("d2d4")
+        self.assertEqual(sorted(game.legal_moves()), sorted(sf.legal_moves(game.fen)))
+        game.unmake()
+        # The values of the position before are kept
+        self.assertEqual(len(game.legal_moves()), 20)
+
+    def test_move_to(self):
+        game = game_state.GameState()
+        placement = sf.get_fen("startpos", ["g1f3"]).split()[0]
+        self.assertEqual(game.move_to(placement), "g1f3")
+        self.assertIsNone(game.move_to(START.split()[0]))
+
+    def test_engine_position(self):
+        game = game_state.GameState()
+        self.assertEqual(game.engine_position(), ("startpos", []))
+        for move in ["g1f3", "g8f6", "f3g1"]:
+            game.make(move)
+        # No capture or pawn move yet, from the start position
+        self.assertEqual(game.engine_position(["f6g8"]), ("startpos", ["g1f3", "g8f6", "f3g1", "f6g8"]))
+        game.make("e7e5")
+        game.make("b1c3")
+        fen, moves = game.engine_position()
+        self.assertEqual(moves, ["b1c3"])
+        self.assertEqual(position(sf.get_fen(fen, moves)), position(game.fen))
+
+    def test_start_fen(self):
+        fen = "4k3/8/8/8/8/8/4P3/4K3 w - - 0 1"
+        game = game_state.GameState(fen)
+        game.make("e1d1")
+        self.assertEqual(game.engine_position(), (fen, ["e1d1"]))
+        game.reset()
+        self.assertEqual(game.moves, [])
+        self.assertEqual(game.engine_position(), ("startpos", []))
+
+
+if __name__ == "__main__":
+    unittest.main()
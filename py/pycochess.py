@@ -1,25 +1,43 @@
 #!/usr/bin/python
 
-from Queue import Queue
+from Queue import Queue, Empty
 import traceback
 import stockfish as sf
-from threading import Thread, RLock
-from threading import Timer
-from time import sleep
-import datetime
+from threading import Thread
+import clock
+from clock import sleep
 import itertools as it
+import operator
 import os
+import random
 import subprocess
 import sys
 import socket
 
 from ChessBoard import ChessBoard
-from pydgt import DGTBoard
+from pydgt import open_dgt_board
+from pydgt import find_dgt_board
+from pydgt import load_device_cache
+from pydgt import save_device_cache
 from pydgt import FEN
 from pydgt import CLOCK_BUTTON_PRESSED
 from pydgt import CLOCK_ACK
 from pydgt import CLOCK_LEVER
+from pydgt import CLOCK_TIME
+from pydgt import BOARD_LOST
+from pydgt import BOARD_RESTORED
+from pydgt import PIECE_LIFTED
 from polyglot_opening_book import PolyglotOpeningBook
+import speculate
+import display
+import chess_clock
+import engine_info
+import event_loop
+import game_state
+import game_journal
+import analysis_cache as cache
+import tracing
+import uci_pool
 
 START_GAME_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR"
 
@@ -52,6 +70,7 @@ except ImportError:
 piface = None
 arduino = False
 dgt_clock = False
+arm = False
 
 try:
     import pifacecad
@@ -225,15 +244,46 @@ class MenuRotation:
     length = 6
     MAIN, POSITION, DATABASE, ALT_INPUT, SYSTEM, ENGINE = range(length)
 
-move_queue = Queue()
+# Runs the handlers of the board, the engines, the timers and the inputs in the main thread (see event_loop.py)
+loop = event_loop.EventLoop()
+# UCI engine processes for the game, the analysis and the hints (see uci_pool.py), None to search with pyfish
+engine_pool = None
+# Search time in ms of a hint of the analysis engine
+HINT_TIME = 2000
+# Search the expected reply while the player thinks, on the play engine of the pool (pyfish has no ponderhit)
+PONDER = True
+# Search the likely destinations of a lifted piece of the player on the play engine of the pool (see speculate.py)
+SPECULATE = True
+# Results of the searches by position (see analysis_cache.py), None to always search
+analysis_cache = None
+# Options set on the engines, by name
+engine_options = {}
+# Analysis lines shown per second at most
+ANALYSIS_RATE = 4
+# Take the times reported by the DGT clock over the computed ones, when the DGT clock keeps the game times
+DGT_CLOCK_TIMES = False
+# Seconds to wait for the ack of a clock message before sending it again
+CLOCK_ACK_TIMEOUT = 2
+# Moves of the king to the rook of the polyglot books, as UCI castles
+POLYGLOT_CASTLING = {"e1h1": "e1g1", "e1a1": "e1c1", "e8h8": "e8g8", "e8a8": "e8c8"}
+
+
+def set_engine_option(name, value):
+    # pyfish keeps every option and the pool engines get them too, though they may have no book:
+    # with the pool, "OwnBook" and "Book File" are played by Pycochess.book_lines()
+    engine_options[name] = value
+    sf.set_option(name, value)
+    if engine_pool:
+        engine_pool.set_option(name, value)
 
 class DGT_Clock_Message(object):
-    def __init__(self, message, move=False, dots=False, beep=True, max_num_tries=5):
+    def __init__(self, message, move=False, dots=False, beep=True, max_num_tries=5, trace_id=None):
         self.message = message
         self.move = move
         self.dots = dots
         self.beep = beep
         self.max_num_tries = max_num_tries
+        self.trace_id = trace_id
 
 
 class Pycochess(object):
@@ -247,12 +297,13 @@ class Pycochess(object):
         self.use_tb = False
         self.clock_ack_queue = Queue()
         self.clock_lever = None
-        self.dgt_clock_lock = RLock()
         self.dgt_pause_clock = False
-        self.dgt_clock_msg_queue = Queue()
+        # Latest-wins displays, the DGT clock one once a clock answered
+        self.clock_display = None
+        self.lcd_display = display.Compositor(self.show_on_lcd, name="lcd")
 
-        sf.set_option('SyzygyPath', '/home/pi/syzygy/')
-        sf.set_option('SyzygyProbeLimit', 0)
+        set_engine_option('SyzygyPath', '/home/pi/syzygy/')
+        set_engine_option('SyzygyProbeLimit', 0)
 
         self.level = 20
         self.book_index = DEFAULT_BOOK_INDEX
@@ -267,28 +318,44 @@ class Pycochess(object):
         self.device = device
         self.turn = WHITE
         self.board_updated = False
-        self.move_list = []
-        self.san_move_list = []
+        # Moves of the game and the position after each of them
+        self.game = game_state.GameState(self.pyfish_fen)
         self.executed_command = False
-        self.pgn_file = open(PROG_PATH+'/py/game.pgn', 'w', 0)
-        self.rewrite_pgn = False
+        # Every game played, appended to the journal (see game_journal.py), and whether the current one is in it
+        self.journal = game_journal.Journal(PROG_PATH+'/py/games.journal')
+        self.journal_game = False
         self.silent = False
         self.first_dgt_fen = None
 
         self.engine_comp_color = BLACK
 
-        self.time_white = 0
+        # Times of the game, ticking the display on each second
+        self.chess_clock = chess_clock.ChessClock(lambda color: self.update_clocks(), ticker=loop.ticker)
+        self.chess_clock.reset({WHITE: 0, BLACK: 0})
         self.time_inc_white = 0
-        self.time_black = 0
         self.time_inc_black = 0
-        self.time_last = None
 
         # Engine specific stuff
-        self.score_count = 0
         self.score = None
+        # Info line parsed in place, and the aggregator of the analysis lines shown
+        self.info = engine_info.Info()
+        self.analysis = engine_info.Aggregator(self.show_analysis, ANALYSIS_RATE, call_later=loop.call_later)
         self.engine_mode = Pycochess.PLAY
         self.engine_searching = False
         self.ponder_move = None
+        # The play engine ponders on these moves of the game, the last one the expected reply
+        self.pondering = False
+        self.ponder_moves = None
+        # Key and side to move of the position searched, and the movetime of the search, for the analysis cache
+        self.search_position = None
+        # pyfish searches started, and bestmoves it gave, in the order of its thread: a line is of the
+        # search numbered by the bestmoves before it, the current one, or None once it is stopped
+        self.pyfish_searches = 0
+        self.pyfish_bestmoves = 0
+        self.pyfish_search = None
+        # Trace of the move being processed, and when the engine was started on it
+        self.trace_id = None
+        self.engine_start = None
 
         # Game specific stuff
         self.clock_mode = FIXED_TIME
@@ -309,63 +376,82 @@ class Pycochess(object):
         self.invalid_computer_move = False
         self.last_output_move = None
         self.last_output_move_can = None
-        sf.add_observer(self.parse_score)
+        # Called with each move handled and when its handling started, for the benchmarks
+        self.move_observers = []
+        if engine_pool:
+            # In the loop once the pool is attached to it
+            engine_pool.get(uci_pool.PLAY).add_observer(self.parse_score)
+            engine_pool.get(uci_pool.ANALYSIS).add_observer(self.parse_score)
+        else:
+            # pyfish calls from its search thread
+            sf.add_observer(self.observe_pyfish)
+        self.speculator = speculate.Speculator(self.engine()) if engine_pool else None
 
         # Polyglot book load
         # Load the GM book for now to provide human reference moves
         self.polyglot_book = PolyglotOpeningBook(BOOK_PATH+"gm1950.bin")
-
-        # display lock
-        self.display_lock = RLock()
-
-    def write_to_dgt(self, message, move=False, dots=False, beep=True, max_num_tries = 5):
-        if self.dgt.dgt_clock:
-            self.dgt_clock_msg_queue.put(DGT_Clock_Message(message, move=move, dots=dots, beep=beep, max_num_tries=max_num_tries))
-
-    def write_to_piface(self, message, custom_bitmap = None, clear = False):
+        # Path and book of the "Book File" option, played instead of the engine book with the pool
+        self.engine_book = (None, None)
+
+    def write_to_dgt(self, message, move=False, dots=False, beep=True, max_num_tries = 5, trace_id=None, kind=None):
+        # Moves (display.MOVE) are shown in turn, the other messages replace those of their kind not shown yet
+        if self.clock_display:
+            if kind is None:
+                kind = display.MOVE if move else display.TEXT
+            self.clock_display.submit(kind, [DGT_Clock_Message(message, move=move, dots=dots, beep=beep,
+                                                               max_num_tries=max_num_tries, trace_id=trace_id)],
+                                      trace_id, append=operator.add if kind == display.MOVE else None)
+
+    def write_to_piface(self, message, custom_bitmap = None, clear = False, kind=display.TEXT):
+        # A screen cleared replaces the one of its kind not shown yet, other writes go after it
+        self.lcd_display.submit(kind, [(message, custom_bitmap, clear)], append=None if clear else operator.add)
+
+    def show_on_lcd(self, writes):
+        # In the thread of the lcd display
+        for message, custom_bitmap, clear in writes:
+            self.write_lcd(message, custom_bitmap, clear)
+
+    def write_lcd(self, message, custom_bitmap, clear):
         if len(message) > 32:
             message = message[:32]
         if len(message) > 16 and "\n" not in message:
             # Append "\n"
             message = message[:16]+"\n"+message[16:]
         if piface:
-            # Acquire piface write lock to guard against multiple threads writing at the same time
-            with self.display_lock:
-                if clear:
-                    cad.lcd.clear()
-
-                if not clear:
-                    col, row = cad.lcd.get_cursor()
-                    if row == 0 and col + len(message)>16:
-                        cad.lcd.set_cursor(0, 1)
-
-
-                cad.lcd.write(message)
-                if custom_bitmap is not None:
-                    cad.lcd.set_cursor(15,1)
-                    cad.lcd.write_custom_bitmap(custom_bitmap)
-                # print "piface wrote: {0}".format(message)
-                # Microsleep before returning lock
-                # Sleep enables that garbage is not written to the screen
-                sleep(0.3)
+            if clear:
+                cad.lcd.clear()
+
+            if not clear:
+                col, row = cad.lcd.get_cursor()
+                if row == 0 and col + len(message)>16:
+                    cad.lcd.set_cursor(0, 1)
+
+
+            cad.lcd.write(message)
+            if custom_bitmap is not None:
+                cad.lcd.set_cursor(15,1)
+                cad.lcd.write_custom_bitmap(custom_bitmap)
+            # print "piface wrote: {0}".format(message)
+            # Microsleep before the next write, in the thread of the display
+            # Sleep enables that garbage is not written to the screen
+            sleep(0.3)
         elif arduino:
-            with self.display_lock:
-                # lcd.printString("                ", 0, 0)
-                # lcd.printString("                ", 1, 0)
-                if clear:
-                    lcd.printString("                ", 0, 0)
-                    lcd.printString("                ", 0, 1)
-
-                    # lcd.printString("      ",0,1)
-                if "\n" in message:
-                    first, second = message.split("\n")
-                    # print first
-                    # print second
-                    lcd.printString(first, 0, 0)
-                    lcd.printString(second, 0, 1)
-                else:
-                    lcd.printString(message, 0, 0)
-                sleep(0.1)
+            # lcd.printString("                ", 0, 0)
+            # lcd.printString("                ", 1, 0)
+            if clear:
+                lcd.printString("                ", 0, 0)
+                lcd.printString("                ", 0, 1)
+
+                # lcd.printString("      ",0,1)
+            if "\n" in message:
+                first, second = message.split("\n")
+                # print first
+                # print second
+                lcd.printString(first, 0, 0)
+                lcd.printString(second, 0, 1)
+            else:
+                lcd.printString(message, 0, 0)
+            sleep(0.1)
         else:
             # if self.dgt.dgt_clock:
             #     self.dgt.send_message_to_clock(message, False, False)
@@ -373,6 +459,9 @@ class Pycochess(object):
 
     def get_legal_move(self, from_fen, to_fen):
         to_fen_first_tok = to_fen.split()[0]
+        if from_fen.split()[0] == self.game.fen.split()[0]:
+            # From the position of the game, whose next boards are computed once
+            return self.game.move_to(to_fen_first_tok)
         for m in sf.legal_moves(from_fen):
             cur_fen = sf.get_fen(from_fen,[m])
             cur_fen_first_tok = str(cur_fen).split()[0]
@@ -381,6 +470,14 @@ class Pycochess(object):
             if cur_fen_first_tok == to_fen_first_tok:
                 return m
 
+    @property
+    def move_list(self):
+        return self.game.moves
+
+    @property
+    def san_move_list(self):
+        return self.game.san
+
     def disconnect(self):
         if self.dgt:
             del self.dgt
@@ -391,6 +488,8 @@ class Pycochess(object):
 
     def on_observe_dgt_move(self, attr):
         if attr.type == FEN:
+            trace_id = getattr(attr, 'trace', None)
+            start = tracing.now()
             fen = attr.message
             # print "pyfish_fen: {0}".format(self.pyfish_fen)
             print "move_list: {0}".format(self.move_list)
@@ -411,10 +510,15 @@ class Pycochess(object):
 
             self.current_fen = fen
             # print "Probing for move.."
-            m = self.probe_move(fen)
+            with tracing.span('probe_move', trace_id):
+                m = self.probe_move(fen)
+            # A move of the player stops their time, the computer move made on the board starts it
+            self.run_clock(getattr(attr, 'time', None))
             print "move: {0}".format(m)
+            tracing.complete('on_observe_dgt_move', trace_id, start)
             if m:
-                move_queue.put(m)
+                # The engine starts before this handler returns
+                handle_move(self, tracing.queued(m, trace_id))
         #        dgt_sem.release()
         if attr.type == CLOCK_BUTTON_PRESSED:
             # print "Clock button {0} pressed".format(attr.message)
@@ -423,6 +527,9 @@ class Pycochess(object):
         if attr.type == CLOCK_ACK:
             self.clock_ack_queue.put('ack')
             print "Clock ACK Received"
+        if attr.type == CLOCK_TIME and DGT_CLOCK_TIMES:
+            wtime, btime, wturn = attr.message
+            self.chess_clock.sync({WHITE: wtime, BLACK: btime}, attr.time)
         if attr.type == CLOCK_LEVER:
             if self.clock_lever != attr.message:
                 if self.clock_lever:
@@ -432,51 +539,77 @@ class Pycochess(object):
                     self.button_event(e)
 
                 self.clock_lever = attr.message
+        if attr.type == BOARD_LOST:
+            print "Board disconnected, waiting for it on {0}".format(attr.message)
+        if attr.type == BOARD_RESTORED:
+            # The position is checked again with the next FEN
+            print "Board reconnected on {0}".format(attr.message)
+        if attr.type == PIECE_LIFTED:
+            self.speculate(*attr.message)
 
 
 
     def poll_dgt(self):
-        thread = Thread(target=self.dgt.poll)
+        self.dgt.watch(loop)
+
+    def queue_move(self, m):
+        # Handled by the loop once the current handler returned
+        loop.call_soon(handle_move, self, m)
+
+    def remember_device(self):
+        # The board found is tried first at the next start, the vendor strings
+        # are asked in the background as the driver waits for their answers
+        def save():
+            vendor = self.dgt.vendor_strings() if hasattr(self.dgt, "vendor_strings") else None
+            save_device_cache(self.device, vendor)
+        thread = Thread(target=save)
+        thread.daemon = True
         thread.start()
 
-    def dgt_clock_ack_thread(self):
-        # print "starting dgt clock_msg_handler thread"
-        thread = Thread(target=self.dgt_clock_msg_handler)
-        thread.start()
+    def test_for_dgt_clock(self):
+        self.dgt.test_for_dgt_clock()
+        loop.call_soon(self.dgt_clock_tested)
 
-    def dgt_clock_msg_handler(self):
-        while True:
-            # print "dgt_clock_msg handler started!!"
-            with self.dgt_clock_lock:
-                # Wait for dgt clock ack after sending a message
-                # print "clock_msg hanlder started.."
-                msg = self.dgt_clock_msg_queue.get()
-                # print "got message!"
-                while True:
+    def dgt_clock_tested(self):
+        if self.dgt.dgt_clock:
+            print "Found DGT Clock"
+            self.clock_display = display.Compositor(self.show_on_clock, name="clock_msg")
+        else:
+            print "No DGT Clock found"
+
+    def show_on_clock(self, messages):
+        # In the thread of the clock display: each message is sent once the clock acked the previous one,
+        # the moves of a frame stay display.HOLD[display.MOVE] seconds each
+        for i, msg in enumerate(messages):
+            if i:
+                sleep(display.HOLD[display.MOVE])
+            # Acks of the messages given up on
+            while not self.clock_ack_queue.empty():
+                self.clock_ack_queue.get()
+            sent = tracing.now()
+            for _ in xrange(max(1, msg.max_num_tries)):
+                with tracing.span('send_message_to_clock', msg.trace_id):
                     self.dgt.send_message_to_clock(msg.message, move=msg.move, dots=msg.dots, beep=msg.beep, max_num_tries=msg.max_num_tries)
-                    sleep(1)
-                    ack_msg = self.clock_ack_queue.get(1)
-                    if ack_msg:
-                        break
-                # self.dgt.send
-                # self.dgt_clock_msg_queue.put(DGT_Clock_Message(message, move=move, dots=dots, beep=beep, max_num_tries=max_num_tries))
+                try:
+                    self.clock_ack_queue.get(timeout=CLOCK_ACK_TIMEOUT)
+                    break
+                except Empty:
+                    print "No clock ack for {0}".format(msg.message)
+            tracing.complete('clock_ack', msg.trace_id, sent, last=True)
 
 
 
     def connect(self):
         if self.device != "human":
-            self.dgt = DGTBoard(self.device)
+            self.dgt = open_dgt_board(self.device)
 
             self.dgt.subscribe(self.on_observe_dgt_move)
             self.poll_dgt()
             # sleep(1)
-            self.dgt.test_for_dgt_clock()
-            # p
-            if self.dgt.dgt_clock:
-                print "Found DGT Clock"
-                self.dgt_clock_ack_thread()
-            else:
-                print "No DGT Clock found"
+            # The test waits for the ack, which comes through the loop
+            thread = Thread(target=self.test_for_dgt_clock)
+            thread.daemon = True
+            thread.start()
             self.dgt.get_board()
 
         # board.poll()
@@ -504,6 +637,7 @@ class Pycochess(object):
 
 
     def start_new_game(self):
+        self.stop_ponder()
         self.engine_computer_move = False
         # Help user execute comp moves
         self.computer_move_FEN_reached = False
@@ -514,8 +648,8 @@ class Pycochess(object):
         self.last_output_move = None
         self.last_output_move_can = None
 
-        self.move_list = []
-        self.san_move_list = []
+        self.game.reset(self.pyfish_fen)
+        self.journal_game = False
         self.turn = WHITE
 
         # if piface:
@@ -529,17 +663,17 @@ class Pycochess(object):
 
         if self.engine_comp_color == WHITE:
             self.engine_computer_move = True
-            move_queue.put(FORCE_MOVE)
+            self.queue_move(FORCE_MOVE)
 
     def set_level(self, level):
-        sf.set_option("Skill Level", level)
+        set_engine_option("Skill Level", level)
         self.write_to_piface("Now on Level " + str(level), clear=True)
         self.write_to_dgt("lvl{: >3}".format(level), max_num_tries=1)
 
     def set_book(self, book_map_entry):
         filepath = BOOK_PATH + book_map_entry[0] + BOOK_EXTENSION
         print "book filepath : {0}".format(filepath)
-        sf.set_option("Book File", filepath)
+        set_engine_option("Book File", filepath)
         self.write_to_piface("Book:\n " + book_map_entry[1], clear=True)
         self.write_to_dgt(book_map_entry[0], move=False, beep=True, max_num_tries=1)
 
@@ -670,31 +804,40 @@ class Pycochess(object):
             except ValueError:
                 return False
 
-    def update_time(self, color=WHITE):
-#        if self.time_last:
-#            current = datetime.datetime.now()
-#            seconds_elapsed = (current - self.time_last).total_seconds()
-    #        print "seconds_elapsed:{0}".format(seconds_elapsed)
-#            self.time_last = current
-        if color == WHITE:
-            self.time_white -= 1*1000
-        else:
-            self.time_black -= 1*1000
-
-    def reset_clock_update(self):
-        self.time_last = datetime.datetime.now()
+    @property
+    def time_white(self):
+        return self.chess_clock.remaining(WHITE)
+
+    @time_white.setter
+    def time_white(self, ms):
+        self.chess_clock.set(WHITE, ms)
+
+    @property
+    def time_black(self):
+        return self.chess_clock.remaining(BLACK)
+
+    @time_black.setter
+    def time_black(self, ms):
+        self.chess_clock.set(BLACK, ms)
+
+    def clock_side(self):
+        # Color whose time runs: the computer while it searches, the player once the computer move is
+        # made on the board in blitz, None otherwise
+        if self.play_mode != GAME_MODE or self.dgt_pause_clock:
+            return None
+        if self.engine_computer_move and self.engine_searching:
+            return self.engine_comp_color
+        if not self.engine_searching and self.computer_move_FEN_reached and len(self.move_list) > 0 \
+                and (self.clock_mode == BLITZ or self.clock_mode == BLITZ_FISCHER):
+            return BLACK if self.engine_comp_color == WHITE else WHITE
+        return None
+
+    def run_clock(self, at=None):
+        # Runs the time of clock_side() from the timestamp at, now by default
+        self.chess_clock.run(self.clock_side(), at)
 
     def time_add_increment(self, color=WHITE):
-        if color == WHITE:
-            self.time_white += self.time_inc_white
-        else:
-            self.time_black += self.time_inc_black
-
-    def update_player_time(self):
-        color = WHITE
-        if self.engine_comp_color == WHITE:
-            color = BLACK
-        self.update_time(color=color)
+        self.chess_clock.add(color, self.time_inc_white if color == WHITE else self.time_inc_black)
 
     def format_time_str(self, time_a):
 
@@ -723,7 +866,10 @@ class Pycochess(object):
         return fmt_time_a+" "*num_spaces+fmt_time_b
 
     def update_clocks(self, *args):
+        # Shows the times, on each second reached by the running one
         # print "updating clocks"
+        time_white = self.chess_clock.displayed(WHITE)
+        time_black = self.chess_clock.displayed(BLACK)
         if self.play_mode == GAME_MODE:
             custom_bitmap = 0
             b_blink = False
@@ -735,32 +881,27 @@ class Pycochess(object):
                 w_blink = True
             if self.engine_computer_move:
                 # print "computer_move"
-                if self.engine_searching:
-                    if not self.dgt_pause_clock:
-                        self.update_time(color=self.engine_comp_color)
-#                    print "comp_time: {0}".format(self.time_black)
-
                 if self.engine_searching and (self.clock_mode == BLITZ or self.clock_mode == BLITZ_FISCHER):
                     if not self.dgt_pause_clock:
-                        self.write_to_piface(self.format_time_strs(self.time_white, self.time_black), custom_bitmap=custom_bitmap, clear=True)
-                        self.dgt.print_time_on_clock(self.time_white, self.time_black, w_blink=w_blink, b_blink=b_blink)
+                        self.write_to_piface(self.format_time_strs(time_white, time_black), custom_bitmap=custom_bitmap, clear=True, kind=display.TIME)
+                        self.show_times_on_clock(time_white, time_black, w_blink, b_blink)
 
                 elif self.clock_mode == FIXED_TIME and self.engine_searching:
                     # If FIXED_TIME
                     if self.engine_comp_color == WHITE:
 #                        print "comp_time: {0}".format(self.time_white)
-                        if self.time_white and self.time_white >= 1000:
-                            self.write_to_piface(self.format_time_str(self.time_white), custom_bitmap=custom_bitmap, clear = True)
+                        if time_white and time_white >= 1000:
+                            self.write_to_piface(self.format_time_str(time_white), custom_bitmap=custom_bitmap, clear=True, kind=display.TIME)
                             # print "DGT time: {0}".format(self.dgt.compute_dgt_time_string(self.time_white))
                             # self.write_to_dgt(self.format_time_str(self.time_white), beep=False, dots=True)
-                            self.write_to_dgt(self.dgt.compute_dgt_time_string(self.time_white), beep=False, dots=True)
+                            self.write_to_dgt(self.dgt.compute_dgt_time_string(time_white), beep=False, dots=True, kind=display.TIME)
                     else:
 #                        print "comp_time: {0}".format(self.time_black)
-                        if self.time_black and self.time_black >= 1000:
-                            self.write_to_piface(self.format_time_str(self.time_black), custom_bitmap=custom_bitmap, clear = True)
+                        if time_black and time_black >= 1000:
+                            self.write_to_piface(self.format_time_str(time_black), custom_bitmap=custom_bitmap, clear=True, kind=display.TIME)
                             # self.write_to_dgt(self.format_time_str(self.time_black), beep=False, dots=True)
                             # print "DGT time: {0}".format(self.dgt.compute_dgt_time_string(self.time_black))
-                            self.write_to_dgt(self.dgt.compute_dgt_time_string(self.time_black), beep=False, dots=True)
+                            self.write_to_dgt(self.dgt.compute_dgt_time_string(time_black), beep=False, dots=True, kind=display.TIME)
 
                         # self.engine_score.children[0].text = "[color=000000]Thinking..\n[size=24]{0}    [b]{1}[/size][/b][/color]".format(self.format_time_str(self.time_white), self.format_time_str(self.time_black))
             # print "not comp move"
@@ -770,17 +911,15 @@ class Pycochess(object):
             if player_move and len(self.move_list) > 0 and (self.clock_mode == BLITZ or self.clock_mode == BLITZ_FISCHER):
                 # print "player_move"
                 if not self.dgt_pause_clock:
-                    self.update_player_time()
-                    self.write_to_piface(self.format_time_strs(self.time_white, self.time_black), custom_bitmap=custom_bitmap, clear=True)
-                    self.dgt.print_time_on_clock(self.time_white, self.time_black, w_blink=w_blink, b_blink=b_blink)
-
+                    self.write_to_piface(self.format_time_strs(time_white, time_black), custom_bitmap=custom_bitmap, clear=True, kind=display.TIME)
+                    self.show_times_on_clock(time_white, time_black, w_blink, b_blink)
 
+    def show_times_on_clock(self, time_white, time_black, w_blink, b_blink):
+        message, dots = self.dgt.time_message(time_white, time_black, w_blink=w_blink, b_blink=b_blink)
+        self.write_to_dgt(message, dots=dots, beep=False, kind=display.TIME)
 
     def register_move(self, m):
-        san = self.get_san([m])[0]
-        self.san_move_list.append(san)
-        self.move_list.append(m)
-        self.write_pgn(san)
+        san = self.game.make(m)
         if not self.engine_computer_move:
             self.engine_computer_move = True
         if self.clock_mode == BLITZ_FISCHER and self.play_mode == GAME_MODE:
@@ -791,14 +930,14 @@ class Pycochess(object):
             # print "Adding increment for {0}".format(self.turn)
             # print "white_time : {0}".format(self.time_white)
             # print "black_time : {0}".format(self.time_black)
+        self.journal_move(m, san)
         self.switch_turn()
 
 
 
     def perform_undo(self):
-        self.move_list.pop()
-        self.san_move_list.pop()
-        self.rewrite_pgn = True
+        self.game.unmake()
+        self.journal.undo()
 
     def probe_move(self, fen, *args):
         if self.dgt_connected and self.dgt:
@@ -876,7 +1015,7 @@ class Pycochess(object):
                             return m
                         else:
                             # print "No legal move found"
-                            last_move_fen = sf.get_fen(self.pyfish_fen,  self.move_list[:-1])
+                            last_move_fen = self.game.fen_before()
                             last_move_fen_first_tok = last_move_fen.split()[0]
 
                             if new_dgt_first_token == last_move_fen_first_tok:
@@ -897,44 +1036,187 @@ class Pycochess(object):
                 self.dgt=None
                 print traceback.format_exc()
 
+    def engine(self, analysis=False):
+        # The engine searching for the game, or for the analysis and the hints
+        if engine_pool:
+            return engine_pool.get(uci_pool.ANALYSIS if analysis else uci_pool.PLAY)
+        return sf
+
+    def search_params(self):
+        # Time control of the search of the computer move, as arguments of go()
+        if self.clock_mode == FIXED_TIME:
+            return {"movetime": self.comp_time}
+        params = {"wtime": int(self.time_white), "btime": int(self.time_black)}
+        if self.clock_mode == BLITZ_FISCHER:
+            params.update(winc=int(self.time_inc_white), binc=int(self.time_inc_black))
+        return params
+
+    def reset_fixed_time(self):
+        # With a fixed time per move the clock of the computer starts again from comp_time
+        if self.clock_mode == FIXED_TIME:
+            if self.engine_comp_color == BLACK:
+                self.time_black = self.comp_time
+            else:
+                self.time_white = self.comp_time
+
+    def start_ponder(self):
+        # Once the computer move is on the board, searches the position after the ponder move
+        # of its bestmove with the time control of the computer move. Once per computer move, the
+        # board updates that follow find the search running.
+        if not PONDER or not engine_pool or self.play_mode != GAME_MODE or self.pondering:
+            return
+        if not self.ponder_move or self.ponder_move == '(none)':
+            return
+        self.ponder_moves = self.move_list + [self.ponder_move]
+        self.pondering = True
+        fen, moves = self.game.engine_position([self.ponder_move])
+        self.engine().go(fen, moves=moves, ponder=True, **self.search_params())
+
+    def speculate(self, square, piece):
+        # A piece was lifted: when the player is to move with it, the play engine searches the
+        # positions after its likely destinations, the book moves first, until the move is made
+        if not SPECULATE or not self.speculator or self.play_mode != GAME_MODE:
+            return
+        if self.engine_searching or self.computer_move_FEN or self.turn == self.engine_comp_color:
+            return
+        if piece.isupper() != (self.turn == WHITE):
+            return
+        if self.pondering:
+            if self.ponder_moves[-1].startswith(square):
+                # The expected reply is on its way
+                return
+            self.stop_ponder()
+        fen, moves = self.game.engine_position()
+        book = [m for san, weight, m in sorted(self.get_polyglot_moves(self.game.fen), key=lambda e: -e[1])]
+        self.speculator.start(fen, moves, speculate.destinations(self.game.legal_moves(), square, book))
+
+    def stop_ponder(self):
+        # Also drops the speculative searches
+        if self.speculator:
+            self.speculator.cancel()
+        if self.pondering:
+            self.pondering = False
+            self.engine().stop()
+
+    def ponder_hit(self):
+        # The player made the expected reply, the ponder search goes on as the search of the computer move.
+        # Otherwise the ponder search is stopped for a new one.
+        if not self.pondering:
+            return False
+        if self.play_mode != GAME_MODE or not self.engine_computer_move or self.move_list != self.ponder_moves:
+            self.stop_ponder()
+            return False
+        self.pondering = False
+        self.set_search_position(self.search_params().get("movetime"))
+        self.engine().ponderhit()
+        print "Ponder hit"
+        return True
+
+    def cache_usable(self):
+        # The results of a weakened engine are not the best moves
+        return analysis_cache and int(engine_options.get("Skill Level", 20)) >= 20
+
+    def set_search_position(self, movetime=None):
+        # Returns the FEN of the position searched
+        fen = self.game.fen
+        self.search_position = (self.game.key(), fen.split()[1], movetime)
+        return fen
+
+    def cache_line(self, line, info):
+        # Keeps what the engine found on the position searched, info is the parsed info line or None.
+        # A line whose move is not legal there is of another search, it is not kept.
+        if not self.search_position or not self.cache_usable():
+            return
+        key, side, movetime = self.search_position
+        if key != self.game.key():
+            return
+        if line.startswith("bestmove"):
+            best_move, ponder_move = self.parse_bestmove(line)
+            if best_move in self.game.legal_moves():
+                analysis_cache.finish(key, side, best_move, ponder_move, movetime)
+        elif info and info.pv_length and info.depth and info.score_type != engine_info.SCORE_NONE:
+            if info.pv[0] in self.game.legal_moves():
+                analysis_cache.update(key, side, info.depth, "m" if info.score_type == engine_info.SCORE_MATE else "c",
+                                      info.score, info.time, info.pv)
+
+    def book_lines(self):
+        # With the pool, the engine lines of a move of the book of the options, weighted as the
+        # book weighs its moves, None to search
+        if not engine_pool or str(engine_options.get("OwnBook", "false")).lower() != "true":
+            return None
+        path = engine_options.get("Book File")
+        if path != self.engine_book[0]:
+            try:
+                self.engine_book = (path, PolyglotOpeningBook(path))
+            except IOError:
+                print "Cannot open the book {0}".format(path)
+                self.engine_book = (path, None)
+        book = self.engine_book[1]
+        if not book:
+            return None
+        legal = self.game.legal_moves()
+        moves = []
+        for e in book.get_entries_for_position(self.game.key()):
+            # Polyglot castles the king to the rook
+            m = e["move"] if e["move"] in legal else POLYGLOT_CASTLING.get(e["move"])
+            if m in legal and e["weight"]:
+                moves.append((m, e["weight"]))
+        if not moves:
+            return None
+        pick = random.randint(1, sum(weight for m, weight in moves))
+        for m, weight in moves:
+            pick -= weight
+            if pick <= 0:
+                return ["bestmove {0} ponder (none)".format(m)]
+
+    def cached_search(self, params):
+        # The engine lines of a cached result of the position good enough for the search params, None to search
+        if not self.cache_usable():
+            return None
+        key, side, movetime = self.search_position
+        entry = analysis_cache.get(key, side)
+        if entry and entry.satisfies(**params):
+            # Also the moves of an entry written before the lines were checked, or of a key collision
+            legal = self.game.legal_moves()
+            if entry.bestmove in legal and (not entry.pv or entry.pv[0] in legal):
+                return entry.lines()
+        return None
+
     def stop_engine(self):
         if self.engine_searching:
             self.engine_searching = False
-            sf.stop()
-
-    def get_score(self, tokens):
-        try:
-            score_index = tokens.index('score')
-        except ValueError, e:
-            score_index = -1
-        score = None
-        score_type = ""
-        # print line
-        if score_index != -1:
-            score_type = tokens[score_index + 1]
-            if tokens[score_index + 1] == "cp":
-                score = float(tokens[score_index + 2]) / 100 * 1.0
-                try:
-                    score = float(score)
-                except ValueError, e:
-                    print "Cannot convert score to a float"
-                    print e
-            elif tokens[score_index + 1] == "mate":
-                score = int(tokens[score_index + 2])
-                try:
-                    score = int(score)
-                except ValueError, e:
-                    print "Cannot convert Mate number of moves to a int"
-                    print e
-
-                    # print self.chessboard.position.turn
-                #            if self.chessboard.position.turn == 'b':
-                #                if score:
-                #                    score *= -1
-            if score_type == "mate":
-                score = score_type + " " + str(score)
-        return score
-
+            self.run_clock()
+            if engine_pool:
+                engine_pool.stop()
+            else:
+                self.pyfish_search = None
+                sf.stop()
+
+    def engine_go(self, fen, moves, analysis=False, **params):
+        if not engine_pool:
+            self.pyfish_search = self.pyfish_searches
+            self.pyfish_searches += 1
+        self.engine(analysis).go(fen, moves=moves, **params)
+
+    def observe_pyfish(self, line):
+        # In the thread of pyfish: the line is tagged with its search before it waits in the loop,
+        # where the search may have been stopped and another one started
+        search = self.pyfish_bestmoves
+        if line.startswith("bestmove"):
+            self.pyfish_bestmoves += 1
+        loop.call_soon(self.parse_pyfish_line, search, line)
+
+    def parse_pyfish_line(self, search, line):
+        # The bestmove and info lines of stopped searches are dropped, as the pool does
+        if search == self.pyfish_search:
+            self.parse_score(line)
+
+    def show_hint(self, fen, line):
+        # Observer of a hint search of the analysis engine, fen is the position of the hint
+        best_move, ponder_move = self.parse_bestmove(line)
+        if best_move and best_move != '(none)':
+            self.write_to_piface("Hint: {0}".format(sf.to_san(fen, [best_move])[0]), clear=True)
+            self.write_to_dgt(best_move, move=True, max_num_tries=1, beep=False)
 
     # def position(self, move_list, pos='startpos'):
     #     sf.position(pos, move_list)
@@ -987,62 +1269,47 @@ class Pycochess(object):
         return best_move, ponder_move
 
     def get_san(self, moves):
-        prev_fen = sf.get_fen(self.pyfish_fen,  self.move_list)
-            # print prev_fen
-        return sf.to_san(prev_fen, moves)
+        return sf.to_san(self.game.fen, moves)
+
+    def info_score(self, info):
+        # Score of an info line for white, in pawns or as "mate n"
+        score = info.score if self.turn == WHITE else -info.score
+        if info.score_type == engine_info.SCORE_MATE:
+            return "mate {0}".format(score)
+        return score / 100.
+
+    def show_analysis(self, info, san):
+        # Analysis line published by the aggregator, a few times per second at most
+        score = self.info_score(info) if info.score_type != engine_info.SCORE_NONE else None
+        if self.use_tb and score == 151:
+            score = 'TB: 1-0'
+        if self.use_tb and score == -151:
+            score = 'TB: 0-1'
+        output = self.generate_move_list(san, eval=score, start_move_num=len(self.move_list)+1)
+        if piface and not self.silent:
+            self.write_to_piface(output, clear=True)
+        print output
 
     def parse_score(self, line):
+        if self.pondering:
+            # Lines of the ponder search count once the player made the expected reply
+            return
+        # Parsed in place, the analysis aggregator keeps a copy of the lines it shows
+        info = self.info
+        parsed = info.parse(line)
+        self.cache_line(line, info if parsed else None)
         print "Got line: " + line
-        tokens = line.split()
-        score = self.get_score(tokens)
-        if score:
-            if self.turn == BLACK:
-                score *=-1
-            self.score = score
+        if parsed and info.score_type != engine_info.SCORE_NONE:
+            self.score = self.info_score(info)
         if self.play_mode == ANALYSIS_MODE:
-            line_index = tokens.index('pv')
-            # print "line_index : {0}".format(line_index)
-            if line_index > -1:
-                pv = self.get_san(tokens[line_index+1:])
-                # print "pv : {0}".format(pv)
-
-                if len(pv)>0:
-                    self.score_count += 1
-                    # print "score_count : {0}".format(self.score_count)
-                    if self.score_count > 5:
-                        self.score_count = 0
-                    if piface and self.score_count == 1:
-                        # first_mv = pv[0]
-                        if self.use_tb and score == 151:
-                            score = 'TB: 1-0'
-                        if self.use_tb and score == -151:
-                            score = 'TB: 0-1'
-                        # separator = ".." if self.turn == BLACK else ""
-                        # print self.generate_move_list(pv, eval=score, start_move_num=len(self.move_list)+1)
-
-                        output = self.generate_move_list(pv, eval=score, start_move_num=len(self.move_list)+1)
-
-                        # if not self.engine_output:
-                        #     self.engine_output = output
-                        #     self.write_to_piface(self.engine_output, clear = True)
-                        #
-                        # if self.engine_output != output:
-                        #     self.engine_output = output
-                        if not self.silent:
-                        #     self.write_to_piface("Secret Analysis", clear=True)
-                        # else:
-                            self.write_to_piface(output, clear=True)
-
-                        #cad.lcd.write(str(score)+' ')
-                        #                    cad.lcd.write(self.generate_move_list(pv, eval=score, start_move_num=len(self.move_list)+1))
-                        print output
-                    else:
-                        print self.generate_move_list(pv, eval=score, start_move_num=len(self.move_list)+1)
-                        print "\n"
+            if parsed and info.pv_length:
+                self.analysis.update(info)
         elif self.play_mode == GAME_MODE:
+            start = tracing.now()
             best_move, self.ponder_move = self.parse_bestmove(line)
 
             if best_move:
+                tracing.complete('engine_search', self.trace_id, self.engine_start, start)
                 # print "best_move_san:{0}".format(best_move)
             #                print "best_move_san:{0}".format(sf.to_san([best_move])[0])
                 self.last_output_move = self.get_san([best_move])[0]
@@ -1051,6 +1318,7 @@ class Pycochess(object):
                 self.engine_computer_move = False
                 self.computer_move_FEN_reached = False
                 self.engine_searching = False
+                self.run_clock()
                 if self.dgt_fen:
 #                    print "dgt_fen : {0}".format(self.dgt_fen)
                     self.pre_computer_move_FEN = sf.get_fen(self.dgt_fen, [])
@@ -1066,10 +1334,8 @@ class Pycochess(object):
                     #     board.addTextMove(move)
                     # board.addTextMove(output_move)
 #                    print "Not using DGT board"
-                    self.move_list.append(best_move)
-                    if self.last_output_move:
-                        self.san_move_list.append(self.last_output_move)
-                    self.switch_turn()
+                    # As when the computer move is made on the board: the increment and the journal
+                    self.register_move(best_move)
                     # self.computer_move_FEN = board.getFEN()
                 if self.last_output_move:
                     # if self.ponder_move and self.ponder_move != '(none)':
@@ -1087,57 +1353,41 @@ class Pycochess(object):
 
                     if self.ponder_move == '(none)':
                         self.write_to_piface(self.last_output_move + " (Book)", custom_bitmap=custom_bitmap, clear=True)
-                        self.write_to_dgt("  book", beep=False, dots=False)
+                        self.write_to_dgt("  book", beep=False, dots=False, kind=display.MOVE)
                         # sleep(1)
-                        self.write_to_dgt(best_move, move=True, beep=True, dots=False)
+                        self.write_to_dgt(best_move, move=True, beep=True, dots=False, trace_id=self.trace_id)
 
                     else:
                         self.write_to_piface(self.last_output_move, custom_bitmap=custom_bitmap, clear=True)
-                        self.write_to_dgt(best_move, move=True, beep=True, dots=False)
-
-
-    def write_move(self, ply_count, san):
-        if ply_count % 2 == 1:
-            self.pgn_file.write(str(ply_count / 2 + 1))
-            self.pgn_file.write(". ")
-        self.pgn_file.write(san)
-        self.pgn_file.write(" ")
-        if ply_count % 20 == 0:
-            self.pgn_file.write("\n")
-
-            # return pgn;
+                        self.write_to_dgt(best_move, move=True, beep=True, dots=False, trace_id=self.trace_id)
+                tracing.complete('parse_bestmove', self.trace_id, start)
 
-    def write_pgn(self, san):
-        ply_count = len(self.move_list)
-        if ply_count == 1 or self.rewrite_pgn:
-            self.pgn_file.write("\n[Event \"Picochess\"]\n")
 
-            if self.pyfish_fen != 'startpos':
-                self.pgn_file.write(" ( FEN: ")
-                self.pgn_file.write(self.pyfish_fen)
-                self.pgn_file.write(" )")
-
-
-            if self.play_mode == ANALYSIS_MODE:
-                self.pgn_file.write ("[White \"Analysis\"]\n")
-                self.pgn_file.write ("[Black \"Analysis\"]\n")
-
-            else:
-                if self.engine_comp_color == WHITE:
-                    self.pgn_file.write("[White \"Stockfish\"]\n")
-                    self.pgn_file.write("[Black \"User\"]\n")
-
-                else:
-                    self.pgn_file.write("[White \"User\"]\n")
-                    self.pgn_file.write("[Black \"Stockfish\"]\n")
-
-        if self.rewrite_pgn:
-            # Rewrite old moves
-            for i, san in enumerate(self.san_move_list):
-                self.write_move(i+1, san)
-            self.rewrite_pgn = False
+    def game_tags(self):
+        tags = {"Event": "Picochess"}
+        if self.game.start_fen != 'startpos':
+            tags["FEN"] = self.game.start_fen
+        if self.play_mode == ANALYSIS_MODE:
+            tags.update(White="Analysis", Black="Analysis")
+        elif self.engine_comp_color == WHITE:
+            tags.update(White="Stockfish", Black="User")
         else:
-            self.write_move(ply_count, san)
+            tags.update(White="User", Black="Stockfish")
+        return tags
+
+    def journal_move(self, m, san):
+        # A game goes into the journal with its first move, once its players are known, self.turn made m
+        if not self.journal_game:
+            self.journal.start_game(self.game_tags())
+            self.journal_game = True
+        self.journal.move(m, san)
+        if self.clock_mode != FIXED_TIME:
+            self.journal.clock(self.time_white, self.time_black)
+        if not self.game.legal_moves():
+            if san.endswith("#"):
+                self.journal.result("1-0" if self.turn == WHITE else "0-1")
+            else:
+                self.journal.result("1/2-1/2")
 
     def reset_clocks(self):
         if not self.player_time:
@@ -1145,79 +1395,93 @@ class Pycochess(object):
         if not self.player_inc:
             self.player_inc = self.comp_inc
         # if not self.time_white or not self.time_black:
-        self.time_white = int(self.comp_time)
+        self.chess_clock.reset({WHITE: int(self.comp_time), BLACK: int(self.player_time)})
         self.time_inc_white = int(self.comp_inc)
-        self.time_black = int(self.player_time)
         self.time_inc_black = int(self.player_inc)
 
         if self.engine_comp_color == BLACK:
-            self.time_white, self.time_black = self.time_black, self.time_white
+            self.chess_clock.reset({WHITE: int(self.player_time), BLACK: int(self.comp_time)})
             self.time_inc_white, self.time_inc_black = self.time_inc_black, self.time_inc_white
 
     def eng_process_move(self):
         print "processing move.."
+        start = tracing.now()
+        if self.speculator:
+            self.speculator.cancel()
+        if self.ponder_hit():
+            self.reset_fixed_time()
+            self.engine_searching = True
+            self.engine_start = tracing.now()
+            self.run_clock()
+            tracing.complete('eng_process_move', self.trace_id, start)
+            return
         self.stop_engine()
-        self.score_count = 0
         # self.position(self.move_list, pos='startpos')
-        # Needed on the Pi!
-        if arm:
-            sleep(0.05)
         if self.play_mode == ANALYSIS_MODE:
-            sf.go(self.pyfish_fen, moves=self.move_list, infinite=True)
+            self.analysis.reset(self.set_search_position())
+            fen, moves = self.game.engine_position()
+            self.engine_go(fen, moves, analysis=True, infinite=True)
         elif self.play_mode == GAME_MODE:
             if self.engine_computer_move:
-                if self.clock_mode == FIXED_TIME:
-                    if self.engine_comp_color == BLACK:
-                    #                        print "comp_time: {0}".format(comp_time)
-                        self.time_black = self.comp_time
-                    #                        print "dgt_time: {0}".format(dgt.btime)
-
-                    else:
-                        self.time_white = self.comp_time
-                    # print "Before sf.go()"
-                    # print "move_list: "
-                    # print self.move_list
-                    # print "pyfish_fen: {0}".format(self.pyfish_fen)
-                    sf.go(self.pyfish_fen, moves=self.move_list, movetime=self.comp_time)
-#                    self.reset_clock_update()
+                self.reset_fixed_time()
+                params = self.search_params()
+                self.set_search_position(params.get("movetime"))
+                lines = self.book_lines()
+                if lines:
+                    # Not a search result to keep
+                    self.search_position = None
                 else:
-                    # self.reset_clocks()
-
-                    if self.clock_mode == BLITZ:
-                        sf.go(self.pyfish_fen, moves=self.move_list, wtime=int(self.time_white), btime=int(self.time_black))
-#                        print "starting wtime: {0}, starting btime: {1}".format(self.time_white, self.time_black)
-                    elif self.clock_mode == BLITZ_FISCHER:
-                        sf.go(self.pyfish_fen, moves=self.move_list, wtime=int(self.time_white), btime=int(self.time_black),
-                            winc=int(self.time_inc_white), binc=int(self.time_inc_black))
-
-#                    self.reset_clock_update()
+                    lines = self.cached_search(params)
+                if lines:
+                    # Answered as the engine would, without searching
+                    print "Answered: {0}".format(lines[-1])
+                    self.engine_searching = True
+                    self.engine_start = tracing.now()
+                    self.run_clock()
+                    tracing.complete('eng_process_move', self.trace_id, start)
+                    for line in lines:
+                        self.parse_score(line)
+                    return
+                fen, moves = self.game.engine_position()
+                self.engine_go(fen, moves, **params)
         self.engine_searching = True
+        self.engine_start = tracing.now()
+        self.run_clock()
+        tracing.complete('eng_process_move', self.trace_id, start)
 
     def is_fen(self, fen):
         return len(fen.split()) == 6
 
     def screen_input(self):
-        # print "screen_input mode"
-        while True:
-            m = raw_input("Enter command/move\n")
+        # stdin is readable, it may hold several lines
+        data = os.read(sys.stdin.fileno(), 4096)
+        if not data:
+            loop.remove_reader(sys.stdin.fileno())
+            return
+        lines = (self.screen_buffer + data).split("\n")
+        self.screen_buffer = lines.pop()
+        for m in lines:
+            m = m.strip()
             # print "got command: {0}".format(m)
             if m == "quit":
                 os._exit(0)
             if m == "undo":
                 if len(self.move_list)>0:
-                    self.move_list.pop()
-                    self.san_move_list.pop()
+                    self.perform_undo()
                 # board = ChessBoard()
                 # for move in self.move_list:
                 #     board.addTextMove(move)
                 # board.addTextMove(m)
             else:
                 self.register_move(m)
-            move_queue.put(m)
+            self.queue_move(m)
+        print "Enter command/move"
 
     def poll_screen(self):
-        thread = Thread(target=self.screen_input)
-        thread.start()
+        # print "screen_input mode"
+        self.screen_buffer = ""
+        print "Enter command/move"
+        loop.add_reader(sys.stdin.fileno(), self.screen_input)
 
     def get_polyglot_moves(self, fen, max_num_moves=4):
         key = sf.key(fen, [])
@@ -1232,14 +1496,7 @@ class Pycochess(object):
                 polyglot_moves.append((sf.to_san(fen, [m]), e["weight"], m))
 
             except ValueError:
-                if m == "e1h1":
-                    m = "e1g1"
-                elif m == "e1a1":
-                    m = "e1c1"
-                elif m == "e8a8":
-                    m = "e8c8"
-                elif m == "e8h8":
-                    m = "e8g8"
+                m = POLYGLOT_CASTLING.get(m, m)
                 polyglot_moves.append((sf.to_san(fen, [m]), e["weight"], m))
             if j >= max_num_moves:
                 break
@@ -1299,7 +1556,7 @@ class Pycochess(object):
                 # self.dgt_pause_clock = True
 
                # if book move, show those first
-                fen = sf.get_fen(self.pyfish_fen,  self.move_list)
+                fen = self.game.fen
                 # print "fen: {0}".format(fen)
                 book_moves = self.get_polyglot_moves(fen)
                 # print book_moves
@@ -1322,6 +1579,12 @@ class Pycochess(object):
 
                     self.write_to_piface(output_str, clear=True)
 
+                elif engine_pool and self.play_mode == GAME_MODE:
+                    # Searched by the analysis engine, the game engine keeps thinking
+                    self.write_to_piface("Hint..", clear=True)
+                    position, moves = self.game.engine_position()
+                    self.engine(analysis=True).go(position, moves=moves, movetime=HINT_TIME,
+                                                  on_line=lambda line: self.show_hint(fen, line))
                 else:
                     self.write_to_piface("Ponder: {0}".format(self.ponder_move), clear=True)
                     self.write_to_dgt(self.ponder_move, move=True, max_num_tries=1, beep=False)
@@ -1331,6 +1594,7 @@ class Pycochess(object):
                # if not, then show a position hint
             elif event.pin_num == PlayMenu.EVAL:
                 self.dgt_pause_clock = not self.dgt_pause_clock
+                self.run_clock()
                 self.write_to_piface("Score: {0}".format(self.score), clear=True)
                 if self.score:
                     self.write_to_dgt("{0}".format(self.score), move=False, beep=False, max_num_tries=1)
@@ -1345,6 +1609,7 @@ class Pycochess(object):
                 self.write_to_dgt("sil "+message, move=False, max_num_tries=1)
 
             elif event.pin_num == PlayMenu.SWITCH_MODE:
+                self.stop_ponder()
                 if self.play_mode == GAME_MODE:
                     self.play_mode = ANALYSIS_MODE
 
@@ -1391,9 +1656,9 @@ class Pycochess(object):
                     status = "ON" if self.use_tb else "OFF"
 
                     if self.use_tb:
-                        sf.set_option('SyzygyProbeLimit', 5)
+                        set_engine_option('SyzygyProbeLimit', 5)
                     else:
-                        sf.set_option('SyzygyProbeLimit', 0)
+                        set_engine_option('SyzygyProbeLimit', 0)
 
                     msg = "Tablebases {0}".format(status)
                     print msg
@@ -1453,17 +1718,15 @@ class Pycochess(object):
 
                 elif m == "a1a1":
                     # self.perform_undo()
-                    move_queue.put("undo_pop")
-                    sleep(2)
-                    move_queue.put("undo_pop")
+                    self.queue_move("undo_pop")
+                    loop.call_later(2, self.queue_move, "undo_pop")
 
                     # Perform undo
                 else:
-                    prev_fen = sf.get_fen(self.pyfish_fen,  self.move_list)
-                    if m in sf.legal_moves(prev_fen):
+                    if m in self.game.legal_moves():
                         self.write_to_piface("Ok", clear=True)
                         self.register_move(m)
-                        move_queue.put(m)
+                        self.queue_move(m)
                         self.alt_input_entry = START_ALT_INPUT
                     else:
                         self.write_to_piface("Invalid Move", clear=True)
@@ -1591,8 +1854,8 @@ class Pycochess(object):
                 fen = self.fen_to_move(self.current_fen, self.turn)
                 self.pyfish_fen = self.update_castling_rights(fen)
                 print "pyfish_fen : {0}".format(self.pyfish_fen)
-                self.move_list = []
-                self.san_move_list = []
+                self.game.reset(self.pyfish_fen)
+                self.journal_game = False
 
                 self.write_to_piface("Scan Position", clear=True)
                 self.write_to_dgt("scan")
@@ -1600,22 +1863,18 @@ class Pycochess(object):
                 if self.engine_comp_color == self.turn:
                     print "Forcing comp to move"
                     self.engine_computer_move = True
-                    move_queue.put(FORCE_MOVE)
+                    self.queue_move(FORCE_MOVE)
 
     def set_device(self, device):
         self.device = device
 
 
-def update_clocks(pyco):
-    Timer(1.0, update_clocks, [pyco]).start()
-    pyco.update_clocks()
-
-
 def process_undo(pyco, m):
 
     if m.startswith("undo") and len(pyco.move_list) > 0:
+        pyco.stop_ponder()
         pyco.write_to_piface("Undo - " + pyco.move_list[-1], clear=True)
-        pyco.write_to_dgt("  undo")
+        pyco.write_to_dgt("  undo", kind=display.MOVE)
         pyco.write_to_dgt(pyco.move_list[-1], move=True)
 
         if m == "undo_pop":
@@ -1629,13 +1888,65 @@ def process_undo(pyco, m):
         return True
 
 
+def process_move(pyco, m):
+    # Handles a move, starting the engine when it is its turn
+    print "Board Updated!"
+    pyco.trace_id = getattr(m, 'trace_id', None)
+    tracing.complete('loop_queue', pyco.trace_id, getattr(m, 'queued', None))
+    if process_undo(pyco, m):
+        if pyco.play_mode == GAME_MODE:
+            return
+
+    if pyco.computer_move_FEN_reached:
+        print "Comp_move FEN reached"
+        custom_bitmap = 0
+        if pyco.turn == BLACK:
+            custom_bitmap = 1
+        pyco.write_to_piface(pyco.last_output_move + " (Done)", custom_bitmap=custom_bitmap, clear=True)
+        if pyco.clock_mode == FIXED_TIME:
+            pyco.write_to_dgt("  done", beep=False)
+        pyco.start_ponder()
+        # pyco.engine_computer_move = False
+        return
+
+    if pyco.invalid_computer_move:
+        print "Invalid Computer Move"
+        pyco.write_to_piface("{0} (Invalid Computer Move)".format(m), clear=True)
+        pyco.write_to_dgt(" wrong")
+        # sleep(2)
+        # process_undo(pyco, "undo_pop")
+
+        return
+
+    if pyco.engine_comp_color == pyco.turn or pyco.play_mode == ANALYSIS_MODE or m == FORCE_MOVE:
+        # if pyco.play_mode != ANALYSIS_MODE:
+        #     pyco.write_to_piface("Ok", clear=True)
+        pyco.eng_process_move()
+    else:
+        print "Not processing move, not my turn"
+
+
+def handle_move(pyco, m):
+    # A move of the board or of an input, in the loop
+    start = tracing.now()
+    process_move(pyco, m)
+    pyco.run_clock()
+    for observer in pyco.move_observers:
+        observer(m, start)
+
+
 if __name__ == '__main__':
-    sf.set_option("OwnBook", "true")
+    if os.environ.get("PYCOCHESS_ENGINE"):
+        # Play, analysis and hints on their own engine processes
+        engine_pool = uci_pool.default_pool(os.environ["PYCOCHESS_ENGINE"])
+        engine_pool.attach(loop)
+    analysis_cache = cache.AnalysisCache(os.environ.get("PYCOCHESS_ANALYSIS_CACHE"))
+    set_engine_option("OwnBook", "true")
 
     # In case someone has the pi rev A
-    sf.set_option("Hash", 128)
-    sf.set_option("Emergency Base Time", 1300)
-    sf.set_option("Book File", BOOK_PATH+book_map[DEFAULT_BOOK_FEN][0]+ BOOK_EXTENSION)
+    set_engine_option("Hash", 128)
+    set_engine_option("Emergency Base Time", 1300)
+    set_engine_option("Book File", BOOK_PATH+book_map[DEFAULT_BOOK_FEN][0]+ BOOK_EXTENSION)
     if piface:
         cad = pifacecad.PiFaceCAD()
         cad.lcd.blink_off()
@@ -1671,11 +1982,15 @@ if __name__ == '__main__':
     arm = False
 #    print os.uname()[4][:3]
     device = None
-    if sys.argv:
+    if len(sys.argv) > 1 and sys.argv[-1].startswith("/dev"):
         device = sys.argv[-1]
-        print "Device :: {0}".format(device)
-    if not device.startswith("/dev"):
-        device = "/dev/ttyUSB0"
+    else:
+        cached = load_device_cache()
+        if cached:
+            print "Last board :: {0} {1}".format(cached.get("device"), cached.get("vendor"))
+        # Every serial device is probed at once, the first board dump wins
+        device = find_dgt_board() or "/dev/ttyUSB0"
+    print "Device :: {0}".format(device)
 
     try:
         if os.uname()[4][:3] == 'arm':
@@ -1684,6 +1999,8 @@ if __name__ == '__main__':
         else:
             pyco = Pycochess(device)
         pyco.connect()
+        if pyco.dgt_connected:
+            pyco.remember_device()
     except OSError:
         print "DGT board not found\n"
         pyco.set_device("human")
@@ -1701,46 +2018,12 @@ if __name__ == '__main__':
     if piface:
         listener = pifacecad.SwitchEventListener(chip=cad)
         for i in range(8):
-            listener.register(i, pifacecad.IODIR_FALLING_EDGE, pyco.button_event)
+            # The listener calls from its own thread
+            listener.register(i, pifacecad.IODIR_FALLING_EDGE, lambda event: loop.call_soon(pyco.button_event, event))
         listener.activate()
 
-    update_clocks(pyco)
     reached_comp_move = False
 
     print "Pycochess Successful Start!"
 
-    while True:
-        #print "Before acquire"
-        m = move_queue.get()
-        print "Board Updated!"
-        if process_undo(pyco, m):
-            if pyco.play_mode == GAME_MODE:
-                continue
-
-        if pyco.computer_move_FEN_reached:
-            print "Comp_move FEN reached"
-            custom_bitmap = 0
-            if pyco.turn == BLACK:
-                custom_bitmap = 1
-            pyco.write_to_piface(pyco.last_output_move + " (Done)", custom_bitmap=custom_bitmap, clear=True)
-            if pyco.clock_mode == FIXED_TIME:
-                pyco.write_to_dgt("  done", beep=False)
-            # pyco.engine_computer_move = False
-            continue
-
-        if pyco.invalid_computer_move:
-            print "Invalid Computer Move"
-            pyco.write_to_piface("{0} (Invalid Computer Move)".format(m), clear=True)
-            pyco.write_to_dgt(" wrong")
-            # sleep(2)
-            # process_undo(pyco, "undo_pop")
-
-            continue
-
-        if pyco.engine_comp_color == pyco.turn or pyco.play_mode == ANALYSIS_MODE or m == FORCE_MOVE:
-            # if pyco.play_mode != ANALYSIS_MODE:
-            #     pyco.write_to_piface("Ok", clear=True)
-            pyco.eng_process_move()
-        else:
-            print "Not processing move, not my turn"
-
+    loop.run()
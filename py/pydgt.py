@@ -1,7 +1,7 @@
 from Queue import Queue
 import serial
 import sys
-import time
+import clock
 from threading import Thread
 from threading import RLock
 from threading import Condition
@@ -9,14 +9,29 @@ from struct import unpack
 import signal
 
 from itertools import cycle
+import glob
+import json
+import os
+import select
+import tracing
 clock_blink_iterator = cycle(range(2))
 
 BOARD = "Board"
 
 FEN = "FEN"
 CLOCK_BUTTON_PRESSED = "CLOCK_BUTTON_PRESSED"
+CLOCK_BUTTON_RELEASED = "CLOCK_BUTTON_RELEASED"
+CLOCK_BUTTON_LONG_PRESS = "CLOCK_BUTTON_LONG_PRESS"
+CLOCK_BUTTON_CHORD = "CLOCK_BUTTON_CHORD"
 CLOCK_ACK = "CLOCK_ACK"
 CLOCK_LEVER = "CLOCK_LEVER"
+# Times shown by the DGT clock, message is (white ms, black ms, white to move)
+CLOCK_TIME = "CLOCK_TIME"
+# The board device went away, and came back (message is the device)
+BOARD_LOST = "BOARD_LOST"
+BOARD_RESTORED = "BOARD_RESTORED"
+# A piece was lifted, message is its square ("e2") and piece ("P"), before the position is stable
+PIECE_LIFTED = "PIECE_LIFTED"
 
 DGTNIX_MSG_UPDATE = 0x05
 _DGTNIX_SEND_BRD = 0x42
@@ -34,6 +49,21 @@ DGTNIX_MSG_MV_ADD = 0x00
 DGTNIX_MSG_MV_REMOVE = 0x01
 
 DGT_SIZE_FIELD_UPDATE = 5
+# A full board dump is requested at least this often (in seconds), otherwise only on desync
+DUMP_INTERVAL = 30
+# A dump that did not arrive within this many seconds is requested again
+DUMP_TIMEOUT = 2
+# Serial devices a board may be on, the Bluetooth ones first
+DEVICE_PATTERNS = ["/dev/rfcomm*", "/dev/ttyUSB*", "/dev/ttyACM*"]
+# Device and vendor strings of the last board found, tried first at the next start
+DEVICE_CACHE = os.path.expanduser("~/.pycochess_dgt.json")
+# Seconds to wait for the board dump of the probed devices
+PROBE_TIMEOUT = 2
+# A device that went away is reopened after this many seconds, doubling up to RECONNECT_DELAY_MAX
+RECONNECT_DELAY = 0.05
+RECONNECT_DELAY_MAX = 2
+MAX_PIECES_PER_SIDE = 16
+MAX_PAWNS_PER_SIDE = 8
 _DGTNIX_FIELD_UPDATE =   0x0e
 _DGTNIX_EMPTY = 0x00
 _DGTNIX_WPAWN = 0x01
@@ -69,6 +99,14 @@ _DGTNIX_SERIALNR = 0x11
 _DGTNIX_TRADEMARK = 0x12
 _DGTNIX_VERSION = 0x13
 
+# Clock buttons (0 is the leftmost) as (mask, bits) of a clock ack byte, the table of processClockBits()
+# in dgtnix.c
+CLOCK_BUTTON_BITS = [(0x07, 0x01), (0x07, 0x04), (0x07, 0x03), (0x37, 0x32), (0x07, 0x05)]
+# A button held this long (in seconds) is a long press
+LONG_PRESS_DELAY = 1.0
+# A second button pressed this soon (in seconds) after the held one is a chord
+CHORD_DELAY = 0.3
+
 DGTNIX_RIGHT_DOT = 0x01
 DGTNIX_RIGHT_SEMICOLON = 0x02
 DGTNIX_RIGHT_1 = 0x04
@@ -103,11 +141,23 @@ class Event(object):
 
 class DGTBoard(object):
     def __init__(self, device, virtual = False, send_board = True):
+        self.device = device
         self.board_reversed = False
         self.clock_ack_recv = False
         # self.clock_queue = Queue()
         self.dgt_clock = False
         self.dgt_clock_lock = RLock()
+        # Board maintained from field updates, internal piece codes
+        self.board = bytearray(64)
+        self.board_synced = False
+        self.dump_pending = False
+        self.last_dump_time = 0
+        # Clock button currently held and when it was pressed
+        self.button_held = None
+        self.button_press_time = 0
+        self.long_press_timer = None
+        # Event loop of watch(), None while poll() reads the board
+        self.loop = None
         # self.dgt_clock_ack_lock = RLock()
         # self.dgt_clock_ack_queue = Queue()
 
@@ -115,13 +165,106 @@ class DGTBoard(object):
             self.ser = serial.Serial(device,stopbits=serial.STOPBITS_ONE)
             self.write(chr(_DGTNIX_SEND_UPDATE_NICE))
             if send_board:
-                self.write(chr(_DGTNIX_SEND_BRD))
+                self.get_board()
 
         self.callbacks = []
 
     def get_board(self):
+        self.dump_pending = True
+        self.last_dump_time = clock.now()
         self.write(chr(_DGTNIX_SEND_BRD))
 
+    def request_board_dump(self):
+        # Only one dump in flight, they cost 67 bytes of line time each
+        if not self.dump_pending or clock.now() - self.last_dump_time > DUMP_TIMEOUT:
+            self.get_board()
+
+    def board_is_consistent(self):
+        # Lifted pieces only lower these numbers, so a failure means a lost field update
+        counts = [0]*(_DGTNIX_BQUEEN+1)
+        for square, piece in enumerate(self.board):
+            if piece > _DGTNIX_BQUEEN:
+                return False
+            if piece in (_DGTNIX_WPAWN, _DGTNIX_BPAWN) and (square < 8 or square >= 56):
+                return False
+            counts[piece] += 1
+        white = sum(counts[_DGTNIX_WPAWN:_DGTNIX_WQUEEN+1])
+        black = sum(counts[_DGTNIX_BPAWN:_DGTNIX_BQUEEN+1])
+        return counts[_DGTNIX_WKING] <= 1 and counts[_DGTNIX_BKING] <= 1 and \
+            counts[_DGTNIX_WPAWN] <= MAX_PAWNS_PER_SIDE and counts[_DGTNIX_BPAWN] <= MAX_PAWNS_PER_SIDE and \
+            white <= MAX_PIECES_PER_SIDE and black <= MAX_PIECES_PER_SIDE
+
+    @staticmethod
+    def decode_clock_button(buf):
+        # The button of a clock ack, None if none: byte 5, or byte 6 when byte 5 has none, as dgtnix
+        for data in (buf[5], buf[6]):
+            for button, (mask, bits) in enumerate(CLOCK_BUTTON_BITS):
+                if (data & mask) == bits:
+                    return button
+        return None
+
+    def clock_button_reported(self, button):
+        # Turns every reported button state into timestamped press/release/long press/chord events.
+        # The clock reports a button once per press: a press while a button is held means its release
+        # was missed, it is released first. A button still held LONG_PRESS_DELAY after its press is
+        # a long press then, as in the dgtnix driver, not only once released.
+        now = clock.now()
+        held = self.button_held
+        if button is None and held is None:
+            return
+        if self.long_press_timer:
+            self.long_press_timer.cancel()
+            self.long_press_timer = None
+        if held is not None:
+            self.fire(type=CLOCK_BUTTON_RELEASED, message=held, press_time=self.button_press_time, release_time=now)
+        self.button_held = button
+        if button is None:
+            return
+        if held is not None and held != button and now - self.button_press_time < CHORD_DELAY:
+            self.fire(type=CLOCK_BUTTON_CHORD, message=(held, button), press_time=self.button_press_time)
+        self.button_press_time = now
+        # A timer of the loop reading the board, or of a thread of its own under poll()
+        call_later = self.loop.call_later if self.loop else clock.call_later
+        self.long_press_timer = call_later(LONG_PRESS_DELAY, self.long_press_due, now)
+        self.fire(type=CLOCK_BUTTON_PRESSED, message=button, press_time=now)
+
+    def long_press_due(self, press_time):
+        # Nothing if the button was released or another one pressed since
+        if self.button_held is None or self.button_press_time != press_time:
+            return
+        self.long_press_timer = None
+        self.fire(type=CLOCK_BUTTON_LONG_PRESS, message=self.button_held, press_time=press_time)
+
+    def field_update(self, square, piece):
+        # Returns False if the update contradicts the maintained board
+        if not 0 <= square < 64 or piece > _DGTNIX_BQUEEN:
+            return False
+        previous = self.board[square]
+        self.board[square] = piece
+        if piece == _DGTNIX_EMPTY:
+            consistent = previous != _DGTNIX_EMPTY
+        else:
+            consistent = previous == _DGTNIX_EMPTY
+        return consistent and self.board_is_consistent()
+
+    def square_name(self, square):
+        # Square of the board representation, as in UCI moves
+        if self.board_reversed:
+            square = 63 - square
+        return "abcdefgh"[square % 8] + str(8 - square // 8)
+
+    def board_dump(self, message):
+        # Returns the list of (square, old piece, new piece) that changed since the maintained board
+        new_board = bytearray(message[:64])
+        changes = []
+        if self.board_synced:
+            changes = [(sq, old, new) for sq, (old, new) in enumerate(zip(self.board, new_board)) if old != new]
+        self.board = new_board
+        self.board_synced = True
+        self.dump_pending = False
+        self.last_dump_time = clock.now()
+        return changes
+
     def subscribe(self, callback):
         self.callbacks.append(callback)
 
@@ -133,6 +276,12 @@ class DGTBoard(object):
         for fn in self.callbacks:
             fn(e)
 
+    def fire_clock_time(self, wtime, btime, wturn, at=None):
+        # The sides of the clock follow the orientation of the board
+        if self.board_reversed:
+            wtime, btime, wturn = btime, wtime, not wturn
+        self.fire(type=CLOCK_TIME, message=(wtime, btime, bool(wturn)), time=at or clock.now())
+
     def convertInternalPieceToExternal(self, c):
         if piece_map.has_key(c):
             return piece_map[c]
@@ -218,7 +367,6 @@ class DGTBoard(object):
         FEN.append('0')
         FEN.append(' ')
         FEN.append('1')
-        FEN.append('0')
 
         return ''.join(FEN)
 
@@ -330,6 +478,11 @@ class DGTBoard(object):
 
 
     def print_time_on_clock(self, w_time, b_time, w_blink=True, b_blink=True):
+        s, dots = self.time_message(w_time, b_time, w_blink=w_blink, b_blink=b_blink)
+        self.send_message_to_clock(s, False, dots)
+
+    def time_message(self, w_time, b_time, w_blink=True, b_blink=True):
+        # Message and dots showing the times on the clock
         dots = 0
         w_dots = True
         b_dots = True
@@ -399,7 +552,7 @@ class DGTBoard(object):
     #     else if (wDots) dots |= DGTNIX_RIGHT_SEMICOLON; //hours:minutes mode
     #   }
     #     dgtnixPrintMessageOnClock (s.c_str (), false, dots);
-        self.send_message_to_clock(s, False, dots)
+        return s, dots
 
     def send_message_to_clock(self, message, beep, dots, move=False, test_clock=False, max_num_tries = 5):
         # Todo locking?
@@ -419,7 +572,7 @@ class DGTBoard(object):
             if test_clock and not self.dgt_clock:
                 tries = 1
                 while True:
-                    time.sleep(1)
+                    clock.sleep(1)
                     if not self.dgt_clock:
                         tries += 1
                         if tries > max_num_tries:
@@ -533,6 +686,7 @@ class DGTBoard(object):
         # print "acquire"
         # self.dgt_clock_ack_lock.acquire()
         print "got DGT message"
+        start = tracing.now()
         header_len = 3
         if head:
             header = head + self.read(header_len-1)
@@ -568,8 +722,17 @@ class DGTBoard(object):
             message = self.read(message_length)
 #            self.dump_board(message)
 #            print self.get_fen(message)
-            self.fire(type=FEN, message=self.get_fen(message))
-            self.fire(type=BOARD, message=self.dump_board(message))
+            synced = self.board_synced
+            changes = self.board_dump(message)
+            if synced and not changes:
+                # Periodic check, nothing was missed
+                return
+            if changes:
+                print "Board dump differs on {0} squares".format(len(changes))
+            trace_id = tracing.new_id()
+            tracing.complete('read_message_from_board', trace_id, start, command=command_id)
+            self.fire(type=FEN, message=self.get_fen(message), trace=trace_id, time=clock.now())
+            self.fire(type=BOARD, message=self.dump_board(message), trace=trace_id)
 
         elif command_id == _DGTNIX_BWTIME:
             print "Received DGTNIX_BWTIME message from the board\n"
@@ -582,6 +745,13 @@ class DGTBoard(object):
             if buf:
                 if buf[0] == buf[1] == buf[2] == buf[3] == buf[4] == buf[5] == 0:
                     self.fire(type=CLOCK_LEVER, message=buf[6])
+                elif (buf[3] & 0x0f) != 0x0a and (buf[6] & 0x0f) != 0x0a and buf[6] & 1:
+                    # Clock times: hours, minutes and seconds of the right then the left side, in BCD,
+                    # 8:00:00 is no time, as in _bwtimeReceived of dgtnix
+                    times = [(buf[i] >> 4) * 10 + (buf[i] & 0x0f) for i in xrange(6)]
+                    sides = [0 if (h & 0x0f) == 8 and not m and not sec else ((h & 0x0f) * 3600 + m * 60 + sec) * 1000
+                             for h, m, sec in (times[0:3], times[3:6])]
+                    self.fire_clock_time(sides[1], sides[0], not buf[6] & 8)
                 if buf[0] == 10 and buf[1] == 16 and buf[2] == 1 and buf[3] == 10 and not buf[4] and not buf[5] and not buf[6]:
                     # print "clock ACK received!"
 
@@ -592,20 +762,9 @@ class DGTBoard(object):
                     if not self.dgt_clock:
                         self.dgt_clock = True
                     self.fire(type=CLOCK_ACK, message='')
-                if 5 <= buf[4] <= 6 and buf[5] == 49:
-                    self.fire(type=CLOCK_BUTTON_PRESSED, message=0)
-
-                if 33 <= buf[4] <= 34 and buf[5] == 52:
-                    self.fire(type=CLOCK_BUTTON_PRESSED, message=1)
-
-                if 17 <= buf[4] <= 18 and buf[5] == 51:
-                    self.fire(type=CLOCK_BUTTON_PRESSED, message=2)
-
-                if 9 <= buf[4] <= 10 and buf[5] == 50:
-                    self.fire(type=CLOCK_BUTTON_PRESSED, message=3)
-
-                if 65 <= buf[4] <= 66 and buf[5] == 53:
-                    self.fire(type=CLOCK_BUTTON_PRESSED, message=4)
+                # Clock acks report the buttons state, no button means released
+                if (buf[3] & 0x0f) == 0x0a or (buf[6] & 0x0f) == 0x0a:
+                    self.clock_button_reported(self.decode_clock_button(buf))
 
 
         elif command_id == _DGTNIX_EE_MOVES:
@@ -631,7 +790,24 @@ class DGTBoard(object):
 
             if message_length == 2:
                 message = self.read(message_length)
-                self.write(chr(_DGTNIX_SEND_BRD))
+                square, piece = unpack('>BB', message)
+                lifted = _DGTNIX_EMPTY
+                if piece == _DGTNIX_EMPTY and 0 <= square < 64:
+                    lifted = self.board[square]
+                if not self.field_update(square, piece) or not self.board_synced:
+                    print "Board out of sync, requesting a board dump"
+                    self.request_board_dump()
+                else:
+                    if clock.now() - self.last_dump_time > DUMP_INTERVAL:
+                        self.request_board_dump()
+                    if lifted != _DGTNIX_EMPTY:
+                        self.fire(type=PIECE_LIFTED, message=(self.square_name(square),
+                                                              self.convertInternalPieceToExternal(lifted)))
+                    board = str(self.board)
+                    trace_id = tracing.new_id()
+                    tracing.complete('read_message_from_board', trace_id, start, command=command_id)
+                    self.fire(type=FEN, message=self.get_fen(board), trace=trace_id, time=clock.now())
+                    self.fire(type=BOARD, message=self.dump_board(board), trace=trace_id)
             else:
                 message = self.read(4)
 
@@ -665,10 +841,68 @@ class DGTBoard(object):
     # Warning, this method must be in a thread
     def poll(self):
         while True:
+            try:
+                c = self.read(1)
+                # print "got msg"
+                if c:
+                    self.read_message_from_board(head=c)
+            except (serial.SerialException, OSError):
+                self.reconnect()
+
+    def watch(self, loop):
+        # Reads the board in the handlers of an event loop (see event_loop.py) instead of poll()
+        self.loop = loop
+        loop.add_reader(self.ser.fileno(), self.read_ready)
+
+    def read_ready(self):
+        # The device is readable, the rest of a message follows its first byte within milliseconds
+        try:
             c = self.read(1)
-            # print "got msg"
             if c:
                 self.read_message_from_board(head=c)
+        except (serial.SerialException, OSError):
+            self.loop.remove_reader(self.ser.fileno())
+            self.device_lost()
+            self.loop.call_later(RECONNECT_DELAY, self.reopen_later, RECONNECT_DELAY)
+
+    def reopen_later(self, delay):
+        # Tries the device again, until it is back, without blocking the loop
+        if not self.reopen():
+            delay = min(delay * 2, RECONNECT_DELAY_MAX)
+            self.loop.call_later(delay, self.reopen_later, delay)
+            return
+        self.loop.add_reader(self.ser.fileno(), self.read_ready)
+        self.device_restored()
+
+    def reconnect(self):
+        # The device went away (unplugged cable, lost Bluetooth link), reopen it
+        # and resync the board with a dump, the driver does the same natively
+        self.device_lost()
+        delay = RECONNECT_DELAY
+        while not self.reopen():
+            clock.sleep(delay)
+            delay = min(delay * 2, RECONNECT_DELAY_MAX)
+        self.device_restored()
+
+    def device_lost(self):
+        print "DGT board on {0} lost, waiting for it".format(self.device)
+        self.fire(type=BOARD_LOST, message=self.device)
+        try:
+            self.ser.close()
+        except (serial.SerialException, OSError):
+            pass
+
+    def reopen(self):
+        try:
+            self.ser = serial.Serial(self.device, stopbits=serial.STOPBITS_ONE)
+            return True
+        except (serial.SerialException, OSError):
+            return False
+
+    def device_restored(self):
+        self.write(chr(_DGTNIX_SEND_UPDATE_NICE))
+        self.fire(type=BOARD_RESTORED, message=self.device)
+        self.get_board()
 
     def _dgt_observer(self, attrs):
         if attrs.type == FEN:
@@ -681,6 +915,254 @@ class DGTBoard(object):
             # self.send_message_to_clock(['b','o','a','r','d','c'], False, False)
 
 
+class NativeDGTBoard(DGTBoard):
+    # Same subscribe/fire interface as DGTBoard on top of the compiled dgtnix driver (dgt/_dgtnix),
+    # which keeps the board synced and only reports stable positions
+    def __init__(self, device, virtual = False, send_board = True):
+        super(NativeDGTBoard, self).__init__(device, virtual = True)
+        from dgt import _dgtnix
+        self.driver = _dgtnix
+        # The driver runs on its own copy of a simulated clock, at the same speed
+        self.driver_speed = None
+        if isinstance(clock.get_clock(), clock.SimulatedClock):
+            self.driver_speed = clock.get_clock().speed
+            self.driver.set_simulated_clock(self.driver_speed)
+        self.driver.init(device)
+        # The driver keeps the classes that are not subscribed only while they are waited for
+        self.driver.subscribe_events(self.event_mask())
+        self.native_board = self.driver.Board()
+        self.board_view = memoryview(self.native_board)
+        self.button_events = {
+            _dgtnix.BUTTON_PRESSED: CLOCK_BUTTON_PRESSED,
+            _dgtnix.BUTTON_RELEASED: CLOCK_BUTTON_RELEASED,
+            _dgtnix.BUTTON_LONG: CLOCK_BUTTON_LONG_PRESS,
+            _dgtnix.BUTTON_CHORD: CLOCK_BUTTON_CHORD
+        }
+
+    def get_board(self):
+        self.native_board.refresh()
+        self.fire_board()
+
+    def fire_board(self, trace_id=None, at=None):
+        fen = self.native_board.fen()
+        if fen.split(' ')[0] == "RNBKQBNR/PPPPPPPP/8/8/8/8/pppppppp/rnbkqbnr":
+            self.reverse_board()
+            self.native_board.refresh()
+            fen = self.native_board.fen()
+        self.fire(type=FEN, message=fen, trace=trace_id, time=at or clock.now())
+        self.fire(type=BOARD, message=self.dump_native_board(), trace=trace_id)
+
+    def trace_time(self, driver_time):
+        # A time of the driver clock on the tracing clock, real seconds
+        if not driver_time or not self.driver_speed:
+            return driver_time
+        return tracing.now() - (self.driver.clock_now() - driver_time) / self.driver_speed
+
+    def clock_time(self, driver_time):
+        # A time of the driver clock on the clock module, both monotonic but of different origins
+        # when simulated
+        if not driver_time:
+            return None
+        return clock.now() - (self.driver.clock_now() - driver_time)
+
+    def dump_native_board(self):
+        rows = ["|" + "|".join(self.board_view[row*8:row*8+8].tobytes()) + "|" for row in xrange(8)]
+        separator = "__"*8
+        return separator + "\n" + ("\n" + separator + "\n").join(rows) + "\n" + separator
+
+    def reverse_board(self):
+        super(NativeDGTBoard, self).reverse_board()
+        # The driver rotates its snapshots
+        if self.board_reversed:
+            self.driver.set_option(self.driver.BOARD_ORIENTATION, self.driver.BOARD_ORIENTATION_CLOCKRIGHT)
+        else:
+            self.driver.set_option(self.driver.BOARD_ORIENTATION, self.driver.BOARD_ORIENTATION_CLOCKLEFT)
+
+    def event_mask(self):
+        return self.driver.EVENT_STABLE | self.driver.EVENT_BUTTON | self.driver.EVENT_TIME | self.driver.EVENT_ACK \
+            | self.driver.EVENT_CONNECTION | self.driver.EVENT_MOVE
+
+    def poll(self):
+        # The GIL is released while the driver waits for events
+        for event in self.driver.events(self.event_mask()):
+            self.dispatch(event)
+
+    def watch(self, loop):
+        # The events are taken in the handlers of an event loop (see event_loop.py) when the eventfd
+        # of the driver signals them, instead of poll()
+        self.event_fd = self.driver.event_fd(self.event_mask())
+        loop.add_reader(self.event_fd, self.read_ready)
+
+    def read_ready(self):
+        try:
+            os.read(self.event_fd, 8)
+        except OSError:
+            pass
+        while True:
+            events = self.driver.wait_events(self.event_mask(), 0)
+            if not events:
+                return
+            for event in events:
+                self.dispatch(event)
+
+    def dispatch(self, event):
+        if event.type == self.driver.EVENT_MOVE:
+            # The driver names the squares from the orientation, with the line as a number
+            if event.code == self.driver.MSG_MV_REMOVE:
+                self.fire(type=PIECE_LIFTED, message=(event.column.lower() + str(ord(event.line)), event.piece))
+        elif event.type == self.driver.EVENT_STABLE:
+            if self.native_board.refresh():
+                # From the byte read by the driver to the stable position, then to this thread
+                trace_id = tracing.new_id()
+                tracing.complete('_readMessageFromBoard', trace_id, self.trace_time(event.arrival),
+                                 self.trace_time(event.timestamp))
+                tracing.complete('dgtnix_event', trace_id, self.trace_time(event.timestamp))
+                # The position is made when its last piece landed
+                self.fire_board(trace_id, self.clock_time(event.arrival or event.timestamp))
+        elif event.type == self.driver.EVENT_BUTTON:
+            # The driver numbers the buttons from 1
+            for flag, event_type in self.button_events.iteritems():
+                if not event.flags & flag:
+                    continue
+                # The long press was reported while the button was held, the release only tells it was
+                if flag == self.driver.BUTTON_LONG and event.flags & self.driver.BUTTON_RELEASED:
+                    continue
+                if flag == self.driver.BUTTON_CHORD:
+                    buttons = tuple(b - 1 for b in xrange(1, 6) if event.buttons & (1 << b))
+                    self.fire(type=event_type, message=buttons, press_time=event.press_time)
+                else:
+                    self.fire(type=event_type, message=event.code - 1, press_time=event.press_time,
+                              release_time=event.timestamp)
+        elif event.type == self.driver.EVENT_ACK:
+            self.dgt_clock = True
+            self.fire(type=CLOCK_ACK, message=event.timestamp)
+        elif event.type == self.driver.EVENT_TIME:
+            # An all-zero BWTIME is the lever, as in DGTBoard
+            if event.flags & self.driver.TIME_LEVER:
+                self.fire(type=CLOCK_LEVER, message=event.code)
+            else:
+                self.fire_clock_time(event.wtime * 1000, event.btime * 1000, event.wturn,
+                                     self.clock_time(event.timestamp))
+        elif event.type == self.driver.EVENT_CONNECTION:
+            # The driver reopens the device and posts the moves made meanwhile
+            if event.flags & self.driver.CONNECTION_LOST:
+                self.fire(type=BOARD_LOST, message=self.device)
+            else:
+                self.fire(type=BOARD_RESTORED, message=self.device)
+
+    def send_message_to_clock(self, message, beep, dots, move=False, test_clock=False, max_num_tries = 5):
+        if move:
+            message = self.format_move_for_dgt(message)
+        else:
+            message = self.format_str_for_dgt(message)
+        with self.dgt_clock_lock:
+            if test_clock:
+                # Without clock no ack comes, the driver gives up after max_num_tries messages
+                self.dgt_clock = self.driver.print_message_on_clock(message, beep, dots, max_num_tries)
+            else:
+                self.driver.print_message_on_clock(message, beep, dots)
+
+    def vendor_strings(self):
+        driver = self.driver
+        return dict((name, driver.query_string(flag)) for name, flag in
+                    (("serial", driver.SERIAL_STRING), ("version", driver.VERSION_STRING),
+                     ("trademark", driver.TRADEMARK_STRING), ("busaddress", driver.BUSADDRESS_STRING)))
+
+    def close(self):
+        self.driver.close()
+
+
+def open_dgt_board(device):
+    # Prefers the compiled driver when it was built (see dgt/setup.py) and opens the device
+    try:
+        from dgt import _dgtnix
+    except ImportError:
+        return DGTBoard(device)
+    try:
+        return NativeDGTBoard(device)
+    except _dgtnix.DgtnixError as e:
+        print "The dgtnix driver cannot open {0} ({1}), trying pyserial".format(device, e)
+        return DGTBoard(device)
+
+
+def load_device_cache():
+    try:
+        with open(DEVICE_CACHE) as f:
+            return json.load(f)
+    except (IOError, ValueError):
+        return {}
+
+
+def save_device_cache(device, vendor=None):
+    try:
+        with open(DEVICE_CACHE, "w") as f:
+            json.dump({"device": device, "vendor": vendor or {}}, f)
+    except IOError as e:
+        print "Cannot save the board device in {0}: {1}".format(DEVICE_CACHE, e)
+
+
+def _board_dump_received(data):
+    # True when data holds a whole board dump frame, as dgtnixProbe checks it
+    start = data.find(chr(_DGTNIX_MSG_BOARD_DUMP) + "\x00" + chr(_DGTNIX_SIZE_BOARD_DUMP))
+    while start >= 0:
+        frame = data[start + 3:start + _DGTNIX_SIZE_BOARD_DUMP]
+        if len(frame) < 64:
+            return False
+        if all(ord(c) <= _DGTNIX_BQUEEN for c in frame):
+            return True
+        start = data.find(chr(_DGTNIX_MSG_BOARD_DUMP), start + 1)
+    return False
+
+
+def _probe_serial(devices, timeout):
+    # dgtnixProbe with pyserial, when the driver is not built: every device at once
+    ports = {}
+    for device in devices:
+        try:
+            port = serial.Serial(device, stopbits=serial.STOPBITS_ONE, timeout=0)
+            port.write(chr(_DGTNIX_SEND_RESET) + chr(_DGTNIX_SEND_BRD))
+            ports[port.fileno()] = (device, port, [""])
+        except (serial.SerialException, OSError, ValueError):
+            continue
+    found = None
+    # Real seconds, as the driver probes
+    deadline = tracing.now() + timeout
+    try:
+        while ports and found is None and tracing.now() < deadline:
+            readable, _, _ = select.select(ports.keys(), [], [], max(0, deadline - tracing.now()))
+            for fd in readable:
+                device, port, data = ports[fd]
+                data[0] += port.read(256)
+                if _board_dump_received(data[0]):
+                    found = device
+                    break
+    finally:
+        for device, port, data in ports.values():
+            port.close()
+    return found
+
+
+def find_dgt_board(candidates=None, timeout=PROBE_TIMEOUT):
+    # The device of a board answering a board dump request, None if there is none.
+    # The device of the last start is tried alone first, then every candidate at once, that one
+    # included as it may just have been slow to answer.
+    if candidates is None:
+        candidates = sorted(d for pattern in DEVICE_PATTERNS for d in glob.glob(pattern))
+    try:
+        from dgt import _dgtnix
+        probe = _dgtnix.probe
+        timeout_ms = int(timeout * 1000)
+    except ImportError:
+        probe = _probe_serial
+        timeout_ms = timeout
+    cached = load_device_cache().get("device")
+    if cached and os.path.exists(cached) and probe([cached], timeout_ms):
+        return cached
+    if not candidates:
+        return None
+    return probe(candidates, timeout_ms)
+
+
 class VirtualDGTBoard(DGTBoard):
     def __init__(self, device, virtual = True):
         super(VirtualDGTBoard, self).__init__(device, virtual = virtual)
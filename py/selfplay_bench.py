@@ -0,0 +1,330 @@
+## Self-play benchmark of the whole stack, from the board to the engine and back:
+## emulated board on a unix socket (dgt_emulator) -> dgtnix virtual board -> NativeDGTBoard
+## events in the pycochess event loop -> probe_move, register_move and the game journal -> sf.go ->
+## bestmove, then the engine move is made on the emulated board, and a random legal move for the
+## player, N games long.
+## It reports the sustained plies per second, the CPU used, latency percentiles and the
+## spans of every stage (see tracing.py), so that a regression anywhere in the stack shows up.
+##
+##   python selfplay_bench.py --games 5 --movetime 20 --speed 10 -o selfplay.json
+##
+## Needs pyfish and the compiled driver (see dgt/setup.py). --speed runs the board, the driver
+## and the pycochess timers on a clock that many times faster (see clock.py), the engine
+## searches stay in real time. Latencies are in real seconds. --engine <command> plays on the
+## UCI engine processes of uci_pool.py instead of pyfish.
+
+import argparse
+import json
+import math
+import os
+import platform
+import random
+import resource
+import sys
+import tempfile
+import threading
+import time
+from Queue import Queue, Empty
+
+import clock
+import tracing
+import uci_pool
+from ChessBoard import ChessBoard
+from dgt_emulator import Emulator, board_squares
+
+
+def percentiles(values):
+    if not values:
+        return {"count": 0}
+    values = sorted(values)
+
+    def at(q):
+        return values[min(len(values) - 1, max(0, int(math.ceil(q * len(values))) - 1))]
+    return {"count": len(values), "mean": sum(values) / len(values), "p50": at(0.5),
+            "p90": at(0.9), "p99": at(0.99), "max": values[-1]}
+
+
+class Stall(object):
+    pass
+
+
+class SelfPlay(object):
+    def __init__(self, args):
+        self.args = args
+        self.random = random.Random(args.seed)
+        self.workdir = tempfile.mkdtemp(prefix="selfplay")
+        self.emulator = None
+        self.board = None
+        self.pyco = None
+        # Work for the emulator thread, which owns the emulated boards
+        self.actions = Queue()
+        self.bestmoves = Queue()
+        # Moves handled by the pycochess loop, and when their handling started
+        self.handled = Queue()
+        self.running = True
+        # Real time of the last field update sent by the emulated board
+        self.placed = 0.
+        self.chessboard = ChessBoard()
+        self.moves = []
+        # Of the --games games, those that ended and those that stalled
+        self.games = 0
+        self.stalls = 0
+        self.plies = 0
+        self.latency = {"board_to_handler": [], "board_to_engine": [], "ply": []}
+
+    # Emulator side
+
+    def serve(self):
+        while self.running:
+            # 5 ms of real time between two looks at the actions
+            self.emulator.step(0.005 * self.args.speed)
+            while True:
+                try:
+                    action = self.actions.get_nowait()
+                except Empty:
+                    break
+                action()
+
+    def on_new_board(self, board):
+        set_square = board.set_square
+
+        def traced_set_square(square, piece):
+            set_square(square, piece)
+            self.placed = tracing.now()
+        board.set_square = traced_set_square
+        self.board = board
+
+    def arrange(self, squares):
+        # In the emulator thread, a hand makes the move after the thinking time.
+        # It does not hit the clock, pycochess would take the lever for a button.
+        self.board.arrange(squares, clock.now() + self.args.think)
+
+    def play(self, move):
+        # UCI promotions are lower case, ChessBoard wants them upper case
+        self.chessboard.addTextMove(move[:4] + move[4:].upper())
+        self.moves.append(move)
+        squares = board_squares(self.chessboard)
+        self.actions.put(lambda: self.arrange(squares))
+
+    # Pycochess side
+
+    def on_engine_line(self, line):
+        # The engine move is known to pycochess
+        if line.startswith("bestmove"):
+            self.bestmoves.put(line.split()[1])
+
+    def get(self, queue):
+        # Queue.get(timeout) polls in python 2 and would add up to 50 ms,
+        # a blocking get woken up by a watchdog after --timeout does not
+        stall = Stall()
+        watchdog = threading.Timer(self.args.timeout, queue.put, [stall])
+        watchdog.daemon = True
+        watchdog.start()
+        while True:
+            item = queue.get()
+            if not isinstance(item, Stall):
+                watchdog.cancel()
+                return item
+            if item is stall:
+                return None
+
+    def on_move(self, m, start):
+        # In the loop, once pycochess handled a move
+        self.handled.put((m, start))
+
+    def next_move(self):
+        # Waits until the loop of pycochess handled the next move
+        item = self.get(self.handled)
+        if item is None:
+            return None
+        m, start = item
+        self.latency["board_to_handler"].append(start - self.placed)
+        return m
+
+    def wait_for(self, condition):
+        end = time.time() + self.args.timeout
+        while not condition():
+            if time.time() > end:
+                return False
+            time.sleep(0.005)
+        return True
+
+    def start(self):
+        import stockfish as sf
+        import pycochess
+        self.sf = sf
+        self.pycochess = pycochess
+        # The game journal of pycochess and an empty book when there is none
+        os.mkdir(os.path.join(self.workdir, "py"))
+        pycochess.PROG_PATH = self.workdir
+        if not os.path.exists(pycochess.BOOK_PATH + "gm1950.bin"):
+            pycochess.BOOK_PATH = self.workdir + "/"
+            open(pycochess.BOOK_PATH + "gm1950.bin", "wb").close()
+
+        self.emulator = Emulator(clock=True)
+        self.emulator.on_new_board = self.on_new_board
+        path = os.path.join(self.workdir, "board.sock")
+        self.emulator.add_unix(path)
+        thread = threading.Thread(target=self.serve, name="emulator")
+        thread.daemon = True
+        thread.start()
+
+        if self.args.engine:
+            pycochess.engine_pool = uci_pool.default_pool(self.args.engine)
+        self.pyco = pycochess.Pycochess(path)
+        self.pyco.comp_time = self.args.movetime
+        # After Pycochess.parse_score, in the loop: the lines of pyfish go through it, those of its
+        # stopped searches dropped before
+        if pycochess.engine_pool:
+            self.pyco.engine().add_observer(self.on_engine_line)
+        else:
+            parse_score = self.pyco.parse_score
+
+            def parsed(line):
+                parse_score(line)
+                self.on_engine_line(line)
+            self.pyco.parse_score = parsed
+        self.pyco.move_observers.append(self.on_move)
+        if pycochess.engine_pool:
+            pycochess.engine_pool.attach(pycochess.loop)
+        self.pyco.connect()
+        if not self.pyco.dgt_connected:
+            raise RuntimeError("pycochess did not connect to the emulated board")
+        # The main thread drives the games, pycochess runs in its loop as in its main
+        pycochess.loop.run_in_thread()
+        # The position sent during connect() came before pycochess took board positions
+        pycochess.loop.call_soon(self.pyco.dgt.get_board)
+        if not self.wait_for(lambda: self.pyco.dgt_fen):
+            raise RuntimeError("no position from the emulated board")
+
+    def new_game(self):
+        self.chessboard = ChessBoard()
+        self.moves = []
+        if self.pyco.move_list:
+            squares = board_squares(self.chessboard)
+            self.actions.put(lambda: self.arrange(squares))
+            return self.wait_for(lambda: not self.pyco.move_list and not self.pyco.engine_searching)
+        return True
+
+    def game(self):
+        # Plays until mate, stalemate or --plies, returns False if the stack stalled
+        sf = self.sf
+        while len(self.moves) < self.args.plies:
+            legal = sf.legal_moves(sf.get_fen("startpos", self.moves))
+            if not legal:
+                return True
+            start = tracing.now()
+            self.play(self.random.choice(legal))
+            if self.next_move() is None:
+                return False
+            self.latency["board_to_engine"].append(self.pyco.engine_start - self.placed)
+            best = self.get(self.bestmoves)
+            if best is None:
+                return False
+            self.latency["ply"].append(tracing.now() - start)
+            self.plies += 1
+            if best == "(none)":
+                return True
+            start = tracing.now()
+            self.play(best)
+            if self.next_move() is None or not self.pyco.computer_move_FEN_reached:
+                return False
+            self.latency["ply"].append(tracing.now() - start)
+            self.plies += 1
+        return True
+
+    def run(self):
+        begin, cpu = time.time(), os.times()
+        while self.games + self.stalls < self.args.games:
+            if not self.new_game():
+                self.stalls += 1
+                break
+            if not self.game():
+                self.stalls += 1
+                # Drop what the stalled game left behind
+                while not self.bestmoves.empty():
+                    self.bestmoves.get()
+                continue
+            self.games += 1
+        wall, cpu_end = time.time() - begin, os.times()
+        self.running = False
+        return wall, (cpu_end[0] - cpu[0]) + (cpu_end[1] - cpu[1])
+
+    def report(self, wall, cpu):
+        stages = {}
+        with tracing.tracer.lock:
+            events = list(tracing.tracer.events)
+        for event in events:
+            if event["ph"] == "X":
+                stages.setdefault(event["name"], []).append(event["dur"] * 1e-6)
+        return {
+            "machine": {"node": platform.node(), "machine": platform.machine(),
+                        "platform": platform.platform(), "python": platform.python_version()},
+            "options": vars(self.args),
+            "games": self.games,
+            "plies": self.plies,
+            "stalls": self.stalls,
+            "wall_seconds": wall,
+            "plies_per_second": self.plies / wall if wall else 0.,
+            "cpu": {"seconds": cpu, "percent": 100. * cpu / wall if wall else 0.,
+                    "ms_per_ply": 1000. * cpu / self.plies if self.plies else 0.,
+                    "max_rss_kb": resource.getrusage(resource.RUSAGE_SELF).ru_maxrss},
+            "latency": dict((name, percentiles(values)) for name, values in self.latency.iteritems()),
+            "stages": dict((name, percentiles(values)) for name, values in stages.iteritems()),
+            "displays": dict((d.name, d.stats()) for d in (self.pyco.clock_display, self.pyco.lcd_display) if d),
+        }
+
+
+def print_report(report, out):
+    print >> out, "{games} games, {plies} plies in {wall_seconds:.1f}s: {plies_per_second:.2f} plies/s, " \
+                  "{stalls} stalls".format(**report)
+    print >> out, "cpu {percent:.0f}% ({ms_per_ply:.1f} ms per ply), max rss {max_rss_kb} kB".format(**report["cpu"])
+    for name, d in sorted(report["displays"].iteritems()):
+        print >> out, "display {0}: {submitted} frames, {shown} shown, {dropped} dropped, {delayed} delayed, " \
+                      "max delay {max_delay:.2f}s".format(name, **d)
+    print >> out, "{0:<24} {1:>6} {2:>9} {3:>9} {4:>9} {5:>9}".format("ms", "count", "mean", "p50", "p99", "max")
+    for section in ("latency", "stages"):
+        for name, p in sorted(report[section].iteritems()):
+            if p["count"]:
+                print >> out, "{0:<24} {1:>6} {2:>9.2f} {3:>9.2f} {4:>9.2f} {5:>9.2f}".format(
+                    name, p["count"], p["mean"] * 1e3, p["p50"] * 1e3, p["p99"] * 1e3, p["max"] * 1e3)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Self-play throughput benchmark of the board to engine pipeline")
+    parser.add_argument("--games", type=int, default=3, help="number of games")
+    parser.add_argument("--plies", type=int, default=80, help="plies after which a game ends")
+    parser.add_argument("--movetime", type=int, default=50, help="engine search time per move in ms")
+    parser.add_argument("--think", type=float, default=0., help="seconds before a hand makes a move")
+    parser.add_argument("--speed", type=float, default=1., help="board, driver and timers speed factor")
+    parser.add_argument("--seed", type=int, default=1, help="seed of the player moves")
+    parser.add_argument("--engine", help="UCI engine command, pyfish by default")
+    parser.add_argument("--timeout", type=float, default=30., help="real seconds before a move counts as a stall")
+    parser.add_argument("--trace", help="also write the Chrome trace of every move there")
+    parser.add_argument("-o", "--output", help="JSON report")
+    parser.add_argument("-v", "--verbose", action="store_true", help="keep the pycochess output")
+    args = parser.parse_args()
+
+    if args.speed != 1:
+        clock.set_clock(clock.SimulatedClock(args.speed))
+    tracing.tracer.enable(args.trace or os.devnull)
+    out = sys.stdout
+    if not args.verbose:
+        sys.stdout = open(os.devnull, "w")
+    bench = SelfPlay(args)
+    try:
+        bench.start()
+        report = bench.report(*bench.run())
+    except Exception as e:
+        print >> out, "selfplay: {0}".format(e)
+        out.flush()
+        os._exit(1)
+    print_report(report, out)
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+    if args.trace:
+        tracing.tracer.close()
+    out.flush()
+    # The pycochess threads never end
+    os._exit(0 if not report["stalls"] else 2)
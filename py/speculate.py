@@ -0,0 +1,65 @@
+# Speculative searches while the player makes a move: when a piece of the side to move is lifted,
+# the positions after its most likely destinations are searched to a shallow depth, one after the
+# other, so that the hash of the engine is warm for its reply the instant the piece lands.
+#
+#   speculator = speculate.Speculator(engine_pool.get(uci_pool.PLAY))
+#   speculator.start(fen, moves, ["g1f3", "g1h3", "g1e2"])
+#   ...
+#   speculator.cancel()     # the move was made, the next go() stops the running search
+#
+# Runs on a UciEngine of uci_pool.py: go() with its own on_line keeps the lines of the
+# speculative searches from the observers of the game.
+import threading
+
+# Depth of each speculative search, and destinations searched for a lifted piece
+DEPTH = 8
+MAX_MOVES = 4
+
+
+def destinations(legal_moves, square, preferred=()):
+    # Moves of legal_moves from square, the preferred ones first in their order, then the
+    # queen promotions before the others
+    moves = [m for m in legal_moves if m.startswith(square)]
+    first = [m for m in preferred if m in moves]
+    rest = [m for m in moves if m not in first]
+    rest.sort(key=lambda m: not m.endswith("q"))
+    return first + rest
+
+
+class Speculator(object):
+    def __init__(self, engine, depth=DEPTH, max_moves=MAX_MOVES):
+        self.engine = engine
+        self.depth = depth
+        self.max_moves = max_moves
+        # Guards the queue, so that a bestmove never starts a search after cancel()
+        self.lock = threading.Lock()
+        self.fen = None
+        self.moves = None
+        self.queue = []
+        self.searched = 0
+
+    def start(self, fen, moves, candidates):
+        # Searches fen after moves and each of the candidates, the first one first
+        with self.lock:
+            self.fen = fen
+            self.moves = list(moves)
+            self.queue = list(candidates[:self.max_moves])
+            self._next()
+
+    def _next(self):
+        if not self.queue:
+            return
+        move = self.queue.pop(0)
+        self.searched += 1
+        self.engine.go(self.fen, moves=self.moves + [move], on_line=self.on_line, depth=self.depth)
+
+    def on_line(self, line):
+        if not line.startswith("bestmove"):
+            return
+        with self.lock:
+            self._next()
+
+    def cancel(self):
+        # The searches still queued are dropped, the running one is left to the next go() or stop()
+        with self.lock:
+            self.queue = []
@@ -0,0 +1,67 @@
+import unittest
+
+import speculate
+
+LEGAL = ["e2e3", "e2e4", "g1f3", "g1h3", "b7b8n", "b7b8q", "b7b8r"]
+
+
+class Engine(object):
+    # Records the searches, finished by hand with bestmove()
+    def __init__(self):
+        self.searches = []
+
+    def go(self, fen, moves=None, on_line=None, **options):
+        self.searches.append((fen, moves, options))
+        self.on_line = on_line
+
+    def bestmove(self):
+        self.on_line("info depth 8 score cp 10 pv e7e5")
+        self.on_line("bestmove e7e5")
+
+
+class DestinationsTest(unittest.TestCase):
+
+    def test_from_square(self):
+        self.assertEqual(speculate.destinations(LEGAL, "g1"), ["g1f3", "g1h3"])
+        self.assertEqual(speculate.destinations(LEGAL, "a2"), [])
+
+    def test_preferred_then_queen_promotions(self):
+        self.assertEqual(speculate.destinations(LEGAL, "e2", preferred=["e2e4", "d2d4"]), ["e2e4", "e2e3"])
+        self.assertEqual(speculate.destinations(LEGAL, "b7"), ["b7b8q", "b7b8n", "b7b8r"])
+
+
+class SpeculatorTest(unittest.TestCase):
+
+    def setUp(self):
+        self.engine = Engine()
+        self.speculator = speculate.Speculator(self.engine, depth=6, max_moves=2)
+
+    def test_one_after_the_other(self):
+        self.speculator.start("startpos", ["d2d4"], ["g1f3", "g1h3", "g1e2"])
+        self.assertEqual(self.engine.searches, [("startpos", ["d2d4", "g1f3"], {"depth": 6})])
+        self.engine.bestmove()
+        self.assertEqual(self.engine.searches[-1], ("startpos", ["d2d4", "g1h3"], {"depth": 6}))
+        # Only max_moves of them
+        self.engine.bestmove()
+        self.assertEqual(len(self.engine.searches), 2)
+        self.assertEqual(self.speculator.searched, 2)
+
+    def test_cancel(self):
+        self.speculator.start("startpos", [], ["e2e4", "d2d4"])
+        self.speculator.cancel()
+        self.engine.bestmove()
+        self.assertEqual(len(self.engine.searches), 1)
+
+    def test_start_again(self):
+        moves = ["e2e4"]
+        self.speculator.start("startpos", moves, ["e7e5", "c7c5"])
+        moves.append("e7e5")
+        self.speculator.start("startpos", ["e2e4", "c7c5"], ["g1f3"])
+        self.engine.bestmove()
+        # The queue of the first start is gone and its moves were copied
+        self.assertEqual([search[1] for search in self.engine.searches],
+                         [["e2e4", "e7e5"], ["e2e4", "c7c5", "g1f3"]])
+
+
+if __name__ == "__main__":
+    unittest.main()
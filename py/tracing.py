@@ -0,0 +1,127 @@
+# Spans of the path of a move, from the board message to the engine search and the clock ack,
+# written as a Chrome trace-event JSON file (open it in chrome://tracing or ui.perfetto.dev).
+# Every span of a move carries the same correlation id and the spans are linked by flow arrows.
+#
+# Tracing is off unless PYCOCHESS_TRACE names the output file, or enable() is called.
+# When off, new_id() returns None and every other call returns at once.
+import atexit
+import itertools
+import json
+import os
+import threading
+from contextlib import contextmanager
+
+import clock
+
+MAX_EVENTS = 1000000
+
+
+def now():
+    # Monotonic seconds, the clock of the dgtnix event timestamps, even when a SimulatedClock is set
+    return clock.monotonic()
+
+
+class TracedMove(str):
+    # A move handed to the event loop that remembers its trace and when it was queued
+    pass
+
+
+class Tracer(object):
+    def __init__(self):
+        self.path = None
+        self.events = []
+        self.lock = threading.Lock()
+        self.ids = itertools.count(1)
+        self.flows = set()
+        self.threads = set()
+        self.pid = os.getpid()
+
+    @property
+    def enabled(self):
+        return self.path is not None
+
+    def enable(self, path):
+        if not self.enabled:
+            atexit.register(self.close)
+        self.path = path
+
+    def new_id(self):
+        if not self.enabled:
+            return None
+        return next(self.ids)
+
+    def _append(self, event):
+        thread = threading.current_thread()
+        event["pid"] = self.pid
+        event["tid"] = thread.ident
+        with self.lock:
+            if len(self.events) >= MAX_EVENTS:
+                return
+            if thread.ident not in self.threads:
+                self.threads.add(thread.ident)
+                self.events.append({"ph": "M", "name": "thread_name", "pid": self.pid, "tid": thread.ident,
+                                    "args": {"name": thread.name}})
+            self.events.append(event)
+
+    def _flow(self, trace_id, ts, last=False):
+        # Arrow from the previous span of trace_id to the span starting at ts
+        with self.lock:
+            if trace_id in self.flows:
+                phase = "f" if last else "t"
+            else:
+                self.flows.add(trace_id)
+                phase = "s"
+            if last:
+                self.flows.discard(trace_id)
+        self._append({"ph": phase, "name": "move", "cat": "move", "id": trace_id, "ts": ts, "bp": "e"})
+
+    def complete(self, name, trace_id, start, end=None, last=False, **args):
+        # A span of the current thread from start to end (now by default), in now() seconds
+        if not self.enabled or trace_id is None or not start:
+            return
+        if end is None:
+            end = now()
+        args["move"] = trace_id
+        ts = start * 1e6
+        self._append({"ph": "X", "name": name, "cat": "move", "ts": ts,
+                      "dur": max(end - start, 0) * 1e6, "args": args})
+        self._flow(trace_id, ts, last)
+
+    @contextmanager
+    def span(self, name, trace_id, **args):
+        if not self.enabled or trace_id is None:
+            yield
+            return
+        start = now()
+        try:
+            yield
+        finally:
+            self.complete(name, trace_id, start, **args)
+
+    def queued(self, move, trace_id):
+        # Tag a move handed to the event loop with its trace
+        if not self.enabled or trace_id is None:
+            return move
+        move = TracedMove(move)
+        move.trace_id = trace_id
+        move.queued = now()
+        return move
+
+    def close(self):
+        # Writes everything traced so far, it may be called again later
+        if not self.enabled:
+            return
+        with self.lock:
+            events = list(self.events)
+        with open(self.path, "w") as f:
+            json.dump({"traceEvents": events, "displayTimeUnit": "ms"}, f)
+
+
+tracer = Tracer()
+new_id = tracer.new_id
+complete = tracer.complete
+span = tracer.span
+queued = tracer.queued
+
+if os.environ.get("PYCOCHESS_TRACE"):
+    tracer.enable(os.environ["PYCOCHESS_TRACE"])
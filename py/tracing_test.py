@@ -0,0 +1,79 @@
+import json
+import os
+import shutil
+import tempfile
+import threading
+import unittest
+
+import tracing
+
+
+class TracerTest(unittest.TestCase):
+
+    def setUp(self):
+        self.directory = tempfile.mkdtemp()
+        self.path = os.path.join(self.directory, "trace.json")
+        self.tracer = tracing.Tracer()
+
+    def tearDown(self):
+        # Off, for the close() enable() left to atexit
+        self.tracer.path = None
+        shutil.rmtree(self.directory)
+
+    def events(self):
+        self.tracer.close()
+        with open(self.path) as f:
+            return [e for e in json.load(f)["traceEvents"] if e["ph"] != "M"]
+
+    def test_disabled(self):
+        self.assertIsNone(self.tracer.new_id())
+        with self.tracer.span("search", None):
+            pass
+        self.assertEqual(self.tracer.queued("e2e4", None), "e2e4")
+        self.tracer.complete("clock", 1, tracing.now())
+        self.assertEqual(self.tracer.events, [])
+
+    def test_spans_and_flows(self):
+        self.tracer.enable(self.path)
+        trace_id = self.tracer.new_id()
+        with self.tracer.span("board", trace_id, square="e4"):
+            pass
+        move = self.tracer.queued("e2e4", trace_id)
+        self.assertEqual(move, "e2e4")
+        self.assertEqual(move.trace_id, trace_id)
+        self.tracer.complete("loop", trace_id, move.queued)
+        self.tracer.complete("clock", trace_id, tracing.now(), last=True)
+        events = self.events()
+        spans = [e for e in events if e["ph"] == "X"]
+        self.assertEqual([e["name"] for e in spans], ["board", "loop", "clock"])
+        self.assertEqual(spans[0]["args"], {"square": "e4", "move": trace_id})
+        self.assertTrue(all(e["dur"] >= 0 for e in spans))
+        # One arrow through the spans of the move, ended at the last one
+        self.assertEqual([e["ph"] for e in events if e["ph"] in "stf"], ["s", "t", "f"])
+        self.assertEqual(self.tracer.flows, set())
+
+    def test_thread_names(self):
+        self.tracer.enable(self.path)
+        thread = threading.Thread(target=self.tracer.complete, args=("engine", 1, tracing.now()),
+                                  name="engine_reader")
+        thread.start()
+        thread.join()
+        self.tracer.close()
+        with open(self.path) as f:
+            names = [e["args"]["name"] for e in json.load(f)["traceEvents"] if e["ph"] == "M"]
+        self.assertEqual(names, ["engine_reader"])
+
+    def test_max_events(self):
+        self.tracer.enable(self.path)
+        limit = tracing.MAX_EVENTS
+        tracing.MAX_EVENTS = 10
+        try:
+            for i in xrange(20):
+                self.tracer.complete("span", i + 1, tracing.now())
+        finally:
+            tracing.MAX_EVENTS = limit
+        self.assertEqual(len(self.tracer.events), 10)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,310 @@
+# Pool of UCI engine processes, so that the game, the analysis and the hints each have their own
+# engine instead of preempting the search of the in-process pyfish (sf) engine.
+# Every engine has a pinned hash size and set of cores, its commands go down a pipe and one reader
+# thread polls the outputs of all of them and hands the lines to the observers, as sf.add_observer:
+# the bestmove lines and the info lines with a pv.
+#
+#   pool = uci_pool.UciPool()
+#   play = pool.add(uci_pool.PLAY, ["stockfish"], hash_mb=128, cpus=[0, 1, 2])
+#   play.add_observer(on_line)
+#   play.go("startpos", moves=["e2e4"], movetime=1000)
+#
+# pool.attach(loop) hands the outputs over to an event loop (see event_loop.py) once the engines
+# started: the observers then run in the loop, and the reader thread exits.
+# go() while a search runs and stop() do not wait for the engine: the bestmove (and info lines)
+# still due from a stopped search are dropped, so the next search never sees them.
+# PYCOCHESS_ENGINE=<command> makes pycochess play and analyse with default_pool(command).
+import atexit
+import ctypes
+import ctypes.util
+import fcntl
+import multiprocessing
+import os
+import select
+import shlex
+import subprocess
+import threading
+
+PLAY = "play"
+ANALYSIS = "analysis"
+# Hash sizes in MB of the engines of default_pool()
+PLAY_HASH = 128
+ANALYSIS_HASH = 32
+# Seconds to wait for the uciok and readyok answers when an engine starts
+START_TIMEOUT = 10
+# Options the pool does not forward, each engine keeps its own
+PINNED_OPTIONS = ("Hash", "Threads")
+
+try:
+    _libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+    _sched_setaffinity = _libc.sched_setaffinity
+except (OSError, AttributeError, TypeError):
+    _sched_setaffinity = None
+
+
+def set_affinity(cpus, pid=0):
+    # Runs pid (0 for the calling process) on the cpus only, False when it is not supported
+    if not _sched_setaffinity:
+        return False
+    mask = (ctypes.c_ulong * 16)()
+    bits = ctypes.sizeof(ctypes.c_ulong) * 8
+    for cpu in cpus:
+        mask[cpu // bits] |= 1 << (cpu % bits)
+    return _sched_setaffinity(pid, ctypes.sizeof(mask), mask) == 0
+
+
+class UciEngine(object):
+    def __init__(self, name, command, hash_mb=None, threads=None, cpus=None, options=None):
+        self.name = name
+        self.command = command
+        self.hash_mb = hash_mb
+        self.threads = threads
+        self.cpus = cpus
+        self.options = options or {}
+        self.process = None
+        self.observers = []
+        # Guards the writes and the search state, the reader thread and the callers race on them
+        self.lock = threading.Lock()
+        self.searching = False
+        # bestmoves still due from stopped searches
+        self.stopped = 0
+        # Observer of the current search, when go() was given one
+        self.on_line = None
+        self.buffer = ""
+        self.ready = threading.Event()
+        self.quitting = False
+
+    def start(self):
+        self.process = subprocess.Popen(self.command, stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                                        bufsize=0, close_fds=True, preexec_fn=self._pin)
+        fd = self.process.stdout.fileno()
+        fcntl.fcntl(fd, fcntl.F_SETFL, fcntl.fcntl(fd, fcntl.F_GETFL) | os.O_NONBLOCK)
+        self.send("uci")
+        options = dict(self.options)
+        if self.hash_mb:
+            options["Hash"] = self.hash_mb
+        if self.threads:
+            options["Threads"] = self.threads
+        for name, value in options.iteritems():
+            self.set_option(name, value)
+        self.send("isready")
+        return self
+
+    def _pin(self):
+        # In the child, before exec
+        if self.cpus:
+            set_affinity(self.cpus)
+
+    def fileno(self):
+        return self.process.stdout.fileno()
+
+    def send(self, command):
+        try:
+            self.process.stdin.write(command + "\n")
+        except (IOError, OSError, ValueError):
+            # The engine is gone, the reader thread reports it
+            pass
+
+    def set_option(self, name, value):
+        if isinstance(value, bool):
+            value = "true" if value else "false"
+        self.send("setoption name {0} value {1}".format(name, value))
+
+    def add_observer(self, observer):
+        self.observers.append(observer)
+
+    def remove_observer(self, observer):
+        if observer in self.observers:
+            self.observers.remove(observer)
+
+    def wait_ready(self, timeout=START_TIMEOUT):
+        return self.ready.wait(timeout)
+
+    def go(self, fen="startpos", moves=(), on_line=None, **params):
+        # Same arguments as sf.go, on_line replaces the observers for the lines of this search.
+        # infinite=True and ponder=True are flags, the other parameters are sent as "name value".
+        position = "position startpos" if fen == "startpos" else "position fen " + fen
+        if moves:
+            position += " moves " + " ".join(moves)
+        command = ["go"]
+        for name, value in params.iteritems():
+            if value is True:
+                command.append(name)
+            elif value is not None and value is not False:
+                command.extend((name, str(value)))
+        with self.lock:
+            if self.searching:
+                self.stopped += 1
+                self.send("stop")
+            self.on_line = on_line
+            self.searching = True
+            self.send(position)
+            self.send(" ".join(command))
+
+    def ponderhit(self):
+        # The ponder search goes on as a normal search
+        with self.lock:
+            if self.searching:
+                self.send("ponderhit")
+
+    def stop(self):
+        with self.lock:
+            if not self.searching:
+                return
+            self.searching = False
+            self.stopped += 1
+            self.send("stop")
+
+    def feed(self, data):
+        # Output of the engine, called by the reader thread
+        lines = (self.buffer + data).split("\n")
+        self.buffer = lines.pop()
+        for line in lines:
+            line = line.strip()
+            if not line:
+                continue
+            with self.lock:
+                if self.stopped:
+                    # Lines of a stopped search, up to its bestmove
+                    if line.startswith("bestmove"):
+                        self.stopped -= 1
+                    continue
+                observers = [self.on_line] if self.on_line else list(self.observers)
+                if line.startswith("bestmove"):
+                    self.searching = False
+                    self.on_line = None
+            if line == "readyok":
+                self.ready.set()
+            elif line.startswith("bestmove") or (line.startswith("info") and " pv " in line):
+                for observer in observers:
+                    observer(line)
+
+    def exited(self):
+        self.searching = False
+        if not self.quitting:
+            print "Engine {0} ({1}) exited with {2}".format(self.name, " ".join(self.command), self.process.poll())
+
+    def quit(self, timeout=1.):
+        if not self.process or self.process.poll() is not None:
+            return
+        self.quitting = True
+        self.send("quit")
+        timer = threading.Timer(timeout, self._kill)
+        timer.start()
+        self.process.wait()
+        timer.cancel()
+
+    def _kill(self):
+        try:
+            self.process.kill()
+        except OSError:
+            pass
+
+
+class UciPool(object):
+    def __init__(self):
+        self.engines = {}
+        self.by_fd = {}
+        self.lock = threading.Lock()
+        self.poller = select.poll()
+        # Wakes the reader up when an engine is added
+        self.wakeup_read, self.wakeup_write = os.pipe()
+        self.poller.register(self.wakeup_read, select.POLLIN)
+        # Event loop reading the outputs instead of the reader thread, see attach()
+        self.loop = None
+        self.reader = threading.Thread(target=self.run, name="uci_pool")
+        self.reader.daemon = True
+        self.reader.start()
+        atexit.register(self.close)
+
+    def add(self, name, command, **engine_options):
+        # Starts an engine (see UciEngine for the options) and waits until it is ready
+        if isinstance(command, basestring):
+            command = shlex.split(command)
+        engine = UciEngine(name, command, **engine_options).start()
+        with self.lock:
+            self.engines[name] = engine
+            self.by_fd[engine.fileno()] = engine
+            if self.loop:
+                self.loop.add_reader(engine.fileno(), self.read, engine.fileno())
+            else:
+                self.poller.register(engine.fileno(), select.POLLIN)
+        os.write(self.wakeup_write, "x")
+        # Not from the loop once attached, it reads the readyok
+        if not engine.wait_ready():
+            print "Engine {0} is not ready after {1}s".format(name, START_TIMEOUT)
+        return engine
+
+    def get(self, name):
+        return self.engines.get(name)
+
+    def set_option(self, name, value):
+        # To every engine, except the options pinned per engine
+        if name in PINNED_OPTIONS:
+            return
+        for engine in self.engines.values():
+            engine.set_option(name, value)
+
+    def stop(self):
+        for engine in self.engines.values():
+            engine.stop()
+
+    def attach(self, loop):
+        # The engine outputs are read by the handlers of loop from now on
+        with self.lock:
+            self.loop = loop
+            for fd in self.by_fd:
+                self.poller.unregister(fd)
+                loop.add_reader(fd, self.read, fd)
+        os.write(self.wakeup_write, "x")
+        # No line is fed by both
+        self.reader.join()
+
+    def run(self):
+        while True:
+            events = self.poller.poll()
+            if self.loop:
+                # The loop reads what is left
+                return
+            for fd, event in events:
+                if fd == self.wakeup_read:
+                    os.read(fd, 512)
+                    continue
+                self.read(fd)
+
+    def read(self, fd):
+        # Output of the engine of fd, readable
+        with self.lock:
+            engine = self.by_fd.get(fd)
+        if not engine:
+            return
+        try:
+            data = os.read(fd, 65536)
+        except OSError:
+            return
+        if data:
+            engine.feed(data)
+            return
+        with self.lock:
+            if self.loop:
+                self.loop.remove_reader(fd)
+            else:
+                self.poller.unregister(fd)
+            del self.by_fd[fd]
+        engine.process.wait()
+        engine.exited()
+
+    def close(self):
+        for engine in self.engines.values():
+            engine.quit()
+
+
+def default_pool(command, cpus=None):
+    # A play engine on every core but one, which ponders, and an analysis engine on the last one,
+    # which also takes the hints, both on every core when there is only one
+    cpus = cpus or range(multiprocessing.cpu_count())
+    play_cpus = cpus[:-1] or cpus
+    pool = UciPool()
+    pool.add(PLAY, command, hash_mb=PLAY_HASH, threads=len(play_cpus), cpus=play_cpus, options={"Ponder": True})
+    pool.add(ANALYSIS, command, hash_mb=ANALYSIS_HASH, threads=1, cpus=cpus[-1:])
+    return pool
@@ -0,0 +1,156 @@
+import os
+import shutil
+import sys
+import tempfile
+import threading
+import unittest
+
+import uci_pool
+
+# A UCI engine answering at once, with the move of the number of moves of its position. Infinite and
+# ponder searches answer on stop, ponderhit answers a ponder search.
+ENGINE = r'''
+import sys
+MOVES = ["e2e4", "e7e5", "g1f3", "b8c6"]
+
+def send(line):
+    sys.stdout.write(line + "\n")
+    sys.stdout.flush()
+
+count = 0
+waiting = False
+while True:
+    line = sys.stdin.readline()
+    if not line:
+        break
+    tokens = line.split()
+    if not tokens:
+        continue
+    if tokens[0] == "uci":
+        send("id name fake")
+        send("uciok")
+    elif tokens[0] == "isready":
+        send("readyok")
+    elif tokens[0] == "position":
+        count = len(tokens) - tokens.index("moves") - 1 if "moves" in tokens else 0
+    elif tokens[0] == "go":
+        if "infinite" in tokens or "ponder" in tokens:
+            waiting = True
+            continue
+        send("info depth {0} score cp 10 pv {1}".format(count + 1, MOVES[count]))
+        send("bestmove " + MOVES[count])
+    elif tokens[0] in ("stop", "ponderhit") and waiting:
+        waiting = False
+        send("info depth 9 score cp 20 pv {0}".format(MOVES[count]))
+        send("info string searched")
+        send("bestmove " + MOVES[count])
+    elif tokens[0] == "quit":
+        break
+'''
+
+
+class Lines(object):
+    # Lines of an observer, done once a bestmove came
+    def __init__(self):
+        self.lines = []
+        self.done = threading.Event()
+
+    def __call__(self, line):
+        self.lines.append(line)
+        if line.startswith("bestmove"):
+            self.done.set()
+
+    def wait(self):
+        return self.done.wait(5)
+
+
+class Recorder(object):
+    def __init__(self):
+        self.options = []
+
+    def set_option(self, name, value):
+        self.options.append((name, value))
+
+
+class UciPoolTest(unittest.TestCase):
+
+    def setUp(self):
+        self.directory = tempfile.mkdtemp()
+        path = os.path.join(self.directory, "engine.py")
+        with open(path, "w") as f:
+            f.write(ENGINE)
+        self.pool = uci_pool.UciPool()
+        self.engine = self.pool.add(uci_pool.PLAY, [sys.executable, path], hash_mb=16)
+
+    def tearDown(self):
+        self.pool.close()
+        shutil.rmtree(self.directory)
+
+    def test_ready(self):
+        self.assertTrue(self.engine.ready.is_set())
+        self.assertIs(self.pool.get(uci_pool.PLAY), self.engine)
+        self.assertIsNone(self.pool.get(uci_pool.ANALYSIS))
+
+    def test_go(self):
+        lines = Lines()
+        self.engine.add_observer(lines)
+        self.engine.go("startpos", ["e2e4"], movetime=100)
+        self.assertTrue(lines.wait())
+        self.assertEqual(lines.lines, ["info depth 2 score cp 10 pv e7e5", "bestmove e7e5"])
+        self.assertFalse(self.engine.searching)
+
+    def test_on_line(self):
+        observed = Lines()
+        self.engine.add_observer(observed)
+        lines = Lines()
+        self.engine.go("startpos", ["e2e4", "e7e5"], on_line=lines, movetime=100)
+        self.assertTrue(lines.wait())
+        self.assertEqual(lines.lines[-1], "bestmove g1f3")
+        # Back to the observers after the bestmove
+        self.engine.go("startpos", movetime=100)
+        self.assertTrue(observed.wait())
+        self.assertEqual(observed.lines[-1], "bestmove e2e4")
+        self.assertEqual(len(lines.lines), 2)
+
+    def test_go_while_searching(self):
+        first = Lines()
+        self.engine.go("startpos", on_line=first, infinite=True)
+        second = Lines()
+        self.engine.go("startpos", ["e2e4"], on_line=second, movetime=100)
+        self.assertTrue(second.wait())
+        # The bestmove of the first search was dropped, not handed to the second one
+        self.assertEqual(first.lines, [])
+        self.assertEqual(second.lines, ["info depth 2 score cp 10 pv e7e5", "bestmove e7e5"])
+
+    def test_stop(self):
+        lines = Lines()
+        self.engine.add_observer(lines)
+        self.engine.go("startpos", infinite=True)
+        self.engine.stop()
+        self.assertFalse(self.engine.searching)
+        self.engine.go("startpos", ["e2e4", "e7e5", "g1f3"], movetime=100)
+        self.assertTrue(lines.wait())
+        self.assertEqual(lines.lines, ["info depth 4 score cp 10 pv b8c6", "bestmove b8c6"])
+
+    def test_ponderhit(self):
+        lines = Lines()
+        self.engine.go("startpos", ["e2e4"], on_line=lines, ponder=True, wtime=60000, btime=60000)
+        # Nothing until the move pondered on is played
+        self.assertFalse(lines.done.wait(0.1))
+        self.engine.ponderhit()
+        self.assertTrue(lines.wait())
+        # The info string line has no pv, the observers do not get it
+        self.assertEqual(lines.lines, ["info depth 9 score cp 20 pv e7e5", "bestmove e7e5"])
+
+    def test_pinned_options(self):
+        recorder = Recorder()
+        self.pool.engines["recorder"] = recorder
+        self.pool.set_option("Hash", 1024)
+        self.pool.set_option("Threads", 8)
+        self.pool.set_option("Skill Level", 10)
+        del self.pool.engines["recorder"]
+        self.assertEqual(recorder.options, [("Skill Level", 10)])
+
+
+if __name__ == "__main__":
+    unittest.main()